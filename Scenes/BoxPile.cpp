@@ -0,0 +1,228 @@
+#include "BoxPile.h"
+#include <imgui.h>
+#include <glm/gtc/quaternion.hpp>
+#include <cfloat>
+#include <random>
+
+void BoxPile::init()
+{
+    world.clear();
+    previousPositions.clear();
+    previousOrientations.clear();
+    islandHistory.clear();
+    resetHandles = true;
+    dropBoxes();
+}
+
+void BoxPile::dropBoxes()
+{
+    std::mt19937 rng((unsigned)world.bodyCount());
+    std::uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+    float height = 0.6f;
+    for (uint32_t i = 0; i < world.bodyCount(); ++i)
+        height = std::max(height, world.body(i).position.y + 2.0f);
+    for (int y = 0; y < layers; ++y)
+        for (int z = 0; z < 10; ++z)
+            for (int x = 0; x < 10; ++x)
+                world.addBox(glm::vec3((x - 4.5f) * 1.2f + jitter(rng), height + y * 1.2f, (z - 4.5f) * 1.2f + jitter(rng)), glm::vec3(1), 1.0f,
+                             glm::quat(glm::vec3(jitter(rng), jitter(rng), jitter(rng))));
+}
+
+void BoxPile::simulateStep()
+{
+    // also while paused, so the interpolation comes to rest at the current transforms
+    previousPositions.resize(world.bodyCount());
+    previousOrientations.resize(world.bodyCount());
+    for (uint32_t i = 0; i < world.bodyCount(); ++i)
+    {
+        previousPositions[i] = world.body(i).position;
+        previousOrientations[i] = world.body(i).orientation;
+    }
+    if (paused)
+        return;
+    for (int i = 0; i < substeps; ++i)
+        world.step(timestep / substeps);
+    islandHistory.push_back((float)world.stats().islands);
+    if (islandHistory.size() > 300)
+        islandHistory.erase(islandHistory.begin());
+}
+
+void BoxPile::saveState(StateWriter &writer) const
+{
+    world.saveState(writer);
+}
+
+void BoxPile::loadState(StateReader &reader)
+{
+    world.loadState(reader);
+    // the loaded state has no previous step to blend from, and may have a different number of boxes
+    previousPositions.clear();
+    previousOrientations.clear();
+    islandHistory.clear();
+    resetHandles = true;
+}
+
+bool BoxPile::setParameter(const std::string &name, double value)
+{
+    ContactSolver::Settings &solver = world.solver.settings;
+    RigidBodyWorld::Settings &settings = world.settings;
+    if (name == "layers")
+        layers = (int)value;
+    else if (name == "iterations")
+        solver.iterations = (int)value;
+    else if (name == "tolerance")
+        solver.tolerance = (float)value;
+    else if (name == "friction")
+        solver.friction = (float)value;
+    else if (name == "restitution")
+        solver.restitution = (float)value;
+    else if (name == "baumgarte")
+        solver.baumgarte = (float)value;
+    else if (name == "slop")
+        solver.slop = (float)value;
+    else if (name == "warmStarting")
+        solver.warmStarting = value != 0;
+    else if (name == "coloring")
+        solver.coloring = value != 0;
+    else if (name == "contactMargin")
+        settings.contactMargin = (float)value;
+    else if (name == "linearDamping")
+        settings.linearDamping = (float)value;
+    else if (name == "angularDamping")
+        settings.angularDamping = (float)value;
+    else if (name == "sleeping")
+        settings.sleeping = value != 0;
+    else if (name == "timeToSleep")
+        settings.timeToSleep = (float)value;
+    else
+        return false;
+    return true;
+}
+
+void BoxPile::reportMetrics(std::vector<std::pair<std::string, double>> &metrics) const
+{
+    const RigidBodyWorld::Stats &stats = world.stats();
+    double kineticEnergy = 0;
+    float lowestBox = FLT_MAX;
+    for (uint32_t i = 0; i < world.bodyCount(); ++i)
+    {
+        const RigidBox &box = world.body(i);
+        if (box.inverseMass == 0)
+            continue;
+        // rotational energy in body space, where the inertia tensor is diagonal
+        glm::vec3 angular = glm::inverse(box.orientation) * box.angularVelocity;
+        kineticEnergy += 0.5 * glm::dot(box.linearVelocity, box.linearVelocity) / box.inverseMass + 0.5 * glm::dot(angular * angular, 1.0f / box.inverseInertiaBody);
+        lowestBox = std::min(lowestBox, box.position.y - 0.5f * box.size.y);
+    }
+    metrics.push_back({"kineticEnergy", kineticEnergy});
+    // below the ground for boxes that sank into it or fell through
+    metrics.push_back({"lowestBox", lowestBox == FLT_MAX ? 0.0 : lowestBox - world.settings.groundHeight});
+    metrics.push_back({"awakeBodies", (double)stats.awakeBodies});
+    metrics.push_back({"sleepingIslands", (double)stats.sleepingIslands});
+    metrics.push_back({"contacts", (double)stats.contacts});
+    metrics.push_back({"solverIterations", (double)world.solver.stats().iterations});
+    metrics.push_back({"lastImpulseDelta", world.solver.stats().lastImpulseDelta});
+}
+
+void BoxPile::onDraw(Renderer &renderer)
+{
+    onDrawInterpolated(renderer, 1.0f);
+}
+
+void BoxPile::interpolate(uint32_t body, float alpha, glm::vec3 &position, glm::quat &orientation) const
+{
+    const RigidBox &box = world.body(body);
+    position = box.position;
+    orientation = box.orientation;
+    // boxes added since the last step have no previous transform
+    if (alpha >= 1.0f || body >= previousPositions.size() || world.isSleeping(body))
+        return;
+    position = glm::mix(previousPositions[body], box.position, alpha);
+    orientation = glm::slerp(previousOrientations[body], box.orientation, alpha);
+}
+
+void BoxPile::onDrawInterpolated(Renderer &renderer, float alpha)
+{
+    renderer.drawCube(glm::vec3(0, world.settings.groundHeight - 0.05f, 0), glm::quat(glm::vec3(0)), glm::vec3(30, 0.1f, 30), glm::vec4(0.3f, 0.3f, 0.3f, 1));
+    if (resetHandles || !retainedDrawing)
+    {
+        for (auto &handle : handles)
+            renderer.destroyInstance(handle);
+        handles.clear();
+        drawnSleeping.clear();
+        resetHandles = false;
+    }
+    if (retainedDrawing)
+    {
+        drawRetained(renderer, alpha);
+        return;
+    }
+    for (uint32_t i = 0; i < world.bodyCount(); ++i)
+    {
+        glm::vec3 position;
+        glm::quat orientation;
+        interpolate(i, alpha, position, orientation);
+        glm::vec4 color = world.isSleeping(i) ? glm::vec4(0.4f, 0.45f, 0.6f, 1) : glm::vec4(1.0f, 0.6f, 0.2f, 1);
+        renderer.drawCube(position, orientation, world.body(i).size, color);
+    }
+}
+
+void BoxPile::drawRetained(Renderer &renderer, float alpha)
+{
+    updatedHandles = 0;
+    for (uint32_t i = 0; i < world.bodyCount(); ++i)
+    {
+        const RigidBox &box = world.body(i);
+        bool sleeping = world.isSleeping(i);
+        // sleeping boxes do not move, their instances only change when they fall asleep or wake up
+        if (i < handles.size() && sleeping && drawnSleeping[i])
+            continue;
+        glm::vec4 color = sleeping ? glm::vec4(0.4f, 0.45f, 0.6f, 1) : glm::vec4(1.0f, 0.6f, 0.2f, 1);
+        glm::vec3 position;
+        glm::quat orientation;
+        interpolate(i, alpha, position, orientation);
+        if (i < handles.size())
+        {
+            renderer.updateInstance(handles[i], position, orientation, box.size, color);
+            drawnSleeping[i] = sleeping;
+        }
+        else
+        {
+            handles.push_back(renderer.createCube(position, orientation, box.size, color));
+            drawnSleeping.push_back(sleeping);
+        }
+        updatedHandles++;
+    }
+}
+
+void BoxPile::onGUI()
+{
+    using namespace ImGui;
+    const RigidBodyWorld::Stats &stats = world.stats();
+    Text("%zu bodies: %zu awake, %zu sleeping in %zu islands", stats.bodies, stats.awakeBodies, stats.sleepingBodies, stats.sleepingIslands);
+    Text("%zu islands this step (largest %zu), %zu fell asleep, %zu woken", stats.islands, stats.largestIsland, stats.islandsFellAsleep, stats.islandsWoken);
+    Text("%zu pairs, %zu contacts", stats.broadphasePairs, stats.contacts);
+    Text("broadphase %.3f ms, narrowphase %.3f ms, solve %.3f ms, islands %.3f ms", stats.broadphaseTime * 1000, stats.narrowphaseTime * 1000,
+         stats.solveTime * 1000, stats.islandTime * 1000);
+    if (!islandHistory.empty())
+        PlotLines("islands/step", islandHistory.data(), (int)islandHistory.size(), 0, nullptr, 0, FLT_MAX, ImVec2(0, 60));
+
+    if (retainedDrawing)
+        Text("%zu of %zu box instances updated last frame", updatedHandles, handles.size());
+
+    Checkbox("Paused", &paused);
+    Checkbox("Retained drawing", &retainedDrawing);
+    Checkbox("Sleeping", &world.settings.sleeping);
+    SliderFloat("Sleep linear velocity", &world.settings.sleepLinearVelocity, 0.0f, 0.5f);
+    SliderFloat("Sleep angular velocity", &world.settings.sleepAngularVelocity, 0.0f, 1.0f);
+    SliderFloat("Time to sleep", &world.settings.timeToSleep, 0.0f, 3.0f);
+    SliderInt("Layers", &layers, 1, 20);
+    if (Button("Drop boxes"))
+        dropBoxes();
+    SameLine();
+    if (Button("Wake all"))
+        world.wakeAll();
+    SameLine();
+    if (Button("Reset"))
+        init();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Scene.h"
+#include <util/RigidBodyWorld.h>
+
+/// @brief Pile of boxes that falls asleep island by island once it has settled
+class BoxPile : public Scene
+{
+public:
+    virtual void init() override;
+    virtual void simulateStep() override;
+    virtual void onDraw(Renderer &renderer) override;
+    virtual void onDrawInterpolated(Renderer &renderer, float alpha) override;
+    virtual void onGUI() override;
+    virtual bool canSaveState() const override { return true; }
+    virtual void saveState(StateWriter &writer) const override;
+    virtual void loadState(StateReader &reader) override;
+    virtual bool setParameter(const std::string &name, double value) override;
+    virtual void reportMetrics(std::vector<std::pair<std::string, double>> &metrics) const override;
+
+private:
+    RigidBodyWorld world;
+    /// box transforms before the last step, drawing blends them with the current ones
+    std::vector<glm::vec3> previousPositions;
+    std::vector<glm::quat> previousOrientations;
+    int layers = 8;
+    bool paused = false;
+    /// islands per step for the plot in the GUI
+    std::vector<float> islandHistory;
+    /// draw the boxes as retained objects and only update the ones that are awake
+    bool retainedDrawing = true;
+    std::vector<Renderer::InstanceHandle> handles;
+    /// whether a box was sleeping when its handle was last updated
+    std::vector<uint8_t> drawnSleeping;
+    bool resetHandles = false;
+    size_t updatedHandles = 0;
+
+    void dropBoxes();
+    void drawRetained(Renderer &renderer, float alpha);
+    /// @brief Transform of a box between its previous and current one, sleeping boxes are drawn where they are
+    void interpolate(uint32_t body, float alpha, glm::vec3 &position, glm::quat &orientation) const;
+};
@@ -0,0 +1,122 @@
+#include "ParticleField.h"
+#include <imgui.h>
+#include <util/ThreadPool.h>
+#include <random>
+#include <stdexcept>
+#include <glm/gtc/constants.hpp>
+
+void ParticleField::init()
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    positions.resize(particleCount);
+    colors.resize(particleCount);
+    angularVelocities.resize(particleCount);
+    for (int i = 0; i < particleCount; ++i)
+    {
+        float r = 0.5f + 4.5f * std::sqrt(unit(rng));
+        float angle = 2 * glm::pi<float>() * unit(rng);
+        positions[i] = glm::vec3(r * std::cos(angle), 2 * (unit(rng) - 0.5f) * (5.5f - r) * 0.3f, r * std::sin(angle));
+        colors[i] = glm::vec4(0.3f + 0.7f * unit(rng), 0.4f + 0.4f * (1 - r / 5), 1.0f - 0.6f * r / 5, unit(rng) < transparentFraction ? 0.4f : 1.0f);
+        // inner particles orbit faster
+        angularVelocities[i] = 1.5f / (0.5f + r);
+    }
+}
+
+void ParticleField::simulateStep()
+{
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        float angle = angularVelocities[i] * timestep;
+        float c = std::cos(angle), s = std::sin(angle);
+        glm::vec3 &p = positions[i];
+        p = glm::vec3(c * p.x - s * p.z, p.y, s * p.x + c * p.z);
+    }
+}
+
+void ParticleField::saveState(StateWriter &writer) const
+{
+    writer.write(positions);
+    writer.write(colors);
+    writer.write(angularVelocities);
+}
+
+void ParticleField::loadState(StateReader &reader)
+{
+    // read aside first, a state that does not fit leaves the particles as they were
+    std::vector<glm::vec3> newPositions;
+    std::vector<glm::vec4> newColors;
+    std::vector<float> newAngularVelocities;
+    reader.read(newPositions);
+    reader.read(newColors);
+    reader.read(newAngularVelocities);
+    if (newColors.size() != newPositions.size() || newAngularVelocities.size() != newPositions.size())
+        throw std::runtime_error("The particle state has arrays of different sizes");
+    positions.swap(newPositions);
+    colors.swap(newColors);
+    angularVelocities.swap(newAngularVelocities);
+    particleCount = (int)positions.size();
+}
+
+bool ParticleField::setParameter(const std::string &name, double value)
+{
+    if (name == "particles")
+        particleCount = (int)value;
+    else if (name == "radius")
+        radius = (float)value;
+    else if (name == "transparentFraction")
+        transparentFraction = (float)value;
+    else
+        return false;
+    return true;
+}
+
+void ParticleField::reportMetrics(std::vector<std::pair<std::string, double>> &metrics) const
+{
+    // the rotation keeps the distance to the y axis, its drift is the accumulated rounding error
+    double radiusSum = 0;
+    for (const glm::vec3 &p : positions)
+        radiusSum += std::sqrt(p.x * p.x + p.z * p.z);
+    metrics.push_back({"meanOrbitRadius", positions.empty() ? 0.0 : radiusSum / positions.size()});
+}
+
+void ParticleField::onDraw(Renderer &renderer)
+{
+    if (transparentFraction > 0)
+        renderer.enableDepthSorting(sortTransparentOnly);
+    if (drawMode == bulkDraw)
+    {
+        renderer.drawSpheres(positions, radius, colors);
+        return;
+    }
+    if (drawMode == parallelDraw)
+    {
+        renderer.drawParallel(positions.size(), [&](DrawList &list, size_t begin, size_t end)
+                              {
+            for (size_t i = begin; i < end; ++i)
+                list.drawSphere(positions[i], radius, colors[i]); },
+                              static_cast<unsigned>(recordingThreads));
+        return;
+    }
+    for (size_t i = 0; i < positions.size(); ++i)
+        renderer.drawSphere(positions[i], radius, colors[i]);
+}
+
+void ParticleField::onGUI()
+{
+    using namespace ImGui;
+    RadioButton("Per call", &drawMode, perCallDraw);
+    SameLine();
+    RadioButton("Bulk", &drawMode, bulkDraw);
+    SameLine();
+    RadioButton("Parallel draw lists", &drawMode, parallelDraw);
+    if (drawMode == parallelDraw)
+        SliderInt("Recording threads (0 = all)", &recordingThreads, 0, static_cast<int>(ThreadPool::global().size()));
+    if (SliderInt("Particles", &particleCount, 1000, 2000000, "%d", ImGuiSliderFlags_Logarithmic))
+        init();
+    SliderFloat("Radius", &radius, 0.005f, 0.1f);
+    if (SliderFloat("Transparent fraction", &transparentFraction, 0.0f, 1.0f))
+        init();
+    Checkbox("Sort transparent particles only", &sortTransparentOnly);
+    Text("Compare DrawPrep above between the draw modes and thread counts");
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "Scene.h"
+
+/// @brief Many small spheres swirling around the origin, for measuring the cost of drawing large numbers of instances
+class ParticleField : public Scene
+{
+public:
+    virtual void init() override;
+    virtual void simulateStep() override;
+    virtual void onDraw(Renderer &renderer) override;
+    virtual void onGUI() override;
+    virtual bool canSaveState() const override { return true; }
+    virtual void saveState(StateWriter &writer) const override;
+    virtual void loadState(StateReader &reader) override;
+    virtual bool setParameter(const std::string &name, double value) override;
+    virtual void reportMetrics(std::vector<std::pair<std::string, double>> &metrics) const override;
+
+private:
+    int particleCount = 100000;
+    float radius = 0.02f;
+    enum DrawMode : int
+    {
+        /// one drawSphere call per particle
+        perCallDraw,
+        /// all particles with one drawSpheres call
+        bulkDraw,
+        /// one drawSphere call per particle, recorded into draw lists from several threads
+        parallelDraw,
+    };
+    int drawMode = bulkDraw;
+    int recordingThreads = 0;
+    /// fraction of particles drawn with alpha < 1, these are depth sorted
+    float transparentFraction = 0;
+    bool sortTransparentOnly = true;
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec4> colors;
+    /// angular velocity around the y axis
+    std::vector<float> angularVelocities;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "Renderer.h"
+#include <util/StateStream.h>
 
 /// @brief Scene base class. **Run `cmake . -B build` after adding new files to the scenes folder**
 ///
@@ -13,15 +14,42 @@ class Scene
 public:
     /// @brief Initialize the scene. Gets called every time the scene is switched to.
     virtual void init() {};
-    /// @brief Simulate a step in the scene. Gets called every frame before onDraw.
+    /// @brief Simulate a step in the scene. Gets called before onDraw, as often as the fixed timestep requires.
     ///
-    /// This is where you should update the physics of the scene.
+    /// This is where you should update the physics of the scene, advancing it by timestep.
     virtual void simulateStep() {};
     /// @brief Draw the scene. Gets called every frame after simulateStep.
     ///
     /// This is where you should call the Renderer draw functions.
     virtual void onDraw(Renderer &renderer);
+    /// @brief Draw the scene between its last two steps. The Simulator calls this instead of onDraw.
+    ///
+    /// alpha in [0, 1] is how far the wall clock is from the step before the last one towards the last one. Scenes
+    /// that keep their previous state can blend it with alpha for smooth motion at any frame rate, the default
+    /// draws the last step.
+    virtual void onDrawInterpolated(Renderer &renderer, float alpha) { onDraw(renderer); }
     /// @brief Define the GUI for the scene. Gets called every frame after onDraw.
     virtual void onGUI() {};
     virtual ~Scene() = default;
+
+    /// @brief Whether saveState and loadState are implemented, checkpoints are only offered for scenes that return true
+    virtual bool canSaveState() const { return false; }
+    /// @brief Append everything that the following steps depend on, so loadState can continue from here
+    ///
+    /// GUI settings that change how the scene steps may be left out, they keep their current values on loading.
+    virtual void saveState(StateWriter &writer) const {};
+    /// @brief Continue from a state written by saveState of the same scene, throws std::runtime_error if it does not fit
+    virtual void loadState(StateReader &reader) {};
+
+    /// @brief Set a parameter by name for batch runs, see BatchRunner. Gets called before init.
+    /// @return
+    ///     False if the scene has no parameter of that name
+    virtual bool setParameter(const std::string &name, double value) { return false; }
+    /// @brief Add measurements of the current state to the results of a batch run, e.g. energy or penetration depth
+    virtual void reportMetrics(std::vector<std::pair<std::string, double>> &metrics) const {};
+
+    /// @brief Simulated seconds that one simulateStep advances the scene, set by the Simulator
+    float timestep = 0.01f;
+    /// @brief Number of steps that simulateStep may split timestep into, for scenes that need smaller steps to stay stable
+    int substeps = 1;
 };
@@ -2,6 +2,8 @@
 #include <map>
 
 #include "Scene1.h"
+#include "BoxPile.h"
+#include "ParticleField.h"
 
 using SceneCreator = std::function<std::unique_ptr<Scene>()>;
 
@@ -14,5 +16,7 @@ SceneCreator creator()
 
 std::map<std::string, SceneCreator> scenesCreators = {
     {"Demo Scene", creator<Scene1>()},
+    {"Box Pile", creator<BoxPile>()},
+    {"Particle Field", creator<ParticleField>()},
     // add more Scene types here
 };
@@ -2,6 +2,9 @@ struct VertexOutput {
         @builtin(position) position: vec4f,
         @location(0) uv: vec2f,
         @location(1) cmapOffset: f32,
+        @location(2) @interpolate(flat) origin: vec2i,
+        @location(3) @interpolate(flat) size: vec2i,
+        @location(4) @interpolate(flat) range: vec2f,
       }
 
 struct ImageAttributes {
@@ -13,6 +16,8 @@ struct ImageAttributes {
     @location(5) width: i32,
     @location(6) height: i32,
     @location(7) cmapOffset: f32,
+    @location(8) vmin: f32,
+    @location(9) vmax: f32,
 
 }
 
@@ -46,6 +51,10 @@ fn vs_main(@builtin(vertex_index) VertexIndex: u32, imageAttributes: ImageAttrib
     output.uv.y *= f32(imageAttributes.height);
 
     output.cmapOffset = imageAttributes.cmapOffset;
+    // texel position in the atlas, 0 for images with their own texture
+    output.origin = vec2i(imageAttributes.offset & 0xFFFF, imageAttributes.offset >> 16);
+    output.size = vec2i(imageAttributes.width, imageAttributes.height);
+    output.range = vec2f(imageAttributes.vmin, imageAttributes.vmax);
 
     return output;
 }
@@ -57,7 +66,12 @@ fn vs_main(@builtin(vertex_index) VertexIndex: u32, imageAttributes: ImageAttrib
 
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
-    let value = textureLoad(texture, vec2i(in.uv), 0).r;
+    // map [vmin, vmax] to [0, 1], the sampler clamps values outside the range
+    let extent = in.range.y - in.range.x;
+    // clamped to the image, neighbors in the atlas must not bleed in at the edges
+    let texel = min(vec2i(in.uv), in.size - vec2i(1)) + in.origin;
+    let raw = textureLoad(texture, texel, 0).r;
+    let value = select(0.0, (raw - in.range.x) / extent, extent != 0.0);
     let color = textureSample(cmapTexture, cmapSampler, vec2f(value, in.cmapOffset)).rgb;
     let corrected = vec4f(pow(color, vec3f(2.2)), 1.0);
     return corrected;
@@ -13,6 +13,18 @@ struct VertexInput {
     @location(7) flags: u32
 };
 
+// CompactInstance layout of the compact instancing pipeline, see src/util/InstancePacking.h
+struct CompactVertexInput {
+	@location(0) position: vec3f,
+	@location(1) normal: vec3f,
+	@location(2) world_pos: vec3f,
+	@location(3) rotation: vec4f, // snorm16 quaternion
+	@location(4) scale_id_flags: vec2u, // three half floats, then the id in 12 bits and the flags in 4 bits
+	@location(5) color: vec4f // unorm8
+};
+
+const COMPACT_ID_BITS = 12u;
+
 struct VertexOutput {
 	@builtin(position) position: vec4f,
 	@location(0) color: vec4f,
@@ -64,21 +76,34 @@ fn transform(position: vec3f, rotation: vec4f, scale: vec3f, v: vec3f) -> vec3f
 }
 
 
-@vertex
-fn vs_main(in: VertexInput) -> VertexOutput {
+fn instance_vertex(position: vec3f, normal: vec3f, world_pos: vec3f, rotation: vec4f, scale: vec3f, color: vec4f, id: u32, flags: u32) -> VertexOutput {
     var out: VertexOutput;
 
-    let worldpos = transform(in.world_pos, in.rotation, in.scale, in.position);
+    let worldpos = transform(world_pos, rotation, scale, position);
 
     out.position = renderUniforms.projectionMatrix * renderUniforms.viewMatrix * vec4f(worldpos, 1.0);
-    out.normal = quatMul(in.rotation, in.normal);
-    out.color = in.color;
-    out.id = in.id;
-    out.flags = in.flags;
+    out.normal = quatMul(rotation, normal);
+    out.color = color;
+    out.id = id;
+    out.flags = flags;
     out.worldpos = worldpos;
     return out;
 }
 
+@vertex
+fn vs_main(in: VertexInput) -> VertexOutput {
+    return instance_vertex(in.position, in.normal, in.world_pos, in.rotation, in.scale, in.color, in.id, in.flags);
+}
+
+@vertex
+fn vs_main_compact(in: CompactVertexInput) -> VertexOutput {
+    let scale = vec3f(unpack2x16float(in.scale_id_flags.x), unpack2x16float(in.scale_id_flags.y).x);
+    let id_flags = in.scale_id_flags.y >> 16u;
+    let id = id_flags & ((1u << COMPACT_ID_BITS) - 1u);
+    let flags = id_flags >> COMPACT_ID_BITS;
+    return instance_vertex(in.position, in.normal, in.world_pos, in.rotation, scale, in.color, id, flags);
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
 
@@ -0,0 +1,373 @@
+#include "BatchRunner.h"
+#include <util/Profiler.h>
+#include <util/ThreadPool.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+
+namespace
+{
+    struct Sweep
+    {
+        std::string scene;
+        size_t steps = 0;
+        size_t repeat = 1;
+        std::vector<std::pair<std::string, std::vector<double>>> parameters;
+    };
+
+    std::string trim(const std::string &text)
+    {
+        size_t begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string::npos)
+            return "";
+        size_t end = text.find_last_not_of(" \t\r");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    double parseNumber(const std::string &text, const std::string &where)
+    {
+        std::string value = trim(text);
+        char *end = nullptr;
+        double number = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0')
+            throw std::runtime_error(where + ": \"" + value + "\" is no number");
+        return number;
+    }
+
+    size_t parseCount(const std::string &text, const std::string &where)
+    {
+        double number = parseNumber(text, where);
+        if (number < 1 || number != std::floor(number))
+            throw std::runtime_error(where + ": expected a positive whole number, not \"" + trim(text) + "\"");
+        return static_cast<size_t>(number);
+    }
+
+    /// @brief A list of values and start:stop:increment ranges, separated by commas
+    std::vector<double> parseValues(const std::string &text, const std::string &where)
+    {
+        std::vector<double> values;
+        size_t begin = 0;
+        while (begin <= text.size())
+        {
+            size_t end = std::min(text.find(',', begin), text.size());
+            std::string item = text.substr(begin, end - begin);
+            size_t colon = item.find(':');
+            if (colon == std::string::npos)
+            {
+                values.push_back(parseNumber(item, where));
+            }
+            else
+            {
+                size_t secondColon = item.find(':', colon + 1);
+                if (secondColon == std::string::npos)
+                    throw std::runtime_error(where + ": a range is start:stop:increment");
+                double start = parseNumber(item.substr(0, colon), where);
+                double stop = parseNumber(item.substr(colon + 1, secondColon - colon - 1), where);
+                double increment = parseNumber(item.substr(secondColon + 1), where);
+                if (increment <= 0 || stop < start)
+                    throw std::runtime_error(where + ": a range needs start <= stop and an increment > 0");
+                // counted instead of summed up, so the stop value is not lost to rounding
+                size_t count = static_cast<size_t>(std::floor((stop - start) / increment + 1e-9)) + 1;
+                for (size_t i = 0; i < count; ++i)
+                    values.push_back(start + i * increment);
+            }
+            begin = end + 1;
+        }
+        return values;
+    }
+
+    std::string csvField(const std::string &text)
+    {
+        if (text.find_first_of(",\"\n") == std::string::npos)
+            return text;
+        std::string quoted = "\"";
+        for (char c : text)
+        {
+            if (c == '"')
+                quoted += '"';
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    const double *find(const BatchRunner::Values &values, const std::string &name)
+    {
+        for (const auto &value : values)
+        {
+            if (value.first == name)
+                return &value.second;
+        }
+        return nullptr;
+    }
+
+    /// @brief Append the names of values that are not in names yet, in the order they come
+    void addNames(const BatchRunner::Values &values, std::vector<std::string> &names)
+    {
+        for (const auto &value : values)
+        {
+            if (std::find(names.begin(), names.end(), value.first) == names.end())
+                names.push_back(value.first);
+        }
+    }
+}
+
+std::vector<BatchRunner::Run> BatchRunner::loadConfig(const std::string &path, size_t defaultSteps)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Could not open " + path);
+    return parseConfig(in, path, defaultSteps);
+}
+
+std::vector<BatchRunner::Run> BatchRunner::parseConfig(std::istream &in, const std::string &name, size_t defaultSteps)
+{
+    std::vector<Sweep> sweeps;
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); ++lineNumber)
+    {
+        std::string where = name + ":" + std::to_string(lineNumber);
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        size_t equals = line.find('=');
+        if (equals == std::string::npos)
+            throw std::runtime_error(where + ": expected key = values");
+        std::string key = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+        if (key == "scene")
+        {
+            sweeps.emplace_back();
+            sweeps.back().scene = value;
+            sweeps.back().steps = defaultSteps;
+            continue;
+        }
+        if (sweeps.empty())
+            throw std::runtime_error(where + ": the first line has to be scene = NAME");
+        Sweep &sweep = sweeps.back();
+        if (key == "steps")
+            sweep.steps = parseCount(value, where);
+        else if (key == "repeat")
+            sweep.repeat = parseCount(value, where);
+        else
+        {
+            for (const auto &parameter : sweep.parameters)
+            {
+                if (parameter.first == key)
+                    throw std::runtime_error(where + ": " + key + " is set twice");
+            }
+            sweep.parameters.emplace_back(key, parseValues(value, where));
+        }
+    }
+
+    std::vector<Run> runs;
+    for (const Sweep &sweep : sweeps)
+    {
+        // every combination, the first parameter of the config changes slowest
+        std::vector<size_t> choice(sweep.parameters.size(), 0);
+        for (;;)
+        {
+            Run run;
+            run.scene = sweep.scene;
+            run.steps = sweep.steps;
+            for (size_t i = 0; i < sweep.parameters.size(); ++i)
+                run.parameters.emplace_back(sweep.parameters[i].first, sweep.parameters[i].second[choice[i]]);
+            for (size_t i = 0; i < sweep.repeat; ++i)
+                runs.push_back(run);
+
+            size_t i = sweep.parameters.size();
+            while (i > 0 && ++choice[i - 1] == sweep.parameters[i - 1].second.size())
+                choice[--i] = 0;
+            if (i == 0)
+                break;
+        }
+    }
+    return runs;
+}
+
+BatchRunner::BatchRunner(const std::map<std::string, SceneCreator> &creators, unsigned threads) : creators(creators), threads(threads)
+{
+}
+
+void BatchRunner::check(const std::vector<Run> &runs) const
+{
+    // one instance per scene is enough to see which parameters it knows, it is never initialized
+    std::set<std::pair<std::string, std::string>> checked;
+    for (const Run &run : runs)
+    {
+        auto creator = creators.find(run.scene);
+        if (creator == creators.end())
+            throw std::runtime_error("Unknown scene \"" + run.scene + "\"");
+        std::unique_ptr<Scene> scene;
+        for (const auto &parameter : run.parameters)
+        {
+            if (parameter.first == "timestep" || parameter.first == "substeps" || !checked.insert({run.scene, parameter.first}).second)
+                continue;
+            if (scene == nullptr)
+                scene = creator->second();
+            if (!scene->setParameter(parameter.first, parameter.second))
+                throw std::runtime_error(run.scene + " has no parameter \"" + parameter.first + "\"");
+        }
+    }
+}
+
+std::vector<BatchRunner::Result> BatchRunner::run(const std::vector<Run> &runs)
+{
+    check(runs);
+    // the longest runs go first, so the last ones to finish are short
+    std::vector<size_t> order(runs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return runs[a].steps > runs[b].steps; });
+
+    std::vector<Result> results(runs.size());
+    std::atomic<size_t> next{0};
+    std::mutex resultMutex;
+    size_t finished = 0;
+    ThreadPool pool(threads);
+    pool.run([&](unsigned thread, unsigned)
+             {
+        for (size_t i = next++; i < order.size(); i = next++)
+        {
+            size_t index = order[i];
+            // nothing may leave the task, a failed run or callback is a row with an error and the next run goes on
+            Result result;
+            try
+            {
+                result = runOne(runs[index]);
+            }
+            catch (const std::exception &e)
+            {
+                result = Result();
+                result.error = e.what();
+            }
+            result.run = index;
+            result.thread = thread;
+            std::lock_guard<std::mutex> lock(resultMutex);
+            results[index] = std::move(result);
+            ++finished;
+            if (onResult)
+            {
+                std::string error;
+                try
+                {
+                    onResult(runs[index], results[index], finished);
+                }
+                catch (const std::exception &e)
+                {
+                    error = e.what();
+                }
+                catch (...)
+                {
+                    error = "unknown exception";
+                }
+                if (!error.empty())
+                    results[index].error += (results[index].error.empty() ? "onResult: " : "; onResult: ") + error;
+            }
+        } });
+    return results;
+}
+
+BatchRunner::Result BatchRunner::runOne(const Run &run) const
+{
+    PROFILE_ZONE("BatchRunner::runOne");
+    using clock = std::chrono::high_resolution_clock;
+    Result result;
+    std::vector<double> stepTimes;
+    try
+    {
+        auto startTime = clock::now();
+        std::unique_ptr<Scene> scene = creators.at(run.scene)();
+        for (const auto &parameter : run.parameters)
+        {
+            if (parameter.first == "timestep")
+                scene->timestep = static_cast<float>(parameter.second);
+            else if (parameter.first == "substeps")
+                scene->substeps = std::max(static_cast<int>(parameter.second), 1);
+            else
+                scene->setParameter(parameter.first, parameter.second);
+        }
+        scene->init();
+        result.initTime = std::chrono::duration<double>(clock::now() - startTime).count();
+
+        stepTimes.reserve(run.steps);
+        for (size_t i = 0; i < run.steps; ++i)
+        {
+            auto stepStart = clock::now();
+            scene->simulateStep();
+            stepTimes.push_back(std::chrono::duration<double>(clock::now() - stepStart).count());
+        }
+        scene->reportMetrics(result.metrics);
+    }
+    catch (const std::exception &e)
+    {
+        result.error = e.what();
+    }
+    catch (...)
+    {
+        result.error = "unknown exception";
+    }
+
+    result.steps = stepTimes.size();
+    if (!stepTimes.empty())
+    {
+        result.stepTime = std::accumulate(stepTimes.begin(), stepTimes.end(), 0.0);
+        result.meanStep = result.stepTime / stepTimes.size();
+        std::sort(stepTimes.begin(), stepTimes.end());
+        result.p95Step = stepTimes[std::min(stepTimes.size() - 1, static_cast<size_t>(std::ceil(0.95 * stepTimes.size())) - 1)];
+        result.maxStep = stepTimes.back();
+    }
+    return result;
+}
+
+void BatchRunner::writeCsv(const std::string &path, const std::vector<Run> &runs, const std::vector<Result> &results)
+{
+    std::vector<std::string> parameterNames, metricNames;
+    for (const Run &run : runs)
+        addNames(run.parameters, parameterNames);
+    for (const Result &result : results)
+        addNames(result.metrics, metricNames);
+
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Could not open " + path + " for writing");
+    out << "run,scene";
+    for (const std::string &name : parameterNames)
+        out << "," << csvField(name);
+    out << ",steps,thread,initSeconds,stepSeconds,stepsPerSecond,meanStepMs,p95StepMs,maxStepMs";
+    for (const std::string &name : metricNames)
+        out << "," << csvField(name);
+    out << ",error\n";
+
+    out << std::setprecision(9);
+    for (const Result &result : results)
+    {
+        const Run &run = runs[result.run];
+        out << result.run << "," << csvField(run.scene);
+        for (const std::string &name : parameterNames)
+        {
+            out << ",";
+            if (const double *value = find(run.parameters, name))
+                out << *value;
+        }
+        out << "," << result.steps << "," << result.thread << "," << result.initTime << "," << result.stepTime << ","
+            << (result.stepTime > 0 ? result.steps / result.stepTime : 0) << "," << result.meanStep * 1000 << "," << result.p95Step * 1000 << ","
+            << result.maxStep * 1000;
+        for (const std::string &name : metricNames)
+        {
+            out << ",";
+            if (const double *value = find(result.metrics, name))
+                out << *value;
+        }
+        out << "," << csvField(result.error) << "\n";
+    }
+    if (!out)
+        throw std::runtime_error("Could not write " + path);
+}
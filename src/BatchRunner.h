@@ -0,0 +1,90 @@
+#pragma once
+#include "Scenes/Scene.h"
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// @brief Runs many independent scene instances with different parameters in parallel, without drawing them
+///
+/// A sweep config lists a scene and values for its parameters, the runner creates one instance per combination of
+/// values, sets them with Scene::setParameter before init and steps it a fixed number of times. The runs are pulled
+/// one at a time by the threads of a ThreadPool of their own, the ones with the most steps first, so threads that
+/// got cheap runs take the next one while the expensive ones are still going. Per run it measures the step times
+/// and collects Scene::reportMetrics after the last step.
+///
+/// Config format, one `key = values` per line, `#` starts a comment:
+///
+///     scene = Box Pile        # starts a sweep, the following lines belong to it
+///     steps = 500             # steps per run, default from the command line
+///     repeat = 3              # runs of every combination, for timing noise
+///     timestep = 0.01, 0.005  # a list of values
+///     iterations = 4:32:4     # start:stop:increment, stop included
+///
+/// Every combination of the parameter values of a sweep is one run. timestep and substeps set the Scene fields of
+/// the same name, all other names are passed to Scene::setParameter. Scenes that use ThreadPool::global() inside a
+/// step, e.g. a ContactSolver with several threads, take turns on it, one thread per run is the fastest setting.
+class BatchRunner
+{
+public:
+    using SceneCreator = std::function<std::unique_ptr<Scene>()>;
+    using Values = std::vector<std::pair<std::string, double>>;
+
+    struct Run
+    {
+        std::string scene;
+        size_t steps = 0;
+        /// in the order of the config
+        Values parameters;
+    };
+
+    struct Result
+    {
+        /// index into the runs passed to run
+        size_t run = 0;
+        /// pool thread the run was stepped on
+        unsigned thread = 0;
+        size_t steps = 0;
+        double initTime = 0;
+        /// seconds of all steps
+        double stepTime = 0;
+        double meanStep = 0;
+        double p95Step = 0;
+        double maxStep = 0;
+        Values metrics;
+        /// what the scene threw, the run stopped there, or what onResult threw for it
+        std::string error;
+    };
+
+    /// @brief Read the runs of a sweep config, throws std::runtime_error with the line of the first mistake
+    /// @param defaultSteps
+    ///     Steps of the sweeps that do not set them
+    static std::vector<Run> loadConfig(const std::string &path, size_t defaultSteps);
+    static std::vector<Run> parseConfig(std::istream &in, const std::string &name, size_t defaultSteps);
+
+    /// @param threads
+    ///     Threads that step scenes, 0 for one per hardware thread
+    explicit BatchRunner(const std::map<std::string, SceneCreator> &creators, unsigned threads = 0);
+
+    /// @brief Called on the thread that finished a run, one call at a time. What it throws goes into Result::error, the other runs continue
+    std::function<void(const Run &, const Result &, size_t finished)> onResult;
+
+    /// @brief Run all runs and wait for them, throws std::runtime_error before the first run for unknown scenes or parameters
+    /// @return
+    ///     One result per run, in the order of runs
+    std::vector<Result> run(const std::vector<Run> &runs);
+
+    /// @brief Write one line per run, parameters and metrics that a run does not have are left empty
+    static void writeCsv(const std::string &path, const std::vector<Run> &runs, const std::vector<Result> &results);
+
+private:
+    void check(const std::vector<Run> &runs) const;
+    Result runOne(const Run &run) const;
+
+    const std::map<std::string, SceneCreator> &creators;
+    unsigned threads;
+};
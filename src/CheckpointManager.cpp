@@ -0,0 +1,254 @@
+#include "CheckpointManager.h"
+#include <util/MappedFile.h>
+#include <util/Profiler.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace
+{
+    const char fileMagic[8] = {'S', 'C', 'N', 'S', 'T', 'A', 'T', 'E'};
+    const uint32_t fileVersion = 1;
+    const char *fileExtension = ".checkpoint";
+
+    /// the state of the scene follows right after it
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        /// null terminated, longer names are cut off
+        char scene[64];
+        uint64_t step;
+        uint64_t size;
+    };
+
+    std::string sceneOf(const FileHeader &header)
+    {
+        return std::string(header.scene, strnlen(header.scene, sizeof(header.scene)));
+    }
+
+    /// @brief The header of a checkpoint file, throws std::runtime_error if it is none or cut off
+    const FileHeader &checkHeader(const MappedFile &file, const std::string &path)
+    {
+        if (file.size() < sizeof(FileHeader))
+            throw std::runtime_error(path + " is no checkpoint file");
+        const FileHeader &header = *reinterpret_cast<const FileHeader *>(file.data());
+        if (std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0)
+            throw std::runtime_error(path + " is no checkpoint file");
+        if (header.version != fileVersion)
+            throw std::runtime_error(path + " has version " + std::to_string(header.version) + ", expected " + std::to_string(fileVersion));
+        if (header.size > file.size() - sizeof(FileHeader))
+            throw std::runtime_error(path + " is cut off");
+        return header;
+    }
+}
+
+CheckpointManager::CheckpointManager()
+{
+    thread = std::thread(&CheckpointManager::writerLoop, this);
+}
+
+CheckpointManager::~CheckpointManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void CheckpointManager::clear(const std::string &name)
+{
+    sceneName = name;
+    checkpoints.clear();
+    nextFile = 0;
+    takeTime = 0;
+}
+
+void CheckpointManager::afterStep(const Scene &scene, uint64_t step)
+{
+    if (settings.enabled && settings.interval > 0 && step % settings.interval == 0 && scene.canSaveState())
+        take(scene, step);
+}
+
+void CheckpointManager::take(const Scene &scene, uint64_t step)
+{
+    PROFILE_ZONE("CheckpointManager::take");
+    if (!scene.canSaveState())
+        throw std::runtime_error(sceneName + " cannot save its state");
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // steps taken again after a rewind replace their old checkpoints
+    while (!checkpoints.empty() && checkpoints.back().step >= step)
+        checkpoints.pop_back();
+    size_t capacity = static_cast<size_t>(std::max(settings.capacity, 1));
+    std::shared_ptr<StateBuffer> state;
+    while (checkpoints.size() >= capacity)
+    {
+        // the buffer of the oldest checkpoint is reused unless the file writer still has it
+        if (checkpoints.front().state.use_count() == 1)
+            state = std::move(checkpoints.front().state);
+        checkpoints.pop_front();
+    }
+    if (state == nullptr)
+        state = std::make_shared<StateBuffer>();
+    // keeps the capacity, a state of the same size as the last one does not allocate
+    state->clear();
+    StateWriter writer(*state);
+    scene.saveState(writer);
+    checkpoints.push_back({step, state});
+
+    if (settings.writeToDisk)
+    {
+        FileJob job;
+        job.path = (std::filesystem::path(settings.directory) / (std::to_string(nextFile % capacity) + fileExtension)).string();
+        job.scene = sceneName;
+        job.step = step;
+        job.state = state;
+        ++nextFile;
+        std::lock_guard<std::mutex> lock(mutex);
+        // a writer that falls behind skips the older files rather than holding on to more buffers
+        if (pending.size() >= capacity)
+            pending.pop_front();
+        pending.push_back(std::move(job));
+        wake.notify_one();
+    }
+    takeTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+bool CheckpointManager::restore(Scene &scene, uint64_t targetStep, uint64_t &restoredStep)
+{
+    PROFILE_ZONE("CheckpointManager::restore");
+    while (!checkpoints.empty() && checkpoints.back().step > targetStep)
+        checkpoints.pop_back();
+    if (checkpoints.empty())
+        return false;
+    const Checkpoint &checkpoint = checkpoints.back();
+    StateReader reader(checkpoint.state->data(), checkpoint.state->size());
+    scene.loadState(reader);
+    restoredStep = checkpoint.step;
+    return true;
+}
+
+std::vector<CheckpointManager::DiskCheckpoint> CheckpointManager::diskCheckpoints() const
+{
+    std::vector<DiskCheckpoint> files;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(settings.directory, error))
+    {
+        if (!entry.is_regular_file(error) || entry.path().extension() != fileExtension)
+            continue;
+        std::string path = entry.path().string();
+        try
+        {
+            MappedFile file(path);
+            const FileHeader &header = checkHeader(file, path);
+            files.push_back({path, sceneOf(header), header.step, header.size});
+        }
+        catch (const std::runtime_error &)
+        {
+            // files that are being written or are no checkpoints are not listed
+        }
+    }
+    std::sort(files.begin(), files.end(), [](const DiskCheckpoint &a, const DiskCheckpoint &b)
+              { return a.step > b.step; });
+    return files;
+}
+
+uint64_t CheckpointManager::restoreFile(Scene &scene, const std::string &path)
+{
+    PROFILE_ZONE("CheckpointManager::restoreFile");
+    MappedFile file(path);
+    const FileHeader &header = checkHeader(file, path);
+    if (sceneOf(header) != sceneName)
+        throw std::runtime_error(path + " is a checkpoint of " + sceneOf(header) + ", not of " + sceneName);
+    StateReader reader(file.data() + sizeof(FileHeader), header.size);
+    scene.loadState(reader);
+    // the checkpoints in memory may be from another run of the scene
+    checkpoints.clear();
+    return header.step;
+}
+
+size_t CheckpointManager::memoryBytes() const
+{
+    size_t bytes = 0;
+    for (const Checkpoint &checkpoint : checkpoints)
+        bytes += checkpoint.state->size();
+    return bytes;
+}
+
+size_t CheckpointManager::filesWritten() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return writtenFiles;
+}
+
+std::string CheckpointManager::diskError() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+void CheckpointManager::writerLoop()
+{
+    Profiler::setThreadName("checkpoint writer");
+    for (;;)
+    {
+        FileJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]
+                      { return !pending.empty() || stopping; });
+            if (pending.empty())
+                return;
+            job = std::move(pending.front());
+            pending.pop_front();
+        }
+        std::string jobError;
+        try
+        {
+            writeFile(job);
+        }
+        catch (const std::exception &e)
+        {
+            jobError = e.what();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobError.empty())
+            ++writtenFiles;
+        error = jobError;
+    }
+}
+
+void CheckpointManager::writeFile(const FileJob &job)
+{
+    PROFILE_ZONE("CheckpointManager::writeFile");
+    std::filesystem::path path(job.path);
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    if (error)
+        throw std::runtime_error("Could not create " + path.parent_path().string() + ": " + error.message());
+
+    FileHeader header{};
+    std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+    header.version = fileVersion;
+    std::memcpy(header.scene, job.scene.data(), std::min(job.scene.size(), sizeof(header.scene) - 1));
+    header.step = job.step;
+    header.size = job.state->size();
+    // written next to the file and renamed, so a file that is listed or read is never half written
+    std::string temporaryPath = job.path + ".tmp";
+    {
+        // the pages are written back by the system after the mapping is gone, the copy is all this thread waits for
+        MappedFile file(temporaryPath, sizeof(FileHeader) + job.state->size());
+        std::memcpy(file.writableData(), &header, sizeof(header));
+        if (!job.state->empty())
+            std::memcpy(file.writableData() + sizeof(FileHeader), job.state->data(), job.state->size());
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error)
+        throw std::runtime_error("Could not rename " + temporaryPath + " to " + job.path + ": " + error.message());
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include "Scenes/Scene.h"
+#include <util/StateStream.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief Periodic snapshots of the scene state, for rewinding it without starting over at init
+///
+/// Every Settings::interval steps the scene writes its state with Scene::saveState into a buffer of a ring of
+/// Settings::capacity checkpoints, the oldest one is dropped and its buffer reused for the new one. Optionally
+/// a background thread also copies every checkpoint into a memory-mapped file. The files form a ring of their own,
+/// one per slot, and carry the scene name and step, so a scene can continue from them after a restart.
+///
+/// Taking a checkpoint costs one copy of the state on the calling thread, i.e. a few milliseconds for a million
+/// particles. The states are stored as they are, without compression.
+class CheckpointManager
+{
+public:
+    struct Settings
+    {
+        bool enabled = false;
+        /// steps between two checkpoints
+        int interval = 100;
+        /// checkpoints kept in memory
+        int capacity = 8;
+        /// also write every checkpoint to a file in directory
+        bool writeToDisk = false;
+        std::string directory = "checkpoints";
+    };
+
+    /// @brief A checkpoint file found by diskCheckpoints
+    struct DiskCheckpoint
+    {
+        std::string path;
+        std::string scene;
+        uint64_t step = 0;
+        uint64_t size = 0;
+    };
+
+    CheckpointManager();
+    /// @brief Finish writing the queued checkpoint files
+    ~CheckpointManager();
+    CheckpointManager(const CheckpointManager &) = delete;
+    CheckpointManager &operator=(const CheckpointManager &) = delete;
+
+    Settings settings;
+
+    /// @brief Forget all checkpoints in memory, the following ones belong to the scene sceneName
+    void clear(const std::string &sceneName);
+
+    /// @brief Take a checkpoint if step is a multiple of the interval and the scene can save its state, call this after every step
+    /// @param step
+    ///     Steps the scene made since init
+    void afterStep(const Scene &scene, uint64_t step);
+    /// @brief Take a checkpoint of the scene after step steps, throws std::runtime_error if it cannot save its state
+    void take(const Scene &scene, uint64_t step);
+
+    /// @brief Load the newest checkpoint at or before targetStep into the scene and drop the newer ones
+    /// @param restoredStep
+    ///     The step of the loaded checkpoint, the caller steps the scene from there to targetStep
+    /// @return
+    ///     False if there is no such checkpoint, the scene is left as it was then
+    bool restore(Scene &scene, uint64_t targetStep, uint64_t &restoredStep);
+
+    /// @brief The checkpoint files in Settings::directory, newest first
+    std::vector<DiskCheckpoint> diskCheckpoints() const;
+    /// @brief Load a checkpoint file into the scene, throws std::runtime_error if it belongs to another scene
+    /// @return
+    ///     The step of the checkpoint
+    uint64_t restoreFile(Scene &scene, const std::string &path);
+
+    size_t count() const { return checkpoints.size(); }
+    uint64_t oldestStep() const { return checkpoints.empty() ? 0 : checkpoints.front().step; }
+    uint64_t newestStep() const { return checkpoints.empty() ? 0 : checkpoints.back().step; }
+    /// @brief Bytes of the states in memory
+    size_t memoryBytes() const;
+    /// @brief Seconds the last checkpoint took on the calling thread
+    double lastTakeTime() const { return takeTime; }
+    /// @brief Files written since the manager was created
+    size_t filesWritten() const;
+    /// @brief The last error of the file writer, empty if every file was written
+    std::string diskError() const;
+
+private:
+    struct Checkpoint
+    {
+        uint64_t step = 0;
+        // shared with the file writer while it is queued there
+        std::shared_ptr<StateBuffer> state;
+    };
+
+    struct FileJob
+    {
+        std::string path;
+        std::string scene;
+        uint64_t step = 0;
+        std::shared_ptr<const StateBuffer> state;
+    };
+
+    void writerLoop();
+    static void writeFile(const FileJob &job);
+
+    std::string sceneName;
+    // oldest first
+    std::deque<Checkpoint> checkpoints;
+    // ring slot of the next checkpoint file
+    uint64_t nextFile = 0;
+    double takeTime = 0;
+
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<FileJob> pending;
+    bool stopping = false;
+    size_t writtenFiles = 0;
+    std::string error;
+};
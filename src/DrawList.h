@@ -0,0 +1,78 @@
+#pragma once
+#include "ResourceManager.h"
+#include <vector>
+
+/// @brief Private recording of draw calls for one thread
+///
+/// Scenes that draw many objects from a parallel loop record into one DrawList per thread, obtained from
+/// Renderer::drawList or Renderer::drawParallel. The calls mirror the immediate drawCube, drawSphere, ...
+/// of the Renderer but touch no shared state, so lists can be filled concurrently. The Renderer merges
+/// the lists in ascending index order and assigns the object ids in that order, the result does not
+/// depend on the timing of the threads.
+class DrawList
+{
+public:
+    using vec2 = glm::vec2;
+    using vec3 = glm::vec3;
+    using vec4 = glm::vec4;
+
+    /// @brief See Renderer::drawCube
+    void drawCube(vec3 position = vec3(0), glm::quat rotation = glm::quat(vec3(0)), vec3 scale = vec3(1), vec4 color = vec4(1), uint32_t flags = 0)
+    {
+        cubes.push_back({position, rotation, scale, color, nextId++, flags});
+    }
+
+    /// @brief See Renderer::drawSphere
+    void drawSphere(vec3 position = vec3(0), float radius = 1, vec4 color = vec4(1), uint32_t flags = 0)
+    {
+        drawEllipsoid(position, glm::quat(vec3(0)), vec3(radius), color, flags);
+    }
+
+    /// @brief See Renderer::drawEllipsoid
+    void drawEllipsoid(vec3 position = vec3(0), glm::quat rotation = glm::quat(vec3(0)), vec3 scale = vec3(1), vec4 color = vec4(1), uint32_t flags = 0)
+    {
+        spheres.push_back({position, rotation, scale, color, nextId++, flags});
+    }
+
+    /// @brief See Renderer::drawQuad
+    void drawQuad(vec3 position = vec3(0), glm::quat rotation = glm::quat(vec3(0)), vec2 scale = vec2(1), vec4 color = vec4(1), uint32_t flags = 0)
+    {
+        quads.push_back({position, rotation, vec3(scale.x, scale.y, 1), color, nextId++, flags});
+    }
+
+    /// @brief See Renderer::drawLine
+    void drawLine(vec3 position1, vec3 position2, vec3 color) { drawLine(position1, position2, color, color); }
+
+    /// @brief See Renderer::drawLine
+    void drawLine(vec3 position1, vec3 position2, vec3 color1, vec3 color2)
+    {
+        lines.push_back({position1, color1});
+        lines.push_back({position2, color2});
+    }
+
+    /// @brief Number of cubes, spheres, ellipsoids and quads recorded so far
+    size_t objectCount() const { return nextId; }
+
+    /// @brief Number of lines recorded so far
+    size_t lineCount() const { return lines.size() / 2; }
+
+    /// @brief Forget all recorded draws, the memory is kept for the next frame
+    void clear()
+    {
+        cubes.clear();
+        spheres.clear();
+        quads.clear();
+        lines.clear();
+        nextId = 0;
+    }
+
+private:
+    friend class Renderer;
+
+    // ids count from 0 in call order across all primitives, the merge offsets them
+    std::vector<ResourceManager::InstancedVertexAttributes> cubes;
+    std::vector<ResourceManager::InstancedVertexAttributes> spheres;
+    std::vector<ResourceManager::InstancedVertexAttributes> quads;
+    std::vector<ResourceManager::LineVertexAttributes> lines;
+    uint32_t nextId = 0;
+};
@@ -9,6 +9,10 @@
 #include <backends/imgui_impl_glfw.h>
 
 #include "Primitives.h"
+#include <util/FrameCapture.h>
+#include <util/Profiler.h>
+#include <util/RangeReduction.h>
+#include <util/ThreadPool.h>
 #include <algorithm>
 
 using namespace wgpu;
@@ -33,12 +37,39 @@ Renderer::Renderer()
 	initGui();
 }
 
+Renderer::Renderer(Headless) : headless(true), width(0), height(0)
+{
+	// the instance lists are otherwise created along with the meshes in init
+	instancingPipeline.initHeadless();
+}
+
 Camera Renderer::camera = Camera();
 
 void Renderer::onFrame()
 {
+	// headless renderers, e.g. the one SimulationThread publishes with, would split the frames of the window
+	if (!headless)
+		Profiler::markFrame();
+	PROFILE_ZONE("Renderer::onFrame");
 	auto startTime = std::chrono::high_resolution_clock::now();
-	glfwPollEvents();
+	if (headless)
+	{
+		// the draws of other threads still join the frame, so the counts match a windowed run
+		std::vector<DrawList *> recorded;
+		for (auto &list : drawLists)
+			recorded.push_back(list.get());
+		mergeDrawLists(recorded.data(), recorded.size());
+		for (auto &list : drawLists)
+			list->clear();
+		if (capture)
+			captureFrame();
+		lastDrawTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+		return;
+	}
+	{
+		PROFILE_ZONE("glfwPollEvents");
+		glfwPollEvents();
+	}
 	updateLightingUniforms();
 	if (reinitSwapChain)
 	{
@@ -54,15 +85,37 @@ void Renderer::onFrame()
 	queue.writeBuffer(uniformBuffer, offsetof(RenderUniforms, cullingOffsets), &renderUniforms.cullingOffsets, sizeof(RenderUniforms::cullingOffsets));
 	queue.writeBuffer(uniformBuffer, offsetof(RenderUniforms, flags), &renderUniforms.flags, sizeof(RenderUniforms::flags));
 
+	// draws recorded on other threads join the frame in list order
+	std::vector<DrawList *> recorded;
+	for (auto &list : drawLists)
+		recorded.push_back(list.get());
+	mergeDrawLists(recorded.data(), recorded.size());
+	for (auto &list : drawLists)
+		list->clear();
+
+	// before sorting and culling, which are redone on replay
+	if (capture)
+		captureFrame();
+
 	if (sortDepth)
-		instancingPipeline.sortDepth();
+		instancingPipeline.sortDepth(sortTransparentOnly, parallelDepthSorting ? 0 : 1);
 	// prepare instanced draw calls
+	instancingPipeline.culling.enabled = frustumCulling;
+	instancingPipeline.culling.threads = parallelCulling ? 0 : 1;
+	instancingPipeline.sphereLod.enabled = sphereLevelOfDetail;
+	instancingPipeline.sphereLod.edgePixels = sphereEdgePixels;
+	instancingPipeline.compactInstances = compactInstances;
+	instancingPipeline.chunkSize = instanceChunkSize;
+	instancingPipeline.setView(renderUniforms.projectionMatrix, renderUniforms.viewMatrix, static_cast<float>(camera.height),
+							   renderUniforms.flags & UniformFlags::cullingPlane, renderUniforms.cullingOffsets);
 	instancingPipeline.commit();
 
 	// prepare line buffers
 	linePipeline.commit();
 
 	// prepare image buffers
+	imagePipeline.atlas = imageAtlas;
+	imagePipeline.halfPrecision = halfPrecisionImages;
 	imagePipeline.commit();
 
 	TextureView nextTexture = swapChain.getCurrentTextureView();
@@ -154,10 +207,12 @@ void Renderer::onFrame()
 	cmdBufferDescriptor.label = "Command buffer";
 	CommandBuffer command = encoder.finish(cmdBufferDescriptor);
 	encoder.release();
-	queue.submit(command);
-	command.release();
-
-	swapChain.present();
+	{
+		PROFILE_ZONE("submit and present");
+		queue.submit(command);
+		command.release();
+		swapChain.present();
+	}
 	lastDrawTime = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - startTime).count();
 
 #ifdef WEBGPU_BACKEND_DAWN
@@ -168,6 +223,8 @@ void Renderer::onFrame()
 
 Renderer::~Renderer()
 {
+	if (headless)
+		return;
 	terminateGui();
 	terminateLightingUniforms();
 	terminateUniforms();
@@ -182,11 +239,13 @@ Renderer::~Renderer()
 
 bool Renderer::isRunning()
 {
-	return !glfwWindowShouldClose(window);
+	return headless || !glfwWindowShouldClose(window);
 }
 
 void Renderer::onResize()
 {
+	if (headless)
+		return;
 	glfwGetFramebufferSize(window, &width, &height);
 	if (width == 0 || height == 0)
 		return;
@@ -236,9 +295,10 @@ void Renderer::initWindowAndDevice()
 	int largestVertexBuffer = sizeof(ResourceManager::InstancedVertexAttributes);
 
 	RequiredLimits requiredLimits = Default;
-	requiredLimits.limits.maxVertexAttributes = 8;
+	requiredLimits.limits.maxVertexAttributes = 10;
 	requiredLimits.limits.maxVertexBuffers = 3;
-	requiredLimits.limits.maxBufferSize = 150000 * largestVertexBuffer;
+	// everything the adapter offers, instance buffers beyond it are split into chunks, see InstancingPipeline::chunkSize
+	requiredLimits.limits.maxBufferSize = supportedLimits.limits.maxBufferSize;
 	requiredLimits.limits.maxVertexBufferArrayStride = largestVertexBuffer;
 	requiredLimits.limits.minStorageBufferOffsetAlignment = supportedLimits.limits.minStorageBufferOffsetAlignment;
 	requiredLimits.limits.minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
@@ -303,9 +363,10 @@ void Renderer::setPresentMode(PresentMode mode)
 	reinitSwapChain = true;
 }
 
-void Renderer::enableDepthSorting()
+void Renderer::enableDepthSorting(bool transparentOnly)
 {
 	sortDepth = true;
+	sortTransparentOnly = transparentOnly;
 }
 
 void Renderer::initSwapChain()
@@ -400,14 +461,137 @@ void Renderer::terminateDepthBuffer()
 	depthTexture.release();
 }
 
+namespace
+{
+	// frame flags of a capture besides the UniformFlags
+	const uint32_t capturedDepthSorting = 1 << 8;
+	const uint32_t capturedTransparentOnly = 1 << 9;
+	const frameCapture::Stream instanceStreams[] = {frameCapture::cubes, frameCapture::spheres, frameCapture::quads};
+}
+
+void Renderer::startCapture(const std::string &path, uint32_t keyframeInterval)
+{
+	stopCapture();
+	capture = std::make_unique<FrameCaptureWriter>(path, keyframeInterval);
+}
+
+void Renderer::stopCapture()
+{
+	if (!capture)
+		return;
+	// the writer is gone even if closing throws
+	std::unique_ptr<FrameCaptureWriter> writer = std::move(capture);
+	writer->close();
+}
+
+size_t Renderer::capturedFrames() const
+{
+	return capture ? capture->framesWritten() : 0;
+}
+
+size_t Renderer::capturedBytes() const
+{
+	return capture ? capture->bytesWritten() : 0;
+}
+
+void Renderer::captureFrame()
+{
+	PROFILE_ZONE("Renderer::captureFrame");
+	recordFrame(capture->frame());
+	capture->submit();
+}
+
+void Renderer::recordFrame(frameCapture::Frame &frame)
+{
+	for (uint32_t primitive = InstancingPipeline::cubePrimitive; primitive <= InstancingPipeline::quadPrimitive; ++primitive)
+	{
+		auto type = static_cast<InstancingPipeline::PrimitiveType>(primitive);
+		// retained objects first, they keep their place when the number of immediate objects changes
+		Span<const ResourceManager::InstancedVertexAttributes> retained = instancingPipeline.retainedSlots(type);
+		Span<const ResourceManager::InstancedVertexAttributes> immediate = instancingPipeline.frameInstances(type);
+		frame.assign(instanceStreams[primitive], retained.data(), retained.size());
+		frame.append(instanceStreams[primitive], immediate.data(), immediate.size());
+	}
+
+	frame.streams[frameCapture::linePoints].clear();
+	for (uint32_t set = 0; set < linePipeline.lineSetCount(); ++set)
+	{
+		Span<const ResourceManager::LineVertexAttributes> points = linePipeline.lineSetPoints(set);
+		frame.append(frameCapture::linePoints, points.data(), points.size());
+	}
+	Span<const ResourceManager::LineVertexAttributes> points = linePipeline.framePoints();
+	frame.append(frameCapture::linePoints, points.data(), points.size());
+
+	Span<const ResourceManager::ImageAttributes> images = imagePipeline.frameImages();
+	frame.assign(frameCapture::images, images.data(), images.size());
+	frame.streams[frameCapture::imagePixels].clear();
+	for (size_t i = 0; i < images.size(); ++i)
+		frame.append(frameCapture::imagePixels, imagePipeline.imageData(i), size_t(images[i].width) * images[i].height);
+
+	frame.flags = renderUniforms.flags | (sortDepth ? capturedDepthSorting : 0) | (sortTransparentOnly ? capturedTransparentOnly : 0);
+	frame.parameters[0] = renderUniforms.cullingOffsets.x;
+	frame.parameters[1] = renderUniforms.cullingOffsets.y;
+	frame.parameters[2] = renderUniforms.cullingOffsets.z;
+}
+
+void Renderer::drawCapturedFrame(FrameCaptureReader &reader, size_t index)
+{
+	try
+	{
+		drawFrame(reader.frame(index));
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw std::runtime_error("Captured frame " + std::to_string(index) + ": " + e.what());
+	}
+}
+
+void Renderer::drawFrame(const frameCapture::Frame &frame)
+{
+	for (uint32_t primitive = InstancingPipeline::cubePrimitive; primitive <= InstancingPipeline::quadPrimitive; ++primitive)
+	{
+		size_t count;
+		const ResourceManager::InstancedVertexAttributes *instances = frame.view<ResourceManager::InstancedVertexAttributes>(instanceStreams[primitive], count);
+		if (count == 0)
+			continue;
+		std::copy(instances, instances + count, instancingPipeline.appendInstances(static_cast<InstancingPipeline::PrimitiveType>(primitive), count));
+		current_id += static_cast<uint32_t>(count);
+	}
+
+	size_t pointCount;
+	const ResourceManager::LineVertexAttributes *points = frame.view<ResourceManager::LineVertexAttributes>(frameCapture::linePoints, pointCount);
+	if (pointCount >= 2)
+		std::copy(points, points + pointCount / 2 * 2, linePipeline.appendLines(pointCount / 2));
+
+	size_t imageCount, pixelCount;
+	const ResourceManager::ImageAttributes *images = frame.view<ResourceManager::ImageAttributes>(frameCapture::images, imageCount);
+	const float *pixels = frame.view<float>(frameCapture::imagePixels, pixelCount);
+	size_t offset = 0;
+	for (size_t i = 0; i < imageCount; ++i)
+	{
+		size_t size = size_t(images[i].width) * images[i].height;
+		if (images[i].width < 0 || images[i].height < 0 || size > pixelCount - offset)
+			throw std::runtime_error("The frame has fewer pixels than its images");
+		imagePipeline.addImage(Span<const float>(pixels + offset, size), images[i]);
+		offset += size;
+	}
+
+	renderUniforms.flags |= frame.flags & UniformFlags::cullingPlane;
+	if (frame.flags & UniformFlags::cullingPlane)
+		renderUniforms.cullingOffsets = vec3(frame.parameters[0], frame.parameters[1], frame.parameters[2]);
+	if (frame.flags & capturedDepthSorting)
+		enableDepthSorting((frame.flags & capturedTransparentOnly) != 0);
+}
+
 void Renderer::clearScene()
 {
 	instancingPipeline.clearAll();
 	linePipeline.clearAll();
 	imagePipeline.clearAll();
-	current_id = 0;
+	current_id = retained_id_end;
 	renderUniforms.flags = 0;
 	sortDepth = false;
+	sortTransparentOnly = false;
 }
 
 void Renderer::initUniforms()
@@ -541,6 +725,314 @@ uint32_t Renderer::drawQuad(glm::vec3 position, glm::quat rotation, glm::vec2 sc
 	return current_id++;
 }
 
+namespace
+{
+	/// bulk draws with fewer instances are filled on the calling thread
+	const size_t parallelBulkThreshold = 1 << 15;
+
+	/// @brief Argument of a bulk draw call: one value for all instances, one per instance or empty for the default
+	template <class T>
+	class BulkArgument
+	{
+	public:
+		BulkArgument(Span<const T> values, size_t count, const T &fallback, const char *name) : fallback(fallback)
+		{
+			if (values.empty())
+				data = &this->fallback;
+			else if (values.size() == count || values.size() == 1)
+				data = values.data(), stride = values.size() == 1 ? 0 : 1;
+			else
+				throw std::runtime_error(std::string("Bulk draw: ") + name + " needs one element or one per instance");
+		}
+		BulkArgument(const BulkArgument &) = delete;
+
+		const T &operator[](size_t i) const { return data[i * stride]; }
+
+	private:
+		T fallback;
+		const T *data = nullptr;
+		size_t stride = 0;
+	};
+
+	template <class Body>
+	void bulkFor(size_t count, const Body &body)
+	{
+		if (count < parallelBulkThreshold)
+			body(0, count);
+		else
+			ThreadPool::global().parallelFor(count, parallelBulkThreshold / 2, body);
+	}
+
+	/// Validates all arguments before anything is appended, so a throwing call leaves no half written instances behind
+	template <class Scale, class ToScale>
+	void fillInstances(InstancingPipeline &pipeline, InstancingPipeline::PrimitiveType primitive, uint32_t firstId, uint32_t flags,
+					   Span<const glm::vec3> positions, Span<const glm::quat> rotations, Span<const Scale> scales, const Scale &defaultScale,
+					   const ToScale &toScale, Span<const glm::vec4> colors)
+	{
+		size_t count = positions.size();
+		BulkArgument<glm::quat> rotation(rotations, count, glm::quat(glm::vec3(0)), "rotations");
+		BulkArgument<Scale> scale(scales, count, defaultScale, "scales");
+		BulkArgument<glm::vec4> color(colors, count, glm::vec4(1), "colors");
+		ResourceManager::InstancedVertexAttributes *out = pipeline.appendInstances(primitive, count);
+		bulkFor(count, [&](size_t begin, size_t end)
+				{
+			for (size_t i = begin; i < end; i++)
+			{
+				ResourceManager::InstancedVertexAttributes &instance = out[i];
+				instance.position = positions[i];
+				instance.rotation = rotation[i];
+				instance.scale = toScale(scale[i]);
+				instance.color = color[i];
+				instance.id = firstId + static_cast<uint32_t>(i);
+				instance.flags = flags;
+			} });
+	}
+}
+
+uint32_t Renderer::drawSpheres(Span<const glm::vec3> positions, Span<const float> radii, Span<const glm::vec4> colors, uint32_t flags)
+{
+	fillInstances(instancingPipeline, InstancingPipeline::spherePrimitive, current_id, flags, positions, {}, radii, 1.0f,
+				  [](float radius)
+				  { return vec3(radius); },
+				  colors);
+	uint32_t first = current_id;
+	current_id += static_cast<uint32_t>(positions.size());
+	return first;
+}
+
+uint32_t Renderer::drawCubes(Span<const glm::vec3> positions, Span<const glm::quat> rotations, Span<const glm::vec3> scales, Span<const glm::vec4> colors, uint32_t flags)
+{
+	fillInstances(instancingPipeline, InstancingPipeline::cubePrimitive, current_id, flags, positions, rotations, scales, vec3(1),
+				  [](const vec3 &scale)
+				  { return scale; },
+				  colors);
+	uint32_t first = current_id;
+	current_id += static_cast<uint32_t>(positions.size());
+	return first;
+}
+
+uint32_t Renderer::drawEllipsoids(Span<const glm::vec3> positions, Span<const glm::quat> rotations, Span<const glm::vec3> scales, Span<const glm::vec4> colors, uint32_t flags)
+{
+	fillInstances(instancingPipeline, InstancingPipeline::spherePrimitive, current_id, flags, positions, rotations, scales, vec3(1),
+				  [](const vec3 &scale)
+				  { return scale; },
+				  colors);
+	uint32_t first = current_id;
+	current_id += static_cast<uint32_t>(positions.size());
+	return first;
+}
+
+uint32_t Renderer::drawQuads(Span<const glm::vec3> positions, Span<const glm::quat> rotations, Span<const glm::vec2> scales, Span<const glm::vec4> colors, uint32_t flags)
+{
+	fillInstances(instancingPipeline, InstancingPipeline::quadPrimitive, current_id, flags, positions, rotations, scales, vec2(1),
+				  [](const vec2 &scale)
+				  { return vec3(scale.x, scale.y, 1); },
+				  colors);
+	uint32_t first = current_id;
+	current_id += static_cast<uint32_t>(positions.size());
+	return first;
+}
+
+void Renderer::drawLines(Span<const glm::vec3> starts, Span<const glm::vec3> ends, Span<const glm::vec3> colors)
+{
+	size_t count = starts.size();
+	if (ends.size() != count)
+		throw std::runtime_error("Bulk draw: starts and ends need the same size");
+	BulkArgument<glm::vec3> color(colors, count, vec3(1), "colors");
+	ResourceManager::LineVertexAttributes *out = linePipeline.appendLines(count);
+	bulkFor(count, [&](size_t begin, size_t end)
+			{
+		for (size_t i = begin; i < end; i++)
+		{
+			out[2 * i] = {starts[i], color[i]};
+			out[2 * i + 1] = {ends[i], color[i]};
+		} });
+}
+
+DrawList &Renderer::drawList(unsigned index)
+{
+	std::lock_guard<std::mutex> lock(drawListMutex);
+	if (drawLists.size() <= index)
+		drawLists.resize(index + 1);
+	// lists live on the heap, growing the vector does not move lists other threads are recording into
+	if (!drawLists[index])
+		drawLists[index] = std::make_unique<DrawList>();
+	return *drawLists[index];
+}
+
+void Renderer::drawParallel(size_t count, const std::function<void(DrawList &, size_t, size_t)> &body, unsigned threads)
+{
+	if (count == 0)
+		return;
+	ThreadPool &pool = ThreadPool::global();
+	unsigned threadCount = pool.threadCount(threads);
+	threadCount = static_cast<unsigned>(std::min<size_t>(threadCount, count));
+	if (parallelDrawLists.size() < threadCount)
+		parallelDrawLists.resize(threadCount);
+	pool.run([&](unsigned thread, unsigned participants)
+			 {
+		DrawList &list = parallelDrawLists[thread];
+		list.clear();
+		body(list, count * thread / participants, count * (thread + 1) / participants); },
+			 threadCount);
+	std::vector<DrawList *> lists(threadCount);
+	for (unsigned thread = 0; thread < threadCount; thread++)
+		lists[thread] = &parallelDrawLists[thread];
+	mergeDrawLists(lists.data(), lists.size());
+}
+
+void Renderer::mergeDrawLists(DrawList *const *lists, size_t count)
+{
+	PROFILE_ZONE("Renderer::mergeDrawLists");
+	// every list gets its place in the appended ranges first, then the lists are copied in parallel
+	struct Placement
+	{
+		size_t cubes = 0, spheres = 0, quads = 0, points = 0;
+		uint32_t firstId = 0;
+	};
+	std::vector<Placement> placements(count);
+	Placement total;
+	total.firstId = current_id;
+	for (size_t i = 0; i < count; i++)
+	{
+		placements[i] = total;
+		total.cubes += lists[i]->cubes.size();
+		total.spheres += lists[i]->spheres.size();
+		total.quads += lists[i]->quads.size();
+		total.points += lists[i]->lines.size();
+		total.firstId += lists[i]->nextId;
+	}
+	if (total.firstId == current_id && total.points == 0)
+		return;
+	ResourceManager::InstancedVertexAttributes *cubes = instancingPipeline.appendInstances(InstancingPipeline::cubePrimitive, total.cubes);
+	ResourceManager::InstancedVertexAttributes *spheres = instancingPipeline.appendInstances(InstancingPipeline::spherePrimitive, total.spheres);
+	ResourceManager::InstancedVertexAttributes *quads = instancingPipeline.appendInstances(InstancingPipeline::quadPrimitive, total.quads);
+	ResourceManager::LineVertexAttributes *points = linePipeline.appendLines(total.points / 2);
+	auto copyInstances = [](const std::vector<ResourceManager::InstancedVertexAttributes> &from, ResourceManager::InstancedVertexAttributes *to, uint32_t firstId)
+	{
+		for (size_t k = 0; k < from.size(); k++)
+		{
+			to[k] = from[k];
+			to[k].id += firstId;
+		}
+	};
+	ThreadPool::global().parallelFor(count, 1, [&](size_t begin, size_t end)
+									 {
+		for (size_t i = begin; i < end; i++)
+		{
+			const DrawList &list = *lists[i];
+			const Placement &placement = placements[i];
+			copyInstances(list.cubes, cubes + placement.cubes, placement.firstId);
+			copyInstances(list.spheres, spheres + placement.spheres, placement.firstId);
+			copyInstances(list.quads, quads + placement.quads, placement.firstId);
+			std::copy(list.lines.begin(), list.lines.end(), points + placement.points);
+		} });
+	current_id = total.firstId;
+}
+
+Renderer::InstanceHandle Renderer::createRetained(InstancingPipeline::PrimitiveType primitive, ResourceManager::InstancedVertexAttributes instance)
+{
+	if (!free_retained_ids.empty())
+	{
+		instance.id = free_retained_ids.back();
+		free_retained_ids.pop_back();
+	}
+	else
+	{
+		instance.id = current_id++;
+		retained_id_end = current_id;
+	}
+	uint32_t slot = instancingPipeline.addRetained(primitive, instance);
+	return {primitive, slot, instancingPipeline.retainedGeneration(primitive, slot)};
+}
+
+Renderer::InstanceHandle Renderer::createCube(glm::vec3 position, glm::quat rotation, glm::vec3 scale, glm::vec4 color, uint32_t flags)
+{
+	return createRetained(InstancingPipeline::cubePrimitive, {position, rotation, scale, color, 0, flags});
+}
+
+Renderer::InstanceHandle Renderer::createEllipsoid(glm::vec3 position, glm::quat rotation, glm::vec3 scale, glm::vec4 color, uint32_t flags)
+{
+	return createRetained(InstancingPipeline::spherePrimitive, {position, rotation, scale, color, 0, flags});
+}
+
+Renderer::InstanceHandle Renderer::createSphere(glm::vec3 position, float radius, glm::vec4 color, uint32_t flags)
+{
+	return createEllipsoid(position, glm::quat(vec3(0)), vec3(radius), color, flags);
+}
+
+Renderer::InstanceHandle Renderer::createQuad(glm::vec3 position, glm::quat rotation, glm::vec2 scale, glm::vec4 color, uint32_t flags)
+{
+	return createRetained(InstancingPipeline::quadPrimitive, {position, rotation, vec3(scale.x, scale.y, 1), color, 0, flags});
+}
+
+void Renderer::updateInstance(InstanceHandle handle, glm::vec3 position, glm::quat rotation)
+{
+	auto primitive = static_cast<InstancingPipeline::PrimitiveType>(handle.primitive);
+	ResourceManager::InstancedVertexAttributes instance = instancingPipeline.retained(primitive, handle.slot, handle.generation);
+	instance.position = position;
+	instance.rotation = rotation;
+	instancingPipeline.updateRetained(primitive, handle.slot, handle.generation, instance);
+}
+
+void Renderer::updateInstance(InstanceHandle handle, glm::vec3 position, glm::quat rotation, glm::vec3 scale, glm::vec4 color, uint32_t flags)
+{
+	auto primitive = static_cast<InstancingPipeline::PrimitiveType>(handle.primitive);
+	// the pipeline keeps the id of the object
+	instancingPipeline.updateRetained(primitive, handle.slot, handle.generation, {position, rotation, scale, color, 0, flags});
+}
+
+void Renderer::updateInstanceColor(InstanceHandle handle, glm::vec4 color)
+{
+	auto primitive = static_cast<InstancingPipeline::PrimitiveType>(handle.primitive);
+	ResourceManager::InstancedVertexAttributes instance = instancingPipeline.retained(primitive, handle.slot, handle.generation);
+	instance.color = color;
+	instancingPipeline.updateRetained(primitive, handle.slot, handle.generation, instance);
+}
+
+void Renderer::destroyInstance(InstanceHandle &handle)
+{
+	if (!handle.valid())
+		return;
+	auto primitive = static_cast<InstancingPipeline::PrimitiveType>(handle.primitive);
+	uint32_t id = instancingPipeline.retained(primitive, handle.slot, handle.generation).id;
+	instancingPipeline.removeRetained(primitive, handle.slot, handle.generation);
+	free_retained_ids.push_back(id);
+	handle = InstanceHandle();
+}
+
+Renderer::LineSetHandle Renderer::createLineSet(const std::vector<Line> &lines)
+{
+	uint32_t index = linePipeline.addLineSet(lines);
+	return {index, linePipeline.lineSetGeneration(index)};
+}
+
+void Renderer::updateLineSet(LineSetHandle handle, const std::vector<Line> &lines)
+{
+	linePipeline.updateLineSet(handle.index, handle.generation, lines);
+}
+
+void Renderer::updateLine(LineSetHandle handle, size_t index, Line line)
+{
+	linePipeline.updateLine(handle.index, handle.generation, index, line);
+}
+
+void Renderer::destroyLineSet(LineSetHandle &handle)
+{
+	if (!handle.valid())
+		return;
+	linePipeline.removeLineSet(handle.index, handle.generation);
+	handle = LineSetHandle();
+}
+
+void Renderer::clearRetained()
+{
+	instancingPipeline.clearRetained();
+	linePipeline.clearRetained();
+	free_retained_ids.clear();
+	retained_id_end = 0;
+}
+
 void Renderer::drawLine(glm::vec3 position1, glm::vec3 position2, glm::vec3 color1, glm::vec3 color2)
 {
 	linePipeline.addLine({{position1, color1}, {position2, color2}});
@@ -553,6 +1045,7 @@ void Renderer::drawLine(glm::vec3 position1, glm::vec3 position2, glm::vec3 colo
 
 void Renderer::updateGui(RenderPassEncoder renderPass)
 {
+	PROFILE_ZONE("Renderer::updateGui");
 	ImGui_ImplWGPU_NewFrame();
 	ImGui_ImplGlfw_NewFrame();
 	ImGui::NewFrame();
@@ -619,8 +1112,8 @@ void Renderer::drawWireCube(vec3 position, vec3 scale, vec3 color)
 
 void Renderer::drawImage(std::vector<float> data, int height, int width, Colormap colormap, glm::vec2 screenPosition, glm::vec2 screenSize)
 {
-	auto [min, max] = std::minmax_element(data.begin(), data.end());
-	drawImage(data, height, width, *min, *max, colormap, screenPosition, screenSize);
+	rangeReduction::Range range = rangeReduction::minMax(data.data(), data.size(), parallelImageRange ? 0 : 1);
+	drawImage(std::move(data), height, width, range.min, range.max, colormap, screenPosition, screenSize);
 }
 
 void Renderer::drawImage(std::vector<float> data, int height, int width, float vmin, float vmax, Colormap colormap, glm::vec2 screenPosition, glm::vec2 screenSize)
@@ -630,11 +1123,56 @@ void Renderer::drawImage(std::vector<float> data, int height, int width, float v
 	//  [4,5,6,7],
 	//  [8,9,10,11]]
 	// for width = 4, height = 3
-	for (float &value : data)
+	if (data.size() < static_cast<size_t>(width) * height)
+		throw std::runtime_error("drawImage: the data has fewer than width * height values");
+	// the pipeline keeps the vector until the frame is drawn, the values are normalized in the shader
+	imagePipeline.addImage(std::move(data), screenPosition, screenSize, width, height, vmin, vmax, colormap);
+}
+
+void Renderer::drawImage(Span<const float> data, int height, int width, Colormap colormap, glm::vec2 screenPosition, glm::vec2 screenSize)
+{
+	drawImage(data, height, width, AutoRange(), colormap, screenPosition, screenSize);
+}
+
+void Renderer::drawImage(Span<const float> data, int height, int width, const AutoRange &autoRange, Colormap colormap, glm::vec2 screenPosition, glm::vec2 screenSize)
+{
+	unsigned threads = parallelImageRange ? 0 : 1;
+	rangeReduction::Range range;
+	if (autoRange.mode == AutoRange::percentile)
+		range = rangeReduction::percentiles(data.data(), data.size(), autoRange.lowPercentile, autoRange.highPercentile, threads);
+	else
+		range = rangeReduction::minMax(data.data(), data.size(), threads);
+	glm::vec2 current(range.low, range.high);
+
+	// images are told apart by their position in the call order, the range of a new image starts from its data
+	size_t index = imagePipeline.objectCount();
+	if (index >= imageRanges.size())
 	{
-		value = (value - vmin) / (vmax - vmin);
+		imageRanges.resize(index + 1, current);
 	}
-	imagePipeline.addImage(data, screenPosition, screenSize, width, height, colormap);
+	else if (autoRange.smoothing > 0)
+	{
+		float smoothing = std::min(autoRange.smoothing, 1.0f);
+		current = glm::mix(current, imageRanges[index], smoothing);
+	}
+	imageRanges[index] = current;
+	drawImage(data, height, width, current.x, current.y, colormap, screenPosition, screenSize);
+}
+
+void Renderer::drawImage(Span<const float> data, int height, int width, float vmin, float vmax, Colormap colormap, glm::vec2 screenPosition, glm::vec2 screenSize)
+{
+	if (data.size() < static_cast<size_t>(width) * height)
+		throw std::runtime_error("drawImage: the data has fewer than width * height values");
+	imagePipeline.addImage(data, screenPosition, screenSize, width, height, vmin, vmax, colormap);
+}
+
+void Renderer::markImageDirty(int x, int y, int width, int height)
+{
+	if (imagePipeline.objectCount() == 0)
+		throw std::runtime_error("markImageDirty: no image was drawn this frame");
+	if (x < 0 || y < 0 || width < 0 || height < 0)
+		throw std::runtime_error("markImageDirty: the region must not be negative");
+	imagePipeline.markDirty(x, y, width, height);
 }
 
 void Renderer::drawCullingPlanes(const glm::vec3 &offsets)
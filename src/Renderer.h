@@ -2,16 +2,27 @@
 #include <webgpu/webgpu.hpp>
 #include <glm/glm.hpp>
 #include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include "ResourceManager.h"
+#include "DrawList.h"
 #include "pipelines/InstancingPipeline.h"
 #include "pipelines/LinePipeline.h"
 #include "pipelines/PostProcessingPipeline.h"
 #include "pipelines/ImagePipeline.h"
 #include "Camera.h"
 #include "Colormap.h"
+#include <util/Span.h>
 
 // Forward declare
 struct GLFWwindow;
+class FrameCaptureWriter;
+class FrameCaptureReader;
+namespace frameCapture
+{
+	struct Frame;
+}
 
 /// @brief Renderer
 ///
@@ -21,6 +32,8 @@ struct GLFWwindow;
 /// After each onFrame call, the rendering engine will draw the scene and present it to the screen.
 /// renderer.clearScreen() should be called at the beginning of each frame to clear all added draw objects.
 /// Otherwise, the objects will be drawn in every frame.
+/// Objects created with createCube, createSphere, createLineSet, etc. are retained: they stay until they are destroyed
+/// and only changes to them are uploaded to the GPU.
 class Renderer
 {
 
@@ -28,6 +41,20 @@ public:
 	Renderer();
 	~Renderer();
 
+	/// @brief Tag for the headless constructor
+	struct Headless
+	{
+	};
+
+	/// @brief Create a renderer without window and GPU device, e.g. to measure the physics of scenes on machines without a GPU
+	///
+	/// Scenes draw into it as usual. onFrame merges the draw lists of other threads but uploads and draws nothing,
+	/// clearScene discards the frame. Object, line and image counts stay available.
+	explicit Renderer(Headless);
+
+	/// @brief True if the renderer was created without window and GPU device
+	bool isHeadless() const { return headless; }
+
 	/// @brief Draw a cube in the next frame
 	///
 	/// Call this function every frame you want to draw a cube
@@ -140,6 +167,56 @@ public:
 	///    The color of the end of the line: (r, g, b).
 	void drawLine(glm::vec3 position1, glm::vec3 position2, glm::vec3 color1, glm::vec3 color2);
 
+	/// @brief Draw many spheres in the next frame
+	///
+	/// Much faster than calling drawSphere in a loop: the instances are written straight into the instance array with a
+	/// single allocation, large batches are filled in parallel. Every argument except positions may hold either one element
+	/// for all spheres or one per sphere.
+	///
+	/// @param positions
+	///    The centers of the spheres
+	/// @param radii
+	///    The radii of the spheres
+	/// @param colors
+	///    The colors of the spheres: (r, g, b, a)
+	/// @param flags
+	///    Flags for all spheres: Renderer::DrawFlags
+	/// @return
+	///    The id of the first sphere, the others have consecutive ids.
+	uint32_t drawSpheres(Span<const glm::vec3> positions, Span<const float> radii, Span<const glm::vec4> colors = vec4(1), uint32_t flags = 0);
+
+	/// @brief Draw many cubes in the next frame
+	///
+	/// See drawSpheres. Empty rotations or scales use the defaults of drawCube.
+	/// @return
+	///    The id of the first cube, the others have consecutive ids.
+	uint32_t drawCubes(Span<const glm::vec3> positions, Span<const glm::quat> rotations, Span<const glm::vec3> scales, Span<const glm::vec4> colors = vec4(1), uint32_t flags = 0);
+
+	/// @brief Draw many ellipsoids in the next frame
+	///
+	/// See drawSpheres. Empty rotations or scales use the defaults of drawEllipsoid.
+	/// @return
+	///    The id of the first ellipsoid, the others have consecutive ids.
+	uint32_t drawEllipsoids(Span<const glm::vec3> positions, Span<const glm::quat> rotations, Span<const glm::vec3> scales, Span<const glm::vec4> colors = vec4(1), uint32_t flags = 0);
+
+	/// @brief Draw many quads in the next frame
+	///
+	/// See drawSpheres. Empty rotations or scales use the defaults of drawQuad.
+	/// @return
+	///    The id of the first quad, the others have consecutive ids.
+	uint32_t drawQuads(Span<const glm::vec3> positions, Span<const glm::quat> rotations, Span<const glm::vec2> scales, Span<const glm::vec4> colors = vec4(1), uint32_t flags = 0);
+
+	/// @brief Draw many lines in the next frame
+	///
+	/// See drawSpheres. starts and ends need the same size, colors may hold one color for all lines or one per line.
+	/// @param starts
+	///    The start points of the lines
+	/// @param ends
+	///    The end points of the lines
+	/// @param colors
+	///    The colors of the lines: (r, g, b)
+	void drawLines(Span<const glm::vec3> starts, Span<const glm::vec3> ends, Span<const glm::vec3> colors = vec3(1));
+
 	/// @brief Draw a wire cube in the next frame
 	///
 	/// Call this function every frame you want to draw a wire cube
@@ -152,6 +229,130 @@ public:
 	///    The color of the wire cube: (r, g, b)
 	void drawWireCube(glm::vec3 position = vec3(0), glm::vec3 scale = vec3(1), glm::vec3 color = vec3(1));
 
+	/// @brief Get a draw list to record into from another thread
+	///
+	/// Every thread has to use its own index, getting the lists is safe from several threads. All lists are merged
+	/// into the frame at the start of the next onFrame, after the immediate draw calls and in ascending index
+	/// order, then they are cleared. Objects in draw lists are not counted by objectCount before that.
+	/// @param index
+	///    The index of the list, usually the index of the recording thread
+	DrawList &drawList(unsigned index);
+
+	/// @brief Record the draws for the elements [0, count) in parallel
+	///
+	/// body(list, begin, end) is called for consecutive ranges on the threads of ThreadPool::global() and records
+	/// into the list it gets. The lists are merged in range order before drawParallel returns, so the objects and
+	/// their ids are exactly those of a serial loop over the elements at this point of the frame.
+	/// @param threads
+	///    Number of threads to use, 0 for all
+	void drawParallel(size_t count, const std::function<void(DrawList &, size_t, size_t)> &body, unsigned threads = 0);
+
+	/// @brief Handle of an object created with createCube, createSphere, createEllipsoid or createQuad
+	///
+	/// The slot is reused after the object is destroyed, the generation tells the handles of its objects apart.
+	/// Using a handle of a destroyed object throws std::runtime_error.
+	struct InstanceHandle
+	{
+		uint32_t primitive = UINT32_MAX;
+		uint32_t slot = 0;
+		uint32_t generation = 0;
+		bool valid() const { return primitive != UINT32_MAX; }
+	};
+
+	/// @brief Handle of a line set created with createLineSet
+	///
+	/// Like InstanceHandle, the index is reused after the set is destroyed and the generation tells the handles apart.
+	/// Using a handle of a destroyed set throws std::runtime_error.
+	struct LineSetHandle
+	{
+		uint32_t index = UINT32_MAX;
+		uint32_t generation = 0;
+		bool valid() const { return index != UINT32_MAX; }
+	};
+
+	/// @brief Create a cube that is drawn every frame until it is destroyed
+	///
+	/// Retained objects are not removed by clearScene. Only objects that change with updateInstance are uploaded to the GPU again,
+	/// which makes large scenes of mostly static objects cheap. They can be mixed freely with drawCube and the other immediate calls,
+	/// but are not depth sorted. A retained object gets the next id like an immediate one and keeps it until it is destroyed,
+	/// the ids of the immediate objects of later frames start after those of the retained ones.
+	///
+	/// @param position
+	///    The center of the cube
+	/// @param rotation
+	///    The rotation of the cube
+	/// @param scale
+	///    The scale of the cube. scale (1,1,1) will result in a cube with side length 1
+	/// @param color
+	///    The color of the cube: (r, g, b, a)
+	/// @param flags
+	///    Flags to modify the cube: Renderer::DrawFlags. Can be combined with bitwise OR.
+	/// @return
+	///    The handle of the cube, used to update or destroy it.
+	InstanceHandle createCube(glm::vec3 position = vec3(0), glm::quat rotation = glm::quat(vec3(0)), glm::vec3 scale = vec3(1), glm::vec4 color = vec4(1), uint32_t flags = 0);
+
+	/// @brief Create a sphere that is drawn every frame until it is destroyed. See createCube.
+	InstanceHandle createSphere(glm::vec3 position = vec3(0), float radius = 1, glm::vec4 color = vec4(1), uint32_t flags = 0);
+
+	/// @brief Create an ellipsoid that is drawn every frame until it is destroyed. See createCube and drawEllipsoid.
+	InstanceHandle createEllipsoid(glm::vec3 position = vec3(0), glm::quat rotation = glm::quat(vec3(0)), glm::vec3 scale = vec3(1), glm::vec4 color = vec4(1), uint32_t flags = 0);
+
+	/// @brief Create a quad that is drawn every frame until it is destroyed. See createCube and drawQuad.
+	InstanceHandle createQuad(glm::vec3 position = vec3(0), glm::quat rotation = glm::quat(vec3(0)), glm::vec2 scale = glm::vec2(1), glm::vec4 color = vec4(1), uint32_t flags = 0);
+
+	/// @brief Move a retained object, the change is uploaded in the next frame
+	void updateInstance(InstanceHandle handle, glm::vec3 position, glm::quat rotation);
+
+	/// @brief Change all properties of a retained object, the change is uploaded in the next frame
+	///
+	/// The scale of a sphere is its radius in every direction, the scale of a quad has z = 1.
+	void updateInstance(InstanceHandle handle, glm::vec3 position, glm::quat rotation, glm::vec3 scale, glm::vec4 color, uint32_t flags = 0);
+
+	/// @brief Change the color of a retained object
+	void updateInstanceColor(InstanceHandle handle, glm::vec4 color);
+
+	/// @brief Stop drawing a retained object and invalidate its handle
+	void destroyInstance(InstanceHandle &handle);
+
+	/// @brief Create a set of lines that is drawn every frame until it is destroyed
+	///
+	/// Like the retained objects, line sets survive clearScene and only changed lines are uploaded again.
+	/// @param lines
+	///    The lines of the set: Line{{position1, color1}, {position2, color2}}
+	/// @return
+	///    The handle of the line set, used to update or destroy it.
+	LineSetHandle createLineSet(const std::vector<Line> &lines);
+
+	/// @brief Replace the lines of a line set. The number of lines may change.
+	void updateLineSet(LineSetHandle handle, const std::vector<Line> &lines);
+
+	/// @brief Replace a single line of a line set, throws std::runtime_error if the set has no line at index
+	void updateLine(LineSetHandle handle, size_t index, Line line);
+
+	/// @brief Stop drawing a line set and invalidate its handle
+	void destroyLineSet(LineSetHandle &handle);
+
+	/// @brief Destroy all retained objects and line sets, e.g. when the scene changes. Existing handles become invalid.
+	void clearRetained();
+
+	/// @brief How the drawImage overloads without vmin and vmax choose the colormap range
+	struct AutoRange
+	{
+		enum Mode
+		{
+			/// smallest to largest value, NaNs are ignored
+			minMax,
+			/// lowPercentile to highPercentile of the values, so single outliers do not wash out the colormap
+			percentile,
+		};
+		Mode mode = minMax;
+		/// Percentiles in percent for the percentile mode, values outside are clipped
+		float lowPercentile = 1;
+		float highPercentile = 99;
+		/// Weight in [0, 1) of the previous frame's range of the image drawn at the same position in the call order, 0 follows the data immediately
+		float smoothing = 0;
+	};
+
 	/// @brief Draw an image in the next frame
 	///
 	/// Call this function every frame you want to draw an image.
@@ -193,6 +394,34 @@ public:
 	///  The size of the image on the screen. (1,1) will fill the whole screen.
 	void drawImage(std::vector<float> data, int height, int width, float vmin, float vmax, Colormap colormap = Colormap("hot"), glm::vec2 screenPosition = {0, 0}, glm::vec2 screenSize = {1, 1});
 
+	/// @brief Draw an image in the next frame without copying the data
+	///
+	/// Same as the vector overload, but the pixels are uploaded straight from the caller's memory when the frame is drawn.
+	/// The memory must stay valid and unchanged until the next call of `onFrame` has returned.
+	/// The colormap range is computed from the data, pass vmin and vmax to skip the scan.
+	void drawImage(Span<const float> data, int height, int width, Colormap colormap = Colormap("hot"), glm::vec2 screenPosition = {0, 0}, glm::vec2 screenSize = {1, 1});
+
+	/// @brief Draw an image without copying the data, the colormap range is chosen as set in autoRange
+	///
+	/// The memory must stay valid and unchanged until the next call of `onFrame` has returned.
+	void drawImage(Span<const float> data, int height, int width, const AutoRange &autoRange, Colormap colormap = Colormap("hot"), glm::vec2 screenPosition = {0, 0}, glm::vec2 screenSize = {1, 1});
+
+	/// @brief Upload only a rectangle of the image drawn last, for fields that change locally
+	///
+	/// Without this, drawImage uploads the whole image every frame. Call it right after drawImage with each region that changed
+	/// since the image was drawn in the previous frame; the rest of the texture keeps the previous data. Calling it with an empty
+	/// rectangle marks the image as unchanged. The first frame of an image and frames in which the images changed their sizes
+	/// still upload everything.
+	/// @param x, y
+	///    Column and row of the first pixel of the region, row 0 is the first row of the data
+	void markImageDirty(int x, int y, int width, int height);
+
+	/// @brief Draw an image with a fixed colormap range in the next frame without copying the data
+	///
+	/// The values are mapped to the colormap on the GPU, the data is neither copied nor touched on the CPU.
+	/// The memory must stay valid and unchanged until the next call of `onFrame` has returned.
+	void drawImage(Span<const float> data, int height, int width, float vmin, float vmax, Colormap colormap = Colormap("hot"), glm::vec2 screenPosition = {0, 0}, glm::vec2 screenSize = {1, 1});
+
 	/// @brief Enable culling planes for the next frame.
 	///
 	/// Don't draw any pixels with positions greater than the values in offsets.
@@ -209,7 +438,7 @@ public:
 	///    The number of objects to be drawn next frame
 	size_t objectCount()
 	{
-		return current_id;
+		return instancingPipeline.objectCount();
 	};
 
 	/// @brief Get the number of lines to be drawn next frame
@@ -217,14 +446,92 @@ public:
 	///    The number of lines to be drawn next frame
 	size_t lineCount() { return linePipeline.objectCount(); };
 
+	/// @brief Get the number of retained objects, see createCube
+	/// @return
+	///    The number of retained spheres, ellipsoids, cubes and quads
+	size_t retainedObjectCount() { return instancingPipeline.retainedCount(); };
+
+	/// @brief Get the number of objects that were drawn last frame after frustum culling
+	/// @return
+	///    The number of visible spheres, ellipsoids, cubes and quads, retained ones not included
+	size_t visibleObjectCount() { return instancingPipeline.visibleCount(); };
+
+	/// @brief Get the number of objects that frustum culling skipped last frame
+	/// @return
+	///    The number of culled spheres, ellipsoids, cubes and quads
+	size_t culledObjectCount() { return instancingPipeline.culledCount(); };
+
+	/// @brief Get the number of triangles of all spheres, ellipsoids, cubes and quads drawn last frame
+	/// @return
+	///    The number of triangles, retained objects included
+	size_t triangleCount() { return instancingPipeline.triangleCount(); };
+
+	/// @brief Get the number of lines in all retained line sets
+	/// @return
+	///    The number of retained lines
+	size_t retainedLineCount() { return linePipeline.retainedCount(); };
+
 	/// @brief Get the number of images to be drawn next frame
 	/// @return
 	///    The number of images to be drawn next frame
 	size_t imageCount() { return imagePipeline.objectCount(); };
 
+	/// @brief Get the number of GPU buffers the pipelines (re)allocated since startup
+	/// @return
+	///    The total number of buffer reallocations
+	size_t bufferReallocations() { return instancingPipeline.reallocationCount() + linePipeline.reallocationCount() + imagePipeline.reallocationCount(); };
+
+	/// @brief Get the number of bytes the pipelines wrote to GPU buffers and textures since startup
+	/// @return
+	///    The total number of uploaded bytes
+	size_t uploadedBytes() { return instancingPipeline.uploadedByteCount() + linePipeline.uploadedByteCount() + imagePipeline.uploadedByteCount(); };
+
+	/// @brief Get the number of bytes written to image textures since startup, part of uploadedBytes
+	size_t uploadedImageBytes() { return imagePipeline.uploadedByteCount(); };
+
 	/// @brief Draw all current objects to the screen.
 	void onFrame();
 
+	/// @brief Record every following frame into a capture file until stopCapture is called
+	///
+	/// The objects, lines and images of each frame, retained ones included, are recorded in onFrame right before they are
+	/// uploaded. A background thread writes each frame as the difference to the previous one, see FrameCaptureWriter.
+	/// This works in headless mode too, so long batch runs can be looked at later with drawCapturedFrame.
+	/// Throws std::runtime_error if the file cannot be created.
+	/// @param keyframeInterval
+	///    Every keyframeInterval-th frame is stored completely. A smaller interval makes seeking faster and the file larger
+	void startCapture(const std::string &path, uint32_t keyframeInterval = 60);
+
+	/// @brief Write the remaining frames and close the capture file, throws std::runtime_error if writing it failed
+	void stopCapture();
+
+	/// @brief True between startCapture and stopCapture
+	bool isCapturing() const { return capture != nullptr; }
+
+	/// @brief Number of frames and bytes written to the capture file so far
+	size_t capturedFrames() const;
+	size_t capturedBytes() const;
+
+	/// @brief Draw a frame of a capture file in the next frame, like the scene drew it
+	///
+	/// Retained objects and line sets of the capture are drawn as immediate ones, depth sorting and the culling planes
+	/// are set as they were. The camera and the rendering options stay the current ones. The images are drawn from the
+	/// reader's frame buffer, so the reader must not decode another frame before onFrame has returned.
+	/// Moving on to the following frame of the capture decodes a single delta, other frames start at the closest key frame.
+	void drawCapturedFrame(FrameCaptureReader &reader, size_t frame);
+
+	/// @brief Copy the objects, lines and images of the current frame into a frame of a capture, without writing it anywhere
+	///
+	/// Call it after onFrame and before clearScene. A headless renderer on another thread can hand its frames to
+	/// the windowed one this way, see SimulationThread.
+	void recordFrame(frameCapture::Frame &frame);
+
+	/// @brief Draw a recorded frame in the next frame, like drawCapturedFrame
+	///
+	/// The images are drawn from the frame's pixels, the frame must not change before onFrame has returned.
+	/// Throws std::runtime_error if the frame has fewer pixels than its images.
+	void drawFrame(const frameCapture::Frame &frame);
+
 	/// @brief Check if the window is still open. If the window is closed, the rendering engine will stop.
 	/// @return
 	///   True if the window is still open, false if the window is closed
@@ -233,7 +540,7 @@ public:
 	/// @brief Callback function that is called when the window is resized
 	void onResize();
 
-	/// @brief Clear all objects that are currently drawn
+	/// @brief Clear all objects that are currently drawn, retained objects stay
 	void clearScene();
 
 	/// @brief Enable or disable frame rate synchronization
@@ -242,9 +549,55 @@ public:
 	/// @brief Enables depth sorting for the current frame.
 	///
 	/// When enabled, all primitives get drawn in order from back to front, respective to their centers and the camera.
+	/// Retained objects are not sorted. Spheres are drawn without sphereLevelOfDetail in sorted frames.
+	///
+	/// Enable this only when drawing transparent objects.
+	/// @param transparentOnly
+	///    Only sort objects with alpha < 1, opaque objects are drawn first in the order they were added
+	void enableDepthSorting(bool transparentOnly = false);
+
+	/// @brief Sort with all threads of ThreadPool::global() when depth sorting is enabled
+	bool parallelDepthSorting = false;
+
+	/// @brief Skip objects outside of the view before they are uploaded to the GPU
+	///
+	/// Objects are tested with a bounding sphere against the camera frustum and, if enabled, the culling planes.
+	/// Retained objects are never culled.
+	bool frustumCulling = true;
+
+	/// @brief Cull with all threads of ThreadPool::global()
+	bool parallelCulling = false;
+
+	/// @brief Compute the automatic colormap range of drawImage with all threads of ThreadPool::global()
+	bool parallelImageRange = false;
+
+	/// @brief Draw spheres and ellipsoids with coarser meshes the smaller they appear on screen
+	///
+	/// Icospheres with 0 to 4 subdivisions are available. Retained objects always use 2 subdivisions, their buffer is only
+	/// uploaded when they change and would have to be bucketed again whenever the camera moves. Frames with depth sorting
+	/// also use 2 subdivisions for all spheres, the levels are drawn one after the other and would break the back to front order.
+	bool sphereLevelOfDetail = true;
+
+	/// @brief Target length in pixels of the triangle edges of sphere meshes with sphereLevelOfDetail
+	float sphereEdgePixels = 8;
+
+	/// @brief Upload spheres, ellipsoids, cubes and quads with 32 instead of 64 bytes per object
+	///
+	/// Positions stay exact, rotations, scales and colors are quantized, colors are clamped to [0, 1].
+	bool compactInstances = false;
+
+	/// @brief Maximum number of objects of one kind per GPU buffer and draw call
+	///
+	/// More objects are split into several buffers, the limit is also capped by the device's maxBufferSize.
+	size_t instanceChunkSize = 1 << 20;
+
+	/// @brief Pack images of up to 1024 pixels per side into one shared texture and draw them with one draw call
+	bool imageAtlas = false;
+
+	/// @brief Upload images as 16 bit floats, half the bytes of 32 bit floats
 	///
-	/// Enable this only when drawing transparent objects, it is slow.
-	void enableDepthSorting();
+	/// Values keep about 3 significant digits, magnitudes above 65504 become infinite.
+	bool halfPrecisionImages = false;
 
 	/// @brief This function is called once per frame inside an ImGui context.
 	std::function<void()> defineGUI = nullptr;
@@ -347,11 +700,31 @@ private:
 	using vec3 = glm::vec3;
 	using vec2 = glm::vec2;
 	uint32_t current_id = 0;
+	/// the ids below belong to retained objects, clearScene starts the immediate ones here
+	uint32_t retained_id_end = 0;
+	/// ids of destroyed retained objects, reused by the next ones
+	std::vector<uint32_t> free_retained_ids;
+	InstanceHandle createRetained(InstancingPipeline::PrimitiveType primitive, ResourceManager::InstancedVertexAttributes instance);
+	bool headless = false;
+
+	std::vector<std::unique_ptr<DrawList>> drawLists;
+	std::mutex drawListMutex;
+	std::vector<DrawList> parallelDrawLists;
+	/// @brief Append the lists to the frame in order, their ids continue from current_id
+	void mergeDrawLists(DrawList *const *lists, size_t count);
+
+	std::unique_ptr<FrameCaptureWriter> capture;
+	/// @brief Hand the draws of this frame to the capture writer
+	void captureFrame();
+
+	/// @brief Smoothed colormap ranges of the auto ranged images, by their position in the call order of a frame
+	std::vector<glm::vec2> imageRanges;
 	int width, height;
 	wgpu::PresentMode presentMode = wgpu::PresentMode::Fifo;
 	bool reinitSwapChain = false;
 
 	bool sortDepth = false;
+	bool sortTransparentOnly = false;
 
 	GLFWwindow *window = nullptr;
 	wgpu::Instance instance = nullptr;
@@ -42,10 +42,13 @@ public:
 		float y;
 		float sx;
 		float sy;
+		/// texel position in the atlas texture, x in the lower and y in the upper 16 bits, 0 for images with their own texture
 		int offset;
 		int width;
 		int height;
 		float cmapOffset;
+		float vmin;
+		float vmax;
 	};
 
 	struct InstancedVertexAttributes
@@ -0,0 +1,168 @@
+#include "SimulationThread.h"
+#include <util/Profiler.h>
+#include <chrono>
+
+SimulationThread::SimulationThread(SceneCreator create, const Settings &settings) : settings(settings)
+{
+    loadScene(std::move(create));
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+SimulationThread::~SimulationThread()
+{
+    stopping.store(true, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+    }
+    wake.notify_one();
+    thread.join();
+    // before the renderer its retained objects live in
+    currentScene = nullptr;
+}
+
+void SimulationThread::post(std::function<void()> command)
+{
+    waiting.push_back(std::move(command));
+    update();
+}
+
+void SimulationThread::setSettings(const Settings &newSettings)
+{
+    post([this, newSettings]()
+         { settings = newSettings; });
+}
+
+void SimulationThread::loadScene(SceneCreator create)
+{
+    post([this, create]()
+         {
+        currentScene = nullptr;
+        renderer.clearRetained();
+        scheduler.reset();
+        step = 0;
+        error.clear();
+        try
+        {
+            currentScene = create();
+            currentScene->init();
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+            currentScene = nullptr;
+        } });
+}
+
+bool SimulationThread::update()
+{
+    size_t sent = 0;
+    while (sent < waiting.size() && commands.push(std::move(waiting[sent])))
+        ++sent;
+    waiting.erase(waiting.begin(), waiting.begin() + sent);
+    if (sent > 0)
+    {
+        // taking the lock once makes sure the thread is either waiting or has not checked the queue yet
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+        }
+        wake.notify_one();
+    }
+    return snapshots.update();
+}
+
+void SimulationThread::run()
+{
+    Profiler::setThreadName("simulation");
+    auto lastTime = std::chrono::steady_clock::now();
+    while (!stopping.load(std::memory_order_acquire))
+    {
+        double idle;
+        {
+            std::lock_guard<std::mutex> lock(sceneMutex);
+            bool changed = false;
+            std::function<void()> command;
+            while (commands.pop(command))
+            {
+                command();
+                changed = true;
+            }
+
+            // time passes while paused too, so resuming does not start with a backlog
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - lastTime).count();
+            lastTime = now;
+            scheduler.settings = settings.scheduler;
+            scheduler.settings.stepTime = settings.timestep / settings.timeScale;
+            bool running = currentScene != nullptr && !settings.paused && error.empty();
+            int steps = 0;
+            double stepTime = 0;
+            if (running)
+            {
+                PROFILE_ZONE("SimulationThread steps");
+                steps = scheduler.advance(elapsed);
+                currentScene->timestep = settings.timestep;
+                currentScene->substeps = settings.substeps;
+                auto startTime = std::chrono::high_resolution_clock::now();
+                try
+                {
+                    for (int i = 0; i < steps; ++i, ++step)
+                        currentScene->simulateStep();
+                }
+                catch (const std::exception &e)
+                {
+                    error = e.what();
+                }
+                stepTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+            }
+            // a paused scene can still be changed by commands and its GUI, it is drawn at the rate of a window
+            if (steps > 0 || changed || !running)
+                publish(steps, stepTime);
+
+            if (!running)
+                idle = 1.0 / 60;
+            else if (settings.scheduler.maxThroughput)
+                idle = 0;
+            else
+                idle = (1 - scheduler.alpha()) * scheduler.settings.stepTime;
+        }
+        if (idle > 0)
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait_for(lock, std::chrono::duration<double>(idle), [this]()
+                          { return stopping.load(std::memory_order_acquire) || !commands.empty(); });
+        }
+    }
+}
+
+void SimulationThread::publish(int steps, double stepTime)
+{
+    PROFILE_ZONE("SimulationThread::publish");
+    auto startTime = std::chrono::high_resolution_clock::now();
+    Snapshot &snapshot = snapshots.back();
+    if (currentScene != nullptr && error.empty())
+    {
+        try
+        {
+            currentScene->onDrawInterpolated(renderer, 1.0f);
+            renderer.onFrame();
+            renderer.recordFrame(snapshot.frame);
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+        renderer.clearScene();
+    }
+    if (!error.empty() || currentScene == nullptr)
+        snapshot.frame.clear();
+
+    snapshot.step = step;
+    snapshot.steps = steps;
+    snapshot.stepTime = stepTime;
+    snapshot.drawPrepTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    snapshot.stepsPerSecond = scheduler.stepsPerSecond();
+    snapshot.backlog = scheduler.backlog();
+    snapshot.droppedSteps = scheduler.droppedSteps();
+    snapshot.error = error;
+    snapshots.publish();
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include "Renderer.h"
+#include "Scenes/Scene.h"
+#include <util/FrameCapture.h>
+#include <util/SpscQueue.h>
+#include <util/StepScheduler.h>
+#include <util/TripleBuffer.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief Steps a scene on its own thread, so the frame rate of the window does not depend on the cost of a step
+///
+/// The thread owns the scene and a headless Renderer. After every batch of steps it draws the scene into that
+/// renderer and publishes the objects, lines and images as a Snapshot through a triple buffer, the window draws the
+/// newest one with Renderer::drawFrame. Settings and other changes travel the other way as commands through a
+/// lock-free queue and run on the simulation thread between two batches.
+///
+/// Scenes keep their retained objects in the headless renderer, the window sees them as immediate objects.
+class SimulationThread
+{
+public:
+    using SceneCreator = std::function<std::unique_ptr<Scene>()>;
+
+    struct Settings
+    {
+        /// simulated seconds per step, see Scene::timestep
+        float timestep = 0.01f;
+        /// simulated seconds per second of wall-clock time
+        float timeScale = 1.0f;
+        int substeps = 1;
+        /// stepTime is derived from timestep and timeScale
+        StepScheduler::Settings scheduler;
+        bool paused = false;
+    };
+
+    /// @brief What the window draws and shows, published after every batch of steps
+    struct Snapshot
+    {
+        frameCapture::Frame frame;
+        /// steps since the scene was created
+        uint64_t step = 0;
+        /// steps of the last batch and the seconds they took
+        int steps = 0;
+        double stepTime = 0;
+        /// seconds that drawing the scene and recording the frame took
+        double drawPrepTime = 0;
+        double stepsPerSecond = 0;
+        double backlog = 0;
+        size_t droppedSteps = 0;
+        /// the scene threw, it is not stepped until another one is loaded
+        std::string error;
+    };
+
+    /// @brief Start the thread, it creates the scene with create
+    SimulationThread(SceneCreator create, const Settings &settings);
+    /// @brief Stop the thread, the scene is destroyed with it
+    ~SimulationThread();
+    SimulationThread(const SimulationThread &) = delete;
+    SimulationThread &operator=(const SimulationThread &) = delete;
+
+    /// @brief Run command on the simulation thread before its next batch of steps
+    ///
+    /// Commands run in the order they were posted. When the queue is full they wait on the calling thread and are
+    /// sent by the following post or update.
+    void post(std::function<void()> command);
+
+    /// @brief Change the settings, they take effect before the next batch
+    void setSettings(const Settings &settings);
+    /// @brief Replace the scene with a new one, its retained objects are destroyed first
+    void loadScene(SceneCreator create);
+
+    /// @brief Switch snapshot() to the newest published snapshot and send the commands that waited for the queue
+    /// @return
+    ///     False if nothing new was published since the last update
+    bool update();
+    /// @brief The snapshot picked up by the last update, it stays valid until the next one
+    const Snapshot &snapshot() const { return snapshots.front(); }
+
+    /// @brief Lock the scene for use on the calling thread, e.g. its GUI. The simulation thread waits until it is released.
+    ///
+    /// The lock is taken for every batch of steps, so it should only be held while the simulation is paused, or the
+    /// caller waits for the batch to end.
+    std::unique_lock<std::mutex> lockScene() { return std::unique_lock<std::mutex>(sceneMutex); }
+    /// @brief The scene, only to be used while lockScene is held
+    Scene *scene() { return currentScene.get(); }
+
+private:
+    void run();
+    /// @brief Draw the scene and publish it with the statistics of the batch
+    void publish(int steps, double stepTime);
+
+    // simulation thread only
+    Settings settings;
+    std::unique_ptr<Scene> currentScene;
+    Renderer renderer{Renderer::Headless()};
+    StepScheduler scheduler;
+    uint64_t step = 0;
+    std::string error;
+
+    // calling thread only
+    std::vector<std::function<void()>> waiting;
+
+    std::mutex sceneMutex;
+    SpscQueue<std::function<void()>> commands;
+    TripleBuffer<Snapshot> snapshots;
+    std::atomic<bool> stopping{false};
+    // lets the idle thread wake up for a command before its next step is due
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::thread thread;
+};
@@ -1,6 +1,9 @@
 #include "Simulator.h"
 #include <imgui.h>
 #include "Scenes/SceneIndex.h"
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
 
 void Simulator::init()
 {
@@ -19,20 +22,65 @@ void Simulator::init()
         currentScene = scenesCreators[currentSceneName]();
         currentScene->init();
     }
+    checkpoints.clear(currentSceneName);
+    lastScheduleTime = std::chrono::steady_clock::now();
+}
+
+void Simulator::reloadScene()
+{
+    if (simulationThread != nullptr)
+    {
+        simulationThread->loadScene(scenesCreators[currentSceneName]);
+        return;
+    }
+    renderer.clearRetained();
+    currentScene = scenesCreators[currentSceneName]();
+    currentScene->init();
+    sceneStep = 0;
+    checkpoints.clear(currentSceneName);
+    // the time spent loading is no backlog of the new scene
+    scheduler.reset();
+    lastScheduleTime = std::chrono::steady_clock::now();
 }
 
 void Simulator::simulateStep()
 {
+    PROFILE_ZONE("Simulator::simulateStep");
     auto startTime = std::chrono::high_resolution_clock::now();
-    if (currentScene != nullptr)
-        currentScene->simulateStep();
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - lastScheduleTime).count();
+    lastScheduleTime = now;
+    lastSteps = 0;
+    if (currentScene != nullptr && replay == nullptr && !paused)
+    {
+        scheduler.settings.stepTime = timestep / timeScale;
+        lastSteps = scheduler.advance(elapsed);
+        currentScene->timestep = timestep;
+        currentScene->substeps = substeps;
+        for (int i = 0; i < lastSteps; ++i)
+        {
+            // errors of the scene are not checkpoint errors, they go on to the caller
+            currentScene->simulateStep();
+            try
+            {
+                checkpoints.afterStep(*currentScene, ++sceneStep);
+            }
+            catch (const std::runtime_error &e)
+            {
+                // the steps go on without checkpoints
+                checkpointMessage = e.what();
+                checkpoints.settings.enabled = false;
+            }
+        }
+    }
     lastStepTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
 }
 
 void Simulator::onGUI()
 {
+    PROFILE_ZONE("Simulator::onGUI");
     using namespace ImGui;
-    if (currentScene == nullptr)
+    if (currentScene == nullptr && simulationThread == nullptr)
     {
         Begin("Game Physics", nullptr, ImGuiWindowFlags_NoTitleBar);
         Text("No scenes available!");
@@ -45,7 +93,36 @@ void Simulator::onGUI()
     Begin("Game Physics", nullptr, ImGuiWindowFlags_NoTitleBar);
     Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / GetIO().Framerate, GetIO().Framerate);
     Text("Step: %.3f ms, DrawPrep: %.3f, Draw: %.3f ms", lastStepTime * 1000, lastDrawPrepTime * 1000, renderer.lastDrawTime * 1000);
+    if (simulationThread != nullptr)
+    {
+        const SimulationThread::Snapshot &snapshot = simulationThread->snapshot();
+        Text("%.1f steps/s, %d steps in the last batch, backlog %.2f steps, %ld dropped, step %llu on the simulation thread", snapshot.stepsPerSecond,
+             snapshot.steps, snapshot.backlog, snapshot.droppedSteps, static_cast<unsigned long long>(snapshot.step));
+    }
+    else
+    {
+        Text("%.1f steps/s, %d steps this frame, backlog %.2f steps, %ld dropped", scheduler.stepsPerSecond(), lastSteps, scheduler.backlog(),
+             scheduler.droppedSteps());
+    }
     Text("%ld objects, %ld lines, %ld images", renderer.objectCount(), renderer.lineCount(), renderer.imageCount());
+    Text("%ld retained objects, %ld retained lines", renderer.retainedObjectCount(), renderer.retainedLineCount());
+    Text("%ld visible, %ld culled objects, %.2f M triangles", renderer.visibleObjectCount(), renderer.culledObjectCount(),
+         renderer.triangleCount() / 1e6);
+    reallocationWindow += GetIO().DeltaTime;
+    if (reallocationWindow >= 1.0f)
+    {
+        size_t reallocations = renderer.bufferReallocations();
+        reallocationsPerSecond = (reallocations - lastReallocationCount) / reallocationWindow;
+        lastReallocationCount = reallocations;
+        reallocationWindow = 0;
+    }
+    // onGUI runs once per frame after the pipelines uploaded their data
+    size_t uploaded = renderer.uploadedBytes();
+    size_t uploadedImages = renderer.uploadedImageBytes();
+    Text("Buffer reallocations: %.1f/s, uploaded %.1f KB/frame (images %.1f KB)", reallocationsPerSecond, (uploaded - lastUploadedBytes) / 1024.0,
+         (uploadedImages - lastUploadedImageBytes) / 1024.0);
+    lastUploadedBytes = uploaded;
+    lastUploadedImageBytes = uploadedImages;
     Separator();
     Text("Scene");
     if (BeginCombo("Scene", currentSceneName.c_str()))
@@ -56,8 +133,7 @@ void Simulator::onGUI()
             if (Selectable(sceneName.c_str(), isSelected))
             {
                 currentSceneName = sceneName;
-                currentScene = scenesCreators[currentSceneName]();
-                currentScene->init();
+                reloadScene();
             }
             if (isSelected)
                 SetItemDefaultFocus();
@@ -65,14 +141,31 @@ void Simulator::onGUI()
         EndCombo();
     }
     if (Button("Reload Scene"))
-    {
-        currentScene = scenesCreators[currentSceneName]();
-        currentScene->init();
-    }
+        reloadScene();
+    if (CollapsingHeader("Simulation"))
+        schedulerGUI();
+    if (CollapsingHeader("Checkpoints"))
+        checkpointGUI();
     Separator();
     if (CollapsingHeader(currentSceneName.c_str(), ImGuiTreeNodeFlags_DefaultOpen))
     {
-        currentScene->onGUI();
+        if (simulationThread == nullptr)
+        {
+            currentScene->onGUI();
+        }
+        else if (paused)
+        {
+            // the paused thread only takes the scene to draw it, so this waits at most for the batch it was in
+            std::unique_lock<std::mutex> lock = simulationThread->lockScene();
+            if (simulationThread->scene() != nullptr)
+                simulationThread->scene()->onGUI();
+        }
+        else
+        {
+            TextWrapped("The scene steps on the simulation thread, pause it in the Simulation section to change its settings.");
+        }
+        if (simulationThread != nullptr && !simulationThread->snapshot().error.empty())
+            TextWrapped("%s", simulationThread->snapshot().error.c_str());
     }
     Separator();
     if (CollapsingHeader("Rendering"))
@@ -84,6 +177,19 @@ void Simulator::onGUI()
             else
                 renderer.setPresentMode(wgpu::PresentMode::Immediate);
         }
+        Checkbox("Parallel depth sorting", &renderer.parallelDepthSorting);
+        Checkbox("Frustum culling", &renderer.frustumCulling);
+        Checkbox("Parallel culling", &renderer.parallelCulling);
+        Checkbox("Sphere level of detail", &renderer.sphereLevelOfDetail);
+        if (renderer.sphereLevelOfDetail)
+            SliderFloat("Sphere edge pixels", &renderer.sphereEdgePixels, 1.0f, 64.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+        Checkbox("Compact instances (32 bytes)", &renderer.compactInstances);
+        const ImU64 minChunkSize = 1 << 10, maxChunkSize = 1 << 24;
+        ImU64 chunkSize = renderer.instanceChunkSize;
+        if (SliderScalar("Instances per draw call", ImGuiDataType_U64, &chunkSize, &minChunkSize, &maxChunkSize, "%llu", ImGuiSliderFlags_Logarithmic))
+            renderer.instanceChunkSize = static_cast<size_t>(chunkSize);
+        Checkbox("Image atlas", &renderer.imageAtlas);
+        Checkbox("Half precision images", &renderer.halfPrecisionImages);
 
         ColorEdit3("Background Color", glm::value_ptr(renderer.backgroundColor));
         Separator();
@@ -98,15 +204,362 @@ void Simulator::onGUI()
         DragFloat("Specular Alpha", &renderer.lightingUniforms.alpha, 0.1f, 0.0, 100.0);
         Separator();
         DragFloat("Diffuse Intensity", &renderer.lightingUniforms.diffuse_intensity, 0.01f, 0.0, 1.0);
+        Separator();
+        profilerGUI();
+    }
+    if (CollapsingHeader("Capture"))
+    {
+        InputText("File", capturePath, sizeof(capturePath));
+        try
+        {
+            if (renderer.isCapturing())
+            {
+                if (Button("Stop capture"))
+                    renderer.stopCapture();
+                Text("%ld frames, %.1f MB", renderer.capturedFrames(), renderer.capturedBytes() / 1e6);
+            }
+            else if (replay == nullptr)
+            {
+                if (Button("Start capture"))
+                {
+                    captureMessage.clear();
+                    renderer.startCapture(capturePath);
+                }
+                // the simulation thread draws the scene on its own, replays go through the main thread
+                if (simulationThread == nullptr)
+                    SameLine();
+                if (simulationThread == nullptr && Button("Replay"))
+                {
+                    captureMessage.clear();
+                    replay = std::make_unique<FrameCaptureReader>(capturePath);
+                    replayFrame = 0;
+                    if (replay->frameCount() == 0)
+                    {
+                        captureMessage = std::string(capturePath) + " has no frames";
+                        replay = nullptr;
+                    }
+                    else
+                    {
+                        // the capture holds the retained objects of its own scene
+                        renderer.clearRetained();
+                    }
+                }
+            }
+            if (replay != nullptr)
+            {
+                Text("Replaying %ld frames, the scene is paused", replay->frameCount());
+                SliderInt("Frame", &replayFrame, 0, static_cast<int>(replay->frameCount()) - 1);
+                Checkbox("Play", &replayPlaying);
+                SameLine();
+                if (Button("Stop replay"))
+                {
+                    replay = nullptr;
+                    reloadScene();
+                }
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            captureMessage = e.what();
+        }
+        if (!captureMessage.empty())
+            TextWrapped("%s", captureMessage.c_str());
     }
 
     End();
 }
 
+SimulationThread::Settings Simulator::simulationSettings() const
+{
+    SimulationThread::Settings settings;
+    settings.timestep = timestep;
+    settings.timeScale = timeScale;
+    settings.substeps = substeps;
+    settings.scheduler = scheduler.settings;
+    settings.paused = paused;
+    return settings;
+}
+
+void Simulator::schedulerGUI()
+{
+    using namespace ImGui;
+    bool changed = Checkbox("Pause##simulation", &paused);
+    changed |= SliderFloat("Timestep", &timestep, 0.001f, 0.1f, "%.4f s", ImGuiSliderFlags_Logarithmic);
+    changed |= SliderFloat("Time scale", &timeScale, 0.05f, 10.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+    changed |= SliderInt("Substeps", &substeps, 1, 32);
+    changed |= SliderInt("Max steps per frame", &scheduler.settings.maxStepsPerFrame, 1, 64);
+    changed |= Checkbox("Max throughput", &scheduler.settings.maxThroughput);
+    if (scheduler.settings.maxThroughput)
+        changed |= SliderInt("Steps per frame", &scheduler.settings.renderInterval, 1, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+    else
+        Text("Real time needs %.0f steps/s, %.3f ms per step", timeScale / timestep, timestep / timeScale * 1000);
+    if (changed && simulationThread != nullptr)
+        simulationThread->setSettings(simulationSettings());
+
+    // the scene is created again on the thread that steps it, its retained objects belong to that thread's renderer
+    bool threaded = simulationThread != nullptr;
+    BeginDisabled(replay != nullptr);
+    if (Checkbox("Simulation thread", &threaded))
+    {
+        if (threaded)
+        {
+            currentScene = nullptr;
+            renderer.clearRetained();
+            simulationThread = std::make_unique<SimulationThread>(scenesCreators[currentSceneName], simulationSettings());
+        }
+        else
+        {
+            simulationThread = nullptr;
+            reloadScene();
+        }
+    }
+    EndDisabled();
+    if (IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled))
+        SetTooltip("Step the scene on its own thread and draw its latest state, the frame rate no longer depends on the step time.\n"
+                   "The scene starts over when this is switched.");
+}
+
+void Simulator::checkpointGUI()
+{
+    using namespace ImGui;
+    if (simulationThread != nullptr || replay != nullptr)
+    {
+        TextWrapped("Checkpoints are taken while the scene steps on the main thread and no capture is replayed.");
+        return;
+    }
+    if (!currentScene->canSaveState())
+    {
+        TextWrapped("%s cannot save its state, see Scene::saveState.", currentSceneName.c_str());
+        return;
+    }
+    CheckpointManager::Settings &settings = checkpoints.settings;
+    Checkbox("Take checkpoints", &settings.enabled);
+    SliderInt("Interval", &settings.interval, 1, 10000, "%d steps", ImGuiSliderFlags_Logarithmic);
+    SliderInt("Kept in memory", &settings.capacity, 1, 256, "%d", ImGuiSliderFlags_Logarithmic);
+    Checkbox("Write to disk", &settings.writeToDisk);
+    if (settings.writeToDisk)
+    {
+        InputText("Directory", checkpointDirectory, sizeof(checkpointDirectory));
+        settings.directory = checkpointDirectory;
+    }
+    Text("Step %llu, %ld checkpoints from step %llu to %llu, %.1f MB, last one took %.2f ms", static_cast<unsigned long long>(sceneStep),
+         checkpoints.count(), static_cast<unsigned long long>(checkpoints.oldestStep()), static_cast<unsigned long long>(checkpoints.newestStep()),
+         checkpoints.memoryBytes() / 1e6, checkpoints.lastTakeTime() * 1000);
+    try
+    {
+        if (Button("Checkpoint now"))
+        {
+            checkpointMessage.clear();
+            checkpoints.take(*currentScene, sceneStep);
+        }
+        InputInt("Steps back", &rewindSteps);
+        rewindSteps = std::max(rewindSteps, 1);
+        SameLine();
+        if (Button("Rewind"))
+        {
+            checkpointMessage.clear();
+            rewindTo(sceneStep - std::min<uint64_t>(sceneStep, rewindSteps));
+        }
+
+        if (settings.writeToDisk)
+        {
+            Text("%ld files written", checkpoints.filesWritten());
+            std::string diskError = checkpoints.diskError();
+            if (!diskError.empty())
+                TextWrapped("%s", diskError.c_str());
+            if (Button("List files"))
+                checkpointFiles = checkpoints.diskCheckpoints();
+            for (size_t i = 0; i < checkpointFiles.size(); ++i)
+            {
+                const CheckpointManager::DiskCheckpoint &file = checkpointFiles[i];
+                PushID(static_cast<int>(i));
+                BeginDisabled(file.scene != currentSceneName);
+                if (Button("Restore"))
+                {
+                    checkpointMessage.clear();
+                    sceneStep = checkpoints.restoreFile(*currentScene, file.path);
+                    scheduler.reset();
+                }
+                EndDisabled();
+                SameLine();
+                Text("%s: %s at step %llu, %.1f MB", file.path.c_str(), file.scene.c_str(), static_cast<unsigned long long>(file.step), file.size / 1e6);
+                PopID();
+            }
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        checkpointMessage = e.what();
+    }
+    if (!checkpointMessage.empty())
+        TextWrapped("%s", checkpointMessage.c_str());
+}
+
+void Simulator::rewindTo(uint64_t step)
+{
+    uint64_t restoredStep;
+    if (!checkpoints.restore(*currentScene, step, restoredStep))
+    {
+        checkpointMessage = "There is no checkpoint at or before step " + std::to_string(step);
+        return;
+    }
+    // the steps after the checkpoint are simulated again, they take their checkpoints again on the way
+    currentScene->timestep = timestep;
+    currentScene->substeps = substeps;
+    for (sceneStep = restoredStep; sceneStep < step;)
+    {
+        currentScene->simulateStep();
+        checkpoints.afterStep(*currentScene, ++sceneStep);
+    }
+    // the time spent simulating is no backlog
+    scheduler.reset();
+    lastScheduleTime = std::chrono::steady_clock::now();
+}
+
+void Simulator::profilerGUI()
+{
+    using namespace ImGui;
+    bool enabled = Profiler::isEnabled();
+    if (Checkbox("Profiler", &enabled))
+        Profiler::setEnabled(enabled);
+    SameLine();
+    Checkbox("Pause", &profilerPaused);
+    SameLine();
+    if (Button("Clear"))
+    {
+        Profiler::clear();
+        profiledZones.clear();
+    }
+
+    InputText("Trace file", tracePath, sizeof(tracePath));
+    SameLine();
+    if (Button("Export Chrome trace"))
+    {
+        try
+        {
+            Profiler::exportChromeTrace(tracePath);
+            traceMessage = std::string("Wrote ") + tracePath + ", open it in chrome://tracing or ui.perfetto.dev";
+        }
+        catch (const std::runtime_error &e)
+        {
+            traceMessage = e.what();
+        }
+    }
+    if (!traceMessage.empty())
+        TextWrapped("%s", traceMessage.c_str());
+
+    // the last frame runs from the start of the previous Renderer::onFrame to the start of this one
+    uint64_t begin, end;
+    if (enabled && !profilerPaused && Profiler::lastFrame(begin, end))
+    {
+        profiledZones = Profiler::zones(begin);
+        profiledZones.erase(std::remove_if(profiledZones.begin(), profiledZones.end(), [&](const Profiler::Zone &zone)
+                                           { return zone.begin >= end; }),
+                            profiledZones.end());
+        profiledBegin = begin;
+        profiledEnd = end;
+    }
+    if (profiledZones.empty())
+    {
+        Text(enabled ? "No zones recorded yet" : "Enable the profiler to record PROFILE_ZONE scopes");
+        return;
+    }
+
+    double frameTime = (profiledEnd - profiledBegin) / 1e6;
+    Text("Frame %.3f ms, %ld zones", frameTime, profiledZones.size());
+    std::vector<std::string> threads = Profiler::threadNames();
+    std::vector<uint32_t> rows(threads.size(), 0);
+    for (const Profiler::Zone &zone : profiledZones)
+        rows[zone.thread] = std::max(rows[zone.thread], zone.depth + 1);
+
+    // one lane per thread with a row per nesting depth, the frame spans the width of the window
+    ImDrawList *drawList = GetWindowDrawList();
+    const float rowHeight = GetTextLineHeight() + 2;
+    const float width = std::max(GetContentRegionAvail().x, 100.0f);
+    for (uint32_t thread = 0; thread < threads.size(); ++thread)
+    {
+        if (rows[thread] == 0)
+            continue;
+        TextDisabled("%s", threads[thread].c_str());
+        ImVec2 origin = GetCursorScreenPos();
+        Dummy(ImVec2(width, rows[thread] * rowHeight));
+        drawList->AddRectFilled(origin, ImVec2(origin.x + width, origin.y + rows[thread] * rowHeight), GetColorU32(ImGuiCol_FrameBg));
+        for (const Profiler::Zone &zone : profiledZones)
+        {
+            if (zone.thread != thread)
+                continue;
+            float x0 = origin.x + width * float(std::max(zone.begin, profiledBegin) - profiledBegin) / float(profiledEnd - profiledBegin);
+            float x1 = origin.x + width * float(std::min(zone.end, profiledEnd) - profiledBegin) / float(profiledEnd - profiledBegin);
+            x1 = std::max(x1, x0 + 1);
+            float y0 = origin.y + zone.depth * rowHeight;
+            ImVec2 min(x0, y0), max(x1, y0 + rowHeight - 1);
+            float hue = (std::hash<std::string_view>{}(zone.name) % 360) / 360.0f;
+            drawList->AddRectFilled(min, max, ImColor::HSV(hue, 0.5f, 0.75f));
+            ImVec4 clip(x0 + 2, y0, x1 - 2, y0 + rowHeight);
+            if (x1 - x0 > 8)
+                drawList->AddText(GetFont(), GetFontSize(), ImVec2(x0 + 2, y0 + 1), IM_COL32(0, 0, 0, 255), zone.name, nullptr, 0, &clip);
+            if (IsMouseHoveringRect(min, max))
+                SetTooltip("%s\n%.3f ms", zone.name, (zone.end - zone.begin) / 1e6);
+        }
+    }
+
+    // inclusive time of every zone name in the frame, nested zones count towards their parents too
+    struct Total
+    {
+        const char *name;
+        uint64_t time;
+        size_t count;
+    };
+    std::unordered_map<std::string_view, Total> byName;
+    for (const Profiler::Zone &zone : profiledZones)
+    {
+        Total &total = byName.try_emplace(zone.name, Total{zone.name, 0, 0}).first->second;
+        total.time += std::min(zone.end, profiledEnd) - std::max(zone.begin, profiledBegin);
+        total.count++;
+    }
+    std::vector<Total> totals;
+    for (auto &entry : byName)
+        totals.push_back(entry.second);
+    std::sort(totals.begin(), totals.end(), [](const Total &a, const Total &b)
+              { return a.time > b.time; });
+    if (TreeNode("Zone totals"))
+    {
+        for (const Total &total : totals)
+            Text("%8.3f ms %5ld x  %s", total.time / 1e6, total.count, total.name);
+        TreePop();
+    }
+}
+
 void Simulator::onDraw()
 {
+    PROFILE_ZONE("Simulator::onDraw");
     auto startTime = std::chrono::high_resolution_clock::now();
-    if (currentScene != nullptr)
-        currentScene->onDraw(renderer);
+    if (replay != nullptr)
+    {
+        try
+        {
+            // one captured frame per drawn frame, as fast as the renderer goes
+            renderer.drawCapturedFrame(*replay, replayFrame);
+            if (replayPlaying)
+                replayFrame = (replayFrame + 1) % static_cast<int>(replay->frameCount());
+        }
+        catch (const std::runtime_error &e)
+        {
+            captureMessage = e.what();
+            replay = nullptr;
+            reloadScene();
+        }
+    }
+    else if (simulationThread != nullptr)
+    {
+        simulationThread->update();
+        const SimulationThread::Snapshot &snapshot = simulationThread->snapshot();
+        renderer.drawFrame(snapshot.frame);
+        lastStepTime = snapshot.stepTime;
+    }
+    else if (currentScene != nullptr)
+    {
+        currentScene->onDrawInterpolated(renderer, scheduler.alpha());
+    }
     lastDrawPrepTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
 };
\ No newline at end of file
@@ -1,7 +1,13 @@
 #pragma once
+#include "CheckpointManager.h"
 #include "Renderer.h"
 #include "glm/glm.hpp"
 #include "Scenes/Scene.h"
+#include "SimulationThread.h"
+#include <util/FrameCapture.h>
+#include <util/Profiler.h>
+#include <util/StepScheduler.h>
+#include <chrono>
 
 /// @brief Backend for running and selecting different scenes.
 class Simulator
@@ -13,9 +19,9 @@ public:
         { onGUI(); };
     };
 
-    /// @brief Call simulateStep for the currently active Scene
+    /// @brief Call simulateStep for the currently active Scene as often as the fixed timestep requires before the next frame
     void simulateStep();
-    /// @brief Call onDraw for the currently active Scene
+    /// @brief Call onDrawInterpolated for the currently active Scene
     void onDraw();
     /// @brief Call onGUI for the currently active Scene, add scene selection and rendering options
     void onGUI();
@@ -23,6 +29,19 @@ public:
     void init();
 
 private:
+    /// @brief Create the current scene again, its retained objects are destroyed first
+    void reloadScene();
+    /// @brief Timestep, substeps and catch-up settings of the scheduler, and the simulation thread
+    void schedulerGUI();
+    /// @brief The scheduler settings for the simulation thread
+    SimulationThread::Settings simulationSettings() const;
+    /// @brief Profiler controls and the timeline of the last frame, part of the Rendering section
+    void profilerGUI();
+    /// @brief Checkpoint settings, rewinding and the checkpoint files
+    void checkpointGUI();
+    /// @brief Restore the newest checkpoint at or before step and simulate from there up to step
+    void rewindTo(uint64_t step);
+
     using vec3 = glm::vec3;
     using vec2 = glm::vec2;
 
@@ -31,7 +50,49 @@ private:
     std::string currentSceneName;
     std::vector<std::string> sceneNames;
 
+    // fixed-timestep scheduling of the scene steps, see StepScheduler
+    StepScheduler scheduler;
+    float timestep = 0.01f;
+    float timeScale = 1.0f;
+    int substeps = 1;
+    bool paused = false;
+    std::chrono::steady_clock::time_point lastScheduleTime;
+    int lastSteps = 0;
+    // steps of the current scene since init, the checkpoints are numbered by it
+    uint64_t sceneStep = 0;
+
+    // snapshots of the scene state for rewinding, only while it steps on this thread
+    CheckpointManager checkpoints;
+    int rewindSteps = 100;
+    char checkpointDirectory[256] = "checkpoints";
+    std::vector<CheckpointManager::DiskCheckpoint> checkpointFiles;
+    std::string checkpointMessage;
+
+    // while it exists the scene lives on the simulation thread and currentScene is empty
+    std::unique_ptr<SimulationThread> simulationThread;
+
     double lastStepTime = 0;
     double lastDrawPrepTime = 0;
+    // buffer reallocations per second, measured over windows of about a second
+    size_t lastReallocationCount = 0;
+    float reallocationWindow = 0;
+    double reallocationsPerSecond = 0;
+    size_t lastUploadedBytes = 0;
+    size_t lastUploadedImageBytes = 0;
     bool limitFPS = true;
+
+    // capture of the drawn frames and replay instead of the scene, see Renderer::startCapture
+    char capturePath[256] = "capture.frames";
+    std::unique_ptr<FrameCaptureReader> replay;
+    int replayFrame = 0;
+    bool replayPlaying = true;
+    std::string captureMessage;
+
+    // zones of the frame shown in the profiler timeline, kept while it is paused
+    bool profilerPaused = false;
+    std::vector<Profiler::Zone> profiledZones;
+    uint64_t profiledBegin = 0;
+    uint64_t profiledEnd = 0;
+    char tracePath[256] = "trace.json";
+    std::string traceMessage;
 };
\ No newline at end of file
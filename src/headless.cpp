@@ -0,0 +1,620 @@
+#include "BatchRunner.h"
+#include "Renderer.h"
+#include "Scenes/SceneIndex.h"
+#include <util/Profiler.h>
+#include <util/RenderBenchmark.h>
+#include <util/SolverBenchmark.h>
+#include <util/ThreadPool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Runs scenes without window and GPU and prints how long their steps take.
+// Usage: Headless [--scene NAME]... [--all] [--steps N] [--seconds T] [--warmup N] [--no-draw] [--capture FILE] [--trace FILE] [--list]
+//        Headless --sweep FILE [--csv FILE] [--jobs N] [--steps N] [--trace FILE]
+//        Headless --benchmark NAME[=ARG]... (--benchmark list shows the micro benchmarks of src/util)
+//        Headless --selftest (the checks of the micro benchmarks with small sizes, run by ctest)
+
+namespace
+{
+	struct Options
+	{
+		std::vector<std::string> scenes;
+		size_t steps = 0;
+		double seconds = 0;
+		size_t warmup = 0;
+		bool draw = true;
+		std::string capture;
+		std::string trace;
+		std::string sweep;
+		std::string csv = "sweep.csv";
+		unsigned jobs = 0;
+		std::vector<std::string> benchmarks;
+		bool selftest = false;
+	};
+
+	void printUsage()
+	{
+		std::cout << "Usage: Headless [options]\n"
+				  << "  --scene NAME   run this scene, can be given several times (default: the first scene)\n"
+				  << "  --all          run every scene of SceneIndex.h\n"
+				  << "  --steps N      run N steps per scene (default: 1000 without --seconds)\n"
+				  << "  --seconds T    run steps until T seconds of wall-clock time have passed, with --steps whatever ends first\n"
+				  << "  --warmup N     run N steps before measuring\n"
+				  << "  --no-draw      skip onDraw, only simulateStep is called\n"
+				  << "  --capture FILE record the drawn frames of all scenes for a replay in the Template application,\n"
+				  << "                 the recording is part of the draw prep times\n"
+				  << "  --trace FILE   profile the measured steps and write the zones as Chrome trace JSON,\n"
+				  << "                 only the last " << Profiler::ringCapacity << " zones of each thread are kept\n"
+				  << "  --list         print the names of the scenes and exit\n"
+				  << "  --sweep FILE   run every parameter combination of a sweep config in parallel without drawing,\n"
+				  << "                 see src/BatchRunner.h for the format, --steps is the default of its sweeps\n"
+				  << "  --csv FILE     where --sweep writes one line per run (default: sweep.csv)\n"
+				  << "  --jobs N       threads that --sweep runs scenes on (default: one per hardware thread)\n"
+				  << "  --benchmark NAME[=ARG]\n"
+				  << "                 run a micro benchmark of src/util instead of scenes, can be given several times,\n"
+				  << "                 --benchmark list prints their names and arguments\n"
+				  << "  --selftest     run the checks of the micro benchmarks with small sizes, exits with 1 if one fails\n";
+	}
+
+	struct Statistics
+	{
+		double mean = 0;
+		double median = 0;
+		double p95 = 0;
+		double min = 0;
+		double max = 0;
+		double deviation = 0;
+	};
+
+	Statistics statistics(std::vector<double> times)
+	{
+		Statistics result;
+		if (times.empty())
+			return result;
+		std::sort(times.begin(), times.end());
+		double sum = 0;
+		for (double time : times)
+			sum += time;
+		result.mean = sum / times.size();
+		double squares = 0;
+		for (double time : times)
+			squares += (time - result.mean) * (time - result.mean);
+		result.deviation = std::sqrt(squares / times.size());
+		result.median = times[times.size() / 2];
+		result.p95 = times[std::min(times.size() - 1, static_cast<size_t>(std::ceil(0.95 * times.size())) - 1)];
+		result.min = times.front();
+		result.max = times.back();
+		return result;
+	}
+
+	void printStatistics(const char *name, const std::vector<double> &times)
+	{
+		Statistics s = statistics(times);
+		std::cout << "  " << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(3)
+				  << "mean " << s.mean * 1000 << " ms, median " << s.median * 1000 << " ms, p95 " << s.p95 * 1000 << " ms, min " << s.min * 1000
+				  << " ms, max " << s.max * 1000 << " ms, stddev " << s.deviation * 1000 << " ms" << std::endl;
+	}
+
+	void runScene(const std::string &name, const Options &options, Renderer &renderer)
+	{
+		using clock = std::chrono::high_resolution_clock;
+		renderer.clearRetained();
+		std::unique_ptr<Scene> scene = scenesCreators[name]();
+		scene->init();
+
+		auto step = [&](std::vector<double> *stepTimes, std::vector<double> *drawTimes)
+		{
+			auto start = clock::now();
+			scene->simulateStep();
+			auto stepped = clock::now();
+			if (stepTimes)
+				stepTimes->push_back(std::chrono::duration<double>(stepped - start).count());
+			if (!options.draw)
+				return;
+			scene->onDraw(renderer);
+			renderer.onFrame();
+			if (drawTimes)
+				drawTimes->push_back(std::chrono::duration<double>(clock::now() - stepped).count());
+		};
+
+		for (size_t i = 0; i < options.warmup; ++i)
+		{
+			step(nullptr, nullptr);
+			renderer.clearScene();
+		}
+
+		size_t steps = options.steps;
+		if (steps == 0 && options.seconds <= 0)
+			steps = 1000;
+		std::vector<double> stepTimes;
+		std::vector<double> drawTimes;
+		Profiler::setEnabled(!options.trace.empty());
+		auto start = clock::now();
+		double elapsed = 0;
+		while ((steps == 0 || stepTimes.size() < steps) && (options.seconds <= 0 || elapsed < options.seconds))
+		{
+			// the last frame stays in the renderer for the counts below
+			renderer.clearScene();
+			step(&stepTimes, &drawTimes);
+			elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		}
+		Profiler::setEnabled(false);
+
+		std::cout << name << ": " << stepTimes.size() << " steps in " << std::fixed << std::setprecision(3) << elapsed << " s ("
+				  << std::setprecision(1) << stepTimes.size() / elapsed << " steps/s)" << std::endl;
+		printStatistics("step", stepTimes);
+		if (options.draw)
+		{
+			printStatistics("draw prep", drawTimes);
+			std::cout << "  last frame: " << renderer.objectCount() << " objects, " << renderer.lineCount() << " lines, " << renderer.imageCount()
+					  << " images" << std::endl;
+		}
+		renderer.clearScene();
+	}
+
+	/// @brief A micro benchmark of src/util that --benchmark runs
+	struct Benchmark
+	{
+		const char *name;
+		/// what may follow the name after a =, empty if it takes nothing
+		const char *argument;
+		const char *description;
+		/// false if one of the checks of the benchmark failed
+		std::function<bool(const std::string &argument)> run;
+		/// the argument --selftest runs it with, nullptr if it has no checks
+		const char *selftest = nullptr;
+	};
+
+	/// @brief The case numbers of a benchmark with cases 1 to count, all of them if argument is empty
+	std::vector<int> benchmarkCases(const std::string &argument, int count)
+	{
+		std::vector<int> cases;
+		if (argument.empty())
+		{
+			for (int caseid = 1; caseid <= count; ++caseid)
+				cases.push_back(caseid);
+			return cases;
+		}
+		char *end = nullptr;
+		long caseid = std::strtol(argument.c_str(), &end, 10);
+		if (*end != '\0' || caseid < 1 || caseid > count)
+			throw std::runtime_error("Expected a case from 1 to " + std::to_string(count) + ", not \"" + argument + "\"");
+		cases.push_back(static_cast<int>(caseid));
+		return cases;
+	}
+
+	/// @brief A positive count like a number of instances, fallback if argument is empty
+	size_t benchmarkCount(const std::string &argument, size_t fallback)
+	{
+		if (argument.empty())
+			return fallback;
+		char *end = nullptr;
+		unsigned long long count = std::strtoull(argument.c_str(), &end, 10);
+		if (*end != '\0' || count == 0 || argument[0] == '-')
+			throw std::runtime_error("Expected a positive count, not \"" + argument + "\"");
+		return static_cast<size_t>(count);
+	}
+
+	/// @brief Counts separated by commas, fallback if argument is empty
+	std::vector<size_t> benchmarkCounts(const std::string &argument, const std::vector<size_t> &fallback)
+	{
+		if (argument.empty())
+			return fallback;
+		std::vector<size_t> counts;
+		size_t begin = 0;
+		while (begin <= argument.size())
+		{
+			size_t end = std::min(argument.find(',', begin), argument.size());
+			std::string item = argument.substr(begin, end - begin);
+			if (item.empty())
+				throw std::runtime_error("Expected counts separated by commas, not \"" + argument + "\"");
+			counts.push_back(benchmarkCount(item, 0));
+			begin = end + 1;
+		}
+		return counts;
+	}
+
+	/// @brief Record spheres and lines with a serial loop of Renderer calls, with drawParallel and with lists of drawList
+	///
+	/// Checks that the three give the same objects, ids and lines in the same order.
+	bool benchmarkDrawLists(size_t count)
+	{
+		std::mt19937 rng(5);
+		std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<glm::vec3> positions(count);
+		std::vector<glm::vec4> colors(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			positions[i] = glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+			colors[i] = glm::vec4(unit(rng), unit(rng), unit(rng), 1.0f);
+		}
+		// every 16th element also draws a line, so the lines and ids of the lists are interleaved
+		auto record = [&](auto &target, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				target.drawSphere(positions[i], 0.1f, colors[i]);
+				if (i % 16 == 0)
+					target.drawLine(positions[i], glm::vec3(0), glm::vec3(colors[i]));
+			}
+		};
+
+		Renderer renderer{Renderer::Headless()};
+		unsigned threads = ThreadPool::global().size();
+		std::cout << "draw lists of " << count << " spheres, " << threads << " threads" << std::endl;
+		frameCapture::Frame reference, frame;
+		const int repetitions = 10;
+		double serialTime = 0;
+		bool haveReference = false;
+		bool passed = true;
+		auto measure = [&](const char *name, const std::function<void()> &draw)
+		{
+			double time = 0;
+			for (int r = 0; r < repetitions; ++r)
+			{
+				renderer.clearScene();
+				auto start = std::chrono::high_resolution_clock::now();
+				draw();
+				time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / repetitions;
+			}
+			bool compared = haveReference;
+			renderer.recordFrame(compared ? frame : reference);
+			if (!compared)
+			{
+				serialTime = time;
+				haveReference = true;
+			}
+			bool same = !compared || std::equal(std::begin(frame.streams), std::end(frame.streams), std::begin(reference.streams));
+			passed = passed && same;
+			std::cout << "  " << name << ": " << time * 1000 << " ms (" << serialTime / time << "x), " << renderer.objectCount() << " objects, "
+					  << (!compared ? "the reference" : same ? "same as serial" : "DIFFERS from serial") << std::endl;
+		};
+
+		measure("serial drawSphere", [&]
+				{ record(renderer, 0, count); });
+		std::vector<unsigned> threadCounts = {1};
+		if (threads > 1)
+			threadCounts.push_back(threads);
+		for (unsigned threadCount : threadCounts)
+		{
+			std::string name = "drawParallel, " + std::to_string(threadCount) + (threadCount == 1 ? " thread" : " threads");
+			measure(name.c_str(), [&]
+					{ renderer.drawParallel(count, [&](DrawList &list, size_t begin, size_t end)
+											{ record(list, begin, end); },
+											threadCount); });
+		}
+		// four lists filled one after the other, they are merged by onFrame like the lists of four threads
+		measure("4 drawList, merged by onFrame", [&]
+				{
+					for (unsigned list = 0; list < 4; ++list)
+						record(renderer.drawList(list), count * list / 4, count * (list + 1) / 4);
+					renderer.onFrame(); });
+		renderer.clearScene();
+		return passed;
+	}
+
+	const std::vector<Benchmark> &benchmarks()
+	{
+		static const std::vector<Benchmark> list = {
+			{"spmv", "CASE", "CSR against SELL-C-sigma matrix-vector products, cases 1 to 4, small for all of them at a test size (default: all)",
+			 [](const std::string &argument)
+			 {
+				 bool small = argument == "small";
+				 bool passed = true;
+				 for (int caseid : benchmarkCases(small ? "" : argument, 4))
+					 passed = solverBenchmark::benchmarkSpMV(caseid, small) && passed;
+				 return passed;
+			 },
+			 "small"},
+			{"captured-solve", "FILE", "solve a system written by SparsePCGSolver::capture_next_solve again, FILE is required",
+			 [](const std::string &argument)
+			 {
+				 if (argument.empty())
+					 throw std::runtime_error("Expected the file of a captured solve, captured-solve=FILE");
+				 solverBenchmark::benchmarkCapturedSolve(argument);
+				 return true;
+			 }},
+			{"capture-round-trip", "FILE", "write a small system in the pcg_binary format to FILE, map it back and compare (default: benchmark.pcgbin)",
+			 [](const std::string &argument)
+			 { return solverBenchmark::checkCaptureRoundTrip(argument.empty() ? "benchmark.pcgbin" : argument); },
+			 "benchmark.pcgbin"},
+			{"contact-solver", "CASE", "contact solver in insertion order against the graph colored variants, case 1 stacks, case 2 a pile, small for both at a test size (default: both)",
+			 [](const std::string &argument)
+			 {
+				 bool small = argument == "small";
+				 bool passed = true;
+				 for (int caseid : benchmarkCases(small ? "" : argument, 2))
+					 passed = solverBenchmark::benchmarkContactSolver(caseid, small) && passed;
+				 return passed;
+			 },
+			 "small"},
+			{"resting-contacts", "", "drop boxes from inside the contact margin and check that they come to rest on their support",
+			 [](const std::string &argument)
+			 {
+				 if (!argument.empty())
+					 throw std::runtime_error("resting-contacts takes no argument");
+				 return solverBenchmark::checkRestingContacts();
+			 },
+			 ""},
+			{"sleeping-pile", "LAYERS", "settle a pile of boxes in a RigidBodyWorld and step it with and without sleeping (default: 8 layers)",
+			 [](const std::string &argument)
+			 {
+				 solverBenchmark::benchmarkSleepingPile(static_cast<int>(benchmarkCount(argument, 8)));
+				 return true;
+			 }},
+			{"depth-sort", "COUNT", "order instances back to front with std::stable_sort and the DepthSorter radix sort (default: 200000)",
+			 [](const std::string &argument)
+			 { return renderBenchmark::benchmarkDepthSort(benchmarkCount(argument, 200000)); },
+			 "5000"},
+			{"frustum-culling", "COUNT", "cull boxes against a camera, scalar, with SIMD and with all threads (default: 1000000)",
+			 [](const std::string &argument)
+			 { return renderBenchmark::benchmarkFrustumCulling(benchmarkCount(argument, 1000000)); },
+			 "20000"},
+			{"instance-packing", "COUNT", "pack instances into CompactInstance with and without SIMD and check the precision (default: 1000000)",
+			 [](const std::string &argument)
+			 { return renderBenchmark::benchmarkInstancePacking(benchmarkCount(argument, 1000000)); },
+			 "20000"},
+			{"instance-throughput", "COUNTS", "cull, gather, pack and split millions of spheres into upload chunks (default: 1000000,5000000,10000000)",
+			 [](const std::string &argument)
+			 {
+				 renderBenchmark::benchmarkInstanceThroughput(benchmarkCounts(argument, {1000000, 5000000, 10000000}));
+				 return true;
+			 }},
+			{"draw-lists", "COUNT", "record spheres with drawSphere, with drawParallel and into drawList and check that they agree (default: 1000000)",
+			 [](const std::string &argument)
+			 { return benchmarkDrawLists(benchmarkCount(argument, 1000000)); },
+			 "20000"},
+			{"image-upload", "WIDTHxHEIGHT", "stage a float image for drawImage by copy, span and half precision and check the staged data (default: 4096x4096)",
+			 [](const std::string &argument)
+			 {
+				 // a single number is a square image
+				 size_t separator = argument.find('x');
+				 size_t width = benchmarkCount(argument.substr(0, separator), 4096);
+				 size_t height = separator == std::string::npos ? width : benchmarkCount(argument.substr(separator + 1), 0);
+				 if (separator == 0 || height == 0)
+					 throw std::runtime_error("Expected WIDTHxHEIGHT, not \"" + argument + "\"");
+				 return renderBenchmark::benchmarkImageUpload(width, height);
+			 },
+			 "512x256"},
+			{"range-reduction", "COUNTS", "colormap range of float fields by min/max and percentiles, scalar, SIMD and threaded, checked against a sort (default: 16777216)",
+			 [](const std::string &argument)
+			 {
+				 bool passed = true;
+				 for (size_t count : benchmarkCounts(argument, {1 << 24}))
+					 passed = renderBenchmark::benchmarkRangeReduction(count) && passed;
+				 return passed;
+			 },
+			 "100000,1000"},
+			{"frame-capture", "COUNT,FRAMES", "capture frames of moving spheres to benchmark.frames in the working directory and check their replay (default: 100000,200)",
+			 [](const std::string &argument)
+			 {
+				 std::vector<size_t> counts = benchmarkCounts(argument, {100000, 200});
+				 if (counts.size() > 2)
+					 throw std::runtime_error("Expected COUNT,FRAMES, not \"" + argument + "\"");
+				 return renderBenchmark::benchmarkFrameCapture(counts[0], counts.size() == 2 ? counts[1] : 200);
+			 },
+			 "1000,100"},
+		};
+		return list;
+	}
+
+	/// @return
+	///     1 if a benchmark is unknown, throws or one of its checks fails
+	int runBenchmarks(const std::vector<std::string> &options)
+	{
+		int failed = 0;
+		for (const std::string &option : options)
+		{
+			if (option == "list")
+			{
+				for (const Benchmark &benchmark : benchmarks())
+				{
+					std::string usage = benchmark.name;
+					if (*benchmark.argument != '\0')
+						usage += std::string("[=") + benchmark.argument + "]";
+					std::cout << "  " << std::left << std::setw(30) << usage << " " << benchmark.description << std::endl;
+				}
+				continue;
+			}
+			size_t equals = option.find('=');
+			std::string name = option.substr(0, equals);
+			std::string argument = equals == std::string::npos ? "" : option.substr(equals + 1);
+			auto benchmark = std::find_if(benchmarks().begin(), benchmarks().end(), [&](const Benchmark &benchmark)
+										  { return name == benchmark.name; });
+			if (benchmark == benchmarks().end())
+			{
+				std::cerr << "Unknown benchmark \"" << name << "\", --benchmark list shows the available ones" << std::endl;
+				return 1;
+			}
+			std::cout << "=== " << option << " ===" << std::endl;
+			try
+			{
+				if (!benchmark->run(argument))
+				{
+					std::cerr << option << ": a check failed" << std::endl;
+					++failed;
+				}
+			}
+			catch (const std::runtime_error &e)
+			{
+				std::cerr << option << ": " << e.what() << std::endl;
+				++failed;
+			}
+		}
+		return failed > 0 ? 1 : 0;
+	}
+
+	int runSelftest()
+	{
+		std::vector<std::string> checks;
+		for (const Benchmark &benchmark : benchmarks())
+		{
+			if (benchmark.selftest != nullptr)
+				checks.push_back(*benchmark.selftest == '\0' ? std::string(benchmark.name) : std::string(benchmark.name) + "=" + benchmark.selftest);
+		}
+		int result = runBenchmarks(checks);
+		std::cout << (result == 0 ? "All checks passed" : "A check failed") << std::endl;
+		return result;
+	}
+
+	int runSweep(const Options &options)
+	{
+		try
+		{
+			std::vector<BatchRunner::Run> runs = BatchRunner::loadConfig(options.sweep, options.steps > 0 ? options.steps : 1000);
+			BatchRunner runner(scenesCreators, options.jobs);
+			runner.onResult = [&](const BatchRunner::Run &run, const BatchRunner::Result &result, size_t finished)
+			{
+				std::cout << std::defaultfloat << std::setprecision(6) << "[" << finished << "/" << runs.size() << "] " << run.scene;
+				for (auto &parameter : run.parameters)
+					std::cout << " " << parameter.first << "=" << parameter.second;
+				std::cout << ": " << result.steps << " steps, " << std::fixed << std::setprecision(1)
+						  << (result.stepTime > 0 ? result.steps / result.stepTime : 0) << " steps/s";
+				if (!result.error.empty())
+					std::cout << ", " << result.error;
+				std::cout << std::endl;
+			};
+			Profiler::setEnabled(!options.trace.empty());
+			auto start = std::chrono::steady_clock::now();
+			std::vector<BatchRunner::Result> results = runner.run(runs);
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			Profiler::setEnabled(false);
+			BatchRunner::writeCsv(options.csv, runs, results);
+			std::cout << runs.size() << " runs in " << std::fixed << std::setprecision(3) << elapsed << " s, wrote " << options.csv << std::endl;
+			if (!options.trace.empty())
+			{
+				Profiler::exportChromeTrace(options.trace);
+				std::cout << "Wrote the trace to " << options.trace << std::endl;
+			}
+		}
+		catch (const std::runtime_error &e)
+		{
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	auto value = [&](int &i)
+	{
+		if (i + 1 >= argc)
+		{
+			std::cerr << argv[i] << " needs a value" << std::endl;
+			std::exit(1);
+		}
+		return argv[++i];
+	};
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--scene") == 0)
+			options.scenes.push_back(value(i));
+		else if (std::strcmp(argv[i], "--all") == 0)
+			for (auto &scene : scenesCreators)
+				options.scenes.push_back(scene.first);
+		else if (std::strcmp(argv[i], "--steps") == 0)
+			options.steps = std::strtoull(value(i), nullptr, 10);
+		else if (std::strcmp(argv[i], "--seconds") == 0)
+			options.seconds = std::strtod(value(i), nullptr);
+		else if (std::strcmp(argv[i], "--warmup") == 0)
+			options.warmup = std::strtoull(value(i), nullptr, 10);
+		else if (std::strcmp(argv[i], "--no-draw") == 0)
+			options.draw = false;
+		else if (std::strcmp(argv[i], "--capture") == 0)
+			options.capture = value(i);
+		else if (std::strcmp(argv[i], "--trace") == 0)
+			options.trace = value(i);
+		else if (std::strcmp(argv[i], "--sweep") == 0)
+			options.sweep = value(i);
+		else if (std::strcmp(argv[i], "--csv") == 0)
+			options.csv = value(i);
+		else if (std::strcmp(argv[i], "--jobs") == 0)
+			options.jobs = static_cast<unsigned>(std::strtoul(value(i), nullptr, 10));
+		else if (std::strcmp(argv[i], "--benchmark") == 0)
+			options.benchmarks.push_back(value(i));
+		else if (std::strcmp(argv[i], "--selftest") == 0)
+			options.selftest = true;
+		else if (std::strcmp(argv[i], "--list") == 0)
+		{
+			for (auto &scene : scenesCreators)
+				std::cout << scene.first << std::endl;
+			return 0;
+		}
+		else
+		{
+			printUsage();
+			return std::strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		}
+	}
+
+	// the micro benchmarks need no scenes
+	if (options.selftest)
+		return runSelftest();
+	if (!options.benchmarks.empty())
+		return runBenchmarks(options.benchmarks);
+	if (scenesCreators.empty())
+	{
+		std::cout << "No scenes available! Did you forget to add your scene to SceneIndex.h?" << std::endl;
+		return 1;
+	}
+	Profiler::setThreadName("main");
+	// the scenes of a sweep come from its config
+	if (!options.sweep.empty())
+		return runSweep(options);
+	if (options.scenes.empty())
+		options.scenes.push_back(scenesCreators.begin()->first);
+	for (auto &name : options.scenes)
+	{
+		if (scenesCreators.find(name) == scenesCreators.end())
+		{
+			std::cerr << "Unknown scene \"" << name << "\", --list shows the available ones" << std::endl;
+			return 1;
+		}
+	}
+
+	if (!options.capture.empty() && !options.draw)
+	{
+		std::cerr << "--capture records the draws, it does not work with --no-draw" << std::endl;
+		return 1;
+	}
+
+	Renderer renderer{Renderer::Headless()};
+	try
+	{
+		if (!options.capture.empty())
+			renderer.startCapture(options.capture);
+		for (auto &name : options.scenes)
+			runScene(name, options, renderer);
+		if (renderer.isCapturing())
+		{
+			renderer.stopCapture();
+			std::cout << "Wrote the capture to " << options.capture << std::endl;
+		}
+		if (!options.trace.empty())
+		{
+			Profiler::exportChromeTrace(options.trace);
+			std::cout << "Wrote the trace to " << options.trace << std::endl;
+		}
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,8 +1,10 @@
 #include "Renderer.h"
 #include "Simulator.h"
+#include <util/Profiler.h>
 
 int main(int, char **)
 {
+	Profiler::setThreadName("main");
 	Renderer renderer = Renderer();
 	Simulator simulator(renderer);
 
@@ -1,5 +1,8 @@
 #include "ImagePipeline.h"
 #include "Colormap.h"
+#include <util/HalfFloat.h>
+#include <util/Profiler.h>
+#include <algorithm>
 
 #ifndef RESOURCE_DIR
 #define RESOURCE_DIR "this will be defined by cmake depending on the build type. This define is to disable error squiggles"
@@ -12,11 +15,14 @@ bool ImagePipeline::init(Device &device, TextureFormat &swapChainFormat, Queue &
     this->device = device;
     this->queue = queue;
     this->swapChainFormat = swapChainFormat;
+    SupportedLimits limits;
+    device.getLimits(&limits);
+    maxAtlasSize = limits.limits.maxTextureDimension2D;
     shaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/image_shader.wgsl", device);
     RenderPipelineDescriptor pipelineDesc;
     pipelineDesc.label = "Image pipeline";
 
-    std::vector<VertexAttribute> instanceAttribs(8);
+    std::vector<VertexAttribute> instanceAttribs(10);
 
     instanceAttribs[0].shaderLocation = 0;
     instanceAttribs[0].format = VertexFormat::Float32;
@@ -50,6 +56,14 @@ bool ImagePipeline::init(Device &device, TextureFormat &swapChainFormat, Queue &
     instanceAttribs[7].format = VertexFormat::Float32;
     instanceAttribs[7].offset = offsetof(ResourceManager::ImageAttributes, cmapOffset);
 
+    instanceAttribs[8].shaderLocation = 8;
+    instanceAttribs[8].format = VertexFormat::Float32;
+    instanceAttribs[8].offset = offsetof(ResourceManager::ImageAttributes, vmin);
+
+    instanceAttribs[9].shaderLocation = 9;
+    instanceAttribs[9].format = VertexFormat::Float32;
+    instanceAttribs[9].offset = offsetof(ResourceManager::ImageAttributes, vmax);
+
     VertexBufferLayout instanceBufferLayout;
     instanceBufferLayout.attributeCount = (uint32_t)instanceAttribs.size();
     instanceBufferLayout.attributes = instanceAttribs.data();
@@ -113,21 +127,56 @@ bool ImagePipeline::init(Device &device, TextureFormat &swapChainFormat, Queue &
 
 void ImagePipeline::draw(RenderPassEncoder &renderPass)
 {
+    PROFILE_ZONE("ImagePipeline::draw");
     if (images.size() == 0)
         return;
     renderPass.setPipeline(pipeline);
-    for (size_t i = 0; i < images.size(); i++)
+    renderPass.setVertexBuffer(0, imageBuffer, 0, sizeof(ResourceManager::ImageAttributes) * images.size());
+    size_t i = 0;
+    while (i < images.size())
     {
-        renderPass.setBindGroup(0, bindGroups[i], 0, nullptr);
-        renderPass.setVertexBuffer(0, imageBuffer, sizeof(ResourceManager::ImageAttributes) * i, sizeof(ResourceManager::ImageAttributes));
-        renderPass.draw(6, 1, 0, 0);
+        if (placements[i].packed)
+        {
+            // every run of packed images in call order is one instanced draw, so the overlap order stays the same
+            size_t first = i;
+            while (i < images.size() && placements[i].packed)
+                i++;
+            renderPass.setBindGroup(0, atlasBindGroup, 0, nullptr);
+            renderPass.draw(6, static_cast<uint32_t>(i - first), 0, static_cast<uint32_t>(first));
+        }
+        else
+        {
+            renderPass.setBindGroup(0, bindGroups[i], 0, nullptr);
+            renderPass.draw(6, 1, 0, static_cast<uint32_t>(i));
+            i++;
+        }
     }
 }
 
 void ImagePipeline::commit()
 {
-    if (!isPrevLayout())
+    PROFILE_ZONE("ImagePipeline::commit");
+    if (!isPrevLayout() || atlasLayout != atlas || halfLayout != halfPrecision)
     {
+        if (halfLayout != halfPrecision && atlasTexture != nullptr)
+        {
+            // recreated in the new format by packAtlas
+            atlasTextureView.release();
+            atlasTexture.release();
+            atlasTextureView = nullptr;
+            atlasTexture = nullptr;
+        }
+        halfLayout = halfPrecision;
+        if (atlas)
+        {
+            packAtlas();
+        }
+        else
+        {
+            placements.assign(images.size(), AtlasPlacement());
+            textureCurrent.assign(images.size(), 0);
+        }
+        atlasLayout = atlas;
         createTextures();
         createTextureViews();
         createBindGroups();
@@ -136,6 +185,10 @@ void ImagePipeline::commit()
 
     if (images.size() > 0)
     {
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            images[i].offset = placements[i].packed ? static_cast<int>(placements[i].x | (placements[i].y << 16)) : 0;
+        }
         queue.writeBuffer(imageBuffer, 0, images.data(), sizeof(ResourceManager::ImageAttributes) * images.size());
         copyDataToTextures();
     }
@@ -146,20 +199,35 @@ size_t ImagePipeline::objectCount()
     return images.size();
 };
 
-void ImagePipeline::addImage(std::vector<float> &data, glm::vec2 position, glm::vec2 scale, size_t width, size_t height, Colormap colormap)
+void ImagePipeline::addImage(std::vector<float> &&data, glm::vec2 position, glm::vec2 scale, size_t width, size_t height, float vmin, float vmax, Colormap colormap)
+{
+    // moving the vector keeps its allocation, so the pointer stays valid when ownedData grows
+    ownedData.push_back(std::move(data));
+    addImage(Span<const float>(ownedData.back()), position, scale, width, height, vmin, vmax, colormap);
+}
+
+void ImagePipeline::addImage(Span<const float> data, glm::vec2 position, glm::vec2 scale, size_t width, size_t height, float vmin, float vmax, Colormap colormap)
 {
-    int offset = this->data.size();
-    this->data.insert(this->data.end(), data.begin(), data.end());
     ResourceManager::ImageAttributes image;
     image.x = position.x;
     image.y = position.y;
     image.sx = scale.x;
     image.sy = scale.y;
-    image.offset = offset;
+    image.offset = 0;
     image.width = width;
     image.height = height;
     image.cmapOffset = colormap.textureOffset();
+    image.vmin = vmin;
+    image.vmax = vmax;
+    addImage(data, image);
+}
+
+void ImagePipeline::addImage(Span<const float> data, const ResourceManager::ImageAttributes &image)
+{
+    sources.push_back(data.data());
+    partialUpload.push_back(0);
     images.push_back(image);
+    images.back().offset = 0;
 }
 
 void ImagePipeline::clearAll()
@@ -168,25 +236,58 @@ void ImagePipeline::clearAll()
     prevImages = images;
     images = tmp;
     images.clear();
-    data.clear();
+    sources.clear();
+    ownedData.clear();
+    dirtyRects.clear();
+    partialUpload.clear();
+}
+
+void ImagePipeline::markDirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    if (images.empty())
+        return;
+    const ResourceManager::ImageAttributes &image = images.back();
+    partialUpload.back() = 1;
+    // clipped to the image, empty rectangles only mark the image as unchanged
+    uint32_t right = static_cast<uint32_t>(std::min<uint64_t>(uint64_t(x) + width, image.width));
+    uint32_t bottom = static_cast<uint32_t>(std::min<uint64_t>(uint64_t(y) + height, image.height));
+    if (x < right && y < bottom)
+        dirtyRects.push_back({images.size() - 1, x, y, right - x, bottom - y});
 }
 
-void ImagePipeline::copyDataToTexture(ResourceManager::ImageAttributes &image, std::vector<float> &data, Texture &texture)
+void ImagePipeline::copyDataToTexture(ResourceManager::ImageAttributes &image, const float *data, Texture &texture, uint32_t x, uint32_t y,
+                                      const DirtyRect &rect)
 {
     ImageCopyTexture destination;
     destination.texture = texture;
     destination.aspect = TextureAspect::All;
     destination.mipLevel = 0;
-    destination.origin = {0, 0, 0};
+    destination.origin = {x + rect.x, y + rect.y, 0};
 
+    const float *first = data + static_cast<size_t>(rect.y) * image.width + rect.x;
     TextureDataLayout source;
     source.offset = 0;
-    source.bytesPerRow = image.width * sizeof(float);
-    source.rowsPerImage = image.height;
+    source.rowsPerImage = rect.height;
 
-    size_t size = image.width * image.height * sizeof(float);
+    if (halfLayout)
+    {
+        halfStaging.resize(static_cast<size_t>(rect.width) * rect.height);
+        for (uint32_t row = 0; row < rect.height; row++)
+        {
+            halfFloat::convert(first + static_cast<size_t>(row) * image.width, halfStaging.data() + static_cast<size_t>(row) * rect.width, rect.width);
+        }
+        source.bytesPerRow = rect.width * sizeof(uint16_t);
+        size_t size = halfStaging.size() * sizeof(uint16_t);
+        queue.writeTexture(destination, halfStaging.data(), size, source, {rect.width, rect.height, 1u});
+        uploadedBytes += size;
+        return;
+    }
 
-    queue.writeTexture(destination, data.data() + image.offset, size, source, {static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height), 1u});
+    // straight from the caller's memory with its row stride, writeTexture copies into its staging memory before returning
+    source.bytesPerRow = image.width * sizeof(float);
+    size_t size = (static_cast<size_t>(rect.height - 1) * image.width + rect.width) * sizeof(float);
+    queue.writeTexture(destination, first, size, source, {rect.width, rect.height, 1u});
+    uploadedBytes += static_cast<size_t>(rect.width) * rect.height * sizeof(float);
 }
 
 void ImagePipeline::terminate()
@@ -216,6 +317,12 @@ void ImagePipeline::terminate()
         bindGroupLayout.release();
     if (imageBuffer != nullptr)
         imageBuffer.release();
+    if (atlasBindGroup != nullptr)
+        atlasBindGroup.release();
+    if (atlasTextureView != nullptr)
+        atlasTextureView.release();
+    if (atlasTexture != nullptr)
+        atlasTexture.release();
     if (colormapTexture != nullptr)
         colormapTexture.release();
     if (colormapTextureView != nullptr)
@@ -257,7 +364,13 @@ void ImagePipeline::createBindGroups()
             bindGroup.release();
     }
     bindGroups.clear();
-    for (auto &textureView : textureViews)
+    if (atlasBindGroup != nullptr)
+    {
+        atlasBindGroup.release();
+        atlasBindGroup = nullptr;
+    }
+
+    auto createBindGroup = [&](TextureView &textureView)
     {
         BindGroupEntry entry;
         entry.binding = 0;
@@ -277,8 +390,15 @@ void ImagePipeline::createBindGroups()
         bindGroupDesc.layout = bindGroupLayout;
         bindGroupDesc.entryCount = (uint32_t)entries.size();
         bindGroupDesc.entries = entries.data();
-        bindGroups.push_back(device.createBindGroup(bindGroupDesc));
+        return device.createBindGroup(bindGroupDesc);
+    };
+
+    for (auto &textureView : textureViews)
+    {
+        bindGroups.push_back(textureView != nullptr ? createBindGroup(textureView) : nullptr);
     }
+    if (atlasTextureView != nullptr)
+        atlasBindGroup = createBindGroup(atlasTextureView);
 }
 
 bool ImagePipeline::isPrevLayout()
@@ -305,20 +425,20 @@ void ImagePipeline::createTextures()
     }
     textures.clear();
 
-    for (auto &image : images)
+    for (size_t i = 0; i < images.size(); i++)
     {
-        textures.push_back(createTexture(image));
+        textures.push_back(placements[i].packed ? nullptr : createTexture(images[i].width, images[i].height));
     }
 }
 
-Texture ImagePipeline::createTexture(ResourceManager::ImageAttributes &image)
+Texture ImagePipeline::createTexture(uint32_t width, uint32_t height)
 {
     TextureDescriptor textureDesc;
     textureDesc.dimension = TextureDimension::_2D;
-    textureDesc.size = {(uint32_t)image.width, (uint32_t)image.height, 1u};
+    textureDesc.size = {width, height, 1u};
     textureDesc.mipLevelCount = 1;
     textureDesc.sampleCount = 1;
-    textureDesc.format = TextureFormat::R32Float;
+    textureDesc.format = textureFormat();
     textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
     textureDesc.viewFormatCount = 0;
     textureDesc.viewFormats = nullptr;
@@ -334,10 +454,15 @@ TextureView ImagePipeline::createTextureView(Texture &texture)
     textureViewDesc.baseMipLevel = 0;
     textureViewDesc.mipLevelCount = 1;
     textureViewDesc.dimension = TextureViewDimension::_2D;
-    textureViewDesc.format = TextureFormat::R32Float;
+    textureViewDesc.format = textureFormat();
     return texture.createView(textureViewDesc);
 }
 
+TextureFormat ImagePipeline::textureFormat() const
+{
+    return halfLayout ? TextureFormat::R16Float : TextureFormat::R32Float;
+}
+
 void ImagePipeline::createTextureViews()
 {
     for (auto &textureView : textureViews)
@@ -349,7 +474,7 @@ void ImagePipeline::createTextureViews()
 
     for (auto &texture : textures)
     {
-        textureViews.push_back(createTextureView(texture));
+        textureViews.push_back(texture != nullptr ? createTextureView(texture) : nullptr);
     }
 }
 
@@ -405,10 +530,115 @@ void ImagePipeline::initColormap()
     colormapTextureView = colormapTexture.createView(textureViewDesc);
 }
 
+bool ImagePipeline::fitsAtlas(const ResourceManager::ImageAttributes &image) const
+{
+    return image.width > 0 && image.height > 0 && image.width <= (int)maxAtlasImageSize && image.height <= (int)maxAtlasImageSize;
+}
+
+void ImagePipeline::packAtlas()
+{
+    if (!atlasLayout || atlasTexture == nullptr)
+    {
+        uint32_t size = std::max(atlasSize, std::min(maxAtlasImageSize, maxAtlasSize));
+        while (!repackAtlas(size) && size < maxAtlasSize)
+            size = std::min(size * 2, maxAtlasSize);
+        createAtlas();
+        return;
+    }
+
+    // images that kept their size keep their place and their texels, the space of the others is given back first
+    for (size_t i = 0; i < placements.size(); i++)
+    {
+        bool changed = i >= images.size() || i >= prevImages.size() || images[i].width != prevImages[i].width || images[i].height != prevImages[i].height;
+        if (placements[i].packed && changed)
+        {
+            atlasPacker.release(placements[i].x, placements[i].y, prevImages[i].width);
+            placements[i] = AtlasPlacement();
+        }
+    }
+    placements.resize(images.size());
+    textureCurrent.resize(images.size(), 0);
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        textureCurrent[i] = textureCurrent[i] && placements[i].packed;
+    }
+    bool allPacked = true;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        if (placements[i].packed || !fitsAtlas(images[i]))
+            continue;
+        placements[i].packed = atlasPacker.allocate(images[i].width, images[i].height, placements[i].x, placements[i].y);
+        allPacked = allPacked && placements[i].packed;
+    }
+    if (allPacked || atlasSize >= maxAtlasSize)
+        return;
+
+    // full, start over in a larger atlas
+    uint32_t size = atlasSize;
+    do
+        size = std::min(size * 2, maxAtlasSize);
+    while (!repackAtlas(size) && size < maxAtlasSize);
+    createAtlas();
+}
+
+bool ImagePipeline::repackAtlas(uint32_t size)
+{
+    atlasPacker.reset(size, size);
+    placements.assign(images.size(), AtlasPlacement());
+    textureCurrent.assign(images.size(), 0);
+    // the highest images first, they leave the least unused space on the shelves
+    std::vector<size_t> order;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        if (fitsAtlas(images[i]))
+            order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return images[a].height > images[b].height; });
+    bool allPacked = true;
+    for (size_t i : order)
+    {
+        placements[i].packed = atlasPacker.allocate(images[i].width, images[i].height, placements[i].x, placements[i].y);
+        allPacked = allPacked && placements[i].packed;
+    }
+    return allPacked;
+}
+
+void ImagePipeline::createAtlas()
+{
+    if (atlasTexture != nullptr && atlasSize == atlasPacker.areaWidth())
+        return;
+    if (atlasTextureView != nullptr)
+        atlasTextureView.release();
+    if (atlasTexture != nullptr)
+        atlasTexture.release();
+    atlasSize = atlasPacker.areaWidth();
+    atlasTexture = createTexture(atlasSize, atlasSize);
+    atlasTextureView = createTextureView(atlasTexture);
+}
+
 void ImagePipeline::copyDataToTextures()
 {
+    PROFILE_ZONE("ImagePipeline::copyDataToTextures");
+    size_t nextRect = 0;
     for (size_t i = 0; i < images.size(); i++)
     {
-        copyDataToTexture(images[i], data, textures[i]);
+        Texture &texture = placements[i].packed ? atlasTexture : textures[i];
+        uint32_t x = placements[i].packed ? placements[i].x : 0;
+        uint32_t y = placements[i].packed ? placements[i].y : 0;
+        if (partialUpload[i] && textureCurrent[i])
+        {
+            for (; nextRect < dirtyRects.size() && dirtyRects[nextRect].image == i; nextRect++)
+            {
+                copyDataToTexture(images[i], sources[i], texture, x, y, dirtyRects[nextRect]);
+            }
+        }
+        else
+        {
+            copyDataToTexture(images[i], sources[i], texture, x, y, {i, 0, 0, static_cast<uint32_t>(images[i].width), static_cast<uint32_t>(images[i].height)});
+        }
+        while (nextRect < dirtyRects.size() && dirtyRects[nextRect].image == i)
+            nextRect++;
+        textureCurrent[i] = 1;
     }
 }
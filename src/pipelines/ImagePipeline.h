@@ -3,28 +3,94 @@
 #include <vector>
 #include "Colormap.h"
 #include "Pipeline.h"
+#include <util/ShelfPacker.h>
+#include <util/Span.h>
 
 class ImagePipeline : public Pipeline
 {
 public:
     bool init(wgpu::Device &device, wgpu::TextureFormat &swapChainFormat, wgpu::Queue &queue);
-    void addImage(std::vector<float> &data, glm::vec2 position, glm::vec2 scale, size_t width, size_t height, Colormap colormap);
+    /// @brief Draw an image straight from the caller's memory, which must stay valid until the next commit
+    void addImage(Span<const float> data, glm::vec2 position, glm::vec2 scale, size_t width, size_t height, float vmin, float vmax, Colormap colormap);
+    /// @brief Draw an image whose data the pipeline keeps until the next clearAll
+    void addImage(std::vector<float> &&data, glm::vec2 position, glm::vec2 scale, size_t width, size_t height, float vmin, float vmax, Colormap colormap);
+    /// @brief Draw an image with the attributes of one returned by frameImages, its place in the atlas is chosen again
+    void addImage(Span<const float> data, const ResourceManager::ImageAttributes &image);
+    /// @brief The images added for this frame so far
+    Span<const ResourceManager::ImageAttributes> frameImages() const { return images; }
+    /// @brief The pixels of an image of frameImages, width * height floats row by row
+    const float *imageData(size_t image) const { return sources[image]; }
     void draw(wgpu::RenderPassEncoder &renderPass) override;
     void commit() override;
     void clearAll() override;
     void terminate() override;
     size_t objectCount() override;
 
+    /// @brief Pack images of up to maxAtlasImageSize pixels per side into one shared texture
+    ///
+    /// Consecutive packed images are drawn with a single instanced draw call and one bind group. When images
+    /// are added, removed or resized, the others keep their place in the atlas. The atlas doubles its size when
+    /// it is full, up to the device's maxTextureDimension2D, images that still do not fit get their own texture.
+    bool atlas = false;
+    static constexpr uint32_t maxAtlasImageSize = 1024;
+
+    /// @brief Store the images as 16 bit floats, converted on the CPU, which halves the upload
+    bool halfPrecision = false;
+
+    /// @brief Upload only this rectangle of the image added last, can be called several times for one image
+    ///
+    /// The rest of its texture keeps the data of the previous frame. Images without a call are uploaded completely, as are
+    /// images whose texture was just created or moved in the atlas.
+    void markDirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
 private:
     std::vector<ResourceManager::ImageAttributes> images;
     std::vector<ResourceManager::ImageAttributes> prevImages;
-    std::vector<float> data;
+    // pixels of each image, uploaded from here in commit
+    std::vector<const float *> sources;
+    // vectors handed over by addImage, kept alive until the frame is drawn
+    std::vector<std::vector<float>> ownedData;
+
+    struct DirtyRect
+    {
+        size_t image;
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+    };
+    // in the order of the images, only those are uploaded for images with partialUpload set
+    std::vector<DirtyRect> dirtyRects;
+    std::vector<uint8_t> partialUpload;
+    // the texture of the image holds its data of the previous frame, so a partial upload is enough
+    std::vector<uint8_t> textureCurrent;
+    // format the current textures were created with
+    bool halfLayout = false;
+    std::vector<uint16_t> halfStaging;
 
     wgpu::Buffer imageBuffer = nullptr;
 
+    // own texture of every image that is not in the atlas, nullptr for the packed ones
     std::vector<wgpu::Texture> textures;
     std::vector<wgpu::TextureView> textureViews;
 
+    struct AtlasPlacement
+    {
+        uint32_t x = 0;
+        uint32_t y = 0;
+        bool packed = false;
+    };
+    // place of every image of the current layout
+    std::vector<AtlasPlacement> placements;
+    ShelfPacker atlasPacker;
+    uint32_t atlasSize = 0;
+    uint32_t maxAtlasSize = 0;
+    // mode the current layout was built for
+    bool atlasLayout = false;
+    wgpu::Texture atlasTexture = nullptr;
+    wgpu::TextureView atlasTextureView = nullptr;
+    wgpu::BindGroup atlasBindGroup = nullptr;
+
     wgpu::Texture colormapTexture = nullptr;
     wgpu::TextureView colormapTextureView = nullptr;
     wgpu::Sampler colormapSampler = nullptr;
@@ -36,13 +102,20 @@ private:
     void createBindGroups();
     bool isPrevLayout();
 
-    wgpu::Texture createTexture(ResourceManager::ImageAttributes &image);
+    wgpu::Texture createTexture(uint32_t width, uint32_t height);
     void createTextures();
     wgpu::TextureView createTextureView(wgpu::Texture &texture);
+    wgpu::TextureFormat textureFormat() const;
     void createTextureViews();
 
     void initColormap();
 
+    bool fitsAtlas(const ResourceManager::ImageAttributes &image) const;
+    void packAtlas();
+    bool repackAtlas(uint32_t size);
+    void createAtlas();
+
     void copyDataToTextures();
-    void copyDataToTexture(ResourceManager::ImageAttributes &image, std::vector<float> &data, wgpu::Texture &texture);
+    void copyDataToTexture(ResourceManager::ImageAttributes &image, const float *data, wgpu::Texture &texture, uint32_t x, uint32_t y,
+                           const DirtyRect &rect);
 };
\ No newline at end of file
@@ -1,7 +1,8 @@
 #include "InstancingPipeline.h"
 #include "Renderer.h"
-#include <numeric>
+#include <util/Profiler.h>
 #include <algorithm>
+#include <stdexcept>
 
 #ifndef RESOURCE_DIR
 #define RESOURCE_DIR "this will be defined by cmake depending on the build type. This define is to disable error squiggles"
@@ -17,6 +18,9 @@ void InstancingPipeline::init(Device &device, Queue &queue, TextureFormat &swapC
     this->lightingUniforms = lightingUniforms;
     this->device = device;
     this->queue = queue;
+    SupportedLimits limits;
+    device.getLimits(&limits);
+    maxBufferSize = limits.limits.maxBufferSize;
     shaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/instancing_shader.wgsl", device);
     RenderPipelineDescriptor pipelineDesc;
 
@@ -139,6 +143,38 @@ void InstancingPipeline::init(Device &device, Queue &queue, TextureFormat &swapC
     if (pipeline == nullptr)
         throw std::runtime_error("Failed to create instancing pipeline");
 
+    // position, packed rotation, scale with id and flags, packed color, see CompactInstance
+    std::vector<VertexAttribute> compactInstanceAttribs(4);
+
+    compactInstanceAttribs[0].shaderLocation = 2;
+    compactInstanceAttribs[0].format = VertexFormat::Float32x3;
+    compactInstanceAttribs[0].offset = offsetof(CompactInstance, position);
+
+    compactInstanceAttribs[1].shaderLocation = 3;
+    compactInstanceAttribs[1].format = VertexFormat::Snorm16x4;
+    compactInstanceAttribs[1].offset = offsetof(CompactInstance, rotation);
+
+    // three half floats and the 16 bits of id and flags, unpacked in the shader
+    compactInstanceAttribs[2].shaderLocation = 4;
+    compactInstanceAttribs[2].format = VertexFormat::Uint32x2;
+    compactInstanceAttribs[2].offset = offsetof(CompactInstance, scale);
+
+    compactInstanceAttribs[3].shaderLocation = 5;
+    compactInstanceAttribs[3].format = VertexFormat::Unorm8x4;
+    compactInstanceAttribs[3].offset = offsetof(CompactInstance, color);
+
+    VertexBufferLayout &compactInstanceBufferLayout = vertexBufferLayouts[1];
+    compactInstanceBufferLayout.attributeCount = (uint32_t)compactInstanceAttribs.size();
+    compactInstanceBufferLayout.attributes = compactInstanceAttribs.data();
+    compactInstanceBufferLayout.arrayStride = sizeof(CompactInstance);
+    compactInstanceBufferLayout.stepMode = VertexStepMode::Instance;
+    pipelineDesc.vertex.entryPoint = "vs_main_compact";
+
+    compactPipeline = device.createRenderPipeline(pipelineDesc);
+
+    if (compactPipeline == nullptr)
+        throw std::runtime_error("Failed to create compact instancing pipeline");
+
     initGeometry();
 }
 
@@ -148,14 +184,14 @@ void InstancingPipeline::terminate()
         shaderModule.release();
     if (pipeline != nullptr)
         pipeline.release();
+    if (compactPipeline != nullptr)
+        compactPipeline.release();
     for (auto &buffer : instanceBuffers)
-    {
-        if (buffer != nullptr)
-        {
-            buffer.destroy();
-            buffer.release();
-        }
-    }
+        releaseBuffer(buffer);
+    for (auto &retained : retainedInstances)
+        releaseBuffer(retained.buffer);
+    for (auto &buffer : sphereLodBuffers)
+        releaseBuffer(buffer);
     if (bindGroupLayout != nullptr)
         bindGroupLayout.release();
     if (bindGroup != nullptr)
@@ -178,41 +214,130 @@ void InstancingPipeline::addQuad(ResourceManager::InstancedVertexAttributes quad
     instances[2].push_back(quad);
 }
 
-template <typename T>
-std::vector<size_t> sort_indices(const std::vector<T> &v)
+ResourceManager::InstancedVertexAttributes *InstancingPipeline::appendInstances(PrimitiveType primitive, size_t count)
+{
+    auto &instanceList = instances[primitive];
+    size_t offset = instanceList.size();
+    instanceList.resize(offset + count);
+    return instanceList.data() + offset;
+}
+
+uint32_t InstancingPipeline::addRetained(PrimitiveType primitive, ResourceManager::InstancedVertexAttributes instance)
+{
+    RetainedInstances &retained = retainedInstances[primitive];
+    uint32_t slot;
+    if (!retained.freeSlots.empty())
+    {
+        slot = retained.freeSlots.back();
+        retained.freeSlots.pop_back();
+    }
+    else
+    {
+        slot = static_cast<uint32_t>(retained.slots.size());
+        retained.slots.push_back({});
+        retained.removed.push_back(false);
+        if (slot == retained.generations.size())
+            retained.generations.push_back(0);
+    }
+    retained.slots[slot] = instance;
+    retained.removed[slot] = false;
+    retained.dirty.mark(slot);
+    return slot;
+}
+
+void InstancingPipeline::checkRetained(PrimitiveType primitive, uint32_t slot, uint32_t generation) const
+{
+    if (static_cast<size_t>(primitive) >= retainedInstances.size() || slot >= retainedInstances[primitive].generations.size())
+        throw std::runtime_error("Retained instance " + std::to_string(slot) + " of primitive " + std::to_string(primitive) + " does not exist");
+    // slots dropped from the end keep their generation
+    if (slot >= retainedInstances[primitive].slots.size() || retainedInstances[primitive].generations[slot] != generation)
+        throw std::runtime_error("Retained instance " + std::to_string(slot) + " of primitive " + std::to_string(primitive) + " was removed");
+}
+
+uint32_t InstancingPipeline::retainedGeneration(PrimitiveType primitive, uint32_t slot) const
+{
+    if (static_cast<size_t>(primitive) >= retainedInstances.size() || slot >= retainedInstances[primitive].slots.size())
+        throw std::runtime_error("Retained instance " + std::to_string(slot) + " of primitive " + std::to_string(primitive) + " does not exist");
+    return retainedInstances[primitive].generations[slot];
+}
+
+const ResourceManager::InstancedVertexAttributes &InstancingPipeline::retained(PrimitiveType primitive, uint32_t slot, uint32_t generation) const
+{
+    checkRetained(primitive, slot, generation);
+    return retainedInstances[primitive].slots[slot];
+}
+
+void InstancingPipeline::updateRetained(PrimitiveType primitive, uint32_t slot, uint32_t generation, const ResourceManager::InstancedVertexAttributes &instance)
 {
-    using namespace std;
-    vector<size_t>
-        idx(v.size());
-    iota(idx.begin(), idx.end(), 0);
+    checkRetained(primitive, slot, generation);
+    RetainedInstances &retained = retainedInstances[primitive];
+    uint32_t id = retained.slots[slot].id;
+    retained.slots[slot] = instance;
+    retained.slots[slot].id = id;
+    retained.dirty.mark(slot);
+}
 
-    stable_sort(idx.begin(), idx.end(),
-                [&v](size_t i1, size_t i2)
-                { return v[i1] < v[i2]; });
+void InstancingPipeline::removeRetained(PrimitiveType primitive, uint32_t slot, uint32_t generation)
+{
+    checkRetained(primitive, slot, generation);
+    RetainedInstances &retained = retainedInstances[primitive];
+    // a zero scale collapses all triangles, the slot stays in the buffer until it is reused
+    retained.slots[slot].scale = glm::vec3(0);
+    retained.dirty.mark(slot);
+    retained.freeSlots.push_back(slot);
+    retained.removed[slot] = true;
+    retained.generations[slot]++;
+    if (slot + 1 < retained.slots.size())
+        return;
+    // drop the removed slots at the end instead of drawing them with a zero scale
+    size_t end = retained.slots.size();
+    while (end > 0 && retained.removed[end - 1])
+        end--;
+    retained.slots.resize(end);
+    retained.removed.resize(end);
+    retained.freeSlots.erase(std::remove_if(retained.freeSlots.begin(), retained.freeSlots.end(), [end](uint32_t freeSlot) { return freeSlot >= end; }),
+                             retained.freeSlots.end());
+}
 
-    return idx;
+void InstancingPipeline::clearRetained()
+{
+    for (auto &retained : retainedInstances)
+    {
+        retained.slots.clear();
+        retained.freeSlots.clear();
+        retained.removed.clear();
+        retained.dirty.clear();
+        for (auto &generation : retained.generations)
+            generation++;
+    }
 }
 
-void InstancingPipeline::sortDepth()
+size_t InstancingPipeline::retainedCount()
 {
+    size_t total = 0;
+    for (auto &retained : retainedInstances)
+    {
+        total += retained.slots.size() - retained.freeSlots.size();
+    }
+    return total;
+}
+
+void InstancingPipeline::sortDepth(bool transparentOnly, unsigned threads)
+{
+    PROFILE_ZONE("InstancingPipeline::sortDepth");
+    depthSorted = true;
     for (auto &instanceList : instances)
     {
-        std::vector<float> depths;
-        depths.reserve(instanceList.size());
-        for (auto &instance : instanceList)
-        {
-            glm::vec3 delta = Renderer::camera.position - instance.position;
-            float depth = -glm::dot(delta, delta);
-            depths.push_back(depth);
-        }
-        auto indices = sort_indices(depths);
-        std::vector<ResourceManager::InstancedVertexAttributes> newOrder;
-        newOrder.resize(instanceList.size());
-        for (auto &index : indices)
+        if (instanceList.size() < 2)
+            continue;
+        const std::vector<uint32_t> &order = depthSorter.sort(Renderer::camera.position, &instanceList[0].position, &instanceList[0].color.a,
+                                                              sizeof(InstancedVertexAttributes), instanceList.size(), transparentOnly, threads);
+        sortedInstances.resize(instanceList.size());
+        for (size_t i = 0; i < order.size(); i++)
         {
-            newOrder.push_back(instanceList[index]);
+            sortedInstances[i] = instanceList[order[i]];
         }
-        instanceList = newOrder;
+        instanceList.swap(sortedInstances);
     }
 }
 
@@ -222,31 +347,172 @@ void InstancingPipeline::clearAll()
     {
         instanceList.clear();
     }
+    depthSorted = false;
+}
+
+size_t InstancingPipeline::instancesPerChunk(size_t instanceSize) const
+{
+    return std::max<size_t>(1, std::min<size_t>(chunkSize, maxBufferSize / instanceSize));
 }
 
-void InstancingPipeline::update(std::vector<ResourceManager::InstancedVertexAttributes> &instances, wgpu::Buffer &instanceBuffer)
+void InstancingPipeline::update(InstanceList &instances, ChunkedBuffer &instanceBuffer)
 {
-    size_t count = instances.size();
-    size_t new_size = count * sizeof(InstancedVertexAttributes);
-    if (instanceBuffer == nullptr || new_size != instanceBuffer.getSize())
-        reallocateBuffer(instanceBuffer, new_size);
-    if (count > 0)
-        queue.writeBuffer(instanceBuffer, 0, instances.data(), new_size);
+    if (!uploadedCompact)
+    {
+        uploadChunked(instanceBuffer, instances.data(), instances.size(), sizeof(InstancedVertexAttributes), instancesPerChunk(sizeof(InstancedVertexAttributes)));
+        return;
+    }
+    packedInstances.resize(instances.size());
+    pack(instances.data(), instances.size(), packedInstances.data());
+    uploadChunked(instanceBuffer, packedInstances.data(), packedInstances.size(), sizeof(CompactInstance), instancesPerChunk(sizeof(CompactInstance)));
+}
+
+void InstancingPipeline::updateRetainedBuffer(RetainedInstances &retained)
+{
+    if (!uploadedCompact)
+    {
+        uploadDirtyChunked(retained.buffer, retained.slots.data(), retained.slots.size(), sizeof(InstancedVertexAttributes),
+                           instancesPerChunk(sizeof(InstancedVertexAttributes)), retained.dirty);
+        return;
+    }
+    retained.packedSlots.resize(retained.slots.size());
+    for (const auto &range : retained.dirty.ranges)
+    {
+        size_t end = std::min(range.second, retained.slots.size());
+        if (range.first < end)
+            pack(&retained.slots[range.first], end - range.first, &retained.packedSlots[range.first]);
+    }
+    uploadDirtyChunked(retained.buffer, retained.packedSlots.data(), retained.packedSlots.size(), sizeof(CompactInstance),
+                       instancesPerChunk(sizeof(CompactInstance)), retained.dirty);
+}
+
+void InstancingPipeline::pack(const InstancedVertexAttributes *instances, size_t count, CompactInstance *out)
+{
+    if (count == 0)
+        return;
+    instancePacking::pack(&instances[0].position, &instances[0].rotation.x, &instances[0].scale, &instances[0].color, &instances[0].id,
+                          &instances[0].flags, sizeof(InstancedVertexAttributes), count, out);
+}
+
+void InstancingPipeline::setView(const glm::mat4 &projection, const glm::mat4 &view, float viewportHeight, bool cullingPlane, const glm::vec3 &cullingOffsets)
+{
+    culler.setView(projection * view);
+    culler.setCullingPlane(cullingPlane, cullingOffsets, Renderer::DrawFlags::dontCull);
+    // projection[1][1] is 1 / tan(fov / 2), half the viewport height corresponds to that tangent
+    pixelsPerRadian = projection[1][1] * viewportHeight * 0.5f;
+    cameraPosition = -glm::transpose(glm::mat3(view)) * glm::vec3(view[3]);
+}
+
+void InstancingPipeline::bucketSphereLods(const InstanceList &spheres)
+{
+    // edge length of the unit icosahedron, every subdivision halves it
+    const float baseEdge = 1.0515f;
+    for (auto &bucket : sphereLodInstances)
+    {
+        bucket.clear();
+    }
+    for (const auto &sphere : spheres)
+    {
+        float radius = glm::max(glm::max(std::abs(sphere.scale.x), std::abs(sphere.scale.y)), std::abs(sphere.scale.z));
+        // inside the sphere the distance goes to zero, which selects the finest mesh
+        float distance = glm::length(sphere.position - cameraPosition);
+        float edge = baseEdge * radius * pixelsPerRadian / std::max(distance, 1e-6f);
+        int lod = 0;
+        while (edge > sphereLod.edgePixels && lod + 1 < sphereLodCount)
+        {
+            edge *= 0.5f;
+            lod++;
+        }
+        sphereLodInstances[lod].push_back(sphere);
+    }
 }
 
 void InstancingPipeline::commit()
 {
+    PROFILE_ZONE("InstancingPipeline::commit");
+    // bounding shapes of the cube, sphere and quad primitives in the order of initGeometry
+    const FrustumCuller::Shape shapes[] = {FrustumCuller::box, FrustumCuller::ellipsoid, FrustumCuller::quad};
+    lastVisible = 0;
+    lastCulled = 0;
+    lastTriangles = 0;
+    bool bucketLods = sphereLod.enabled && !depthSorted;
+    if (compactInstances != uploadedCompact)
+    {
+        // the retained buffers hold the other layout, all of their slots have to be written again
+        uploadedCompact = compactInstances;
+        for (auto &retained : retainedInstances)
+        {
+            retained.dirty.clear();
+            if (!retained.slots.empty())
+                retained.dirty.mark(0, retained.slots.size());
+        }
+    }
     for (size_t i = 0; i < instanceBuffers.size(); i++)
     {
-        update(instances[i], instanceBuffers[i]);
+        InstanceList *drawn = &instances[i];
+        if (culling.enabled && !instances[i].empty())
+        {
+            InstanceList &instanceList = instances[i];
+            const std::vector<uint32_t> &visible = culler.cull(&instanceList[0].position, &instanceList[0].scale, &instanceList[0].flags,
+                                                               sizeof(InstancedVertexAttributes), instanceList.size(), shapes[i], culling.threads);
+            // the visible instances keep their order, a depth sorted list stays sorted
+            visibleInstances.resize(visible.size());
+            for (size_t j = 0; j < visible.size(); j++)
+            {
+                visibleInstances[j] = instanceList[visible[j]];
+            }
+            lastCulled += instanceList.size() - visible.size();
+            drawn = &visibleInstances;
+        }
+        lastVisible += drawn->size();
+
+        if (i == spherePrimitive && bucketLods)
+        {
+            // the spheres go to the level of detail buckets instead
+            bucketSphereLods(*drawn);
+            visibleInstances.clear();
+            drawn = &visibleInstances;
+            for (int lod = 0; lod < sphereLodCount; lod++)
+            {
+                update(sphereLodInstances[lod], sphereLodBuffers[lod]);
+                lastTriangles += sphereLodInstances[lod].size() * triangles(sphereLodIndexBuffers[lod]);
+            }
+        }
+        else if (!bucketLods)
+        {
+            for (auto &buffer : sphereLodBuffers)
+            {
+                releaseBuffer(buffer);
+            }
+        }
+        update(*drawn, instanceBuffers[i]);
+        lastTriangles += drawn->size() * triangles(indexBuffers[i]);
+    }
+    for (size_t i = 0; i < retainedInstances.size(); i++)
+    {
+        RetainedInstances &retained = retainedInstances[i];
+        updateRetainedBuffer(retained);
+        // removed slots are still in the buffer but have no area
+        lastTriangles += (retained.slots.size() - retained.freeSlots.size()) * triangles(indexBuffers[i]);
     }
 }
 
+size_t InstancingPipeline::triangles(wgpu::Buffer &indexBuffer)
+{
+    return indexBuffer.getSize() / sizeof(Triangle);
+}
+
 void InstancingPipeline::draw(RenderPassEncoder &renderPass)
 {
+    PROFILE_ZONE("InstancingPipeline::draw");
     for (size_t i = 0; i < instanceBuffers.size(); i++)
     {
-        drawInstanced(renderPass, instanceBuffers[i], vertexBuffers[i], indexBuffers[i], instanceBuffers[i].getSize() / sizeof(InstancedVertexAttributes));
+        drawInstanced(renderPass, instanceBuffers[i], vertexBuffers[i], indexBuffers[i]);
+        drawInstanced(renderPass, retainedInstances[i].buffer, vertexBuffers[i], indexBuffers[i]);
+    }
+    for (int lod = 0; lod < sphereLodCount; lod++)
+    {
+        drawInstanced(renderPass, sphereLodBuffers[lod], sphereLodVertexBuffers[lod], sphereLodIndexBuffers[lod]);
     }
 }
 
@@ -260,31 +526,44 @@ size_t InstancingPipeline::objectCount()
     return total;
 }
 
-void InstancingPipeline::addPrimitive(VertexNormalList vertexData, TriangleList triangles)
+void InstancingPipeline::createMesh(const VertexNormalList &vertexData, const TriangleList &triangles, Buffer &vertexBuffer, Buffer &indexBuffer)
 {
     BufferDescriptor vertexBufferDescriptor;
     vertexBufferDescriptor.size = vertexData.size() * sizeof(PrimitiveVertexAttributes);
     vertexBufferDescriptor.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
     vertexBufferDescriptor.mappedAtCreation = false;
-    Buffer vertexBuffer = device.createBuffer(vertexBufferDescriptor);
-    queue.writeBuffer(vertexBuffer, 0, vertexData.data(), vertexBufferDescriptor.size);
-    vertexBuffers.push_back(vertexBuffer);
+    vertexBuffer = device.createBuffer(vertexBufferDescriptor);
     if (vertexBuffer == nullptr)
         throw std::runtime_error("Failed to create vertex buffer");
+    queue.writeBuffer(vertexBuffer, 0, vertexData.data(), vertexBufferDescriptor.size);
 
     BufferDescriptor indexBufferDescriptor;
     indexBufferDescriptor.size = triangles.size() * sizeof(Triangle);
     indexBufferDescriptor.usage = BufferUsage::CopyDst | BufferUsage::Index;
     indexBufferDescriptor.mappedAtCreation = false;
-    Buffer indexBuffer = device.createBuffer(indexBufferDescriptor);
-    queue.writeBuffer(indexBuffer, 0, triangles.data(), indexBufferDescriptor.size);
-    indexBuffers.push_back(indexBuffer);
-
+    indexBuffer = device.createBuffer(indexBufferDescriptor);
     if (indexBuffer == nullptr)
         throw std::runtime_error("Failed to create index buffer");
+    queue.writeBuffer(indexBuffer, 0, triangles.data(), indexBufferDescriptor.size);
+}
+
+void InstancingPipeline::addPrimitive(VertexNormalList vertexData, TriangleList triangles)
+{
+    Buffer vertexBuffer = nullptr;
+    Buffer indexBuffer = nullptr;
+    createMesh(vertexData, triangles, vertexBuffer, indexBuffer);
+    vertexBuffers.push_back(vertexBuffer);
+    indexBuffers.push_back(indexBuffer);
 
-    instanceBuffers.push_back(nullptr);
+    instanceBuffers.push_back({});
     instances.push_back({});
+    retainedInstances.push_back({});
+}
+
+void InstancingPipeline::initHeadless()
+{
+    instances.resize(quadPrimitive + 1);
+    retainedInstances.resize(quadPrimitive + 1);
 }
 
 void InstancingPipeline::initGeometry()
@@ -300,6 +579,19 @@ void InstancingPipeline::initGeometry()
 
     // Load quad geometry
     addPrimitive(quad::vertices, quad::triangles);
+
+    // Sphere levels of detail, 20 to 5120 triangles
+    for (int lod = 0; lod < sphereLodCount; lod++)
+    {
+        IndexedMesh mesh = make_icosphere(lod);
+        Buffer vertexBuffer = nullptr;
+        Buffer indexBuffer = nullptr;
+        createMesh(mesh.first, mesh.second, vertexBuffer, indexBuffer);
+        sphereLodVertexBuffers.push_back(vertexBuffer);
+        sphereLodIndexBuffers.push_back(indexBuffer);
+        sphereLodBuffers.push_back({});
+        sphereLodInstances.push_back({});
+    }
 }
 
 void InstancingPipeline::terminateGeometry()
@@ -314,6 +606,16 @@ void InstancingPipeline::terminateGeometry()
         buffer.destroy();
         buffer.release();
     }
+    for (auto &buffer : sphereLodVertexBuffers)
+    {
+        buffer.destroy();
+        buffer.release();
+    }
+    for (auto &buffer : sphereLodIndexBuffers)
+    {
+        buffer.destroy();
+        buffer.release();
+    }
 }
 
 void InstancingPipeline::initBindGroupLayout()
@@ -368,15 +670,22 @@ void InstancingPipeline::initBindGroup()
         throw std::runtime_error("Could not create bind group!");
 }
 
-void InstancingPipeline::drawInstanced(wgpu::RenderPassEncoder renderPass, wgpu::Buffer &instanceBuffer, wgpu::Buffer &vertexBuffer, wgpu::Buffer &indexBuffer, size_t instances)
+void InstancingPipeline::drawInstanced(wgpu::RenderPassEncoder renderPass, ChunkedBuffer &instanceBuffer, wgpu::Buffer &vertexBuffer, wgpu::Buffer &indexBuffer)
 {
-    if (instances > 0)
+    if (instanceBuffer.count == 0)
+        return;
+    size_t instanceSize = uploadedCompact ? sizeof(CompactInstance) : sizeof(InstancedVertexAttributes);
+    renderPass.setPipeline(uploadedCompact ? compactPipeline : pipeline);
+    renderPass.setBindGroup(0, bindGroup, 0, nullptr);
+    renderPass.setVertexBuffer(0, vertexBuffer, 0, vertexBuffer.getSize());
+    renderPass.setIndexBuffer(indexBuffer, IndexFormat::Uint16, 0, indexBuffer.getSize());
+    // one draw call per chunk, only the instance buffer changes in between
+    for (auto &chunk : instanceBuffer.chunks)
     {
-        renderPass.setPipeline(pipeline);
-        renderPass.setBindGroup(0, bindGroup, 0, nullptr);
-        renderPass.setVertexBuffer(0, vertexBuffer, 0, vertexBuffer.getSize());
-        renderPass.setVertexBuffer(1, instanceBuffer, 0, instances * sizeof(InstancedVertexAttributes));
-        renderPass.setIndexBuffer(indexBuffer, IndexFormat::Uint16, 0, indexBuffer.getSize());
+        size_t instances = chunk.count;
+        if (instances == 0)
+            continue;
+        renderPass.setVertexBuffer(1, chunk.buffer, 0, instances * instanceSize);
         renderPass.drawIndexed(static_cast<uint32_t>(indexBuffer.getSize() / sizeof(uint16_t)), static_cast<uint32_t>(instances), 0, 0, 0);
     }
 }
\ No newline at end of file
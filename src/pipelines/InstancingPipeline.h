@@ -2,41 +2,178 @@
 #include "Pipeline.h"
 #include <ResourceManager.h>
 #include "Primitives.h"
+#include <util/DefaultInitAllocator.h>
+#include <util/DepthSort.h>
+#include <util/FrustumCulling.h>
+#include <util/InstancePacking.h>
+#include <util/Span.h>
 
 class InstancingPipeline : public Pipeline
 {
 public:
+    /// @brief Index of the geometry an instance is drawn with
+    enum PrimitiveType : uint32_t
+    {
+        cubePrimitive = 0,
+        spherePrimitive = 1,
+        quadPrimitive = 2,
+    };
+
     void init(wgpu::Device &device, wgpu::Queue &queue, wgpu::TextureFormat &swapChainFormat, wgpu::TextureFormat &depthTextureFormat, wgpu::Buffer &cameraUniforms, wgpu::Buffer &lightingUniforms);
+    /// @brief Create only the instance lists of the primitives, for a renderer without device that records but never commits
+    void initHeadless();
     void addCube(ResourceManager::InstancedVertexAttributes cube);
     void addSphere(ResourceManager::InstancedVertexAttributes sphere);
     void addQuad(ResourceManager::InstancedVertexAttributes quad);
-    void sortDepth();
+    /// @brief Append count instances of a primitive for this frame and return the first one.
+    ///
+    /// The instances are left for the caller to fill, the pointer is valid until the next add call.
+    ResourceManager::InstancedVertexAttributes *appendInstances(PrimitiveType primitive, size_t count);
+    /// @brief Order the instances of this frame back to front, see DepthSorter
+    void sortDepth(bool transparentOnly = false, unsigned threads = 1);
+
+    struct CullingSettings
+    {
+        /// Only upload instances whose bounding sphere intersects the view frustum, retained instances are never culled
+        bool enabled = true;
+        /// Number of threads of ThreadPool::global() to use, 0 for all
+        unsigned threads = 1;
+    };
+    CullingSettings culling;
+
+    /// @brief Spheres are drawn with icospheres of 0 to 4 subdivisions, chosen by their size on screen
+    static constexpr int sphereLodCount = 5;
+    struct LevelOfDetailSettings
+    {
+        /// Without level of detail every sphere uses the icosphere with 2 subdivisions, retained spheres always do.
+        /// Frames ordered with sortDepth are drawn without it, the buckets are drawn one after the other and would
+        /// break the back to front order.
+        bool enabled = true;
+        /// Pick the coarsest mesh whose triangle edges are at most this many pixels long on screen
+        float edgePixels = 8;
+    };
+    LevelOfDetailSettings sphereLod;
+
+    /// @brief Upload instances in the 32 byte CompactInstance layout instead of the 64 byte InstancedVertexAttributes
+    ///
+    /// Halves the upload bandwidth, rotation, scale and color lose precision and only the lower 12 bits of the id are kept.
+    bool compactInstances = false;
+
+    /// @brief Maximum number of instances per buffer and draw call.
+    ///
+    /// More instances of a primitive are split into several chunks. The chunk size is further limited by the
+    /// maxBufferSize of the device.
+    size_t chunkSize = 1 << 20;
+
+    /// @brief Set the view the next commit culls against and chooses the sphere meshes for
+    /// @param viewportHeight
+    ///     Height of the render target in pixels
+    /// @param cullingPlane, cullingOffsets
+    ///     The culling plane of Renderer::drawCullingPlanes
+    void setView(const glm::mat4 &projection, const glm::mat4 &view, float viewportHeight, bool cullingPlane, const glm::vec3 &cullingOffsets);
+    /// @brief Number of instances that were uploaded by the last commit
+    size_t visibleCount() const { return lastVisible; }
+    /// @brief Number of instances the last commit skipped because they were outside the view
+    size_t culledCount() const { return lastCulled; }
+    /// @brief Number of triangles drawn by the last frame, retained instances included
+    size_t triangleCount() const { return lastTriangles; }
     void clearAll() override;
     void commit() override;
     void terminate() override;
     void draw(wgpu::RenderPassEncoder &renderPass) override;
     size_t objectCount() override;
 
+    /// @brief Store an instance that is drawn every frame until it is removed. Returns its slot.
+    ///
+    /// Every removal and clearRetained increment the generation of a slot. The calls below throw std::runtime_error
+    /// for slots that do not exist or have another generation than the one they are given, e.g. a removed instance.
+    /// The id of the instance stays the same until it is removed.
+    uint32_t addRetained(PrimitiveType primitive, ResourceManager::InstancedVertexAttributes instance);
+    /// @brief The generation of a slot, see addRetained
+    uint32_t retainedGeneration(PrimitiveType primitive, uint32_t slot) const;
+    const ResourceManager::InstancedVertexAttributes &retained(PrimitiveType primitive, uint32_t slot, uint32_t generation) const;
+    void updateRetained(PrimitiveType primitive, uint32_t slot, uint32_t generation, const ResourceManager::InstancedVertexAttributes &instance);
+    void removeRetained(PrimitiveType primitive, uint32_t slot, uint32_t generation);
+    void clearRetained();
+    size_t retainedCount();
+
+    /// @brief The instances of a primitive added for this frame so far, in the order they were added
+    Span<const ResourceManager::InstancedVertexAttributes> frameInstances(PrimitiveType primitive) const { return instances[primitive]; }
+    /// @brief All retained slots of a primitive up to the last one in use, removed ones have a zero scale
+    Span<const ResourceManager::InstancedVertexAttributes> retainedSlots(PrimitiveType primitive) const { return retainedInstances[primitive].slots; }
+
 private:
-    std::vector<std::vector<ResourceManager::InstancedVertexAttributes>> instances;
+    /// filled right after appending, so growing it does not need to zero the new instances
+    using InstanceList = std::vector<ResourceManager::InstancedVertexAttributes, DefaultInitAllocator<ResourceManager::InstancedVertexAttributes>>;
+    std::vector<InstanceList> instances;
+    DepthSorter depthSorter;
+    InstanceList sortedInstances;
+    FrustumCuller culler;
+    InstanceList visibleInstances;
+    std::vector<CompactInstance, DefaultInitAllocator<CompactInstance>> packedInstances;
+    /// layout of the instance buffers written by the last commit, the draw calls have to match it
+    bool uploadedCompact = false;
+    size_t lastVisible = 0;
+    size_t lastCulled = 0;
+    size_t lastTriangles = 0;
+
+    // sphere instances of this frame bucketed by level of detail, with one mesh per level
+    std::vector<InstanceList> sphereLodInstances;
+    std::vector<ChunkedBuffer> sphereLodBuffers;
+    std::vector<wgpu::Buffer> sphereLodVertexBuffers;
+    std::vector<wgpu::Buffer> sphereLodIndexBuffers;
+    /// projected radius in pixels of a unit sphere at distance 1
+    float pixelsPerRadian = 1;
+    glm::vec3 cameraPosition = glm::vec3(0);
+    /// sortDepth was called for this frame
+    bool depthSorted = false;
+
+    /// @brief Instances that persist between frames in stable slots.
+    ///
+    /// Only the ranges that changed since the last frame are uploaded. Removed slots are hidden with a zero
+    /// scale and reused by the next addRetained, removed slots at the end are dropped so the buffer shrinks.
+    struct RetainedInstances
+    {
+        std::vector<ResourceManager::InstancedVertexAttributes> slots;
+        /// slots in the compact layout, only the dirty ranges are repacked
+        std::vector<CompactInstance> packedSlots;
+        std::vector<uint32_t> freeSlots;
+        /// per slot, whether it is in freeSlots
+        std::vector<bool> removed;
+        /// per slot, kept by clearRetained so the handles from before stay stale
+        std::vector<uint32_t> generations;
+        DirtyRanges dirty;
+        ChunkedBuffer buffer;
+    };
+    std::vector<RetainedInstances> retainedInstances;
     wgpu::Buffer cameraUniforms = nullptr;
     wgpu::Buffer lightingUniforms = nullptr;
 
-    std::vector<wgpu::Buffer> instanceBuffers;
+    std::vector<ChunkedBuffer> instanceBuffers;
+    /// queried from the device in init
+    uint64_t maxBufferSize = 0;
     std::vector<wgpu::Buffer> vertexBuffers;
     std::vector<wgpu::Buffer> indexBuffers;
 
+    wgpu::RenderPipeline compactPipeline = nullptr;
     wgpu::BindGroupLayout bindGroupLayout = nullptr;
     wgpu::BindGroup bindGroup = nullptr;
 
+    void createMesh(const VertexNormalList &vertexData, const TriangleList &triangles, wgpu::Buffer &vertexBuffer, wgpu::Buffer &indexBuffer);
     void addPrimitive(VertexNormalList vertexData, TriangleList triangles);
+    void bucketSphereLods(const InstanceList &spheres);
+    static size_t triangles(wgpu::Buffer &indexBuffer);
     void terminateGeometry();
     void initGeometry();
 
-    void update(std::vector<ResourceManager::InstancedVertexAttributes> &instances, wgpu::Buffer &instanceBuffer);
+    void update(InstanceList &instances, ChunkedBuffer &instanceBuffer);
+    size_t instancesPerChunk(size_t instanceSize) const;
+    void updateRetainedBuffer(RetainedInstances &retained);
+    void checkRetained(PrimitiveType primitive, uint32_t slot, uint32_t generation) const;
+    void pack(const ResourceManager::InstancedVertexAttributes *instances, size_t count, CompactInstance *out);
 
     void initBindGroupLayout();
     void initBindGroup();
 
-    void drawInstanced(wgpu::RenderPassEncoder renderPass, wgpu::Buffer &instanceBuffer, wgpu::Buffer &vertexBuffer, wgpu::Buffer &indexBuffer, size_t instances);
+    void drawInstanced(wgpu::RenderPassEncoder renderPass, ChunkedBuffer &instanceBuffer, wgpu::Buffer &vertexBuffer, wgpu::Buffer &indexBuffer);
 };
\ No newline at end of file
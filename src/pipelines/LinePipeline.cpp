@@ -1,5 +1,8 @@
 #include "LinePipeline.h"
 #include "Renderer.h"
+#include <util/Profiler.h>
+#include <stdexcept>
+#include <string>
 
 #ifndef RESOURCE_DIR
 #define RESOURCE_DIR "this will be defined by cmake depending on the build type. This define is to disable error squiggles"
@@ -109,8 +112,8 @@ void LinePipeline::terminate()
         shaderModule.release();
     if (pipeline != nullptr)
         pipeline.release();
-    if (linePointsBuffer != nullptr)
-        linePointsBuffer.release();
+    releaseBuffer(linePointsBuffer);
+    clearRetained();
     if (bindGroupLayout != nullptr)
         bindGroupLayout.release();
     if (bindGroup != nullptr)
@@ -119,13 +122,12 @@ void LinePipeline::terminate()
 
 void LinePipeline::commit()
 {
-    size_t count = lines.size();
-    size_t new_size = count * sizeof(LineVertexAttributes);
-    if (linePointsBuffer == nullptr || new_size != linePointsBuffer.getSize())
-        reallocateBuffer(linePointsBuffer, new_size);
-    if (count > 0)
+    PROFILE_ZONE("LinePipeline::commit");
+    upload(linePointsBuffer, lines.data(), lines.size(), sizeof(LineVertexAttributes));
+    for (auto &set : lineSets)
     {
-        queue.writeBuffer(linePointsBuffer, 0, lines.data(), new_size);
+        if (set.alive)
+            uploadDirty(set.buffer, set.points.data(), set.points.size(), sizeof(LineVertexAttributes), set.dirty);
     }
 }
 
@@ -140,17 +142,140 @@ void LinePipeline::addLine(Line line)
     lines.push_back(line.end);
 }
 
+ResourceManager::LineVertexAttributes *LinePipeline::appendLines(size_t count)
+{
+    size_t offset = lines.size();
+    lines.resize(offset + 2 * count);
+    return lines.data() + offset;
+}
+
+uint32_t LinePipeline::addLineSet(const std::vector<Line> &lines)
+{
+    uint32_t set;
+    if (!freeLineSets.empty())
+    {
+        set = freeLineSets.back();
+        freeLineSets.pop_back();
+    }
+    else
+    {
+        set = static_cast<uint32_t>(lineSets.size());
+        lineSets.push_back({});
+        if (set == lineSetGenerations.size())
+            lineSetGenerations.push_back(0);
+    }
+    lineSets[set].alive = true;
+    updateLineSet(set, lineSetGenerations[set], lines);
+    return set;
+}
+
+void LinePipeline::checkLineSet(uint32_t set, uint32_t generation) const
+{
+    if (set >= lineSets.size())
+        throw std::runtime_error("Line set " + std::to_string(set) + " does not exist");
+    if (!lineSets[set].alive || lineSetGenerations[set] != generation)
+        throw std::runtime_error("Line set " + std::to_string(set) + " was removed");
+}
+
+uint32_t LinePipeline::lineSetGeneration(uint32_t set) const
+{
+    if (set >= lineSets.size())
+        throw std::runtime_error("Line set " + std::to_string(set) + " does not exist");
+    return lineSetGenerations[set];
+}
+
+void LinePipeline::updateLineSet(uint32_t set, uint32_t generation, const std::vector<Line> &lines)
+{
+    checkLineSet(set, generation);
+    RetainedLineSet &lineSet = lineSets[set];
+    size_t oldPointCount = lineSet.points.size();
+    lineSet.points.resize(lines.size() * 2);
+    // the buffer holds nothing valid past the old size
+    if (lineSet.points.size() > oldPointCount)
+        lineSet.dirty.mark(oldPointCount, lineSet.points.size());
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        LineVertexAttributes &start = lineSet.points[2 * i];
+        LineVertexAttributes &end = lineSet.points[2 * i + 1];
+        const Line &line = lines[i];
+        if (start.position != line.start.position || start.color != line.start.color ||
+            end.position != line.end.position || end.color != line.end.color)
+        {
+            start = line.start;
+            end = line.end;
+            lineSet.dirty.mark(2 * i, 2 * i + 2);
+        }
+    }
+}
+
+void LinePipeline::updateLine(uint32_t set, uint32_t generation, size_t index, Line line)
+{
+    checkLineSet(set, generation);
+    RetainedLineSet &lineSet = lineSets[set];
+    if (index >= lineSet.points.size() / 2)
+        throw std::runtime_error("Line " + std::to_string(index) + " of line set " + std::to_string(set) + " does not exist, it has " +
+                                 std::to_string(lineSet.points.size() / 2) + " lines");
+    lineSet.points[2 * index] = line.start;
+    lineSet.points[2 * index + 1] = line.end;
+    lineSet.dirty.mark(2 * index, 2 * index + 2);
+}
+
+void LinePipeline::removeLineSet(uint32_t set, uint32_t generation)
+{
+    checkLineSet(set, generation);
+    RetainedLineSet &lineSet = lineSets[set];
+    lineSet.points.clear();
+    lineSet.dirty.clear();
+    releaseBuffer(lineSet.buffer);
+    lineSet.alive = false;
+    freeLineSets.push_back(set);
+    lineSetGenerations[set]++;
+}
+
+void LinePipeline::clearRetained()
+{
+    for (auto &set : lineSets)
+    {
+        releaseBuffer(set.buffer);
+    }
+    lineSets.clear();
+    freeLineSets.clear();
+    for (auto &generation : lineSetGenerations)
+        generation++;
+}
+
+size_t LinePipeline::retainedCount()
+{
+    size_t total = 0;
+    for (auto &set : lineSets)
+    {
+        total += set.points.size() / 2;
+    }
+    return total;
+}
+
 void LinePipeline::draw(RenderPassEncoder &renderPass)
 {
-    size_t linePointCount = linePointsBuffer.getSize() / sizeof(LineVertexAttributes);
+    PROFILE_ZONE("LinePipeline::draw");
+    size_t linePointCount = linePointsBuffer.count;
     if (linePointCount > 0)
     {
         renderPass.setBindGroup(0, bindGroup, 0, nullptr);
         renderPass.setPipeline(pipeline);
-        renderPass.setVertexBuffer(0, linePointsBuffer, 0, linePointsBuffer.getSize());
+        renderPass.setVertexBuffer(0, linePointsBuffer.buffer, 0, linePointCount * sizeof(LineVertexAttributes));
 
         renderPass.draw(linePointCount, 1, 0, 0);
     }
+    for (auto &set : lineSets)
+    {
+        size_t pointCount = set.buffer.count;
+        if (!set.alive || pointCount == 0)
+            continue;
+        renderPass.setBindGroup(0, bindGroup, 0, nullptr);
+        renderPass.setPipeline(pipeline);
+        renderPass.setVertexBuffer(0, set.buffer.buffer, 0, pointCount * sizeof(LineVertexAttributes));
+        renderPass.draw(pointCount, 1, 0, 0);
+    }
 }
 
 size_t LinePipeline::objectCount()
@@ -1,6 +1,8 @@
 #pragma once
 #include "Pipeline.h"
 #include "ResourceManager.h"
+#include <util/DefaultInitAllocator.h>
+#include <util/Span.h>
 
 struct Line
 {
@@ -21,19 +23,58 @@ public:
     void commit() override;
     void clearAll() override;
     void addLine(Line line);
+    /// @brief Append count lines for this frame and return their 2 * count points, valid until the next add call
+    ResourceManager::LineVertexAttributes *appendLines(size_t count);
     void draw(wgpu::RenderPassEncoder &renderPass) override;
     size_t objectCount() override;
 
+    /// @brief Store a set of lines that is drawn every frame until it is removed. Returns its index.
+    ///
+    /// Indices are reused like the slots of the retained instances: every removal and clearRetained increment the
+    /// generation of an index, and the calls below throw std::runtime_error for sets that do not exist or have
+    /// another generation than the one they are given.
+    uint32_t addLineSet(const std::vector<Line> &lines);
+    /// @brief The generation of a line set index, see addLineSet
+    uint32_t lineSetGeneration(uint32_t set) const;
+    /// @brief Replace the lines of a set, only lines that differ from the stored ones are uploaded
+    void updateLineSet(uint32_t set, uint32_t generation, const std::vector<Line> &lines);
+    /// @brief Replace a single line, throws std::runtime_error if the set has no line at index
+    void updateLine(uint32_t set, uint32_t generation, size_t index, Line line);
+    void removeLineSet(uint32_t set, uint32_t generation);
+    void clearRetained();
+    size_t retainedCount();
+
+    /// @brief The points of the lines added for this frame so far, two per line
+    Span<const ResourceManager::LineVertexAttributes> framePoints() const { return lines; }
+    /// @brief Number of line set indices, removed sets included
+    size_t lineSetCount() const { return lineSets.size(); }
+    /// @brief The points of a retained line set, empty if it was removed
+    Span<const ResourceManager::LineVertexAttributes> lineSetPoints(uint32_t set) const { return lineSets[set].points; }
+
 private:
-    std::vector<ResourceManager::LineVertexAttributes> lines;
+    std::vector<ResourceManager::LineVertexAttributes, DefaultInitAllocator<ResourceManager::LineVertexAttributes>> lines;
+
+    /// @brief Lines that persist between frames, each set has its own buffer so it can change its size
+    struct RetainedLineSet
+    {
+        std::vector<ResourceManager::LineVertexAttributes> points;
+        DirtyRanges dirty;
+        GrowableBuffer buffer;
+        bool alive = false;
+    };
+    std::vector<RetainedLineSet> lineSets;
+    std::vector<uint32_t> freeLineSets;
+    /// per line set index, kept by clearRetained so the handles from before stay stale
+    std::vector<uint32_t> lineSetGenerations;
 
-    wgpu::Buffer linePointsBuffer = nullptr;
+    GrowableBuffer linePointsBuffer;
     wgpu::Buffer cameraUniforms = nullptr;
     wgpu::Buffer lightingUniforms = nullptr;
 
     wgpu::BindGroupLayout bindGroupLayout = nullptr;
     wgpu::BindGroup bindGroup = nullptr;
 
+    void checkLineSet(uint32_t set, uint32_t generation) const;
     void initBindGroupLayout();
     void initBindGroup();
 };
\ No newline at end of file
@@ -1,5 +1,18 @@
 #include "Pipeline.h"
+#include <util/Profiler.h>
+#include <algorithm>
 using namespace wgpu;
+
+namespace
+{
+    /// smallest buffer that gets allocated, avoids a few reallocations for tiny scenes
+    const size_t minimumBufferSize = 4096;
+    /// uploads in a row below a quarter of the capacity before a buffer shrinks, about two seconds at 60 fps
+    const int shrinkDelay = 120;
+    /// dirty ranges closer than this are uploaded with one write, a few extra bytes are cheaper than another call
+    const size_t rangeMergeBytes = 4096;
+}
+
 void Pipeline::reallocateBuffer(wgpu::Buffer &buffer, size_t size)
 {
     if (buffer != nullptr)
@@ -12,4 +25,168 @@ void Pipeline::reallocateBuffer(wgpu::Buffer &buffer, size_t size)
     bufferDesc.usage = BufferUsage::Vertex | BufferUsage::CopyDst;
     bufferDesc.mappedAtCreation = false;
     buffer = device.createBuffer(bufferDesc);
-}
\ No newline at end of file
+    reallocations++;
+}
+
+void Pipeline::upload(GrowableBuffer &target, const void *data, size_t count, size_t elementSize)
+{
+    PROFILE_ZONE("Pipeline::upload");
+    size_t size = count * elementSize;
+    size_t capacity = target.capacity;
+    if (size > capacity)
+    {
+        capacity = std::max({size, capacity * 2, minimumBufferSize});
+    }
+    else if (size < capacity / 4 && capacity > minimumBufferSize)
+    {
+        if (++target.underusedUploads >= shrinkDelay)
+            capacity = std::max(size * 2, minimumBufferSize);
+    }
+    else
+    {
+        target.underusedUploads = 0;
+    }
+
+    if (capacity != target.capacity)
+    {
+        // growing must not go past the device limit, whatever is requested beyond it fails like before
+        SupportedLimits limits;
+        device.getLimits(&limits);
+        capacity = std::min<size_t>(capacity, std::max<size_t>(size, limits.limits.maxBufferSize));
+        // writeBuffer sizes and offsets have to be multiples of 4
+        capacity = (capacity + 3) & ~size_t(3);
+        reallocateBuffer(target.buffer, capacity);
+        target.capacity = capacity;
+        target.underusedUploads = 0;
+    }
+    target.count = count;
+    if (size > 0)
+        queue.writeBuffer(target.buffer, 0, data, size);
+    uploadedBytes += size;
+}
+
+void Pipeline::uploadDirty(GrowableBuffer &target, const void *data, size_t count, size_t elementSize, DirtyRanges &dirty)
+{
+    PROFILE_ZONE("Pipeline::uploadDirty");
+    if (target.buffer == nullptr || count * elementSize > target.capacity)
+    {
+        // a new buffer has none of the old content, everything goes up
+        upload(target, data, count, elementSize);
+        dirty.clear();
+        return;
+    }
+    target.count = count;
+    if (dirty.empty())
+        return;
+
+    auto &ranges = dirty.ranges;
+    std::sort(ranges.begin(), ranges.end());
+    const char *bytes = static_cast<const char *>(data);
+    auto write = [&](size_t begin, size_t end)
+    {
+        end = std::min(end, count);
+        if (end <= begin)
+            return;
+        size_t size = (end - begin) * elementSize;
+        queue.writeBuffer(target.buffer, begin * elementSize, bytes + begin * elementSize, size);
+        uploadedBytes += size;
+    };
+    size_t gap = std::max<size_t>(1, rangeMergeBytes / elementSize);
+    size_t begin = ranges[0].first;
+    size_t end = ranges[0].second;
+    for (size_t i = 1; i < ranges.size(); i++)
+    {
+        if (ranges[i].first <= end + gap)
+        {
+            end = std::max(end, ranges[i].second);
+        }
+        else
+        {
+            write(begin, end);
+            begin = ranges[i].first;
+            end = ranges[i].second;
+        }
+    }
+    write(begin, end);
+    dirty.clear();
+}
+
+void Pipeline::uploadChunked(ChunkedBuffer &target, const void *data, size_t count, size_t elementSize, size_t chunkSize)
+{
+    PROFILE_ZONE("Pipeline::uploadChunked");
+    chunkSize = std::max<size_t>(chunkSize, 1);
+    size_t used = (count + chunkSize - 1) / chunkSize;
+    if (target.chunks.size() < used)
+        target.chunks.resize(used);
+    const char *bytes = static_cast<const char *>(data);
+    for (size_t k = 0; k < target.chunks.size(); k++)
+    {
+        size_t begin = std::min(k * chunkSize, count);
+        size_t end = std::min(begin + chunkSize, count);
+        upload(target.chunks[k], bytes + begin * elementSize, end - begin, elementSize);
+    }
+    target.count = count;
+    target.chunkSize = chunkSize;
+}
+
+void Pipeline::uploadDirtyChunked(ChunkedBuffer &target, const void *data, size_t count, size_t elementSize, size_t chunkSize, DirtyRanges &dirty)
+{
+    PROFILE_ZONE("Pipeline::uploadDirtyChunked");
+    chunkSize = std::max<size_t>(chunkSize, 1);
+    if (chunkSize != target.chunkSize)
+    {
+        // the elements moved to other chunks
+        uploadChunked(target, data, count, elementSize, chunkSize);
+        dirty.clear();
+        return;
+    }
+    size_t used = (count + chunkSize - 1) / chunkSize;
+    if (target.chunks.size() < used)
+        target.chunks.resize(used);
+
+    auto &ranges = dirty.ranges;
+    std::sort(ranges.begin(), ranges.end());
+    const char *bytes = static_cast<const char *>(data);
+    size_t range = 0;
+    for (size_t k = 0; k < target.chunks.size(); k++)
+    {
+        size_t chunkBegin = std::min(k * chunkSize, count);
+        size_t chunkEnd = std::min(chunkBegin + chunkSize, count);
+        // the ranges are sorted, a range that reaches into the next chunk is visited again for it
+        chunkDirty.clear();
+        while (range < ranges.size() && ranges[range].first < chunkEnd)
+        {
+            size_t begin = std::max(ranges[range].first, chunkBegin);
+            size_t end = std::min(ranges[range].second, chunkEnd);
+            if (begin < end)
+                chunkDirty.mark(begin - chunkBegin, end - chunkBegin);
+            if (ranges[range].second > chunkEnd)
+                break;
+            range++;
+        }
+        uploadDirty(target.chunks[k], bytes + chunkBegin * elementSize, chunkEnd - chunkBegin, elementSize, chunkDirty);
+    }
+    target.count = count;
+    dirty.clear();
+}
+
+void Pipeline::releaseBuffer(ChunkedBuffer &target)
+{
+    for (auto &chunk : target.chunks)
+        releaseBuffer(chunk);
+    target.chunks.clear();
+    target.count = 0;
+    target.chunkSize = 0;
+}
+
+void Pipeline::releaseBuffer(GrowableBuffer &target)
+{
+    if (target.buffer != nullptr)
+    {
+        target.buffer.destroy();
+        target.buffer.release();
+        target.buffer = nullptr;
+    }
+    target.count = 0;
+    target.capacity = 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 #include <webgpu/webgpu.hpp>
+#include <utility>
+#include <vector>
 class Pipeline
 {
 public:
@@ -9,11 +11,82 @@ public:
     virtual void terminate() = 0;
     virtual void clearAll() = 0;
 
+    /// @brief Number of GPU buffers this pipeline created so far
+    size_t reallocationCount() const { return reallocations; }
+    /// @brief Number of bytes this pipeline wrote to GPU buffers so far
+    size_t uploadedByteCount() const { return uploadedBytes; }
+
 protected:
+    /// @brief Vertex buffer that is kept between frames.
+    ///
+    /// It grows geometrically when more elements are uploaded than fit and only shrinks after a number of
+    /// uploads in a row used less than a quarter of it, so a changing element count does not reallocate every frame.
+    struct GrowableBuffer
+    {
+        wgpu::Buffer buffer = nullptr;
+        /// number of elements written by the last upload, draw calls use this instead of the buffer size
+        size_t count = 0;
+        /// size of the buffer in bytes
+        size_t capacity = 0;
+        /// uploads in a row that used less than a quarter of the capacity
+        int underusedUploads = 0;
+    };
+
+    /// @brief Element ranges [begin, end) of retained data that changed since the last upload
+    struct DirtyRanges
+    {
+        std::vector<std::pair<size_t, size_t>> ranges;
+
+        void mark(size_t begin, size_t end)
+        {
+            // consecutive updates usually touch neighbouring elements, extend the last range instead of adding one
+            if (!ranges.empty() && ranges.back().second == begin)
+                ranges.back().second = end;
+            else
+                ranges.emplace_back(begin, end);
+        }
+        void mark(size_t index) { mark(index, index + 1); }
+        bool empty() const { return ranges.empty(); }
+        void clear() { ranges.clear(); }
+    };
+
+    /// @brief Elements split across several growable buffers of at most chunkSize elements each.
+    ///
+    /// A single buffer is limited by the device's maxBufferSize, chunks lift that limit. They are drawn with one
+    /// call per chunk. Chunks that are not needed by an upload keep their buffer with a count of 0.
+    struct ChunkedBuffer
+    {
+        std::vector<GrowableBuffer> chunks;
+        /// total number of elements written by the last upload
+        size_t count = 0;
+        /// elements per chunk of the last upload
+        size_t chunkSize = 0;
+    };
+
     void reallocateBuffer(wgpu::Buffer &buffer, size_t size);
+    /// @brief Write count elements to the start of the buffer, reallocating it according to the growth policy
+    void upload(GrowableBuffer &target, const void *data, size_t count, size_t elementSize);
+    /// @brief Write only the dirty elements of data to the buffer and clear the dirty ranges.
+    ///
+    /// Nearby ranges are merged into one write. If the buffer is too small it is reallocated and all count elements
+    /// are uploaded. elementSize has to be a multiple of 4.
+    void uploadDirty(GrowableBuffer &target, const void *data, size_t count, size_t elementSize, DirtyRanges &dirty);
+    /// @brief Write count elements to consecutive chunks of chunkSize elements
+    void uploadChunked(ChunkedBuffer &target, const void *data, size_t count, size_t elementSize, size_t chunkSize);
+    /// @brief uploadDirty for chunks. If the chunk size changed all elements are uploaded.
+    void uploadDirtyChunked(ChunkedBuffer &target, const void *data, size_t count, size_t elementSize, size_t chunkSize, DirtyRanges &dirty);
+    void releaseBuffer(GrowableBuffer &target);
+    void releaseBuffer(ChunkedBuffer &target);
+
     wgpu::RenderPipeline pipeline = nullptr;
     wgpu::ShaderModule shaderModule = nullptr;
     wgpu::Device device = nullptr;
     wgpu::Queue queue = nullptr;
     wgpu::TextureFormat swapChainFormat = wgpu::TextureFormat::Undefined;
-};
\ No newline at end of file
+    size_t reallocations = 0;
+    size_t uploadedBytes = 0;
+
+private:
+    /// dirty ranges of the chunk uploadDirtyChunked currently writes, kept to avoid allocations
+    DirtyRanges chunkDirty;
+};
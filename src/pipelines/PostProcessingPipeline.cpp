@@ -1,5 +1,6 @@
 #include "PostProcessingPipeline.h"
 #include "ResourceManager.h"
+#include <util/Profiler.h>
 
 #ifndef RESOURCE_DIR
 #define RESOURCE_DIR "this will be defined by cmake depending on the build type. This define is to disable error squiggles"
@@ -72,6 +73,7 @@ bool PostProcessingPipeline::init(Device &device, TextureFormat &swapChainFormat
 
 void PostProcessingPipeline::draw(RenderPassEncoder &renderPass)
 {
+    PROFILE_ZONE("PostProcessingPipeline::draw");
     renderPass.setPipeline(pipeline);
     renderPass.setBindGroup(0, bindGroup, 0, nullptr);
     renderPass.draw(6, 1, 0, 0);
@@ -0,0 +1,552 @@
+#include <util/ContactSolver.h>
+#include <util/Profiler.h>
+#include <util/Simd.h>
+#include <util/StateStream.h>
+#include <util/ThreadPool.h>
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+using vec3 = glm::vec3;
+using mat3 = glm::mat3;
+
+namespace
+{
+    const uint32_t overflowColor = 64;
+
+    double secondsSince(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+}
+
+void ContactSolver::addContact(uint32_t a, uint32_t b, const CollisionInfo &contact)
+{
+    addContact(a, b, contact, settings.friction);
+}
+
+void ContactSolver::addContact(uint32_t a, uint32_t b, const CollisionInfo &contact, float frictionCoefficient)
+{
+    // degenerate SAT results (parallel edges) come with a zero or NaN normal
+    float normalLength2 = glm::length2(contact.normalWorld);
+    if (!contact.isColliding || !(normalLength2 > 0) || !std::isfinite(normalLength2))
+        return;
+    bodyA.push_back(a);
+    bodyB.push_back(b);
+    point.push_back(contact.collisionPointWorld);
+    normal.push_back(glm::normalize(contact.normalWorld));
+    depth.push_back(contact.depth);
+    friction.push_back(frictionCoefficient);
+}
+
+void ContactSolver::reset()
+{
+    clearContacts();
+    cacheKey.clear();
+    cachePoint.clear();
+    cacheNormalImpulse.clear();
+    cacheFrictionImpulse.clear();
+    lastStats = Stats();
+}
+
+void ContactSolver::saveCache(StateWriter &writer) const
+{
+    writer.write(cacheKey);
+    writer.write(cachePoint);
+    writer.write(cacheNormalImpulse);
+    writer.write(cacheFrictionImpulse);
+}
+
+void ContactSolver::loadCache(StateReader &reader)
+{
+    // read aside first, a cache that does not fit leaves the solver as it was
+    std::vector<uint64_t> key;
+    std::vector<glm::vec3> point;
+    std::vector<float> normalImpulse;
+    std::vector<glm::vec3> frictionImpulse;
+    reader.read(key);
+    reader.read(point);
+    reader.read(normalImpulse);
+    reader.read(frictionImpulse);
+    if (point.size() != key.size() || normalImpulse.size() != key.size() || frictionImpulse.size() != key.size())
+        throw std::runtime_error("The warm starting cache has arrays of different sizes");
+    reset();
+    cacheKey.swap(key);
+    cachePoint.swap(point);
+    cacheNormalImpulse.swap(normalImpulse);
+    cacheFrictionImpulse.swap(frictionImpulse);
+}
+
+void ContactSolver::clearContacts()
+{
+    bodyA.clear();
+    bodyB.clear();
+    point.clear();
+    normal.clear();
+    depth.clear();
+    friction.clear();
+}
+
+void ContactSolver::solve(std::vector<ContactBody> &bodies, float dt)
+{
+    PROFILE_ZONE("ContactSolver::solve");
+    auto startTime = std::chrono::high_resolution_clock::now();
+    lastStats = Stats();
+    lastStats.contacts = bodyA.size();
+
+    int width = 1;
+    if (settings.coloring && settings.simd)
+        width = simd::Widest::width;
+
+    gatherBodies(bodies);
+    auto coloringStart = std::chrono::high_resolution_clock::now();
+    buildBatches(width);
+    lastStats.coloringTime = secondsSince(coloringStart);
+    prepare(bodies, dt);
+    if (settings.warmStarting)
+        warmStart();
+    lastStats.prepareTime = secondsSince(startTime);
+
+    auto iterationStart = std::chrono::high_resolution_clock::now();
+    iterate(width);
+    lastStats.iterationTime = secondsSince(iterationStart);
+    lastStats.timePerIteration = lastStats.iterations > 0 ? lastStats.iterationTime / lastStats.iterations : 0;
+
+    scatterBodies(bodies);
+    storeCache();
+    clearContacts();
+}
+
+void ContactSolver::gatherBodies(const std::vector<ContactBody> &bodies)
+{
+    slotOfBody.assign(bodies.size(), 0);
+    bodyOfSlot.clear();
+    velocity.clear();
+    dynamic.clear();
+
+    // slot 0 is the static world
+    bodyOfSlot.push_back(staticBody);
+    velocity.push_back({vec3(0), 0, vec3(0), 0});
+    dynamic.push_back(false);
+
+    for (size_t i = 0; i < bodyA.size(); ++i)
+    {
+        for (uint32_t body : {bodyA[i], bodyB[i]})
+        {
+            if (body == staticBody || slotOfBody[body] != 0)
+                continue;
+            const ContactBody &b = bodies[body];
+            slotOfBody[body] = (uint32_t)bodyOfSlot.size();
+            bodyOfSlot.push_back(body);
+            velocity.push_back({b.linearVelocity, 0, b.angularVelocity, 0});
+            dynamic.push_back(b.inverseMass > 0 || b.inverseInertiaWorld != mat3(0));
+        }
+    }
+    lastStats.bodies = bodyOfSlot.size() - 1;
+}
+
+void ContactSolver::scatterBodies(std::vector<ContactBody> &bodies)
+{
+    for (size_t s = 1; s < bodyOfSlot.size(); ++s)
+    {
+        ContactBody &b = bodies[bodyOfSlot[s]];
+        b.linearVelocity = velocity[s].linear;
+        b.angularVelocity = velocity[s].angular;
+    }
+}
+
+void ContactSolver::buildBatches(int width)
+{
+    PROFILE_ZONE("ContactSolver::buildBatches");
+    size_t count = bodyA.size();
+    auto slot = [this](uint32_t body)
+    { return body == staticBody ? 0u : slotOfBody[body]; };
+
+    rowOfContact.resize(count);
+    batchStart.clear();
+    if (!settings.coloring)
+    {
+        std::iota(rowOfContact.begin(), rowOfContact.end(), 0);
+        batchStart = {0, count};
+        slotA.resize(count);
+        slotB.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            slotA[i] = slot(bodyA[i]);
+            slotB[i] = slot(bodyB[i]);
+        }
+        return;
+    }
+
+    // greedy coloring: lowest color not used by one of the two dynamic bodies yet
+    std::vector<uint64_t> usedColors(velocity.size(), 0);
+    std::vector<uint32_t> color(count);
+    std::vector<size_t> colorSize(overflowColor + 1, 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t a = slot(bodyA[i]), b = slot(bodyB[i]);
+        uint64_t used = (dynamic[a] ? usedColors[a] : 0) | (dynamic[b] ? usedColors[b] : 0);
+        uint32_t c = 0;
+        while (c < overflowColor && (used & (uint64_t(1) << c)))
+            ++c;
+        if (c < overflowColor)
+        {
+            if (dynamic[a])
+                usedColors[a] |= uint64_t(1) << c;
+            if (dynamic[b])
+                usedColors[b] |= uint64_t(1) << c;
+        }
+        color[i] = c;
+        ++colorSize[c];
+    }
+
+    // batches in color order, each padded to the SIMD width, overflow contacts last and unpadded
+    std::vector<size_t> next(overflowColor + 1);
+    size_t rows = 0;
+    for (uint32_t c = 0; c <= overflowColor; ++c)
+    {
+        if (colorSize[c] == 0 && c != overflowColor)
+            continue;
+        batchStart.push_back(rows);
+        next[c] = rows;
+        size_t size = colorSize[c];
+        if (c != overflowColor)
+            size = (size + width - 1) / width * width;
+        rows += size;
+    }
+    batchStart.push_back(rows);
+    lastStats.colors = batchStart.size() - 2;
+    lastStats.overflowContacts = colorSize[overflowColor];
+
+    slotA.assign(rows, 0);
+    slotB.assign(rows, 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t row = next[color[i]]++;
+        rowOfContact[i] = row;
+        slotA[row] = slot(bodyA[i]);
+        slotB[row] = slot(bodyB[i]);
+    }
+}
+
+void ContactSolver::prepare(const std::vector<ContactBody> &bodies, float dt)
+{
+    PROFILE_ZONE("ContactSolver::prepare");
+    size_t rows = slotA.size();
+    for (Vec3Array *array : {&rowNormal, &rowTangent1, &rowTangent2, &angularA, &angularA1, &angularA2, &angularB, &angularB1, &angularB2,
+                             &inertiaA, &inertiaA1, &inertiaA2, &inertiaB, &inertiaB1, &inertiaB2})
+        array->assign(rows);
+    for (std::vector<float> *array : {&inverseMassA, &inverseMassB, &normalMass, &tangentMass1, &tangentMass2, &bias, &rowFriction,
+                                      &normalImpulse, &tangentImpulse1, &tangentImpulse2})
+        array->assign(rows, 0);
+
+    const mat3 zero(0);
+    for (size_t i = 0; i < bodyA.size(); ++i)
+    {
+        size_t row = rowOfContact[i];
+        uint32_t a = slotA[row], b = slotB[row];
+        const ContactBody *A = bodyA[i] == staticBody ? nullptr : &bodies[bodyA[i]];
+        const ContactBody *B = bodyB[i] == staticBody ? nullptr : &bodies[bodyB[i]];
+        vec3 rA = A ? point[i] - A->position : vec3(0);
+        vec3 rB = B ? point[i] - B->position : vec3(0);
+        const mat3 &invIA = A ? A->inverseInertiaWorld : zero;
+        const mat3 &invIB = B ? B->inverseInertiaWorld : zero;
+        float invMA = A ? A->inverseMass : 0;
+        float invMB = B ? B->inverseMass : 0;
+        const vec3 &n = normal[i];
+
+        vec3 dv = velocity[a].linear + glm::cross(velocity[a].angular, rA) - velocity[b].linear - glm::cross(velocity[b].angular, rB);
+        float vn = glm::dot(dv, n);
+
+        // tangent basis aligned with the sliding direction if there is one
+        vec3 vt = dv - vn * n;
+        vec3 t1;
+        if (glm::length2(vt) > 1e-8f)
+            t1 = glm::normalize(vt);
+        else
+            t1 = glm::normalize(std::abs(n.x) > 0.57735f ? vec3(n.y, -n.x, 0) : vec3(0, n.z, -n.y));
+        vec3 t2 = glm::cross(n, t1);
+
+        // sets the jacobian rows of one direction and returns its effective mass
+        auto direction = [&](const vec3 &d, Vec3Array &jA, Vec3Array &jB, Vec3Array &iA, Vec3Array &iB)
+        {
+            vec3 raxd = glm::cross(rA, d);
+            vec3 rbxd = glm::cross(rB, d);
+            jA.set(row, raxd);
+            jB.set(row, rbxd);
+            iA.set(row, invIA * raxd);
+            iB.set(row, invIB * rbxd);
+            float k = invMA + invMB + glm::dot(raxd, invIA * raxd) + glm::dot(rbxd, invIB * rbxd);
+            return k > 0 ? 1.0f / k : 0.0f;
+        };
+        rowNormal.set(row, n);
+        rowTangent1.set(row, t1);
+        rowTangent2.set(row, t2);
+        normalMass[row] = direction(n, angularA, angularB, inertiaA, inertiaB);
+        tangentMass1[row] = direction(t1, angularA1, angularB1, inertiaA1, inertiaB1);
+        tangentMass2[row] = direction(t2, angularA2, angularB2, inertiaA2, inertiaB2);
+        inverseMassA[row] = invMA;
+        inverseMassB[row] = invMB;
+        rowFriction[row] = friction[i];
+
+        float restitutionBias = vn < -settings.restitutionThreshold ? -settings.restitution * vn : 0.0f;
+        if (depth[i] < 0)
+        {
+            // speculative contact of bodies that are still apart: they may approach by the gap within this step,
+            // so the solver closes it without overshooting, and a bounce only starts if they would close it
+            float speculativeBias = depth[i] / dt;
+            bias[row] = vn < speculativeBias && restitutionBias > 0 ? restitutionBias : speculativeBias;
+        }
+        else
+        {
+            float positionBias = settings.baumgarte / dt * std::max(depth[i] - settings.slop, 0.0f);
+            bias[row] = std::max(positionBias, restitutionBias);
+        }
+    }
+}
+
+void ContactSolver::warmStart()
+{
+    PROFILE_ZONE("ContactSolver::warmStart");
+    const float maxDistance2 = settings.warmStartDistance * settings.warmStartDistance;
+    for (size_t i = 0; i < bodyA.size(); ++i)
+    {
+        uint64_t key = pairKey(bodyA[i], bodyB[i]);
+        auto range = std::equal_range(cacheKey.begin(), cacheKey.end(), key);
+        size_t best = SIZE_MAX;
+        float bestDistance2 = maxDistance2;
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            size_t c = it - cacheKey.begin();
+            float distance2 = glm::distance2(cachePoint[c], point[i]);
+            if (distance2 <= bestDistance2)
+            {
+                best = c;
+                bestDistance2 = distance2;
+            }
+        }
+        if (best == SIZE_MAX)
+            continue;
+
+        size_t row = rowOfContact[i];
+        normalImpulse[row] = cacheNormalImpulse[best];
+        tangentImpulse1[row] = glm::dot(cacheFrictionImpulse[best], rowTangent1.get(row));
+        tangentImpulse2[row] = glm::dot(cacheFrictionImpulse[best], rowTangent2.get(row));
+        applyImpulse(row, normalImpulse[row], tangentImpulse1[row], tangentImpulse2[row]);
+        ++lastStats.warmStartedContacts;
+    }
+}
+
+void ContactSolver::applyImpulse(size_t row, float normalLambda, float lambda1, float lambda2)
+{
+    vec3 impulse = normalLambda * rowNormal.get(row) + lambda1 * rowTangent1.get(row) + lambda2 * rowTangent2.get(row);
+    SolverVelocity &a = velocity[slotA[row]];
+    SolverVelocity &b = velocity[slotB[row]];
+    a.linear += inverseMassA[row] * impulse;
+    a.angular += normalLambda * inertiaA.get(row) + lambda1 * inertiaA1.get(row) + lambda2 * inertiaA2.get(row);
+    b.linear -= inverseMassB[row] * impulse;
+    b.angular -= normalLambda * inertiaB.get(row) + lambda1 * inertiaB1.get(row) + lambda2 * inertiaB2.get(row);
+}
+
+// Solves the rows [begin, end) in blocks of V::width rows. Rows of one block must not share a dynamic body.
+// Returns the largest absolute impulse change.
+template <class V>
+float ContactSolver::solveRows(size_t begin, size_t end)
+{
+    struct V3
+    {
+        V x, y, z;
+    };
+    auto load = [](const Vec3Array &a, size_t k) -> V3
+    { return {V::load(&a.x[k]), V::load(&a.y[k]), V::load(&a.z[k])}; };
+    auto dot = [](const V3 &a, const V3 &b)
+    { return a.x * b.x + a.y * b.y + a.z * b.z; };
+    auto add = [](V3 &a, const V3 &d, V s)
+    { a.x = a.x + d.x * s, a.y = a.y + d.y * s, a.z = a.z + d.z * s; };
+
+    const float *base = &velocity[0].linear.x;
+    const int stride = sizeof(SolverVelocity) / sizeof(float);
+    const int angularOffset = offsetof(SolverVelocity, angular) / sizeof(float);
+    V maxDelta = 0.0f;
+
+    for (size_t k = begin; k < end; k += V::width)
+    {
+        const uint32_t *a = &slotA[k];
+        const uint32_t *b = &slotB[k];
+        V3 vA = {V::gather(base + 0, a, stride), V::gather(base + 1, a, stride), V::gather(base + 2, a, stride)};
+        V3 wA = {V::gather(base + angularOffset, a, stride), V::gather(base + angularOffset + 1, a, stride), V::gather(base + angularOffset + 2, a, stride)};
+        V3 vB = {V::gather(base + 0, b, stride), V::gather(base + 1, b, stride), V::gather(base + 2, b, stride)};
+        V3 wB = {V::gather(base + angularOffset, b, stride), V::gather(base + angularOffset + 1, b, stride), V::gather(base + angularOffset + 2, b, stride)};
+
+        V invMA = V::load(&inverseMassA[k]);
+        V invMB = V::load(&inverseMassB[k]);
+        V3 n = load(rowNormal, k), t1 = load(rowTangent1, k), t2 = load(rowTangent2, k);
+        V3 jA1 = load(angularA1, k), jB1 = load(angularB1, k), jA2 = load(angularA2, k), jB2 = load(angularB2, k);
+
+        // relative velocity along a direction: J v = d.(vA - vB) + (rA x d).wA - (rB x d).wB
+        V3 dv = {vA.x - vB.x, vA.y - vB.y, vA.z - vB.z};
+        V maxFriction = V::load(&rowFriction[k]) * V::load(&normalImpulse[k]);
+
+        V old1 = V::load(&tangentImpulse1[k]);
+        V lambda1 = -(V::load(&tangentMass1[k]) * (dot(dv, t1) + dot(wA, jA1) - dot(wB, jB1)));
+        V new1 = min(max(old1 + lambda1, -maxFriction), maxFriction);
+        lambda1 = new1 - old1;
+        new1.store(&tangentImpulse1[k]);
+
+        V old2 = V::load(&tangentImpulse2[k]);
+        V lambda2 = -(V::load(&tangentMass2[k]) * (dot(dv, t2) + dot(wA, jA2) - dot(wB, jB2)));
+        V new2 = min(max(old2 + lambda2, -maxFriction), maxFriction);
+        lambda2 = new2 - old2;
+        new2.store(&tangentImpulse2[k]);
+
+        V3 frictionImpulse = {t1.x * lambda1 + t2.x * lambda2, t1.y * lambda1 + t2.y * lambda2, t1.z * lambda1 + t2.z * lambda2};
+        add(vA, frictionImpulse, invMA);
+        add(wA, load(inertiaA1, k), lambda1);
+        add(wA, load(inertiaA2, k), lambda2);
+        add(vB, frictionImpulse, -invMB);
+        add(wB, load(inertiaB1, k), -lambda1);
+        add(wB, load(inertiaB2, k), -lambda2);
+
+        dv = {vA.x - vB.x, vA.y - vB.y, vA.z - vB.z};
+        V oldN = V::load(&normalImpulse[k]);
+        V lambda = V::load(&normalMass[k]) * (V::load(&bias[k]) - (dot(dv, n) + dot(wA, load(angularA, k)) - dot(wB, load(angularB, k))));
+        V newN = max(oldN + lambda, V(0.0f));
+        lambda = newN - oldN;
+        newN.store(&normalImpulse[k]);
+
+        add(vA, n, invMA * lambda);
+        add(wA, load(inertiaA, k), lambda);
+        add(vB, n, -(invMB * lambda));
+        add(wB, load(inertiaB, k), -lambda);
+
+        maxDelta = max(maxDelta, max(abs(lambda), max(abs(lambda1), abs(lambda2))));
+
+        for (int lane = 0; lane < V::width; ++lane)
+        {
+            if (dynamic[a[lane]])
+            {
+                velocity[a[lane]].linear = {vA.x.lane(lane), vA.y.lane(lane), vA.z.lane(lane)};
+                velocity[a[lane]].angular = {wA.x.lane(lane), wA.y.lane(lane), wA.z.lane(lane)};
+            }
+            if (dynamic[b[lane]])
+            {
+                velocity[b[lane]].linear = {vB.x.lane(lane), vB.y.lane(lane), vB.z.lane(lane)};
+                velocity[b[lane]].angular = {wB.x.lane(lane), wB.y.lane(lane), wB.z.lane(lane)};
+            }
+        }
+    }
+    return horizontalMax(maxDelta);
+}
+
+void ContactSolver::iterate(int width)
+{
+    PROFILE_ZONE("ContactSolver::iterate");
+    auto solveRange = [this, width](size_t begin, size_t end)
+    {
+#ifdef SIMD_AVX
+        if (width == 8)
+            return solveRows<simd::Float8>(begin, end);
+#endif
+#ifdef SIMD_SSE
+        if (width == 4)
+            return solveRows<simd::Float4>(begin, end);
+#endif
+        return solveRows<simd::Float1>(begin, end);
+    };
+    auto finishIteration = [this](float delta)
+    {
+        lastStats.lastImpulseDelta = delta;
+        if (settings.recordConvergence)
+            lastStats.convergence.push_back(delta);
+        ++lastStats.iterations;
+        return delta <= settings.tolerance;
+    };
+
+    lastStats.simdWidth = width;
+    const size_t batches = batchStart.size() - 1;
+    unsigned threads = 1;
+    // the barrier needs the number of threads the run gets, which is 1 inside a task of the pool
+    if (settings.coloring && settings.threads != 1)
+        threads = ThreadPool::global().threadCount(settings.threads);
+    lastStats.threads = threads;
+
+    if (threads <= 1)
+    {
+        for (int iteration = 0; iteration < settings.iterations; ++iteration)
+        {
+            float delta = 0;
+            for (size_t batch = 0; batch < batches; ++batch)
+            {
+                bool overflow = settings.coloring && batch == batches - 1;
+                if (overflow)
+                    delta = std::max(delta, solveRows<simd::Float1>(batchStart[batch], batchStart[batch + 1]));
+                else
+                    delta = std::max(delta, solveRange(batchStart[batch], batchStart[batch + 1]));
+            }
+            if (finishIteration(delta))
+                break;
+        }
+        return;
+    }
+
+    // one task for all iterations, threads split every color batch and meet at a barrier after it
+    SpinBarrier barrier(threads);
+    std::vector<float> threadDelta(threads * 16, 0.0f);
+    bool stop = false;
+    ThreadPool::global().run([&](unsigned thread, unsigned threadCount)
+                             {
+        for (int iteration = 0; iteration < settings.iterations; ++iteration)
+        {
+            float delta = 0;
+            for (size_t batch = 0; batch + 1 < batches; ++batch)
+            {
+                size_t blocks = (batchStart[batch + 1] - batchStart[batch]) / width;
+                size_t begin = batchStart[batch] + blocks * thread / threadCount * width;
+                size_t end = batchStart[batch] + blocks * (thread + 1) / threadCount * width;
+                if (begin < end)
+                    delta = std::max(delta, solveRange(begin, end));
+                barrier.wait();
+            }
+            threadDelta[thread * 16] = delta;
+            barrier.wait();
+            if (thread == 0)
+            {
+                delta = solveRows<simd::Float1>(batchStart[batches - 1], batchStart[batches]);
+                for (unsigned t = 0; t < threadCount; ++t)
+                    delta = std::max(delta, threadDelta[t * 16]);
+                stop = finishIteration(delta);
+            }
+            barrier.wait();
+            if (stop)
+                break;
+        } },
+                             threads);
+}
+
+void ContactSolver::storeCache()
+{
+    size_t count = bodyA.size();
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](size_t i, size_t j)
+              { return pairKey(bodyA[i], bodyB[i]) < pairKey(bodyA[j], bodyB[j]); });
+
+    cacheKey.resize(count);
+    cachePoint.resize(count);
+    cacheNormalImpulse.resize(count);
+    cacheFrictionImpulse.resize(count);
+    contactNormalImpulse.resize(count);
+    for (size_t k = 0; k < count; ++k)
+    {
+        size_t i = order[k];
+        size_t row = rowOfContact[i];
+        cacheKey[k] = pairKey(bodyA[i], bodyB[i]);
+        cachePoint[k] = point[i];
+        cacheNormalImpulse[k] = normalImpulse[row];
+        cacheFrictionImpulse[k] = tangentImpulse1[row] * rowTangent1.get(row) + tangentImpulse2[row] * rowTangent2.get(row);
+        contactNormalImpulse[i] = normalImpulse[row];
+    }
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <util/CollisionInfo.h>
+
+class StateWriter;
+class StateReader;
+
+/// @brief Velocity state of a rigid body as seen by the ContactSolver
+///
+/// Scenes keep their own body representation and fill one of these per body before solving.
+/// Only the velocities are written back.
+struct ContactBody
+{
+    /// world space center of mass, contact offsets are relative to it
+    glm::vec3 position = glm::vec3(0);
+    glm::vec3 linearVelocity = glm::vec3(0);
+    glm::vec3 angularVelocity = glm::vec3(0);
+    /// 0 for static or kinematic bodies
+    float inverseMass = 0;
+    /// inverse inertia tensor in world space
+    glm::mat3 inverseInertiaWorld = glm::mat3(0);
+};
+
+/// @brief Sequential impulse (projected Gauss-Seidel) solver for contact and friction constraints
+///
+/// Usage per step: add all contacts found by the collision detection with addContact, then call solve.
+/// The normal of a CollisionInfo is the direction of the impulse applied to body A, as returned by
+/// collisionTools::checkCollisionSAT(A, B). Friction uses a pyramid approximation: two orthogonal
+/// tangent directions that are clamped independently against friction * normal impulse.
+///
+/// A contact with a negative depth is speculative, the bodies are that far apart. Its target velocity lets them
+/// approach by the gap within the step, so a resting body closes the gap instead of hovering above its support.
+/// Baumgarte stabilization only pushes apart contacts that penetrate by more than Settings::slop.
+///
+/// Accumulated impulses are cached between steps and used to warm start contacts that persist,
+/// matched by body pair and contact point. This lets stacks converge in a few iterations.
+///
+/// With Settings::coloring the contacts are greedily colored so that contacts of one color share no
+/// dynamic body. Each color batch is then solved with SIMD over several contacts at once and split
+/// across threads. Contacts of one color are independent, so the result is the same for any number of
+/// threads. Scalar and SIMD batches only differ where the compiler fuses multiply-adds differently.
+class ContactSolver
+{
+public:
+    /// Body index for contacts with the static world
+    static constexpr uint32_t staticBody = UINT32_MAX;
+
+    struct Settings
+    {
+        /// Maximum number of PGS iterations per solve
+        int iterations = 10;
+        /// Stop early once the largest impulse change of an iteration is below this value, 0 always runs all iterations
+        float tolerance = 0;
+        /// Default friction coefficient for addContact
+        float friction = 0.5f;
+        /// Coefficient of restitution
+        float restitution = 0;
+        /// Closing speeds below this do not bounce
+        float restitutionThreshold = 1.0f;
+        /// Fraction of the penetration resolved per step (Baumgarte stabilization)
+        float baumgarte = 0.2f;
+        /// Penetration depth that is tolerated without correction
+        float slop = 0.005f;
+        /// Reuse the accumulated impulses of persisting contacts from the previous solve
+        bool warmStarting = true;
+        /// Contacts of the same body pair closer than this are treated as the same contact as last step
+        float warmStartDistance = 0.05f;
+        /// Solve contacts in color batches instead of the order they were added, required for simd and threads
+        bool coloring = false;
+        /// Solve several contacts of a color batch at once with the widest SIMD type of the build
+        bool simd = true;
+        /// Number of threads for colored solving, 0 uses all threads of ThreadPool::global()
+        unsigned threads = 1;
+        /// Record the largest impulse change of every iteration in Stats::convergence
+        bool recordConvergence = false;
+    };
+
+    /// @brief Measurements of the last solve call
+    struct Stats
+    {
+        size_t contacts = 0;
+        size_t bodies = 0;
+        size_t warmStartedContacts = 0;
+        /// number of color batches, 0 without coloring
+        size_t colors = 0;
+        /// contacts that did not fit into the 64 colors and are solved serially after the batches
+        size_t overflowContacts = 0;
+        int simdWidth = 1;
+        unsigned threads = 1;
+        int iterations = 0;
+        /// largest absolute impulse change in the last iteration, a convergence measure
+        float lastImpulseDelta = 0;
+        double prepareTime = 0;
+        double coloringTime = 0;
+        double iterationTime = 0;
+        double timePerIteration = 0;
+        /// largest impulse change per iteration if Settings::recordConvergence is set
+        std::vector<float> convergence;
+    };
+
+    Settings settings;
+
+    /// @brief Add a contact between bodyA and bodyB (or staticBody) with the default friction coefficient
+    void addContact(uint32_t bodyA, uint32_t bodyB, const CollisionInfo &contact);
+    /// @brief Add a contact with an explicit friction coefficient
+    void addContact(uint32_t bodyA, uint32_t bodyB, const CollisionInfo &contact, float friction);
+
+    /// @brief Solve all contacts added since the last solve and update the body velocities
+    /// @param bodies
+    ///     All bodies, indexed by the body indices passed to addContact
+    /// @param dt
+    ///     Time step, used for position correction
+    void solve(std::vector<ContactBody> &bodies, float dt);
+
+    /// @brief Forget all contacts and the warm starting cache
+    void reset();
+    /// @brief Append the warm starting cache, the only state kept between solves
+    void saveCache(StateWriter &writer) const;
+    /// @brief Replace the warm starting cache with one written by saveCache, throws std::runtime_error and keeps the old one if it does not fit
+    void loadCache(StateReader &reader);
+
+    size_t contactCount() const { return bodyA.size(); }
+    const Stats &stats() const { return lastStats; }
+
+    /// @brief Accumulated normal impulses of the last solve, in the order contacts were added
+    const std::vector<float> &normalImpulses() const { return contactNormalImpulse; }
+
+protected:
+    // contacts as added, in their original order
+    std::vector<uint32_t> bodyA, bodyB;
+    std::vector<glm::vec3> point, normal;
+    std::vector<float> depth, friction;
+
+    // x, y and z components in separate arrays for SIMD loads
+    struct Vec3Array
+    {
+        std::vector<float> x, y, z;
+        void assign(size_t count) { x.assign(count, 0), y.assign(count, 0), z.assign(count, 0); }
+        void set(size_t i, const glm::vec3 &v) { x[i] = v.x, y[i] = v.y, z[i] = v.z; }
+        glm::vec3 get(size_t i) const { return {x[i], y[i], z[i]}; }
+    };
+
+    // constraint rows in solve order, structure of arrays. With coloring every color batch is padded
+    // to the SIMD width with empty rows between the static slot and itself.
+    // Angular jacobians (r x d) and their images under the inverse inertia are precomputed per row,
+    // so solving never touches the inertia tensors.
+    std::vector<uint32_t> slotA, slotB;
+    Vec3Array rowNormal, rowTangent1, rowTangent2;
+    Vec3Array angularA, angularA1, angularA2, angularB, angularB1, angularB2;
+    Vec3Array inertiaA, inertiaA1, inertiaA2, inertiaB, inertiaB1, inertiaB2;
+    std::vector<float> inverseMassA, inverseMassB;
+    std::vector<float> normalMass, tangentMass1, tangentMass2, bias, rowFriction;
+    std::vector<float> normalImpulse, tangentImpulse1, tangentImpulse2;
+    // row of each contact, and the row ranges of the color batches (last batch is the serial overflow)
+    std::vector<size_t> rowOfContact;
+    std::vector<size_t> batchStart;
+    std::vector<float> contactNormalImpulse;
+
+    // solver bodies, densely packed in order of first use, slot 0 is the static world
+    struct SolverVelocity
+    {
+        glm::vec3 linear;
+        float pad0;
+        glm::vec3 angular;
+        float pad1;
+    };
+    std::vector<SolverVelocity> velocity;
+    std::vector<uint8_t> dynamic;
+    std::vector<uint32_t> slotOfBody;
+    std::vector<uint32_t> bodyOfSlot;
+
+    // warm starting cache from the previous solve, sorted by pair key
+    std::vector<uint64_t> cacheKey;
+    std::vector<glm::vec3> cachePoint;
+    std::vector<float> cacheNormalImpulse;
+    std::vector<glm::vec3> cacheFrictionImpulse;
+
+    Stats lastStats;
+
+    static uint64_t pairKey(uint32_t a, uint32_t b) { return (uint64_t(a) << 32) | b; }
+
+    void gatherBodies(const std::vector<ContactBody> &bodies);
+    void scatterBodies(std::vector<ContactBody> &bodies);
+    void buildBatches(int width);
+    void prepare(const std::vector<ContactBody> &bodies, float dt);
+    void warmStart();
+    void applyImpulse(size_t row, float normalLambda, float lambda1, float lambda2);
+    template <class V>
+    float solveRows(size_t begin, size_t end);
+    void iterate(int width);
+    void storeCache();
+    void clearContacts();
+};
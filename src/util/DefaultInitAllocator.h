@@ -0,0 +1,34 @@
+#pragma once
+#include <memory>
+#include <new>
+#include <utility>
+
+/// @brief Allocator that default-initializes instead of value-initializing
+///
+/// std::vector::resize with the standard allocator zeroes every new element. For buffers that are filled right
+/// after resizing, e.g. per-frame instance arrays, that doubles the memory traffic.
+template <class T, class Base = std::allocator<T>>
+class DefaultInitAllocator : public Base
+{
+    using Traits = std::allocator_traits<Base>;
+
+public:
+    template <class U>
+    struct rebind
+    {
+        using other = DefaultInitAllocator<U, typename Traits::template rebind_alloc<U>>;
+    };
+
+    using Base::Base;
+
+    template <class U>
+    void construct(U *pointer) noexcept(std::is_nothrow_default_constructible<U>::value)
+    {
+        ::new (static_cast<void *>(pointer)) U;
+    }
+    template <class U, class... Args>
+    void construct(U *pointer, Args &&...args)
+    {
+        Traits::construct(static_cast<Base &>(*this), pointer, std::forward<Args>(args)...);
+    }
+};
@@ -0,0 +1,164 @@
+#include <util/DepthSort.h>
+#include <util/ThreadPool.h>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    /// fewer keys than this are not worth waking up other threads
+    const size_t parallelThreshold = 1 << 16;
+
+    inline uint32_t digit(uint64_t key, int pass, int bits)
+    {
+        return uint32_t(key >> (32 + pass * bits)) & ((1u << bits) - 1);
+    }
+
+    inline const glm::vec3 &strided(const glm::vec3 *first, size_t stride, size_t index)
+    {
+        return *reinterpret_cast<const glm::vec3 *>(reinterpret_cast<const char *>(first) + index * stride);
+    }
+
+    inline float stridedAlpha(const float *first, size_t stride, size_t index)
+    {
+        return *reinterpret_cast<const float *>(reinterpret_cast<const char *>(first) + index * stride);
+    }
+
+    inline uint64_t makeKey(const glm::vec3 &camera, const glm::vec3 &position, uint32_t index)
+    {
+        glm::vec3 delta = camera - position;
+        float distance2 = glm::dot(delta, delta);
+        uint32_t bits;
+        std::memcpy(&bits, &distance2, sizeof(bits));
+        return (uint64_t(~bits) << 32) | index;
+    }
+}
+
+const std::vector<uint32_t> &DepthSorter::sort(const glm::vec3 &camera, const glm::vec3 *positions, const float *alphas, size_t stride, size_t count,
+                                               bool transparentOnly, unsigned threads)
+{
+    order.clear();
+    keys.clear();
+    if (transparentOnly)
+    {
+        // opaque instances are drawn first and in their original order, the transparent ones sorted after them
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (stridedAlpha(alphas, stride, i) < 1.0f)
+                keys.push_back(makeKey(camera, strided(positions, stride, i), uint32_t(i)));
+            else
+                order.push_back(uint32_t(i));
+        }
+    }
+    else
+    {
+        keys.resize(count);
+        auto fill = [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+                keys[i] = makeKey(camera, strided(positions, stride, i), uint32_t(i));
+        };
+        if (threads != 1 && count >= parallelThreshold)
+            ThreadPool::global().parallelFor(count, parallelThreshold / 4, fill, threads);
+        else
+            fill(0, count);
+    }
+
+    if (threads != 1 && keys.size() >= parallelThreshold)
+        radixSortParallel(threads);
+    else
+        radixSortSerial();
+
+    size_t opaque = order.size();
+    order.resize(opaque + keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+        order[opaque + i] = uint32_t(keys[i]);
+    return order;
+}
+
+void DepthSorter::radixSortSerial()
+{
+    size_t count = keys.size();
+    scratch.resize(count);
+    histograms.assign(size_t(passes) * digitCount, 0);
+
+    // one read of the keys counts the digits of all passes
+    for (uint64_t key : keys)
+        for (int pass = 0; pass < passes; ++pass)
+            histograms[pass * digitCount + digit(key, pass, digitBits)]++;
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        uint32_t *histogram = histograms.data() + pass * digitCount;
+        // a pass where all keys share the digit would only copy them
+        if (count == 0 || histogram[digit(keys[0], pass, digitBits)] == count)
+            continue;
+        uint32_t offset = 0;
+        for (int d = 0; d < digitCount; ++d)
+        {
+            uint32_t digitTotal = histogram[d];
+            histogram[d] = offset;
+            offset += digitTotal;
+        }
+        for (uint64_t key : keys)
+            scratch[histogram[digit(key, pass, digitBits)]++] = key;
+        keys.swap(scratch);
+    }
+}
+
+void DepthSorter::radixSortParallel(unsigned threads)
+{
+    ThreadPool &pool = ThreadPool::global();
+    size_t count = keys.size();
+    unsigned threadCount = pool.threadCount(threads);
+    scratch.resize(count);
+    histograms.assign(size_t(threadCount) * digitCount, 0);
+    SpinBarrier barrier(threadCount);
+    bool skipPass = false;
+
+    pool.run([&](unsigned thread, unsigned participants)
+             {
+        // every thread keeps the same contiguous range of positions in every pass, the offsets of equal digits
+        // are assigned in thread order so the scatter stays stable
+        size_t begin = count * thread / participants;
+        size_t end = count * (thread + 1) / participants;
+        uint32_t *histogram = histograms.data() + size_t(thread) * digitCount;
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            std::fill(histogram, histogram + digitCount, 0);
+            for (size_t i = begin; i < end; ++i)
+                histogram[digit(keys[i], pass, digitBits)]++;
+            barrier.wait();
+            if (thread == 0)
+            {
+                uint32_t firstDigit = digit(keys[0], pass, digitBits);
+                uint32_t firstDigitTotal = 0;
+                for (unsigned t = 0; t < participants; ++t)
+                    firstDigitTotal += histograms[size_t(t) * digitCount + firstDigit];
+                skipPass = firstDigitTotal == count;
+                uint32_t offset = 0;
+                for (int d = 0; d < digitCount && !skipPass; ++d)
+                {
+                    for (unsigned t = 0; t < participants; ++t)
+                    {
+                        uint32_t &entry = histograms[size_t(t) * digitCount + d];
+                        uint32_t digitTotal = entry;
+                        entry = offset;
+                        offset += digitTotal;
+                    }
+                }
+            }
+            barrier.wait();
+            if (skipPass)
+                continue;
+            for (size_t i = begin; i < end; ++i)
+            {
+                uint64_t key = keys[i];
+                scratch[histogram[digit(key, pass, digitBits)]++] = key;
+            }
+            barrier.wait();
+            if (thread == 0)
+                keys.swap(scratch);
+            barrier.wait();
+        } },
+             threadCount);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+/// @brief Back to front ordering of instances for drawing transparent objects
+///
+/// Every instance gets a 64 bit key: the inverted bits of its squared camera distance in the upper half
+/// and its index in the lower half. Squared distances are never negative, so their float bits compare
+/// like the floats and the inverted bits sort the farthest instance first. The keys are sorted with a
+/// least significant digit radix sort over the upper half only. Keys are created in index order and
+/// every pass is stable, so equal distances keep their original order, exactly like a std::stable_sort
+/// by distance would.
+///
+/// All buffers are kept between calls, sorting the same number of instances every frame allocates nothing.
+class DepthSorter
+{
+public:
+    /// @brief Compute the draw order of count instances
+    /// @param camera
+    ///     Position the distances are measured from
+    /// @param positions
+    ///     Position of the first instance, the following ones are stride bytes apart
+    /// @param alphas
+    ///     Alpha of the first instance with the same stride, only read when transparentOnly is set
+    /// @param transparentOnly
+    ///     Only sort instances with alpha < 1. Opaque instances come first in their original order.
+    /// @param threads
+    ///     Number of threads of ThreadPool::global() to use, 0 for all
+    /// @return
+    ///     Instance indices in draw order, valid until the next call
+    const std::vector<uint32_t> &sort(const glm::vec3 &camera, const glm::vec3 *positions, const float *alphas, size_t stride, size_t count,
+                                      bool transparentOnly = false, unsigned threads = 1);
+
+    /// @brief Number of keys that went through the radix sort in the last call
+    size_t sortedCount() const { return keys.size(); }
+
+private:
+    static constexpr int digitBits = 11;
+    static constexpr int digitCount = 1 << digitBits;
+    /// three 11 bit digits cover the 32 distance bits
+    static constexpr int passes = 3;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> scratch;
+    std::vector<uint32_t> order;
+    /// per thread digit counts, turned into scatter offsets in place
+    std::vector<uint32_t> histograms;
+
+    void radixSortSerial();
+    void radixSortParallel(unsigned threads);
+};
@@ -0,0 +1,327 @@
+#include <util/FrameCapture.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    const size_t maxRun = UINT32_MAX;
+
+    inline uint32_t wordAt(const uint8_t *bytes, size_t word)
+    {
+        uint32_t value;
+        std::memcpy(&value, bytes + 4 * word, sizeof(value));
+        return value;
+    }
+
+    inline void putWord(std::vector<uint8_t> &out, uint32_t value)
+    {
+        size_t offset = out.size();
+        out.resize(offset + sizeof(value));
+        std::memcpy(out.data() + offset, &value, sizeof(value));
+    }
+}
+
+namespace frameCapture
+{
+    void encodeDelta(const uint8_t *data, const uint8_t *previous, size_t size, std::vector<uint8_t> &out)
+    {
+        size_t words = size / 4;
+        size_t i = 0;
+        while (i < words)
+        {
+            size_t unchangedStart = i;
+            while (i < words && i - unchangedStart < maxRun && wordAt(data, i) == wordAt(previous, i))
+                ++i;
+            // a single unchanged word between changes costs less as a literal than as a new run
+            size_t literalStart = i;
+            while (i < words && i - literalStart < maxRun &&
+                   !(wordAt(data, i) == wordAt(previous, i) && (i + 1 == words || wordAt(data, i + 1) == wordAt(previous, i + 1))))
+                ++i;
+            putWord(out, uint32_t(literalStart - unchangedStart));
+            putWord(out, uint32_t(i - literalStart));
+            for (size_t word = literalStart; word < i; ++word)
+                putWord(out, wordAt(data, word) ^ wordAt(previous, word));
+        }
+        for (size_t byte = words * 4; byte < size; ++byte)
+            out.push_back(data[byte] ^ previous[byte]);
+    }
+
+    void applyDelta(const uint8_t *encoded, size_t encodedSize, uint8_t *data, size_t size)
+    {
+        size_t words = size / 4;
+        size_t i = 0;
+        size_t position = 0;
+        while (i < words)
+        {
+            if (encodedSize - position < 8)
+                throw std::runtime_error("Delta ends inside a run header");
+            size_t unchanged = wordAt(encoded + position, 0);
+            size_t literals = wordAt(encoded + position, 1);
+            position += 8;
+            if ((unchanged == 0 && literals == 0) || unchanged + literals > words - i || literals * 4 > encodedSize - position)
+                throw std::runtime_error("Delta run does not fit the stream");
+            i += unchanged;
+            for (size_t word = 0; word < literals; ++word, ++i)
+            {
+                uint32_t value = wordAt(data, i) ^ wordAt(encoded + position, word);
+                std::memcpy(data + 4 * i, &value, sizeof(value));
+            }
+            position += literals * 4;
+        }
+        if (encodedSize - position != size - words * 4)
+            throw std::runtime_error("Delta does not end with the stream");
+        for (size_t byte = words * 4; byte < size; ++byte)
+            data[byte] ^= encoded[position++];
+    }
+}
+
+FrameCaptureWriter::FrameCaptureWriter(const std::string &path, uint32_t keyframeInterval, size_t maxPending)
+    : path(path), keyframeInterval(std::max(keyframeInterval, 1u)), maxPending(std::max<size_t>(maxPending, 1))
+{
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        throw std::runtime_error("Could not open " + path + " for writing");
+    frameCapture::FileHeader header{};
+    std::memcpy(header.magic, frameCapture::fileMagic, sizeof(header.magic));
+    header.version = frameCapture::fileVersion;
+    header.keyframeInterval = this->keyframeInterval;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        std::fclose(file);
+        throw std::runtime_error("Could not write " + path);
+    }
+    writtenBytes = sizeof(header);
+    thread = std::thread(&FrameCaptureWriter::writerLoop, this);
+}
+
+FrameCaptureWriter::~FrameCaptureWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (const std::exception &)
+    {
+        // nobody is left to report it to, the file ends with the last complete frame
+    }
+}
+
+void FrameCaptureWriter::submit()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!error.empty())
+        throw std::runtime_error(error);
+    written.wait(lock, [&]
+                 { return pending.size() < maxPending; });
+    pending.push_back(std::move(current));
+    if (recycled.empty())
+    {
+        current = frameCapture::Frame();
+    }
+    else
+    {
+        current = std::move(recycled.back());
+        recycled.pop_back();
+        current.clear();
+    }
+    wake.notify_one();
+}
+
+void FrameCaptureWriter::close()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    wake.notify_one();
+    thread.join();
+    if (std::fclose(file) != 0 && error.empty())
+        error = "Could not write " + path;
+    file = nullptr;
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+void FrameCaptureWriter::writerLoop()
+{
+    uint64_t index = 0;
+    for (;;)
+    {
+        frameCapture::Frame frame;
+        bool failed;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]
+                      { return !pending.empty() || closing; });
+            if (pending.empty())
+                return;
+            frame = std::move(pending.front());
+            pending.pop_front();
+            failed = !error.empty();
+        }
+        // after an error the frames are still taken, so submit does not wait forever before it reports it
+        if (!failed)
+        {
+            try
+            {
+                write(frame, index++);
+            }
+            catch (const std::exception &e)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = e.what();
+            }
+        }
+        std::swap(previous, frame);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            recycled.push_back(std::move(frame));
+        }
+        written.notify_one();
+    }
+}
+
+void FrameCaptureWriter::write(const frameCapture::Frame &frame, uint64_t index)
+{
+    using namespace frameCapture;
+    bool keyframe = index % keyframeInterval == 0;
+    StreamHeader streamHeaders[streamCount];
+    // one buffer for the deltas of all streams, pointers into it are taken once it stopped growing
+    encoded.clear();
+    size_t totalSize = 0;
+    for (const auto &data : frame.streams)
+        totalSize += data.size();
+    encoded.reserve(totalSize);
+    size_t deltaOffsets[streamCount] = {};
+    uint64_t chunkSize = sizeof(FrameHeader);
+    for (uint32_t stream = 0; stream < streamCount; ++stream)
+    {
+        const std::vector<uint8_t> &data = frame.streams[stream];
+        StreamHeader &streamHeader = streamHeaders[stream];
+        streamHeader = {raw, 0, data.size(), data.size()};
+        if (!keyframe && !data.empty() && previous.streams[stream].size() == data.size())
+        {
+            size_t offset = encoded.size();
+            encodeDelta(data.data(), previous.streams[stream].data(), data.size(), encoded);
+            if (encoded.size() - offset < data.size())
+            {
+                streamHeader.encoding = xorRuns;
+                streamHeader.encodedSize = encoded.size() - offset;
+                deltaOffsets[stream] = offset;
+            }
+            else
+            {
+                encoded.resize(offset);
+            }
+        }
+        chunkSize += sizeof(StreamHeader) + streamHeader.encodedSize;
+    }
+
+    FrameHeader frameHeader{};
+    frameHeader.chunkSize = chunkSize;
+    frameHeader.index = index;
+    frameHeader.keyframe = keyframe ? 1 : 0;
+    frameHeader.flags = frame.flags;
+    std::memcpy(frameHeader.parameters, frame.parameters, sizeof(frameHeader.parameters));
+    bool ok = std::fwrite(&frameHeader, sizeof(frameHeader), 1, file) == 1;
+    for (uint32_t stream = 0; stream < streamCount && ok; ++stream)
+    {
+        const StreamHeader &streamHeader = streamHeaders[stream];
+        const uint8_t *payload = streamHeader.encoding == xorRuns ? encoded.data() + deltaOffsets[stream] : frame.streams[stream].data();
+        ok = std::fwrite(&streamHeader, sizeof(streamHeader), 1, file) == 1 &&
+             (streamHeader.encodedSize == 0 || std::fwrite(payload, streamHeader.encodedSize, 1, file) == 1);
+    }
+    if (!ok)
+        throw std::runtime_error("Could not write " + path);
+    writtenFrames++;
+    writtenBytes += chunkSize;
+}
+
+FrameCaptureReader::FrameCaptureReader(const std::string &path) : path(path), file(path)
+{
+    using namespace frameCapture;
+    if (file.size() < sizeof(FileHeader))
+        throw std::runtime_error(path + " is too small for a capture file");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0)
+        throw std::runtime_error(path + " is not a capture file");
+    if (header.version != fileVersion)
+        throw std::runtime_error(path + " has unsupported version " + std::to_string(header.version));
+
+    // a capture that was cut off ends with its last complete frame
+    size_t offset = sizeof(FileHeader);
+    while (file.size() - offset >= sizeof(FrameHeader))
+    {
+        Chunk chunk;
+        chunk.begin = file.data() + offset;
+        std::memcpy(&chunk.header, chunk.begin, sizeof(FrameHeader));
+        if (chunk.header.chunkSize < sizeof(FrameHeader) || chunk.header.chunkSize > file.size() - offset)
+            break;
+        chunks.push_back(chunk);
+        offset += chunk.header.chunkSize;
+    }
+}
+
+const frameCapture::Frame &FrameCaptureReader::frame(size_t index)
+{
+    if (index >= chunks.size())
+        throw std::runtime_error(path + " has no frame " + std::to_string(index));
+    if (index == decodedIndex)
+        return decoded;
+    size_t keyframe = index;
+    while (keyframe > 0 && !chunks[keyframe].header.keyframe)
+        --keyframe;
+    // stepping forward within the interval continues from the decoded frame
+    size_t begin = decodedIndex != SIZE_MAX && decodedIndex < index && decodedIndex >= keyframe ? decodedIndex + 1 : keyframe;
+    for (size_t i = begin; i <= index; ++i)
+        decode(i);
+    return decoded;
+}
+
+void FrameCaptureReader::decode(size_t index)
+{
+    using namespace frameCapture;
+    const Chunk &chunk = chunks[index];
+    decodedIndex = SIZE_MAX;
+    auto corrupt = [&]()
+    { return std::runtime_error(path + " is corrupt in frame " + std::to_string(index)); };
+
+    size_t offset = sizeof(FrameHeader);
+    for (uint32_t stream = 0; stream < streamCount; ++stream)
+    {
+        StreamHeader streamHeader;
+        if (chunk.header.chunkSize - offset < sizeof(StreamHeader))
+            throw corrupt();
+        std::memcpy(&streamHeader, chunk.begin + offset, sizeof(StreamHeader));
+        offset += sizeof(StreamHeader);
+        if (streamHeader.encodedSize > chunk.header.chunkSize - offset)
+            throw corrupt();
+        const uint8_t *payload = chunk.begin + offset;
+        std::vector<uint8_t> &data = decoded.streams[stream];
+        if (streamHeader.encoding == raw && streamHeader.encodedSize == streamHeader.size)
+        {
+            data.assign(payload, payload + streamHeader.size);
+        }
+        else if (streamHeader.encoding == xorRuns && data.size() == streamHeader.size)
+        {
+            try
+            {
+                applyDelta(payload, streamHeader.encodedSize, data.data(), data.size());
+            }
+            catch (const std::runtime_error &)
+            {
+                throw corrupt();
+            }
+        }
+        else
+        {
+            throw corrupt();
+        }
+        offset += streamHeader.encodedSize;
+    }
+    decoded.flags = chunk.header.flags;
+    std::memcpy(decoded.parameters, chunk.header.parameters, sizeof(decoded.parameters));
+    decodedIndex = index;
+}
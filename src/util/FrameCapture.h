@@ -0,0 +1,206 @@
+#pragma once
+#include <util/MappedFile.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief Binary stream of captured frames, written by FrameCaptureWriter and replayed by FrameCaptureReader
+///
+/// A frame is a few byte streams: the instance arrays of cubes, spheres and quads, the line points, the image
+/// attributes and the pixels of all images. The file is a FileHeader followed by one chunk per frame, a FrameHeader
+/// and for every stream a StreamHeader with its payload. A stream that has the same size as in the previous frame is
+/// stored as the XOR with the previous frame, in runs of unchanged 32 bit words and literal words, so objects that did
+/// not move cost 8 bytes per run. Key frames store every stream as it is, so seeking decodes at most one key frame
+/// interval of deltas. Chunks carry their size, a file cut off by a crash is read up to its last complete frame.
+namespace frameCapture
+{
+    const char fileMagic[8] = {'F', 'R', 'M', 'C', 'A', 'P', '\r', '\n'};
+    const uint32_t fileVersion = 1;
+
+    enum Stream : uint32_t
+    {
+        cubes,
+        spheres,
+        quads,
+        linePoints,
+        images,
+        imagePixels,
+        streamCount,
+    };
+
+    enum Encoding : uint32_t
+    {
+        /// the stream as it is
+        raw = 0,
+        /// pairs of (unchanged words, literal words) counts, each followed by the literals XOR the previous frame
+        xorRuns = 1,
+    };
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t keyframeInterval;
+        uint64_t reserved[2];
+    };
+
+    struct FrameHeader
+    {
+        /// bytes of the whole chunk, this header included
+        uint64_t chunkSize;
+        uint64_t index;
+        uint32_t keyframe;
+        /// left to the producer, e.g. render flags that change how the frame is drawn
+        uint32_t flags;
+        float parameters[4];
+    };
+
+    struct StreamHeader
+    {
+        uint32_t encoding;
+        uint32_t reserved;
+        uint64_t size;
+        uint64_t encodedSize;
+    };
+
+    struct Frame
+    {
+        std::vector<uint8_t> streams[streamCount];
+        uint32_t flags = 0;
+        float parameters[4] = {0, 0, 0, 0};
+
+        /// @brief Replace a stream with count elements of a trivially copyable type
+        template <class T>
+        void assign(Stream stream, const T *data, size_t count)
+        {
+            streams[stream].resize(count * sizeof(T));
+            if (count > 0)
+                std::memcpy(streams[stream].data(), data, count * sizeof(T));
+        }
+
+        /// @brief Append count elements of a trivially copyable type to a stream
+        template <class T>
+        void append(Stream stream, const T *data, size_t count)
+        {
+            size_t offset = streams[stream].size();
+            streams[stream].resize(offset + count * sizeof(T));
+            if (count > 0)
+                std::memcpy(streams[stream].data() + offset, data, count * sizeof(T));
+        }
+
+        /// @brief The elements of a stream, valid until the frame changes
+        template <class T>
+        const T *view(Stream stream, size_t &count) const
+        {
+            count = streams[stream].size() / sizeof(T);
+            return reinterpret_cast<const T *>(streams[stream].data());
+        }
+
+        void clear()
+        {
+            for (auto &stream : streams)
+                stream.clear();
+            flags = 0;
+        }
+    };
+
+    /// @brief Append the XOR runs of data against previous, both size bytes long, to out
+    void encodeDelta(const uint8_t *data, const uint8_t *previous, size_t size, std::vector<uint8_t> &out);
+
+    /// @brief Apply encoded XOR runs to data, which holds the previous frame's stream, throws std::runtime_error if they do not fit
+    void applyDelta(const uint8_t *encoded, size_t encodedSize, uint8_t *data, size_t size);
+}
+
+/// @brief Writes frames to a capture file on a background thread
+///
+/// The caller fills frame() and hands it over with submit(), the delta encoding and the writing happen on the
+/// writer's thread. Frames are recycled, so a capture of frames with a steady size does not allocate. When the
+/// thread falls behind by maxPending frames, submit waits for it.
+class FrameCaptureWriter
+{
+public:
+    /// @brief Create or truncate the file, throws std::runtime_error if that fails
+    /// @param keyframeInterval
+    ///     Every keyframeInterval-th frame is stored without deltas, 1 stores only key frames
+    explicit FrameCaptureWriter(const std::string &path, uint32_t keyframeInterval = 60, size_t maxPending = 4);
+    ~FrameCaptureWriter();
+    FrameCaptureWriter(const FrameCaptureWriter &) = delete;
+    FrameCaptureWriter &operator=(const FrameCaptureWriter &) = delete;
+
+    /// @brief The frame to fill, it is cleared after each submit
+    frameCapture::Frame &frame() { return current; }
+
+    /// @brief Queue frame() for writing, throws std::runtime_error if writing an earlier frame failed
+    void submit();
+
+    /// @brief Write the queued frames and close the file, throws std::runtime_error if writing failed
+    void close();
+
+    size_t framesWritten() const { return writtenFrames; }
+    uint64_t bytesWritten() const { return writtenBytes; }
+
+private:
+    void writerLoop();
+    void write(const frameCapture::Frame &frame, uint64_t index);
+
+    std::string path;
+    std::FILE *file = nullptr;
+    uint32_t keyframeInterval;
+    size_t maxPending;
+
+    frameCapture::Frame current;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable written;
+    std::deque<frameCapture::Frame> pending;
+    std::vector<frameCapture::Frame> recycled;
+    bool closing = false;
+    std::string error;
+
+    // only touched by the writer thread
+    frameCapture::Frame previous;
+    std::vector<uint8_t> encoded;
+    std::atomic<size_t> writtenFrames{0};
+    std::atomic<uint64_t> writtenBytes{0};
+};
+
+/// @brief Random access to the frames of a memory-mapped capture file
+///
+/// Frames are decoded into one frame buffer. Asking for the frame after the decoded one applies a single delta, any
+/// other frame starts over at the closest key frame before it.
+class FrameCaptureReader
+{
+public:
+    /// @brief Map the file and index its frames, throws std::runtime_error if it is no capture file
+    explicit FrameCaptureReader(const std::string &path);
+
+    size_t frameCount() const { return chunks.size(); }
+    uint32_t keyframeInterval() const { return header.keyframeInterval; }
+
+    /// @brief Decode a frame, the reference stays valid until the next call
+    const frameCapture::Frame &frame(size_t index);
+
+private:
+    struct Chunk
+    {
+        const uint8_t *begin;
+        frameCapture::FrameHeader header;
+    };
+
+    void decode(size_t index);
+
+    std::string path;
+    MappedFile file;
+    frameCapture::FileHeader header;
+    std::vector<Chunk> chunks;
+    frameCapture::Frame decoded;
+    size_t decodedIndex = SIZE_MAX;
+};
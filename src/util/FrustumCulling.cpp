@@ -0,0 +1,126 @@
+#include <util/FrustumCulling.h>
+#include <util/Simd.h>
+#include <util/ThreadPool.h>
+#include <algorithm>
+
+namespace
+{
+    /// fewer instances than this are not worth waking up other threads
+    const size_t parallelThreshold = 1 << 15;
+}
+
+void FrustumCuller::setView(const glm::mat4 &viewProjection)
+{
+    // rows of the matrix, clip = viewProjection * p
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; ++i)
+        row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    // -w <= x <= w, -w <= y <= w and 0 <= z <= w
+    planes[0] = row[3] + row[0];
+    planes[1] = row[3] - row[0];
+    planes[2] = row[3] + row[1];
+    planes[3] = row[3] - row[1];
+    planes[4] = row[2];
+    planes[5] = row[3] - row[2];
+    for (glm::vec4 &plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+}
+
+void FrustumCuller::setCullingPlane(bool enabled, const glm::vec3 &offsets, uint32_t flag)
+{
+    cullingPlane = enabled;
+    cullingOffsets = offsets;
+    dontCullFlag = flag;
+}
+
+template <class V>
+void FrustumCuller::testRange(const float *positions, const float *scales, const uint32_t *flags, size_t stride, size_t begin, size_t end, Shape shape)
+{
+    const int width = V::width;
+    int floatStride = int(stride / sizeof(float));
+    uint32_t index[width];
+    float inside[width];
+    float inOctant[width];
+    size_t i = begin;
+    for (; i + width <= end; i += width)
+    {
+        for (int lane = 0; lane < width; ++lane)
+            index[lane] = uint32_t(i + lane);
+        V x = V::gather(positions, index, floatStride);
+        V y = V::gather(positions + 1, index, floatStride);
+        V z = V::gather(positions + 2, index, floatStride);
+        V sx = V::gather(scales, index, floatStride);
+        V sy = V::gather(scales + 1, index, floatStride);
+        V sz = V::gather(scales + 2, index, floatStride);
+        V radius;
+        if (shape == box)
+            radius = V(0.5f) * sqrt(sx * sx + sy * sy + sz * sz);
+        else if (shape == ellipsoid)
+            radius = max(max(abs(sx), abs(sy)), abs(sz));
+        else
+            radius = V(0.5f) * sqrt(sx * sx + sy * sy);
+
+        // smallest signed distance to a plane plus the radius, negative if the sphere is outside of that plane
+        V minimum = V(planes[0].x) * x + V(planes[0].y) * y + V(planes[0].z) * z + V(planes[0].w) + radius;
+        for (int p = 1; p < 6; ++p)
+            minimum = min(minimum, V(planes[p].x) * x + V(planes[p].y) * y + V(planes[p].z) * z + V(planes[p].w) + radius);
+        minimum.store(inside);
+        if (cullingPlane)
+        {
+            // positive if the sphere lies completely in the hidden octant
+            V octant = min(min(x - V(cullingOffsets.x), y - V(cullingOffsets.y)), z - V(cullingOffsets.z)) - radius;
+            octant.store(inOctant);
+        }
+
+        for (int lane = 0; lane < width; ++lane)
+        {
+            // comparisons with NaN are false, instances with NaN positions are culled
+            bool isVisible = inside[lane] >= 0;
+            if (cullingPlane && inOctant[lane] > 0)
+            {
+                uint32_t instanceFlags = *reinterpret_cast<const uint32_t *>(reinterpret_cast<const char *>(flags) + (i + lane) * stride);
+                isVisible = isVisible && (instanceFlags & dontCullFlag) != 0;
+            }
+            visibility[i + lane] = isVisible;
+        }
+    }
+    // the remainder one by one with the same operations
+    if (i < end && width > 1)
+        testRange<simd::Float1>(positions, scales, flags, stride, i, end, shape);
+}
+
+const std::vector<uint32_t> &FrustumCuller::cull(const glm::vec3 *positions, const glm::vec3 *scales, const uint32_t *flags, size_t stride, size_t count,
+                                                 Shape shape, unsigned threads, bool vectorized)
+{
+    visibility.resize(count);
+    const float *positionData = &positions->x;
+    const float *scaleData = &scales->x;
+    auto test = [&](size_t begin, size_t end)
+    {
+        if (vectorized)
+            testRange<simd::Widest>(positionData, scaleData, flags, stride, begin, end, shape);
+        else
+            testRange<simd::Float1>(positionData, scaleData, flags, stride, begin, end, shape);
+    };
+    if (threads != 1 && count >= parallelThreshold)
+    {
+        // ranges start at multiples of the SIMD width, so the same instances end up in the scalar remainder for any thread count
+        const size_t width = simd::Widest::width;
+        size_t batches = (count + width - 1) / width;
+        ThreadPool::global().parallelFor(batches, parallelThreshold / 4 / width, [&](size_t begin, size_t end)
+                                         { test(begin * width, std::min(end * width, count)); },
+                                         threads);
+    }
+    else
+    {
+        test(0, count);
+    }
+
+    visible.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (visibility[i])
+            visible.push_back(uint32_t(i));
+    }
+    return visible;
+}
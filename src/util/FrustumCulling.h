@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+/// @brief View frustum culling of instances on the CPU
+///
+/// Every instance is bounded by a sphere around its position with a radius derived from its scale and
+/// the shape of its mesh. An instance is culled if its sphere lies completely outside one of the six
+/// frustum planes. With the culling plane of Renderer::drawCullingPlanes active, instances whose sphere
+/// lies completely in the hidden octant are culled as well, unless they carry the dontCull flag. The
+/// fragment shader would discard all of their pixels anyway.
+///
+/// The tests run with the widest SIMD type of the build over batches of instances and can be split
+/// across threads. The resulting index list is the same for any number of threads.
+class FrustumCuller
+{
+public:
+    /// @brief Mesh the instance scale is applied to, decides the bounding sphere radius
+    enum Shape
+    {
+        /// unit cube centered at the origin, radius 0.5 * |scale|
+        box,
+        /// unit sphere, radius max(|scale.x|, |scale.y|, |scale.z|)
+        ellipsoid,
+        /// unit quad in the xy plane, radius 0.5 * |scale.xy|
+        quad,
+    };
+
+    /// @brief Extract the frustum planes from a projection * view matrix with depth in [0, 1]
+    void setView(const glm::mat4 &viewProjection);
+
+    /// @brief Also cull instances inside the octant hidden by the culling plane
+    /// @param dontCullFlag
+    ///     Instances with this flag set are never culled by the culling plane
+    void setCullingPlane(bool enabled, const glm::vec3 &offsets, uint32_t dontCullFlag);
+
+    /// @brief Find the visible instances of a strided array
+    /// @param positions, scales, flags
+    ///     Fields of the first instance, the following ones are stride bytes apart. stride has to be a multiple of 4.
+    /// @param threads
+    ///     Number of threads of ThreadPool::global() to use, 0 for all
+    /// @param vectorized
+    ///     Test several instances at once with SIMD, false tests them one by one
+    /// @return
+    ///     Indices of the visible instances in ascending order, valid until the next call
+    const std::vector<uint32_t> &cull(const glm::vec3 *positions, const glm::vec3 *scales, const uint32_t *flags, size_t stride, size_t count,
+                                      Shape shape, unsigned threads = 1, bool vectorized = true);
+
+private:
+    /// plane normals and distances, normalized so that dot(normal, p) + distance is the signed distance of p
+    glm::vec4 planes[6] = {};
+    bool cullingPlane = false;
+    glm::vec3 cullingOffsets = glm::vec3(0);
+    uint32_t dontCullFlag = 0;
+
+    std::vector<uint8_t> visibility;
+    std::vector<uint32_t> visible;
+
+    template <class V>
+    void testRange(const float *positions, const float *scales, const uint32_t *flags, size_t stride, size_t begin, size_t end, Shape shape);
+};
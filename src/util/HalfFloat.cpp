@@ -0,0 +1,90 @@
+#include <util/HalfFloat.h>
+#include <cstring>
+
+namespace
+{
+    inline uint32_t bitsOf(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    inline float floatOf(uint32_t bits)
+    {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+}
+
+namespace halfFloat
+{
+    uint16_t fromFloat(float value)
+    {
+        // 2^16, everything from here on is infinity or NaN as a half
+        const uint32_t halfOverflow = (127 + 16) << 23;
+        // 2^-14, the smallest normal half
+        const uint32_t smallestNormal = (127 - 14) << 23;
+        // adding 0.5 shifts the subnormal mantissa bits to the bottom of the float and rounds them with the FPU
+        const uint32_t subnormalMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+        uint32_t bits = bitsOf(value);
+        uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+        uint32_t half;
+        if (bits >= halfOverflow)
+        {
+            half = bits > 0x7f800000u ? 0x7e00u : 0x7c00u;
+        }
+        else if (bits < smallestNormal)
+        {
+            half = bitsOf(floatOf(bits) + floatOf(subnormalMagic)) - subnormalMagic;
+        }
+        else
+        {
+            // rebias the exponent and round the 13 dropped mantissa bits to nearest even, a carry may
+            // overflow into the exponent which correctly rounds up to the next power of two or infinity
+            uint32_t odd = (bits >> 13) & 1;
+            bits += ((15u - 127u) << 23) + 0xfffu + odd;
+            half = bits >> 13;
+        }
+        return uint16_t(half | (sign >> 16));
+    }
+
+    float toFloat(uint16_t half)
+    {
+        const uint32_t exponentMask = 0x7c00u << 13;
+        const uint32_t magic = 113u << 23;
+
+        uint32_t bits = uint32_t(half & 0x7fffu) << 13;
+        uint32_t exponent = bits & exponentMask;
+        bits += (127u - 15u) << 23;
+        if (exponent == exponentMask)
+        {
+            // infinity or NaN
+            bits += (128u - 16u) << 23;
+        }
+        else if (exponent == 0)
+        {
+            // zero or subnormal, let the FPU normalize it
+            bits += 1u << 23;
+            bits = bitsOf(floatOf(bits) - floatOf(magic));
+        }
+        return floatOf(bits | (uint32_t(half & 0x8000u) << 16));
+    }
+
+    void convert(const float *values, uint16_t *halves, size_t count)
+    {
+        size_t i = 0;
+#ifdef HALF_FLOAT_F16C
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i converted = _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(halves + i), converted);
+        }
+#endif
+        for (; i < count; ++i)
+            halves[i] = fromFloat(values[i]);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+#define HALF_FLOAT_F16C 1
+#endif
+
+/// @brief Conversion between 32 bit floats and IEEE 754 half precision floats
+///
+/// fromFloat rounds to nearest even like the F16C instructions, values beyond the half range become
+/// infinity, small values become subnormals or zero. NaNs stay NaNs, their payload is not kept.
+/// convert uses F16C when the build enables it (-mf16c, implied by /arch:AVX2 on MSVC) and the
+/// scalar conversion otherwise, both give the same halves for all non NaN inputs.
+namespace halfFloat
+{
+    uint16_t fromFloat(float value);
+    float toFloat(uint16_t half);
+
+    /// @brief Convert count floats to halves
+    void convert(const float *values, uint16_t *halves, size_t count);
+
+    /// @brief True if convert runs with F16C instructions
+    constexpr bool hardwareConversion()
+    {
+#ifdef HALF_FLOAT_F16C
+        return true;
+#else
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,165 @@
+#include <util/InstancePacking.h>
+#include <util/HalfFloat.h>
+#include <util/Simd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    template <class T>
+    inline const T &strided(const T *first, size_t stride, size_t index)
+    {
+        return *reinterpret_cast<const T *>(reinterpret_cast<const char *>(first) + index * stride);
+    }
+
+    // same semantics as the SSE min and max, a NaN input becomes the bound
+    inline float clamp(float value, float low, float high)
+    {
+        value = value > low ? value : low;
+        return value < high ? value : high;
+    }
+
+    inline uint16_t packIdFlags(uint32_t id, uint32_t flags)
+    {
+        using namespace instancePacking;
+        return uint16_t((id & ((1u << idBits) - 1)) | ((flags & ((1u << flagBits) - 1)) << idBits));
+    }
+
+    void packScalar(const glm::vec3 &position, const float *rotation, const glm::vec3 &scale, const glm::vec4 &color, uint32_t id, uint32_t flags,
+                    CompactInstance &out)
+    {
+        out.position = position;
+        // lrint rounds to nearest even like cvtps2dq with the default rounding mode
+        for (int c = 0; c < 4; ++c)
+            out.rotation[c] = int16_t(std::lrint(clamp(rotation[c], -1.0f, 1.0f) * 32767.0f));
+        for (int c = 0; c < 3; ++c)
+            out.scale[c] = halfFloat::fromFloat(scale[c]);
+        out.idFlags = packIdFlags(id, flags);
+        for (int c = 0; c < 4; ++c)
+            out.color[c] = uint8_t(std::lrint(clamp(color[c], 0.0f, 1.0f) * 255.0f));
+    }
+
+#ifdef SIMD_SSE
+    void packVectorized(const glm::vec3 &position, const float *rotation, const glm::vec3 &scale, const glm::vec4 &color, uint32_t id, uint32_t flags,
+                        CompactInstance &out)
+    {
+        out.position = position;
+
+        __m128 q = _mm_loadu_ps(rotation);
+        q = _mm_min_ps(_mm_max_ps(q, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+        __m128i q32 = _mm_cvtps_epi32(_mm_mul_ps(q, _mm_set1_ps(32767.0f)));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out.rotation), _mm_packs_epi32(q32, q32));
+
+#ifdef HALF_FLOAT_F16C
+        // the scale is a vec3, the fourth lane must not read past it
+        __m128i halves = _mm_cvtps_ph(_mm_setr_ps(scale.x, scale.y, scale.z, 0.0f), _MM_FROUND_TO_NEAREST_INT);
+        uint64_t packedScale;
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(&packedScale), halves);
+        out.scale[0] = uint16_t(packedScale);
+        out.scale[1] = uint16_t(packedScale >> 16);
+        out.scale[2] = uint16_t(packedScale >> 32);
+#else
+        for (int c = 0; c < 3; ++c)
+            out.scale[c] = halfFloat::fromFloat(scale[c]);
+#endif
+        out.idFlags = packIdFlags(id, flags);
+
+        __m128 rgba = _mm_loadu_ps(&color.x);
+        rgba = _mm_min_ps(_mm_max_ps(rgba, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        __m128i rgba32 = _mm_cvtps_epi32(_mm_mul_ps(rgba, _mm_set1_ps(255.0f)));
+        __m128i rgba16 = _mm_packs_epi32(rgba32, rgba32);
+        int packedColor = _mm_cvtsi128_si32(_mm_packus_epi16(rgba16, rgba16));
+        std::memcpy(out.color, &packedColor, sizeof(out.color));
+    }
+
+    /// instances per block of packBlocks, their 24 scales are three 8 wide half conversions
+    constexpr size_t blockSize = 8;
+
+    // converts the fields of a whole block at once, the rest of count is left to packVectorized
+    size_t packBlocks(const glm::vec3 *positions, const float *rotations, const glm::vec3 *scales, const glm::vec4 *colors, const uint32_t *ids,
+                      const uint32_t *flags, size_t stride, size_t count, CompactInstance *out)
+    {
+        const __m128 minusOne = _mm_set1_ps(-1.0f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 zero = _mm_setzero_ps();
+        auto rotation = [&](size_t i)
+        {
+            __m128 q = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&strided(rotations, stride, i)), minusOne), one);
+            return _mm_cvtps_epi32(_mm_mul_ps(q, _mm_set1_ps(32767.0f)));
+        };
+        auto color = [&](size_t i)
+        {
+            __m128 rgba = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&strided(colors, stride, i).x), zero), one);
+            return _mm_cvtps_epi32(_mm_mul_ps(rgba, _mm_set1_ps(255.0f)));
+        };
+
+        alignas(16) int16_t blockRotations[blockSize * 4];
+        alignas(16) uint8_t blockColors[blockSize * 4];
+        float blockScales[blockSize * 3];
+        uint16_t blockHalves[blockSize * 3];
+        size_t begin = 0;
+        for (; begin + blockSize <= count; begin += blockSize)
+        {
+            for (size_t k = 0; k < blockSize; k += 2)
+                _mm_store_si128(reinterpret_cast<__m128i *>(blockRotations + 4 * k), _mm_packs_epi32(rotation(begin + k), rotation(begin + k + 1)));
+            for (size_t k = 0; k < blockSize; k += 4)
+            {
+                __m128i rgba01 = _mm_packs_epi32(color(begin + k), color(begin + k + 1));
+                __m128i rgba23 = _mm_packs_epi32(color(begin + k + 2), color(begin + k + 3));
+                _mm_store_si128(reinterpret_cast<__m128i *>(blockColors + 4 * k), _mm_packus_epi16(rgba01, rgba23));
+            }
+            for (size_t k = 0; k < blockSize; ++k)
+                std::memcpy(blockScales + 3 * k, &strided(scales, stride, begin + k), sizeof(glm::vec3));
+            halfFloat::convert(blockScales, blockHalves, blockSize * 3);
+
+            for (size_t k = 0; k < blockSize; ++k)
+            {
+                CompactInstance &instance = out[begin + k];
+                instance.position = strided(positions, stride, begin + k);
+                std::memcpy(instance.rotation, blockRotations + 4 * k, sizeof(instance.rotation));
+                std::memcpy(instance.scale, blockHalves + 3 * k, sizeof(instance.scale));
+                instance.idFlags = packIdFlags(strided(ids, stride, begin + k), strided(flags, stride, begin + k));
+                std::memcpy(instance.color, blockColors + 4 * k, sizeof(instance.color));
+            }
+        }
+        return begin;
+    }
+#endif
+}
+
+namespace instancePacking
+{
+    void pack(const glm::vec3 *positions, const float *rotations, const glm::vec3 *scales, const glm::vec4 *colors, const uint32_t *ids,
+              const uint32_t *flags, size_t stride, size_t count, CompactInstance *out, bool vectorized)
+    {
+#ifdef SIMD_SSE
+        if (vectorized)
+        {
+            for (size_t i = packBlocks(positions, rotations, scales, colors, ids, flags, stride, count, out); i < count; ++i)
+                packVectorized(strided(positions, stride, i), &strided(rotations, stride, i), strided(scales, stride, i), strided(colors, stride, i),
+                               strided(ids, stride, i), strided(flags, stride, i), out[i]);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < count; ++i)
+            packScalar(strided(positions, stride, i), &strided(rotations, stride, i), strided(scales, stride, i), strided(colors, stride, i),
+                       strided(ids, stride, i), strided(flags, stride, i), out[i]);
+    }
+
+    void unpack(const CompactInstance &instance, glm::vec3 &position, glm::vec4 &rotation, glm::vec3 &scale, glm::vec4 &color, uint32_t &id,
+                uint32_t &flags)
+    {
+        position = instance.position;
+        // snorm16 vertex format
+        for (int c = 0; c < 4; ++c)
+            rotation[c] = std::max(instance.rotation[c] / 32767.0f, -1.0f);
+        for (int c = 0; c < 3; ++c)
+            scale[c] = halfFloat::toFloat(instance.scale[c]);
+        // unorm8 vertex format
+        for (int c = 0; c < 4; ++c)
+            color[c] = instance.color[c] / 255.0f;
+        id = instance.idFlags & ((1u << idBits) - 1);
+        flags = uint32_t(instance.idFlags) >> idBits;
+    }
+}
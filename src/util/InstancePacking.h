@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/// @brief 32 byte instance layout of InstancingPipeline's compact mode
+///
+/// Half the size of ResourceManager::InstancedVertexAttributes at the cost of precision:
+/// - position stays a full float, the objects keep their place
+/// - rotation quaternion (x, y, z, w) as snorm16, about 1.5e-5 per component
+/// - scale as half floats, about 5e-4 relative and at most 65504
+/// - color as unorm8, components are clamped to [0, 1]
+/// - the lower 12 bits of the id and the lower 4 bits of the flags share 16 bits
+///
+/// The shader reads the scale and the packed id and flags as two u32 and unpacks them with
+/// unpack2x16float, the layout relies on a little endian host like all WebGPU targets.
+struct CompactInstance
+{
+    glm::vec3 position;
+    int16_t rotation[4];
+    uint16_t scale[3];
+    /// id in the lower 12 bits, flags in the upper 4 bits
+    uint16_t idFlags;
+    uint8_t color[4];
+};
+static_assert(sizeof(CompactInstance) == 32, "CompactInstance has to match the vertex layout of the compact instancing pipeline");
+
+namespace instancePacking
+{
+    constexpr int idBits = 12;
+    constexpr int flagBits = 4;
+
+    /// @brief Pack count strided instances
+    /// @param positions, rotations, scales, colors, ids, flags
+    ///     Fields of the first instance, the following ones are stride bytes apart. rotations point to (x, y, z, w).
+    /// @param vectorized
+    ///     Convert the fields of blocks of instances with SSE and F16C where available, false packs them one by one.
+    ///     Both give the same bytes.
+    void pack(const glm::vec3 *positions, const float *rotations, const glm::vec3 *scales, const glm::vec4 *colors, const uint32_t *ids,
+              const uint32_t *flags, size_t stride, size_t count, CompactInstance *out, bool vectorized = true);
+
+    /// @brief Decode one instance the way the shader does
+    void unpack(const CompactInstance &instance, glm::vec3 &position, glm::vec4 &rotation, glm::vec3 &scale, glm::vec4 &color, uint32_t &id,
+                uint32_t &flags);
+}
@@ -0,0 +1,153 @@
+#include <util/MappedFile.h>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string &path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Could not open " + path);
+    fileHandle = file;
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    length = (size_t)fileSize.QuadPart;
+    if (length > 0)
+    {
+        mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr)
+        {
+            unmap();
+            throw std::runtime_error("Could not map " + path);
+        }
+        begin = static_cast<const uint8_t *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Could not stat " + path);
+    }
+    length = (size_t)info.st_size;
+    if (length > 0)
+    {
+        void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+            begin = static_cast<const uint8_t *>(mapping);
+    }
+    // the mapping stays valid after closing the descriptor
+    ::close(fd);
+#endif
+    if (length > 0 && begin == nullptr)
+    {
+        unmap();
+        throw std::runtime_error("Could not map " + path);
+    }
+}
+
+MappedFile::MappedFile(const std::string &path, size_t size) : writable(true)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Could not create " + path);
+    fileHandle = file;
+    length = size;
+    if (length > 0)
+    {
+        LARGE_INTEGER fileSize;
+        fileSize.QuadPart = (LONGLONG)length;
+        // the mapping grows the file to its size
+        mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, nullptr);
+        if (mappingHandle == nullptr)
+        {
+            unmap();
+            throw std::runtime_error("Could not map " + path);
+        }
+        begin = static_cast<const uint8_t *>(MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, 0));
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Could not create " + path);
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Could not resize " + path + " to " + std::to_string(size) + " bytes");
+    }
+    length = size;
+    if (length > 0)
+    {
+        void *mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED)
+            begin = static_cast<const uint8_t *>(mapping);
+    }
+    ::close(fd);
+#endif
+    if (length > 0 && begin == nullptr)
+    {
+        unmap();
+        throw std::runtime_error("Could not map " + path);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        unmap();
+        std::swap(begin, other.begin);
+        std::swap(length, other.length);
+        std::swap(writable, other.writable);
+#ifdef _WIN32
+        std::swap(fileHandle, other.fileHandle);
+        std::swap(mappingHandle, other.mappingHandle);
+#endif
+    }
+    return *this;
+}
+
+void MappedFile::unmap()
+{
+#ifdef _WIN32
+    if (begin != nullptr)
+        UnmapViewOfFile(begin);
+    if (mappingHandle != nullptr)
+        CloseHandle(mappingHandle);
+    if (fileHandle != nullptr)
+        CloseHandle(fileHandle);
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    if (begin != nullptr)
+        munmap(const_cast<uint8_t *>(begin), length);
+#endif
+    begin = nullptr;
+    length = 0;
+    writable = false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// @brief Memory mapping of a whole file, read-only or of a new file to write
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    /// @brief Map the file at path, throws std::runtime_error if that fails
+    explicit MappedFile(const std::string &path);
+    /// @brief Create or truncate the file at path to size bytes and map it for writing, throws std::runtime_error if that fails
+    ///
+    /// The written bytes reach the file when the mapping is destroyed, or earlier when the system chooses to.
+    MappedFile(const std::string &path, size_t size);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    const uint8_t *data() const { return begin; }
+    size_t size() const { return length; }
+    /// @brief The bytes of a mapping created for writing, nullptr for a read-only one
+    uint8_t *writableData() { return writable ? const_cast<uint8_t *>(begin) : nullptr; }
+
+private:
+    void unmap();
+
+    const uint8_t *begin = nullptr;
+    size_t length = 0;
+    bool writable = false;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#endif
+};
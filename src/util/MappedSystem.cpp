@@ -0,0 +1,125 @@
+#include <util/MappedSystem.h>
+#include <stdexcept>
+#include <climits>
+#include <cstring>
+
+MappedSystem::MappedSystem(const std::string &path, bool verifyChecksums) : path(path), file(path)
+{
+    using namespace pcg_binary;
+    if (file.size() < sizeof(FileHeader))
+        throw std::runtime_error(path + " is too small for a pcg binary file");
+    FileHeader fileHeader;
+    std::memcpy(&fileHeader, file.data(), sizeof(fileHeader));
+    if (std::memcmp(fileHeader.magic, file_magic, sizeof(file_magic)) != 0)
+        throw std::runtime_error(path + " is not a pcg binary file");
+    if (fileHeader.version != file_version)
+        throw std::runtime_error(path + " has unsupported version " + std::to_string(fileHeader.version));
+
+    size_t offset = sizeof(FileHeader);
+    for (uint32_t i = 0; i < fileHeader.section_count; ++i)
+    {
+        if (offset + sizeof(SectionHeader) > file.size())
+            throw std::runtime_error(path + " is truncated");
+        Section section;
+        std::memcpy(&section.header, file.data() + offset, sizeof(SectionHeader));
+        section.header.name[sizeof(section.header.name) - 1] = '\0';
+        offset += sizeof(SectionHeader);
+        if (section.header.payload_size > file.size() - offset)
+            throw std::runtime_error(path + " is truncated in section " + section.header.name);
+        checkSize(section.header);
+        section.payload = file.data() + offset;
+        if (verifyChecksums && checksum(section.payload, section.header.payload_size) != section.header.checksum)
+            throw std::runtime_error(path + " has a checksum mismatch in section " + section.header.name);
+        offset += section.header.payload_size;
+        sectionList.push_back(section);
+    }
+}
+
+const MappedSystem::Section *MappedSystem::find(const char *name) const
+{
+    for (auto &section : sectionList)
+    {
+        if (std::strcmp(section.header.name, name) == 0)
+            return &section;
+    }
+    return nullptr;
+}
+
+const MappedSystem::Section &MappedSystem::get(const char *name, pcg_binary::SectionKind kind, size_t scalarSize) const
+{
+    const Section *section = find(name);
+    if (section == nullptr)
+        throw std::runtime_error(path + " has no section " + name);
+    if (section->header.kind != kind)
+        throw std::runtime_error(path + ": section " + name + " has a different kind");
+    if (section->header.scalar_size != scalarSize)
+        throw std::runtime_error(path + ": section " + name + " has a different scalar type");
+    return *section;
+}
+
+pcg_binary::SolveInfo MappedSystem::solveInfo(const char *name) const
+{
+    const Section *section = find(name);
+    if (section == nullptr || section->header.kind != pcg_binary::solve_info)
+        throw std::runtime_error(path + " has no solve info " + name);
+    if (section->header.payload_size < sizeof(pcg_binary::SolveInfo))
+        throw std::runtime_error(path + ": solve info " + name + " is too small");
+    pcg_binary::SolveInfo info;
+    std::memcpy(&info, section->payload, sizeof(info));
+    return info;
+}
+
+void MappedSystem::checkSize(const pcg_binary::SectionHeader &header) const
+{
+    using namespace pcg_binary;
+    std::string section = path + ": section " + header.name;
+    // the payloads that follow are used in place, they have to stay aligned
+    if (header.payload_size % alignment != 0)
+        throw std::runtime_error(section + " is not padded to " + std::to_string(alignment) + " bytes");
+    if ((header.kind == csr_matrix || header.kind == dense_vector) && header.scalar_size != sizeof(float) && header.scalar_size != sizeof(double))
+        throw std::runtime_error(section + " has scalars of " + std::to_string(header.scalar_size) + " bytes");
+    switch (header.kind)
+    {
+    case csr_matrix:
+    {
+        if (header.n >= INT_MAX || header.nonzeros > INT_MAX)
+            throw std::runtime_error(section + " is too large for int indices");
+        // both are below 2^31, the sum cannot overflow
+        uint64_t needed = padded_size((header.n + 1) * sizeof(int)) + padded_size(header.nonzeros * sizeof(int)) +
+                          padded_size(header.nonzeros * header.scalar_size);
+        if (needed > header.payload_size)
+            throw std::runtime_error(section + " is too small for " + std::to_string(header.n) + " rows and " +
+                                     std::to_string(header.nonzeros) + " nonzeros");
+        break;
+    }
+    case dense_vector:
+        if (header.n > header.payload_size / header.scalar_size)
+            throw std::runtime_error(section + " is too small for " + std::to_string(header.n) + " values");
+        break;
+    case solve_info:
+        if (header.payload_size < sizeof(SolveInfo))
+            throw std::runtime_error(section + " is too small for the solve info");
+        break;
+    }
+}
+
+void MappedSystem::checkMatrix(const Section &section) const
+{
+    int n = (int)section.header.n;
+    int64_t nonzeros = (int64_t)section.header.nonzeros;
+    const int *rowstart = reinterpret_cast<const int *>(section.payload);
+    const int *colindex = reinterpret_cast<const int *>(section.payload + pcg_binary::padded_size((n + 1) * sizeof(int)));
+    std::string name = path + ": section " + section.header.name;
+    if (rowstart[0] != 0 || rowstart[n] != nonzeros)
+        throw std::runtime_error(name + " has rows that do not go from 0 to its nonzeros");
+    for (int i = 0; i < n; ++i)
+    {
+        if (rowstart[i + 1] < rowstart[i])
+            throw std::runtime_error(name + " has a row that ends before it starts, row " + std::to_string(i));
+    }
+    for (int64_t i = 0; i < nonzeros; ++i)
+    {
+        if (colindex[i] < 0 || colindex[i] >= n)
+            throw std::runtime_error(name + " has a column index outside of the matrix, entry " + std::to_string(i));
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <util/MappedFile.h>
+#include <util/pcgsolver.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// @brief Memory-mapped file in the pcg_binary format (see util/pcgsolver.h)
+///
+/// Vectors and matrices are returned as views that point straight into the mapping,
+/// nothing is parsed or copied. Files written by SparsePCGSolver::capture_next_solve
+/// contain the sections "matrix", "rhs", "result" and "info".
+class MappedSystem
+{
+public:
+    struct Section
+    {
+        pcg_binary::SectionHeader header;
+        const uint8_t *payload;
+    };
+
+    /// @brief Compressed sparse row view of a csr_matrix section
+    template <class T>
+    struct CsrView
+    {
+        int n = 0;
+        size_t nonzeros = 0;
+        const int *rowstart = nullptr;
+        const int *colindex = nullptr;
+        const T *value = nullptr;
+    };
+
+    /// @brief Map the file and validate its header and section table, throws std::runtime_error if it is invalid
+    ///
+    /// The payload of every matrix, vector and solve info section has to be large enough for its n and nonzeros.
+    /// @param verifyChecksums
+    ///     Also hash all payloads. This touches every page of the file, skip it when the file is known to be good.
+    explicit MappedSystem(const std::string &path, bool verifyChecksums = true);
+
+    const std::vector<Section> &sections() const { return sectionList; }
+
+    /// @brief Find a section by name, nullptr if there is none
+    const Section *find(const char *name) const;
+
+    /// @brief View of the csr_matrix section with the given name, throws if it is missing or has a different scalar type
+    ///
+    /// Also throws if rowstart does not go up from 0 to nonzeros or a column index is outside of the matrix,
+    /// checking this reads both index arrays once.
+    template <class T>
+    CsrView<T> matrix(const char *name) const
+    {
+        const Section &section = get(name, pcg_binary::csr_matrix, sizeof(T));
+        checkMatrix(section);
+        CsrView<T> view;
+        view.n = (int)section.header.n;
+        view.nonzeros = section.header.nonzeros;
+        size_t offset = 0;
+        view.rowstart = reinterpret_cast<const int *>(section.payload);
+        offset += pcg_binary::padded_size((view.n + 1) * sizeof(int));
+        view.colindex = reinterpret_cast<const int *>(section.payload + offset);
+        offset += pcg_binary::padded_size(view.nonzeros * sizeof(int));
+        view.value = reinterpret_cast<const T *>(section.payload + offset);
+        return view;
+    }
+
+    /// @brief Pointer to the values of the dense_vector section with the given name, n is set to its length
+    template <class T>
+    const T *vector(const char *name, size_t &n) const
+    {
+        const Section &section = get(name, pcg_binary::dense_vector, sizeof(T));
+        n = section.header.n;
+        return reinterpret_cast<const T *>(section.payload);
+    }
+
+    /// @brief The solver parameters and outcome stored by SparsePCGSolver::capture_next_solve
+    pcg_binary::SolveInfo solveInfo(const char *name = "info") const;
+
+    /// @brief Copy a matrix view into a SparseMatrix, e.g. to solve it again with SparsePCGSolver
+    template <class T>
+    static void copy(const CsrView<T> &view, SparseMatrix<T> &matrix)
+    {
+        matrix.resize(view.n);
+        for (int i = 0; i < view.n; ++i)
+        {
+            matrix.index[i].assign(view.colindex + view.rowstart[i], view.colindex + view.rowstart[i + 1]);
+            matrix.value[i].assign(view.value + view.rowstart[i], view.value + view.rowstart[i + 1]);
+        }
+    }
+
+    /// @brief Copy a matrix view into a FixedSparseMatrix
+    template <class T>
+    static void copy(const CsrView<T> &view, FixedSparseMatrix<T> &matrix)
+    {
+        matrix.resize(view.n);
+        matrix.rowstart.assign(view.rowstart, view.rowstart + view.n + 1);
+        matrix.colindex.assign(view.colindex, view.colindex + view.nonzeros);
+        matrix.value.assign(view.value, view.value + view.nonzeros);
+    }
+
+private:
+    const Section &get(const char *name, pcg_binary::SectionKind kind, size_t scalarSize) const;
+    void checkSize(const pcg_binary::SectionHeader &header) const;
+    void checkMatrix(const Section &section) const;
+
+    std::string path;
+    MappedFile file;
+    std::vector<Section> sectionList;
+};
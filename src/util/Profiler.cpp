@@ -0,0 +1,183 @@
+#include <util/Profiler.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+std::atomic<bool> Profiler::enabled{false};
+
+namespace
+{
+    struct ThreadRing
+    {
+        std::vector<Profiler::Zone> zones = std::vector<Profiler::Zone>(Profiler::ringCapacity);
+        /// number of zones recorded so far, zone i is in slot i % ringCapacity
+        std::atomic<uint64_t> written{0};
+        uint32_t index = 0;
+        uint32_t depth = 0;
+        std::string name;
+    };
+
+    // rings are never freed, the zones of a thread that exited stay readable
+    std::mutex ringMutex;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    std::atomic<uint64_t> clearedAt{0};
+    std::atomic<uint64_t> previousMark{0};
+    std::atomic<uint64_t> lastMark{0};
+
+    // a thread gets its ring with its first zone, so threads that are never profiled cost nothing
+    thread_local ThreadRing *ring = nullptr;
+    thread_local std::string threadName;
+
+    ThreadRing &threadRing()
+    {
+        if (ring == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(ringMutex);
+            rings.push_back(std::make_unique<ThreadRing>());
+            ring = rings.back().get();
+            ring->index = static_cast<uint32_t>(rings.size() - 1);
+            ring->name = threadName.empty() ? "thread " + std::to_string(ring->index) : threadName;
+        }
+        return *ring;
+    }
+
+    void writeJsonString(std::ostream &out, const std::string &text)
+    {
+        out << '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+            else
+                out << c;
+        }
+        out << '"';
+    }
+}
+
+uint64_t Profiler::now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t Profiler::Scope::enter()
+{
+    threadRing().depth++;
+    return now();
+}
+
+void Profiler::Scope::leave(const char *name, uint64_t begin)
+{
+    uint64_t end = now();
+    ThreadRing &ring = threadRing();
+    ring.depth--;
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    ring.zones[index % ringCapacity] = {name, begin, end, ring.index, ring.depth};
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::markFrame()
+{
+    previousMark.store(lastMark.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    lastMark.store(now(), std::memory_order_relaxed);
+}
+
+bool Profiler::lastFrame(uint64_t &begin, uint64_t &end)
+{
+    end = lastMark.load(std::memory_order_relaxed);
+    begin = previousMark.load(std::memory_order_relaxed);
+    return begin != 0 && begin < end;
+}
+
+std::vector<Profiler::Zone> Profiler::zones(uint64_t since)
+{
+    std::vector<Zone> result;
+    std::vector<uint64_t> indices;
+    uint64_t cleared = clearedAt.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(ringMutex);
+    for (auto &ring : rings)
+    {
+        uint64_t end = ring->written.load(std::memory_order_acquire);
+        uint64_t begin = end > ringCapacity ? end - ringCapacity : 0;
+        size_t first = result.size();
+        indices.clear();
+        for (uint64_t i = begin; i < end; ++i)
+        {
+            const Zone &zone = ring->zones[i % ringCapacity];
+            if (zone.end >= since && zone.begin >= cleared)
+            {
+                result.push_back(zone);
+                indices.push_back(i);
+            }
+        }
+        // the thread may be writing the slot after its last zone, which is the oldest one we copied
+        uint64_t written = ring->written.load(std::memory_order_acquire) + 1;
+        uint64_t valid = written > ringCapacity ? written - ringCapacity : 0;
+        size_t overwritten = std::lower_bound(indices.begin(), indices.end(), valid) - indices.begin();
+        result.erase(result.begin() + first, result.begin() + first + overwritten);
+    }
+    return result;
+}
+
+void Profiler::setThreadName(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(ringMutex);
+    threadName = name;
+    if (ring != nullptr)
+        ring->name = name;
+}
+
+std::vector<std::string> Profiler::threadNames()
+{
+    std::lock_guard<std::mutex> lock(ringMutex);
+    std::vector<std::string> names;
+    for (auto &ring : rings)
+        names.push_back(ring->name);
+    return names;
+}
+
+void Profiler::clear()
+{
+    clearedAt.store(now(), std::memory_order_relaxed);
+}
+
+void Profiler::exportChromeTrace(const std::string &path)
+{
+    std::vector<Zone> recorded = zones();
+    std::vector<std::string> names = threadNames();
+    uint64_t origin = UINT64_MAX;
+    for (const Zone &zone : recorded)
+        origin = std::min(origin, zone.begin);
+
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Could not open " + path + " for writing");
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (uint32_t thread = 0; thread < names.size(); ++thread)
+    {
+        out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread << ",\"args\":{\"name\":";
+        writeJsonString(out, names[thread]);
+        out << "}}";
+        first = false;
+    }
+    // microseconds with nanosecond resolution
+    out << std::fixed << std::setprecision(3);
+    for (const Zone &zone : recorded)
+    {
+        out << (first ? "\n" : ",\n") << "{\"name\":";
+        writeJsonString(out, zone.name);
+        out << ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << zone.thread << ",\"ts\":" << (zone.begin - origin) / 1000.0
+            << ",\"dur\":" << (zone.end - zone.begin) / 1000.0 << "}";
+        first = false;
+    }
+    out << "\n]}\n";
+    if (!out)
+        throw std::runtime_error("Could not write " + path);
+}
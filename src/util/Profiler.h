@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// @brief Hierarchical CPU profiler of named scopes
+///
+/// PROFILE_ZONE("name") measures the rest of the enclosing scope with the steady clock. Every thread records its
+/// zones into its own ring buffer that keeps the last ringCapacity zones, so recording takes no lock. Zones of a
+/// thread nest, each one knows how many zones were open when it began. While the profiler is disabled a zone costs
+/// one relaxed atomic load, building with PROFILER_DISABLED removes the zones completely.
+class Profiler
+{
+public:
+    struct Zone
+    {
+        /// the string given to PROFILE_ZONE, it has to outlive the profiler
+        const char *name;
+        /// nanoseconds of the steady clock
+        uint64_t begin;
+        uint64_t end;
+        /// index of the recording thread, see threadNames
+        uint32_t thread;
+        /// number of zones of the same thread that were open when this one began
+        uint32_t depth;
+    };
+
+    static constexpr size_t ringCapacity = 1 << 14;
+
+    static void setEnabled(bool enable) { enabled.store(enable, std::memory_order_relaxed); }
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    /// @brief Nanoseconds of the steady clock, the time base of the zones
+    static uint64_t now();
+
+    /// @brief Mark the end of a frame, called at the start of Renderer::onFrame of the presenting renderer
+    /// so the last frame holds the complete onFrame before it
+    static void markFrame();
+
+    /// @brief Begin and end of the last complete frame between two markFrame calls
+    /// @return
+    ///     False if markFrame was not called twice yet
+    static bool lastFrame(uint64_t &begin, uint64_t &end);
+
+    /// @brief Copy the recorded zones of all threads that end at or after since, ordered by thread and end
+    ///
+    /// Zones that a thread overwrites while they are copied are left out.
+    static std::vector<Zone> zones(uint64_t since = 0);
+
+    /// @brief Name the calling thread in the timeline and the trace, threads are called "thread N" otherwise
+    static void setThreadName(const std::string &name);
+
+    /// @brief Names of the threads that recorded zones, by Zone::thread
+    static std::vector<std::string> threadNames();
+
+    /// @brief Forget the zones recorded so far
+    static void clear();
+
+    /// @brief Write all recorded zones as Chrome trace event JSON, for chrome://tracing or ui.perfetto.dev
+    ///
+    /// Throws std::runtime_error if the file cannot be written.
+    static void exportChromeTrace(const std::string &path);
+
+    /// @brief Measures its lifetime, see PROFILE_ZONE
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name) : name(name), active(isEnabled())
+        {
+            if (active)
+                begin = enter();
+        }
+        ~Scope()
+        {
+            if (active)
+                leave(name, begin);
+        }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const char *name;
+        bool active;
+        uint64_t begin = 0;
+
+        static uint64_t enter();
+        static void leave(const char *name, uint64_t begin);
+    };
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+/// @brief Profile the rest of the enclosing scope under a name, which has to be a string literal
+#ifdef PROFILER_DISABLED
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE(name) Profiler::Scope PROFILE_CONCAT(profileZone, __LINE__)(name)
+#endif
@@ -0,0 +1,263 @@
+#include <util/RangeReduction.h>
+#include <util/Simd.h>
+#include <util/ThreadPool.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    const size_t parallelThreshold = 1 << 16;
+    // below this the percentiles come from selecting the ranks of a copy, clearing and scanning the histogram would take longer
+    const size_t selectionThreshold = 1 << 14;
+    // upper 16 bits of the order preserving key, one extra bin at the end counts the NaNs
+    const uint32_t binCount = 1 << 16;
+    const uint32_t nanBin = binCount;
+
+    struct Partial
+    {
+        float min = std::numeric_limits<float>::infinity();
+        float max = -std::numeric_limits<float>::infinity();
+    };
+
+    inline uint32_t bitsOf(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    inline float floatOf(uint32_t bits)
+    {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // negative values get all bits flipped, positive ones only the sign bit, the unsigned order of the keys is the order of the floats
+    inline uint32_t orderKey(uint32_t bits) { return bits ^ (uint32_t(int32_t(bits) >> 31) | 0x80000000u); }
+    inline uint32_t fromOrderKey(uint32_t key) { return (key & 0x80000000u) ? key ^ 0x80000000u : ~key; }
+    inline bool isNan(uint32_t bits) { return (bits & 0x7FFFFFFFu) > 0x7F800000u; }
+
+    // the value first, min and max of the SIMD types return their second operand if one of them is NaN
+    template <class V>
+    Partial minMaxRange(const float *data, size_t begin, size_t end)
+    {
+        V low(std::numeric_limits<float>::infinity());
+        V high(-std::numeric_limits<float>::infinity());
+        size_t i = begin;
+        for (; i + V::width <= end; i += V::width)
+        {
+            V value = V::load(data + i);
+            low = min(value, low);
+            high = max(value, high);
+        }
+        Partial partial;
+        partial.min = -horizontalMax(-low);
+        partial.max = horizontalMax(high);
+        for (; i < end; ++i)
+        {
+            partial.min = min(simd::Float1(data[i]), simd::Float1(partial.min)).v;
+            partial.max = max(simd::Float1(data[i]), simd::Float1(partial.max)).v;
+        }
+        return partial;
+    }
+
+    void histogramScalar(const float *data, size_t begin, size_t end, uint32_t *histogram, Partial &partial)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            uint32_t bits = bitsOf(data[i]);
+            if (isNan(bits))
+            {
+                histogram[nanBin]++;
+                continue;
+            }
+            histogram[orderKey(bits) >> 16]++;
+            partial.min = std::min(partial.min, data[i]);
+            partial.max = std::max(partial.max, data[i]);
+        }
+    }
+
+#ifdef SIMD_SSE
+    void histogramVectorized(const float *data, size_t begin, size_t end, uint32_t *histogram, Partial &partial)
+    {
+        const __m128i signBit = _mm_set1_epi32(int(0x80000000u));
+        const __m128i absoluteMask = _mm_set1_epi32(0x7FFFFFFF);
+        const __m128i infinity = _mm_set1_epi32(0x7F800000);
+        const __m128i nanBins = _mm_set1_epi32(int(nanBin));
+        simd::Float4 low(std::numeric_limits<float>::infinity());
+        simd::Float4 high(-std::numeric_limits<float>::infinity());
+        alignas(16) uint32_t bins[4];
+        size_t i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 value = _mm_loadu_ps(data + i);
+            low = _mm_min_ps(value, low.v);
+            high = _mm_max_ps(value, high.v);
+            __m128i bits = _mm_castps_si128(value);
+            __m128i key = _mm_xor_si128(bits, _mm_or_si128(_mm_srai_epi32(bits, 31), signBit));
+            __m128i nan = _mm_cmpgt_epi32(_mm_and_si128(bits, absoluteMask), infinity);
+            __m128i bin = _mm_or_si128(_mm_andnot_si128(nan, _mm_srli_epi32(key, 16)), _mm_and_si128(nan, nanBins));
+            _mm_store_si128(reinterpret_cast<__m128i *>(bins), bin);
+            histogram[bins[0]]++;
+            histogram[bins[1]]++;
+            histogram[bins[2]]++;
+            histogram[bins[3]]++;
+        }
+        partial.min = std::min(partial.min, -horizontalMax(-low));
+        partial.max = std::max(partial.max, horizontalMax(high));
+        histogramScalar(data, i, end, histogram, partial);
+    }
+#endif
+
+    // interpolated between ranks, the values of a bin are assumed to be spread evenly over the part of it inside [min, max]
+    float percentile(const uint32_t *histogram, uint64_t total, float percent, float min, float max)
+    {
+        double rank = std::min(std::max(double(percent), 0.0), 100.0) / 100.0 * double(total - 1);
+        if (rank <= 0)
+            return min;
+        if (rank >= double(total - 1))
+            return max;
+        uint64_t below = 0;
+        for (uint32_t bin = 0; bin < binCount; ++bin)
+        {
+            uint32_t n = histogram[bin];
+            if (rank < double(below + n))
+            {
+                float low = std::max(floatOf(fromOrderKey(bin << 16)), min);
+                float high = std::min(floatOf(fromOrderKey((bin << 16) | 0xFFFFu)), max);
+                if (!std::isfinite(low) || !std::isfinite(high))
+                    return std::isfinite(low) ? high : low;
+                float fraction = float(std::min((rank - double(below) + 0.5) / n, 1.0));
+                return std::min(std::max(low + fraction * (high - low), low), high);
+            }
+            below += n;
+        }
+        return max;
+    }
+
+    // numpy's linear interpolation between the two values around the rank, values has to hold no NaN
+    float selectPercentile(std::vector<float> &values, float percent)
+    {
+        double rank = std::min(std::max(double(percent), 0.0), 100.0) / 100.0 * double(values.size() - 1);
+        size_t below = size_t(rank);
+        std::nth_element(values.begin(), values.begin() + below, values.end());
+        float low = values[below];
+        float fraction = float(rank - double(below));
+        if (fraction == 0)
+            return low;
+        float high = *std::min_element(values.begin() + below + 1, values.end());
+        if (!std::isfinite(low) || !std::isfinite(high))
+            return fraction < 0.5f ? low : high;
+        return low + fraction * (high - low);
+    }
+
+    Partial merge(const std::vector<Partial> &partials)
+    {
+        Partial result;
+        for (const Partial &partial : partials)
+        {
+            result.min = std::min(result.min, partial.min);
+            result.max = std::max(result.max, partial.max);
+        }
+        return result;
+    }
+
+    // the most ranges forEachRange splits count into, the partial results are sized by it
+    unsigned rangeCount(size_t count, unsigned threads)
+    {
+        if (threads == 1 || count < parallelThreshold)
+            return 1;
+        unsigned size = ThreadPool::global().size();
+        return threads == 0 ? size : std::min(threads, size);
+    }
+
+    // static split into contiguous ranges, the reductions are exact so the result is the same for any split
+    template <class Body>
+    void forEachRange(size_t count, unsigned threads, Body body)
+    {
+        unsigned ranges = rangeCount(count, threads);
+        if (ranges > 1)
+        {
+            ThreadPool::global().run([&](unsigned thread, unsigned threadCount)
+                                     { body(thread, count * thread / threadCount, count * (thread + 1) / threadCount); },
+                                     ranges);
+        }
+        else
+        {
+            body(0, 0, count);
+        }
+    }
+}
+
+namespace rangeReduction
+{
+    Range minMax(const float *data, size_t count, unsigned threads, bool vectorized)
+    {
+        std::vector<Partial> partials(rangeCount(count, threads));
+        forEachRange(count, threads, [&](unsigned thread, size_t begin, size_t end)
+                     {
+                         if (vectorized)
+                             partials[thread] = minMaxRange<simd::Widest>(data, begin, end);
+                         else
+                             partials[thread] = minMaxRange<simd::Float1>(data, begin, end); });
+        Partial range = merge(partials);
+        if (!(range.min <= range.max))
+            return {0, 0, 0, 0};
+        return {range.min, range.max, range.min, range.max};
+    }
+
+    Range percentiles(const float *data, size_t count, float lowPercent, float highPercent, unsigned threads, bool vectorized)
+    {
+        if (count < selectionThreshold)
+        {
+            std::vector<float> values;
+            values.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!isNan(bitsOf(data[i])))
+                    values.push_back(data[i]);
+            }
+            if (values.empty())
+                return {0, 0, 0, 0};
+            auto range = std::minmax_element(values.begin(), values.end());
+            float min = *range.first;
+            float max = *range.second;
+            return {min, max, selectPercentile(values, lowPercent), selectPercentile(values, highPercent)};
+        }
+
+        const size_t stride = binCount + 1;
+        std::vector<Partial> partials(rangeCount(count, threads));
+        std::vector<uint32_t> histograms(partials.size() * stride, 0);
+        forEachRange(count, threads, [&](unsigned thread, size_t begin, size_t end)
+                     {
+                         uint32_t *histogram = histograms.data() + thread * stride;
+#ifdef SIMD_SSE
+                         if (vectorized)
+                         {
+                             histogramVectorized(data, begin, end, histogram, partials[thread]);
+                             return;
+                         }
+#endif
+                         histogramScalar(data, begin, end, histogram, partials[thread]); });
+        Partial range = merge(partials);
+        if (!(range.min <= range.max))
+            return {0, 0, 0, 0};
+
+        uint32_t *histogram = histograms.data();
+        for (size_t thread = 1; thread < partials.size(); ++thread)
+        {
+            const uint32_t *other = histograms.data() + thread * stride;
+            for (uint32_t bin = 0; bin < binCount; ++bin)
+                histogram[bin] += other[bin];
+        }
+        uint64_t total = 0;
+        for (uint32_t bin = 0; bin < binCount; ++bin)
+            total += histogram[bin];
+        return {range.min, range.max, percentile(histogram, total, lowPercent, range.min, range.max),
+                percentile(histogram, total, highPercent, range.min, range.max)};
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Value range of large float fields for colormaps
+///
+/// minMax finds the smallest and largest value with the widest SIMD type of the build. percentiles
+/// additionally sorts every value into a histogram over the upper 16 bits of its order preserving
+/// bit pattern: sign, exponent and 7 mantissa bits. The histogram needs no range up front, so min,
+/// max and the percentiles come out of a single pass over the data. A percentile is interpolated
+/// inside its bin, its error is below 1% of its magnitude. For fewer than 16384 values clearing and
+/// scanning the histogram costs more than the data, their percentiles are selected exactly from a copy.
+///
+/// NaNs are ignored, infinities count as values. Both can be split across the threads of
+/// ThreadPool::global(), the result does not depend on the number of threads.
+namespace rangeReduction
+{
+    struct Range
+    {
+        float min;
+        float max;
+        /// the low and high percentile, min and max for minMax
+        float low;
+        float high;
+        /// false if the data has no value besides NaNs, the other fields are 0 then
+        bool valid() const { return min <= max; }
+    };
+
+    /// @brief Smallest and largest value of count floats
+    /// @param threads
+    ///     Number of threads of ThreadPool::global() to use, 0 for all
+    /// @param vectorized
+    ///     Compare several values at once with SIMD, false compares them one by one
+    Range minMax(const float *data, size_t count, unsigned threads = 1, bool vectorized = true);
+
+    /// @brief Smallest and largest value and approximate percentiles of count floats in one pass
+    /// @param lowPercent, highPercent
+    ///     Percentiles in [0, 100], linearly interpolated between ranks like numpy's default
+    Range percentiles(const float *data, size_t count, float lowPercent, float highPercent, unsigned threads = 1, bool vectorized = true);
+}
@@ -0,0 +1,637 @@
+#include <util/RenderBenchmark.h>
+#include <util/DepthSort.h>
+#include <util/FrameCapture.h>
+#include <util/FrustumCulling.h>
+#include <util/HalfFloat.h>
+#include <util/InstancePacking.h>
+#include <util/RangeReduction.h>
+#include <util/Span.h>
+#include <util/ThreadPool.h>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+
+namespace renderBenchmark
+{
+    using clock = std::chrono::high_resolution_clock;
+
+    // same layout as ResourceManager::InstancedVertexAttributes, without pulling in the WebGPU headers
+    struct Instance
+    {
+        glm::vec3 position;
+        glm::vec4 rotation;
+        glm::vec3 scale;
+        glm::vec4 color;
+        uint32_t id;
+        uint32_t flags;
+    };
+
+    // the sort InstancingPipeline::sortDepth used before the radix sort
+    std::vector<uint32_t> referenceOrder(const std::vector<Instance> &instances, const glm::vec3 &camera, bool transparentOnly)
+    {
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> sorted;
+        for (uint32_t i = 0; i < instances.size(); ++i)
+        {
+            if (transparentOnly && instances[i].color.a >= 1.0f)
+                order.push_back(i);
+            else
+                sorted.push_back(i);
+        }
+        std::vector<float> depths(instances.size());
+        for (uint32_t i : sorted)
+        {
+            glm::vec3 delta = camera - instances[i].position;
+            depths[i] = -glm::dot(delta, delta);
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b)
+                         { return depths[a] < depths[b]; });
+        order.insert(order.end(), sorted.begin(), sorted.end());
+        return order;
+    }
+
+    bool benchmarkDepthSort(size_t count)
+    {
+        if (count == 0)
+            return true;
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<Instance> instances(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Instance &instance = instances[i];
+            // every 8th instance sits on an integer grid, which gives many exactly equal distances
+            if (i % 8 == 0)
+                instance.position = glm::round(glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng)));
+            else
+                instance.position = glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+            instance.color = glm::vec4(1, 1, 1, unit(rng) < 0.3f ? 0.5f : 1.0f);
+            instance.id = uint32_t(i);
+        }
+        glm::vec3 camera(3, 4, 25);
+        unsigned threads = ThreadPool::global().size();
+        std::cout << "depth sort of " << count << " instances, " << threads << " threads" << std::endl;
+
+        bool passed = true;
+        for (bool transparentOnly : {false, true})
+        {
+            auto start = clock::now();
+            const int repetitions = 20;
+            std::vector<uint32_t> reference;
+            for (int r = 0; r < repetitions; ++r)
+                reference = referenceOrder(instances, camera, transparentOnly);
+            double referenceTime = std::chrono::duration<double>(clock::now() - start).count() / repetitions;
+            std::cout << (transparentOnly ? "  alpha < 1 only" : "  all instances") << std::endl;
+            std::cout << "    stable_sort:      " << referenceTime * 1000 << " ms" << std::endl;
+
+            std::vector<unsigned> threadCounts = {1};
+            if (threads > 1)
+                threadCounts.push_back(threads);
+            for (unsigned threadCount : threadCounts)
+            {
+                DepthSorter sorter;
+                // first call allocates, it is not measured
+                std::vector<uint32_t> order = sorter.sort(camera, &instances[0].position, &instances[0].color.a, sizeof(Instance), count, transparentOnly, threadCount);
+                start = clock::now();
+                for (int r = 0; r < repetitions; ++r)
+                    sorter.sort(camera, &instances[0].position, &instances[0].color.a, sizeof(Instance), count, transparentOnly, threadCount);
+                double time = std::chrono::duration<double>(clock::now() - start).count() / repetitions;
+                std::cout << "    radix " << threadCount << " thread" << (threadCount == 1 ? ": " : "s:") << "    " << time * 1000 << " ms ("
+                          << referenceTime / time << "x), " << sorter.sortedCount() << " keys sorted, order "
+                          << (order == reference ? "matches" : "DIFFERS") << std::endl;
+                passed = passed && order == reference;
+            }
+        }
+        return passed;
+    }
+
+    bool benchmarkFrustumCulling(size_t count)
+    {
+        if (count == 0)
+            return true;
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+        std::uniform_real_distribution<float> size(0.1f, 2.0f);
+        std::vector<Instance> instances(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            instances[i].position = glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+            instances[i].scale = glm::vec3(size(rng), size(rng), size(rng));
+            instances[i].flags = i % 16 == 0 ? 2u : 0u;
+        }
+        glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+        glm::mat4 view = glm::lookAtRH(glm::vec3(0, 0, 30), glm::vec3(10, 5, 0), glm::vec3(0, 1, 0));
+        unsigned threads = ThreadPool::global().size();
+        std::cout << "frustum culling of " << count << " boxes, " << threads << " threads" << std::endl;
+
+        bool passed = true;
+        for (bool cullingPlane : {false, true})
+        {
+            FrustumCuller culler;
+            culler.setView(projection * view);
+            culler.setCullingPlane(cullingPlane, glm::vec3(0), 2u);
+            std::vector<uint32_t> reference;
+            double referenceTime = 0;
+            bool first = true;
+            struct Variant
+            {
+                const char *name;
+                unsigned threads;
+                bool vectorized;
+            };
+            for (Variant variant : {Variant{"scalar", 1, false}, Variant{"simd", 1, true}, Variant{"simd, all threads", threads, true}})
+            {
+                const int repetitions = 10;
+                std::vector<uint32_t> visible = culler.cull(&instances[0].position, &instances[0].scale, &instances[0].flags, sizeof(Instance), count,
+                                                            FrustumCuller::box, variant.threads, variant.vectorized);
+                auto start = clock::now();
+                for (int r = 0; r < repetitions; ++r)
+                    culler.cull(&instances[0].position, &instances[0].scale, &instances[0].flags, sizeof(Instance), count, FrustumCuller::box,
+                                variant.threads, variant.vectorized);
+                double time = std::chrono::duration<double>(clock::now() - start).count() / repetitions;
+                if (first)
+                {
+                    reference = visible;
+                    referenceTime = time;
+                    first = false;
+                }
+                std::cout << "  " << (cullingPlane ? "with culling plane, " : "") << variant.name << ": " << time * 1000 << " ms ("
+                          << referenceTime / time << "x), " << visible.size() << " visible, " << count - visible.size() << " culled, "
+                          << (visible == reference ? "same as scalar" : "DIFFERS from scalar") << std::endl;
+                passed = passed && visible == reference;
+            }
+        }
+        return passed;
+    }
+
+    bool benchmarkInstancePacking(size_t count)
+    {
+        if (count == 0)
+            return true;
+        std::cout << "instance packing of " << count << " instances, F16C " << (halfFloat::hardwareConversion() ? "on" : "off") << std::endl;
+
+        // every half converts to a float and back to itself
+        size_t halfMismatches = 0;
+        for (uint32_t half = 0; half < 65536; ++half)
+        {
+            float value = halfFloat::toFloat(uint16_t(half));
+            if (!std::isnan(value) && halfFloat::fromFloat(value) != half)
+                halfMismatches++;
+        }
+        std::cout << "  half round trip: " << (halfMismatches == 0 ? "all 65536 halves exact" : "MISMATCHES") << std::endl;
+
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_real_distribution<float> exponent(-12.0f, 15.0f);
+        std::vector<Instance> instances(count);
+        std::vector<float> values(count * 3);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Instance &instance = instances[i];
+            instance.position = glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+            glm::vec4 rotation(unit(rng) * 2 - 1, unit(rng) * 2 - 1, unit(rng) * 2 - 1, unit(rng) * 2 - 1);
+            instance.rotation = glm::length(rotation) > 0 ? glm::normalize(rotation) : glm::vec4(0, 0, 0, 1);
+            // scales over the whole normal half range
+            instance.scale = glm::vec3(std::exp2(exponent(rng)), std::exp2(exponent(rng)), std::exp2(exponent(rng)));
+            instance.color = glm::vec4(unit(rng), unit(rng), unit(rng), unit(rng));
+            instance.id = uint32_t(rng());
+            instance.flags = uint32_t(rng()) & 0xfu;
+            for (int c = 0; c < 3; ++c)
+                values[i * 3 + c] = instance.scale[c];
+        }
+
+        std::vector<uint16_t> halves(values.size());
+        std::vector<uint16_t> scalarHalves(values.size());
+        auto start = clock::now();
+        halfFloat::convert(values.data(), halves.data(), values.size());
+        double convertTime = std::chrono::duration<double>(clock::now() - start).count();
+        start = clock::now();
+        for (size_t i = 0; i < values.size(); ++i)
+            scalarHalves[i] = halfFloat::fromFloat(values[i]);
+        double scalarConvertTime = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout << "  " << values.size() << " floats to halves: scalar " << scalarConvertTime * 1000 << " ms, bulk " << convertTime * 1000
+                  << " ms, " << (halves == scalarHalves ? "same halves" : "DIFFERENT halves") << std::endl;
+
+        std::vector<CompactInstance> packed[2];
+        double times[2];
+        const int repetitions = 10;
+        for (int vectorized = 0; vectorized < 2; ++vectorized)
+        {
+            packed[vectorized].resize(count);
+            start = clock::now();
+            for (int r = 0; r < repetitions; ++r)
+                instancePacking::pack(&instances[0].position, &instances[0].rotation.x, &instances[0].scale, &instances[0].color, &instances[0].id,
+                                      &instances[0].flags, sizeof(Instance), count, packed[vectorized].data(), vectorized != 0);
+            times[vectorized] = std::chrono::duration<double>(clock::now() - start).count() / repetitions;
+        }
+        bool sameBytes = std::memcmp(packed[0].data(), packed[1].data(), count * sizeof(CompactInstance)) == 0;
+        std::cout << "  pack scalar: " << times[0] * 1000 << " ms, simd: " << times[1] * 1000 << " ms (" << times[0] / times[1] << "x), "
+                  << (sameBytes ? "same bytes" : "DIFFERENT bytes") << std::endl;
+
+        // largest errors relative to the precision of the formats, 1 for a correct rounding plus the float error of the check itself
+        float rotationError = 0, scaleError = 0, colorError = 0;
+        size_t wrongPositions = 0, wrongIds = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Instance &instance = instances[i];
+            glm::vec3 position, scale;
+            glm::vec4 rotation, color;
+            uint32_t id, flags;
+            instancePacking::unpack(packed[1][i], position, rotation, scale, color, id, flags);
+            if (position != instance.position)
+                wrongPositions++;
+            if (id != (instance.id & ((1u << instancePacking::idBits) - 1)) || flags != instance.flags)
+                wrongIds++;
+            for (int c = 0; c < 4; ++c)
+            {
+                rotationError = std::max(rotationError, std::abs(rotation[c] - instance.rotation[c]) * 32767.0f / 0.5f);
+                colorError = std::max(colorError, std::abs(color[c] - instance.color[c]) * 255.0f / 0.5f);
+            }
+            for (int c = 0; c < 3; ++c)
+                scaleError = std::max(scaleError, std::abs(scale[c] - instance.scale[c]) / instance.scale[c] / std::exp2(-11.0f));
+        }
+        bool withinPrecision = rotationError <= 1.01f && scaleError <= 1.01f && colorError <= 1.01f && wrongPositions == 0 && wrongIds == 0;
+        std::cout << "  round trip error in half units of the format: rotation " << rotationError << ", scale " << scaleError << ", color "
+                  << colorError << ", " << wrongPositions << " wrong positions, " << wrongIds << " wrong ids or flags, "
+                  << (withinPrecision ? "within precision" : "OUT OF PRECISION") << std::endl;
+        return halfMismatches == 0 && halves == scalarHalves && sameBytes && withinPrecision;
+    }
+
+    void benchmarkInstanceThroughput(const std::vector<size_t> &counts)
+    {
+        glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+        glm::mat4 view = glm::lookAtRH(glm::vec3(0, 0, 150), glm::vec3(30, 0, 0), glm::vec3(0, 1, 0));
+        unsigned threads = ThreadPool::global().size();
+        const size_t chunkSizes[] = {size_t(1) << 16, size_t(1) << 20, size_t(1) << 22};
+        for (size_t count : counts)
+        {
+            if (count == 0)
+                continue;
+            std::mt19937 rng(3);
+            std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+            std::uniform_real_distribution<float> radius(0.05f, 0.5f);
+            std::vector<Instance> instances(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                float r = radius(rng);
+                instances[i].position = glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+                instances[i].rotation = glm::vec4(0, 0, 0, 1);
+                instances[i].scale = glm::vec3(r);
+                instances[i].color = glm::vec4(0.2f, 0.5f, 0.8f, 1.0f);
+                instances[i].id = uint32_t(i);
+                instances[i].flags = 0;
+            }
+            std::cout << "instance throughput, " << count << " spheres, " << threads << " threads" << std::endl;
+
+            FrustumCuller culler;
+            culler.setView(projection * view);
+            auto start = clock::now();
+            const std::vector<uint32_t> &visible = culler.cull(&instances[0].position, &instances[0].scale, &instances[0].flags, sizeof(Instance),
+                                                               count, FrustumCuller::ellipsoid, 0);
+            double cullTime = std::chrono::duration<double>(clock::now() - start).count();
+            std::vector<Instance> drawn(visible.size());
+            start = clock::now();
+            for (size_t i = 0; i < visible.size(); ++i)
+                drawn[i] = instances[visible[i]];
+            double gatherTime = std::chrono::duration<double>(clock::now() - start).count();
+            std::cout << "  cull: " << cullTime * 1000 << " ms, gather: " << gatherTime * 1000 << " ms, " << drawn.size() << " visible" << std::endl;
+            if (drawn.empty())
+                continue;
+
+            std::vector<CompactInstance> packed(drawn.size());
+            start = clock::now();
+            instancePacking::pack(&drawn[0].position, &drawn[0].rotation.x, &drawn[0].scale, &drawn[0].color, &drawn[0].id, &drawn[0].flags,
+                                  sizeof(Instance), drawn.size(), packed.data());
+            double packTime = std::chrono::duration<double>(clock::now() - start).count();
+            std::cout << "  pack to compact: " << packTime * 1000 << " ms" << std::endl;
+
+            for (bool compact : {false, true})
+            {
+                const char *data = compact ? reinterpret_cast<const char *>(packed.data()) : reinterpret_cast<const char *>(drawn.data());
+                size_t elementSize = compact ? sizeof(CompactInstance) : sizeof(Instance);
+                for (size_t chunkSize : chunkSizes)
+                {
+                    size_t chunks = (drawn.size() + chunkSize - 1) / chunkSize;
+                    std::vector<std::vector<char>> staging(chunks);
+                    for (size_t k = 0; k < chunks; ++k)
+                        staging[k].resize(std::min(chunkSize, drawn.size() - k * chunkSize) * elementSize);
+                    // the staging memory is touched once before, like the persistent buffers of the pipeline
+                    start = clock::now();
+                    for (size_t k = 0; k < chunks; ++k)
+                        std::memcpy(staging[k].data(), data + k * chunkSize * elementSize, staging[k].size());
+                    double time = std::chrono::duration<double>(clock::now() - start).count();
+                    double bytes = double(drawn.size() * elementSize);
+                    std::cout << "  " << (compact ? "32 byte" : "64 byte") << " instances, chunks of " << chunkSize << ": " << chunks << " draw calls, "
+                              << bytes / (1 << 20) << " MB in " << time * 1000 << " ms (" << bytes / time / 1e9 << " GB/s, "
+                              << drawn.size() / time / 1e6 << " M instances/s)" << std::endl;
+                }
+            }
+        }
+    }
+
+    bool benchmarkImageUpload(size_t width, size_t height)
+    {
+        size_t count = width * height;
+        if (count == 0)
+            return true;
+        std::mt19937 rng(5);
+        std::normal_distribution<float> value(0.0f, 1.0f);
+        std::vector<float> field(count);
+        for (float &v : field)
+            v = value(rng);
+        // stands in for the staging memory writeTexture copies into, touched once like in a running application
+        std::vector<float> staging(count);
+        std::vector<float> pipelineData;
+        pipelineData.reserve(count);
+        std::cout << "image upload, " << width << " x " << height << " floats (" << count * sizeof(float) / double(1 << 20) << " MB)" << std::endl;
+
+        const int repetitions = 5;
+        double copyTime = 0, spanTime = 0, spanRangeTime = 0;
+        bool same = true;
+        for (int r = 0; r < repetitions; ++r)
+        {
+            // previous drawImage: the vector by value into both overloads, min and max, normalization and the append
+            auto start = clock::now();
+            {
+                std::vector<float> argument = field;
+                auto [min, max] = std::minmax_element(argument.begin(), argument.end());
+                std::vector<float> normalized = argument;
+                float vmin = *min, vmax = *max;
+                for (float &v : normalized)
+                    v = (v - vmin) / (vmax - vmin);
+                pipelineData.clear();
+                pipelineData.insert(pipelineData.end(), normalized.begin(), normalized.end());
+                std::memcpy(staging.data(), pipelineData.data(), count * sizeof(float));
+            }
+            copyTime += std::chrono::duration<double>(clock::now() - start).count();
+
+            // span with automatic range: one scan for min and max, the upload reads the caller's memory
+            start = clock::now();
+            {
+                Span<const float> data(field);
+                auto [min, max] = std::minmax_element(data.begin(), data.end());
+                same = same && *min <= *max;
+                std::memcpy(staging.data(), data.data(), count * sizeof(float));
+            }
+            spanRangeTime += std::chrono::duration<double>(clock::now() - start).count();
+
+            // span with a fixed range: the upload is the only pass over the data
+            start = clock::now();
+            std::memcpy(staging.data(), field.data(), count * sizeof(float));
+            spanTime += std::chrono::duration<double>(clock::now() - start).count();
+            same = same && std::memcmp(staging.data(), field.data(), count * sizeof(float)) == 0;
+        }
+        std::cout << "  copy and normalize on the CPU: " << copyTime / repetitions * 1000 << " ms" << std::endl;
+        std::cout << "  span, automatic range:        " << spanRangeTime / repetitions * 1000 << " ms" << std::endl;
+        std::cout << "  span, fixed range:            " << spanTime / repetitions * 1000 << " ms" << std::endl;
+        if (!same)
+            std::cout << "  ERROR: the staged data differs from the field" << std::endl;
+
+        // half precision: the conversion writes the staging memory, which is half as large
+        std::vector<uint16_t> halves(count);
+        double halfTime = 0;
+        for (int r = 0; r < repetitions; ++r)
+        {
+            auto start = clock::now();
+            halfFloat::convert(field.data(), halves.data(), count);
+            halfTime += std::chrono::duration<double>(clock::now() - start).count();
+        }
+        std::cout << "  span, half precision:         " << halfTime / repetitions * 1000 << " ms, " << count * sizeof(uint16_t) / double(1 << 20) << " MB"
+                  << (halfFloat::hardwareConversion() ? " (F16C)" : " (scalar)") << std::endl;
+        bool sameHalves = true;
+        for (size_t i = 0; i < count; i += 997)
+        {
+            if (halves[i] != halfFloat::fromFloat(field[i]))
+            {
+                std::cout << "  ERROR: bulk half conversion differs from the scalar one" << std::endl;
+                sameHalves = false;
+                break;
+            }
+        }
+
+        // a local change, only the rows of a small rectangle are staged
+        size_t rectangle = std::min<size_t>(256, std::min(width, height));
+        double rectTime = 0;
+        for (int r = 0; r < repetitions; ++r)
+        {
+            auto start = clock::now();
+            for (size_t row = 0; row < rectangle; ++row)
+                std::memcpy(staging.data() + row * rectangle, field.data() + (height / 2 + row - rectangle / 2) * width + width / 2, rectangle * sizeof(float));
+            rectTime += std::chrono::duration<double>(clock::now() - start).count();
+        }
+        std::cout << "  dirty " << rectangle << " x " << rectangle << " rectangle:      " << rectTime / repetitions * 1000 << " ms, "
+                  << rectangle * rectangle * sizeof(float) / 1024.0 << " KB" << std::endl;
+        return same && sameHalves;
+    }
+
+    bool benchmarkRangeReduction(size_t count)
+    {
+        if (count < 2)
+            return true;
+        // a smooth field with a few outliers that would wash out a min/max colormap
+        std::mt19937 rng(11);
+        std::normal_distribution<float> value(0.0f, 1.0f);
+        std::uniform_int_distribution<size_t> index(0, count - 1);
+        std::vector<float> field(count);
+        for (float &v : field)
+            v = value(rng);
+        for (int i = 0; i < 100; ++i)
+            field[index(rng)] = value(rng) * 1000.0f;
+        unsigned threads = ThreadPool::global().size();
+        std::cout << "range reduction, " << count << " floats, " << threads << " threads" << std::endl;
+
+        auto timed = [](auto &&function)
+        {
+            const int repetitions = 5;
+            auto start = clock::now();
+            for (int r = 0; r < repetitions - 1; ++r)
+                function();
+            auto result = function();
+            return std::make_pair(result, std::chrono::duration<double>(clock::now() - start).count() / repetitions);
+        };
+
+        auto [reference, referenceTime] = timed([&]
+                                                { return std::minmax_element(field.begin(), field.end()); });
+        std::cout << "  std::minmax_element: " << referenceTime * 1000 << " ms" << std::endl;
+        bool passed = true;
+
+        struct Variant
+        {
+            const char *name;
+            unsigned threads;
+            bool vectorized;
+        };
+        const Variant variants[] = {{"scalar", 1, false}, {"SIMD", 1, true}, {"SIMD, all threads", 0, true}};
+        for (const Variant &variant : variants)
+        {
+            auto [range, time] = timed([&]
+                                       { return rangeReduction::minMax(field.data(), count, variant.threads, variant.vectorized); });
+            std::cout << "  min/max, " << variant.name << ": " << time * 1000 << " ms" << std::endl;
+            if (range.min != *reference.first || range.max != *reference.second)
+            {
+                std::cout << "  ERROR: min/max differs from std::minmax_element" << std::endl;
+                passed = false;
+            }
+        }
+
+        std::vector<float> sorted = field;
+        std::sort(sorted.begin(), sorted.end());
+        auto exact = [&](float percent)
+        {
+            double rank = percent / 100.0 * double(count - 1);
+            size_t below = size_t(rank);
+            size_t above = std::min(below + 1, count - 1);
+            return float(sorted[below] + (rank - double(below)) * (sorted[above] - sorted[below]));
+        };
+        const float percents[][2] = {{1, 99}, {0.1f, 99.9f}, {0, 100}, {50, 50}};
+        for (const Variant &variant : variants)
+        {
+            auto [range, time] = timed([&]
+                                       { return rangeReduction::percentiles(field.data(), count, 1, 99, variant.threads, variant.vectorized); });
+            std::cout << "  min/max and percentiles, " << variant.name << ": " << time * 1000 << " ms" << std::endl;
+            if (range.min != *reference.first || range.max != *reference.second)
+            {
+                std::cout << "  ERROR: min/max differs from std::minmax_element" << std::endl;
+                passed = false;
+            }
+            for (const auto &percent : percents)
+            {
+                rangeReduction::Range result = rangeReduction::percentiles(field.data(), count, percent[0], percent[1], variant.threads, variant.vectorized);
+                for (int k = 0; k < 2; ++k)
+                {
+                    float expected = exact(percent[k]);
+                    float estimate = k == 0 ? result.low : result.high;
+                    // the bins are 2^-7 of the magnitude wide, plus the distance between neighboring ranks
+                    size_t below = size_t(percent[k] / 100.0 * double(count - 1));
+                    float gap = sorted[std::min(below + 1, count - 1)] - sorted[below];
+                    float tolerance = std::abs(expected) / 128.0f + gap + 1e-6f;
+                    if (std::abs(estimate - expected) > tolerance)
+                    {
+                        std::cout << "  ERROR: " << percent[k] << "% percentile " << estimate << ", exact " << expected << std::endl;
+                        passed = false;
+                    }
+                }
+            }
+        }
+        rangeReduction::Range range = rangeReduction::percentiles(field.data(), count, 1, 99, 0);
+        std::cout << "  min " << range.min << ", max " << range.max << ", 1% " << range.low << " (exact " << exact(1) << "), 99% " << range.high
+                  << " (exact " << exact(99) << ")" << std::endl;
+
+        std::vector<float> nans(1000, std::numeric_limits<float>::quiet_NaN());
+        nans[500] = 3.0f;
+        rangeReduction::Range withNans = rangeReduction::percentiles(nans.data(), nans.size(), 1, 99);
+        rangeReduction::Range minMaxNans = rangeReduction::minMax(nans.data(), nans.size());
+        if (withNans.min != 3.0f || withNans.max != 3.0f || withNans.low != 3.0f || minMaxNans.min != 3.0f || minMaxNans.max != 3.0f)
+        {
+            std::cout << "  ERROR: NaNs are not ignored" << std::endl;
+            passed = false;
+        }
+        return passed;
+    }
+
+    bool benchmarkFrameCapture(size_t count, size_t frames, const char *path)
+    {
+        if (count == 0 || frames == 0)
+            return true;
+        std::mt19937 rng(6);
+        std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+        std::uniform_int_distribution<size_t> pick(0, count - 1);
+        std::vector<Instance> instances(count);
+        for (size_t i = 0; i < count; ++i)
+            instances[i] = {{position(rng), position(rng), position(rng)}, {0, 0, 0, 1}, glm::vec3(0.2f), {1, 0.5f, 0.2f, 1}, uint32_t(i), 0};
+        std::cout << "frame capture, " << frames << " frames of " << count << " spheres (" << count * sizeof(Instance) / double(1 << 20)
+                  << " MB per frame)" << std::endl;
+
+        std::vector<std::vector<Instance>> captured;
+        captured.reserve(frames);
+        double submitTime = 0;
+        uint64_t fileSize = 0;
+        {
+            FrameCaptureWriter writer(path);
+            for (size_t frame = 0; frame < frames; ++frame)
+            {
+                for (size_t i = 0; i < count / 10; ++i)
+                    instances[pick(rng)].position.y += 0.01f;
+                auto start = clock::now();
+                writer.frame().assign(frameCapture::spheres, instances.data(), instances.size());
+                writer.frame().flags = uint32_t(frame);
+                writer.submit();
+                submitTime += std::chrono::duration<double>(clock::now() - start).count();
+                captured.push_back(instances);
+            }
+            auto start = clock::now();
+            writer.close();
+            submitTime += std::chrono::duration<double>(clock::now() - start).count();
+            fileSize = writer.bytesWritten();
+        }
+        std::cout << "  file " << fileSize / double(1 << 20) << " MB, " << double(count * sizeof(Instance) * frames) / fileSize
+                  << "x smaller than the raw arrays" << std::endl;
+        std::cout << "  capture: " << submitTime * 1000 / frames << " ms per frame" << std::endl;
+
+        auto matches = [&](const frameCapture::Frame &frame, size_t index)
+        {
+            size_t n;
+            const Instance *replayed = frame.view<Instance>(frameCapture::spheres, n);
+            return n == count && frame.flags == index && std::memcmp(replayed, captured[index].data(), n * sizeof(Instance)) == 0;
+        };
+        bool passed = true;
+        FrameCaptureReader reader(path);
+        if (reader.frameCount() != frames)
+        {
+            std::cout << "  ERROR: " << reader.frameCount() << " frames in the file" << std::endl;
+            return false;
+        }
+        auto start = clock::now();
+        for (size_t frame = 0; frame < reader.frameCount(); ++frame)
+        {
+            if (!matches(reader.frame(frame), frame))
+            {
+                std::cout << "  ERROR: frame " << frame << " differs after sequential replay" << std::endl;
+                passed = false;
+            }
+        }
+        std::cout << "  sequential replay: " << std::chrono::duration<double>(clock::now() - start).count() * 1000 / frames << " ms per frame" << std::endl;
+        start = clock::now();
+        const size_t seeks = 50;
+        std::uniform_int_distribution<size_t> frameIndex(0, frames - 1);
+        for (size_t i = 0; i < seeks; ++i)
+        {
+            size_t frame = frameIndex(rng);
+            if (!matches(reader.frame(frame), frame))
+            {
+                std::cout << "  ERROR: frame " << frame << " differs after seeking" << std::endl;
+                passed = false;
+            }
+        }
+        std::cout << "  random seek: " << std::chrono::duration<double>(clock::now() - start).count() * 1000 / seeks << " ms per frame" << std::endl;
+
+        // a run that crashed while writing, the last frame is incomplete
+        std::string cutPath = std::string(path) + ".cut";
+        {
+            std::ifstream input(path, std::ios::binary);
+            std::vector<char> bytes(fileSize / 2);
+            input.read(bytes.data(), bytes.size());
+            std::ofstream(cutPath, std::ios::binary).write(bytes.data(), bytes.size());
+        }
+        FrameCaptureReader cut(cutPath);
+        for (size_t frame = 0; frame < cut.frameCount(); ++frame)
+        {
+            if (!matches(cut.frame(frame), frame))
+            {
+                std::cout << "  ERROR: frame " << frame << " of the cut file differs" << std::endl;
+                passed = false;
+            }
+        }
+        std::cout << "  cut after half of the file: " << cut.frameCount() << " complete frames" << std::endl;
+        return passed;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// micro benchmarks and correctness checks for the CPU side of the renderer, results are printed to std::cout,
+// the ones with checks return false if one of them failed
+namespace renderBenchmark
+{
+    /* order a cloud of instances back to front with the previous std::stable_sort over an index array and with
+    the DepthSorter radix sort (serial and with all threads of ThreadPool::global()), checks that every variant
+    produces exactly the order of the stable sort, also for the transparent only mode and for equal distances
+    */
+    bool benchmarkDepthSort(size_t count = 200000);
+
+    /* cull a cloud of boxes against a camera that sees part of it, scalar, with SIMD and with all threads of
+    ThreadPool::global(), checks that the SIMD and threaded variants find the same visible instances as the scalar one
+    */
+    bool benchmarkFrustumCulling(size_t count = 1000000);
+
+    /* pack random instances into the 32 byte CompactInstance layout with and without SIMD, checks that both give
+    the same bytes and that every field decodes within the precision of its format, also checks the half float
+    conversion against all 65536 halves and the bulk conversion against the scalar one
+    */
+    bool benchmarkInstancePacking(size_t count = 1000000);
+
+    /* CPU side of a frame with millions of spheres: frustum culling, gathering the visible instances, packing them
+    for the compact layout and splitting them into chunks of several sizes the way InstancingPipeline uploads them.
+    The upload is stood in for by a copy into one staging allocation per chunk, like writeBuffer does before the
+    GPU sees the data, so the GPU side is not part of the numbers
+    */
+    void benchmarkInstanceThroughput(const std::vector<size_t> &counts = {1000000, 5000000, 10000000});
+
+    /* CPU side of drawImage for a large float field: the previous path that copied the vector twice, normalized it
+    and appended it to the pipeline data, against the span path that hands the caller's memory to writeTexture,
+    with and without the min and max scan, the conversion to half precision and the upload of a dirty 256 x 256
+    rectangle. The copy into writeTexture's staging memory is part of every variant. Checks that the staged data is
+    the field and that the bulk half conversion matches the scalar one
+    */
+    bool benchmarkImageUpload(size_t width = 4096, size_t height = 4096);
+
+    /* colormap range of a normal distributed field with outliers: std::minmax_element against rangeReduction::minMax
+    and rangeReduction::percentiles, scalar, with SIMD and with all threads of ThreadPool::global(). Checks min and max
+    against std::minmax_element, the percentiles against a full sort and that NaNs are ignored
+    */
+    bool benchmarkRangeReduction(size_t count = 1 << 24);
+
+    /* capture frames of a sphere cloud in which a tenth of the spheres moves each frame with FrameCaptureWriter and
+    replay them with FrameCaptureReader: file size against the raw instance arrays, time per submitted frame including
+    the wait for the background writer, sequential decoding and random seeks. Checks that every replayed frame is
+    exactly the captured one, also for a copy of the file that is cut off in the middle of a frame
+    */
+    bool benchmarkFrameCapture(size_t count = 100000, size_t frames = 200, const char *path = "benchmark.frames");
+}
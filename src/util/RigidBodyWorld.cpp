@@ -0,0 +1,578 @@
+#include <util/RigidBodyWorld.h>
+#include <util/CollisionDetection.h>
+#include <util/Profiler.h>
+#include <util/StateStream.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+using vec3 = glm::vec3;
+using mat3 = glm::mat3;
+
+namespace
+{
+    using clock = std::chrono::high_resolution_clock;
+
+    double secondsSince(clock::time_point start)
+    {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    bool overlap(const vec3 &minA, const vec3 &maxA, const vec3 &minB, const vec3 &maxB)
+    {
+        return minA.x <= maxB.x && minB.x <= maxA.x && minA.y <= maxB.y && minB.y <= maxA.y && minA.z <= maxB.z && minB.z <= maxA.z;
+    }
+}
+
+uint32_t RigidBodyWorld::addBox(const vec3 &position, const vec3 &size, float mass, const glm::quat &orientation)
+{
+    uint32_t index = (uint32_t)boxes.size();
+    RigidBox box;
+    box.position = position;
+    box.orientation = orientation;
+    box.size = size;
+    ContactBody solverBody;
+    solverBody.position = position;
+    if (mass > 0)
+    {
+        box.inverseMass = 1.0f / mass;
+        vec3 inertia = mass / 12.0f * vec3(size.y * size.y + size.z * size.z, size.x * size.x + size.z * size.z, size.x * size.x + size.y * size.y);
+        box.inverseInertiaBody = 1.0f / inertia;
+        state.push_back(Awake);
+        awake.push_back(index);
+    }
+    else
+    {
+        state.push_back(Static);
+        inactiveDirty = true;
+    }
+    boxes.push_back(box);
+    restTime.push_back(0);
+    islandOfBody.push_back(0);
+    solverBodies.push_back(solverBody);
+    return index;
+}
+
+void RigidBodyWorld::clear()
+{
+    boxes.clear();
+    state.clear();
+    restTime.clear();
+    awake.clear();
+    inactive.clear();
+    inactiveBounds.clear();
+    inactiveDirty = true;
+    sleepingIslands.clear();
+    freeIslands.clear();
+    islandOfBody.clear();
+    solverBodies.clear();
+    solver.reset();
+    lastStats = Stats();
+}
+
+void RigidBodyWorld::saveState(StateWriter &writer) const
+{
+    writer.write(boxes);
+    writer.write(state);
+    writer.write(restTime);
+    writer.write(awake);
+    writer.write<uint64_t>(sleepingIslands.size());
+    for (const std::vector<uint32_t> &island : sleepingIslands)
+        writer.write(island);
+    writer.write(freeIslands);
+    writer.write(islandOfBody);
+    // sleeping and static bodies keep the solver body of their last step
+    writer.write(solverBodies);
+    solver.saveCache(writer);
+}
+
+void RigidBodyWorld::loadState(StateReader &reader)
+{
+    // everything is read and checked aside, a state that does not fit leaves the world as it was
+    std::vector<RigidBox> newBoxes;
+    std::vector<State> newState;
+    std::vector<float> newRestTime;
+    std::vector<uint32_t> newAwake;
+    std::vector<std::vector<uint32_t>> newSleepingIslands;
+    std::vector<uint32_t> newFreeIslands;
+    std::vector<uint32_t> newIslandOfBody;
+    std::vector<ContactBody> newSolverBodies;
+    reader.read(newBoxes);
+    reader.read(newState);
+    reader.read(newRestTime);
+    reader.read(newAwake);
+    uint64_t islandCount;
+    reader.read(islandCount);
+    if (islandCount > reader.remaining() / sizeof(uint64_t))
+        throw std::runtime_error("State ends inside " + std::to_string(islandCount) + " sleeping islands");
+    newSleepingIslands.resize((size_t)islandCount);
+    for (std::vector<uint32_t> &island : newSleepingIslands)
+        reader.read(island);
+    reader.read(newFreeIslands);
+    reader.read(newIslandOfBody);
+    reader.read(newSolverBodies);
+
+    size_t count = newBoxes.size();
+    if (newState.size() != count || newRestTime.size() != count || newIslandOfBody.size() != count || newSolverBodies.size() != count)
+        throw std::runtime_error("The rigid body state has arrays of different sizes");
+    for (uint32_t i : newAwake)
+    {
+        if (i >= count)
+            throw std::runtime_error("The rigid body state has an awake body out of range");
+    }
+    for (const std::vector<uint32_t> &island : newSleepingIslands)
+    {
+        for (uint32_t i : island)
+        {
+            if (i >= count)
+                throw std::runtime_error("The rigid body state has a sleeping body out of range");
+        }
+    }
+    for (uint32_t island : newFreeIslands)
+    {
+        if (island >= newSleepingIslands.size())
+            throw std::runtime_error("The rigid body state has a free island out of range");
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (newState[i] != Awake && newState[i] != Sleeping && newState[i] != Static)
+            throw std::runtime_error("The rigid body state has a body in an unknown state");
+        // islandOfBody is left over from the last sleep for the other bodies
+        if (newState[i] == Sleeping && newIslandOfBody[i] >= newSleepingIslands.size())
+            throw std::runtime_error("The rigid body state has a sleeping body in an island out of range");
+    }
+    // the last part of the state, it replaces the cache only if it fits as well
+    solver.loadCache(reader);
+
+    boxes.swap(newBoxes);
+    state.swap(newState);
+    restTime.swap(newRestTime);
+    awake.swap(newAwake);
+    sleepingIslands.swap(newSleepingIslands);
+    freeIslands.swap(newFreeIslands);
+    islandOfBody.swap(newIslandOfBody);
+    solverBodies.swap(newSolverBodies);
+    inactive.clear();
+    inactiveBounds.clear();
+    inactiveDirty = true;
+    lastStats = Stats();
+}
+
+glm::mat4 RigidBodyWorld::worldFromObj(uint32_t body) const
+{
+    const RigidBox &box = boxes[body];
+    return glm::translate(glm::mat4(1), box.position) * glm::mat4_cast(box.orientation) * glm::scale(glm::mat4(1), box.size);
+}
+
+RigidBodyWorld::Bounds RigidBodyWorld::computeBounds(const RigidBox &box) const
+{
+    mat3 rotation = glm::mat3_cast(box.orientation);
+    vec3 halfSize = 0.5f * box.size;
+    vec3 extent(0.5f * settings.contactMargin);
+    for (int i = 0; i < 3; ++i)
+        extent += glm::abs(rotation[i]) * halfSize[i];
+    return {box.position - extent, box.position + extent};
+}
+
+void RigidBodyWorld::step(float dt)
+{
+    PROFILE_ZONE("RigidBodyWorld::step");
+    auto startTime = clock::now();
+    lastStats = Stats();
+    if (!settings.sleeping)
+        wakeAll();
+
+    float linearDamping = 1.0f / (1.0f + dt * settings.linearDamping);
+    float angularDamping = 1.0f / (1.0f + dt * settings.angularDamping);
+    for (uint32_t i : awake)
+    {
+        RigidBox &box = boxes[i];
+        box.linearVelocity = (box.linearVelocity + dt * settings.gravity) * linearDamping;
+        box.angularVelocity *= angularDamping;
+    }
+
+    // collide until no sleeping island is woken up by a new contact anymore
+    while (true)
+    {
+        if (inactiveDirty)
+            rebuildInactive();
+        broadphase();
+        narrowphase();
+        size_t woken = lastStats.islandsWoken;
+        for (const Contact &contact : contacts)
+        {
+            if (contact.b != ContactSolver::staticBody && state[contact.b] == Sleeping)
+                wakeIsland(islandOfBody[contact.b]);
+        }
+        if (lastStats.islandsWoken == woken)
+            break;
+    }
+
+    solve(dt);
+    integrate(dt);
+    updateIslands(dt);
+
+    lastStats.bodies = boxes.size();
+    lastStats.awakeBodies = awake.size();
+    lastStats.sleepingIslands = sleepingIslands.size() - freeIslands.size();
+    for (const auto &island : sleepingIslands)
+        lastStats.sleepingBodies += island.size();
+    lastStats.stepTime = secondsSince(startTime);
+}
+
+void RigidBodyWorld::rebuildInactive()
+{
+    inactive.clear();
+    for (uint32_t i = 0; i < boxes.size(); ++i)
+    {
+        if (state[i] != Awake)
+            inactive.push_back(i);
+    }
+    bounds.resize(boxes.size());
+    inactiveMaxWidth = 0;
+    for (uint32_t i : inactive)
+    {
+        bounds[i] = computeBounds(boxes[i]);
+        inactiveMaxWidth = std::max(inactiveMaxWidth, bounds[i].max.x - bounds[i].min.x);
+    }
+    std::sort(inactive.begin(), inactive.end(), [this](uint32_t a, uint32_t b)
+              { return bounds[a].min.x < bounds[b].min.x; });
+    inactiveBounds.resize(inactive.size());
+    for (size_t k = 0; k < inactive.size(); ++k)
+        inactiveBounds[k] = bounds[inactive[k]];
+    inactiveDirty = false;
+}
+
+void RigidBodyWorld::broadphase()
+{
+    PROFILE_ZONE("RigidBodyWorld::broadphase");
+    auto startTime = clock::now();
+    bounds.resize(boxes.size());
+    for (uint32_t i : awake)
+        bounds[i] = computeBounds(boxes[i]);
+
+    // sweep and prune along x among the awake bodies
+    std::vector<uint32_t> sorted = awake;
+    std::sort(sorted.begin(), sorted.end(), [this](uint32_t a, uint32_t b)
+              { return bounds[a].min.x < bounds[b].min.x; });
+    pairs.clear();
+    for (size_t k = 0; k < sorted.size(); ++k)
+    {
+        const Bounds &a = bounds[sorted[k]];
+        for (size_t l = k + 1; l < sorted.size() && bounds[sorted[l]].min.x <= a.max.x; ++l)
+        {
+            const Bounds &b = bounds[sorted[l]];
+            if (overlap(a.min, a.max, b.min, b.max))
+                pairs.push_back({sorted[k], sorted[l]});
+        }
+    }
+
+    // awake against sleeping and static bodies, the inactive bodies are never tested against each other
+    for (uint32_t i : awake)
+    {
+        const Bounds &a = bounds[i];
+        auto first = std::lower_bound(inactiveBounds.begin(), inactiveBounds.end(), a.min.x - inactiveMaxWidth,
+                                      [](const Bounds &bounds, float x)
+                                      { return bounds.min.x < x; });
+        for (size_t k = first - inactiveBounds.begin(); k < inactive.size() && inactiveBounds[k].min.x <= a.max.x; ++k)
+        {
+            if (overlap(a.min, a.max, inactiveBounds[k].min, inactiveBounds[k].max))
+                pairs.push_back({i, inactive[k]});
+        }
+    }
+    lastStats.broadphasePairs = pairs.size();
+    lastStats.broadphaseTime += secondsSince(startTime);
+}
+
+void RigidBodyWorld::narrowphase()
+{
+    PROFILE_ZONE("RigidBodyWorld::narrowphase");
+    auto startTime = clock::now();
+    contacts.clear();
+    const float margin = settings.contactMargin;
+    if (settings.ground)
+    {
+        for (uint32_t i : awake)
+        {
+            if (bounds[i].min.y > settings.groundHeight + margin)
+                continue;
+            for (const vec3 &corner : collisionTools::getCorners(worldFromObj(i)))
+            {
+                if (corner.y < settings.groundHeight + margin)
+                    contacts.push_back({i, ContactSolver::staticBody, {true, corner, vec3(0, 1, 0), settings.groundHeight - corner.y}});
+            }
+        }
+    }
+
+    for (auto &pair : pairs)
+    {
+        // both boxes grown by half the margin, so SAT reports pairs closer than the margin
+        glm::mat4 transformA = glm::scale(worldFromObj(pair.first), 1.0f + margin / boxes[pair.first].size);
+        glm::mat4 transformB = glm::scale(worldFromObj(pair.second), 1.0f + margin / boxes[pair.second].size);
+        CollisionInfo info = collisionTools::checkCollisionSAT(transformA, transformB);
+        if (!info.isColliding)
+            continue;
+        // checkCollisionSAT finds a single point and resting boxes rock around it, face contacts get clipped instead
+        if (!addFaceContact(pair.first, pair.second, info.normalWorld))
+        {
+            info.depth -= margin;
+            contacts.push_back({pair.first, pair.second, info});
+        }
+    }
+    lastStats.narrowphaseTime += secondsSince(startTime);
+}
+
+bool RigidBodyWorld::addFaceContact(uint32_t a, uint32_t b, const vec3 &normal)
+{
+    // the face most parallel to the normal is the reference face, the face of the other box
+    // facing it the incident face. Edge-edge contacts have no face that is parallel enough.
+    const float faceAlignment = 0.98f;
+    mat3 rotationA = glm::mat3_cast(boxes[a].orientation);
+    mat3 rotationB = glm::mat3_cast(boxes[b].orientation);
+    auto bestAxis = [&normal](const mat3 &rotation, float &alignment)
+    {
+        int best = 0;
+        alignment = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            float d = std::abs(glm::dot(rotation[i], normal));
+            if (d > alignment)
+                alignment = d, best = i;
+        }
+        return best;
+    };
+    float alignmentA, alignmentB;
+    int axisA = bestAxis(rotationA, alignmentA);
+    int axisB = bestAxis(rotationB, alignmentB);
+    if (std::max(alignmentA, alignmentB) < faceAlignment)
+        return false;
+
+    // the normal points from B to A, the reference face normal points out of the reference box
+    bool referenceIsB = alignmentB >= alignmentA;
+    uint32_t reference = referenceIsB ? b : a;
+    uint32_t incident = referenceIsB ? a : b;
+    const mat3 &referenceRotation = referenceIsB ? rotationB : rotationA;
+    const mat3 &incidentRotation = referenceIsB ? rotationA : rotationB;
+    int referenceAxis = referenceIsB ? axisB : axisA;
+    vec3 towardsIncident = referenceIsB ? normal : -normal;
+    vec3 referenceNormal = referenceRotation[referenceAxis];
+    if (glm::dot(referenceNormal, towardsIncident) < 0)
+        referenceNormal = -referenceNormal;
+    const vec3 referenceHalf = 0.5f * boxes[reference].size;
+    const vec3 &referenceCenter = boxes[reference].position;
+
+    float alignment;
+    int incidentAxis = bestAxis(incidentRotation, alignment);
+    vec3 incidentNormal = incidentRotation[incidentAxis];
+    if (glm::dot(incidentNormal, referenceNormal) > 0)
+        incidentNormal = -incidentNormal;
+    const vec3 incidentHalf = 0.5f * boxes[incident].size;
+    vec3 incidentCenter = boxes[incident].position + incidentHalf[incidentAxis] * incidentNormal;
+    int u = (incidentAxis + 1) % 3, v = (incidentAxis + 2) % 3;
+    vec3 du = incidentHalf[u] * incidentRotation[u], dv = incidentHalf[v] * incidentRotation[v];
+    std::vector<vec3> polygon = {incidentCenter + du + dv, incidentCenter - du + dv, incidentCenter - du - dv, incidentCenter + du - dv};
+
+    // Sutherland-Hodgman against the four side planes of the reference face
+    std::vector<vec3> clipped;
+    for (int side = 1; side < 3; ++side)
+    {
+        int axis = (referenceAxis + side) % 3;
+        for (float sign : {1.0f, -1.0f})
+        {
+            vec3 planeNormal = sign * referenceRotation[axis];
+            float offset = glm::dot(planeNormal, referenceCenter) + referenceHalf[axis];
+            clipped.clear();
+            for (size_t i = 0; i < polygon.size(); ++i)
+            {
+                const vec3 &p = polygon[i];
+                const vec3 &q = polygon[(i + 1) % polygon.size()];
+                float dp = glm::dot(planeNormal, p) - offset;
+                float dq = glm::dot(planeNormal, q) - offset;
+                if (dp <= 0)
+                    clipped.push_back(p);
+                if ((dp < 0) != (dq < 0) && dp != dq)
+                    clipped.push_back(p + (q - p) * (dp / (dp - dq)));
+            }
+            polygon.swap(clipped);
+        }
+    }
+
+    vec3 contactNormal = referenceIsB ? referenceNormal : -referenceNormal;
+    float referenceOffset = glm::dot(referenceNormal, referenceCenter) + referenceHalf[referenceAxis];
+    size_t first = contacts.size();
+    for (const vec3 &p : polygon)
+    {
+        float separation = glm::dot(referenceNormal, p) - referenceOffset;
+        if (separation <= settings.contactMargin)
+            contacts.push_back({a, b, {true, p, contactNormal, -separation}});
+    }
+    return contacts.size() > first;
+}
+
+void RigidBodyWorld::solve(float dt)
+{
+    PROFILE_ZONE("RigidBodyWorld::solve");
+    auto startTime = clock::now();
+    for (uint32_t i : awake)
+    {
+        const RigidBox &box = boxes[i];
+        ContactBody &body = solverBodies[i];
+        mat3 rotation = glm::mat3_cast(box.orientation);
+        body.position = box.position;
+        body.linearVelocity = box.linearVelocity;
+        body.angularVelocity = box.angularVelocity;
+        body.inverseMass = box.inverseMass;
+        body.inverseInertiaWorld = rotation * mat3(box.inverseInertiaBody.x, 0, 0, 0, box.inverseInertiaBody.y, 0, 0, 0, box.inverseInertiaBody.z) *
+                                   glm::transpose(rotation);
+    }
+    for (const Contact &contact : contacts)
+        solver.addContact(contact.a, contact.b, contact.info);
+    lastStats.contacts = solver.contactCount();
+    solver.solve(solverBodies, dt);
+    for (uint32_t i : awake)
+    {
+        boxes[i].linearVelocity = solverBodies[i].linearVelocity;
+        boxes[i].angularVelocity = solverBodies[i].angularVelocity;
+    }
+    lastStats.solveTime = secondsSince(startTime);
+}
+
+void RigidBodyWorld::integrate(float dt)
+{
+    PROFILE_ZONE("RigidBodyWorld::integrate");
+    for (uint32_t i : awake)
+    {
+        RigidBox &box = boxes[i];
+        box.position += dt * box.linearVelocity;
+        box.orientation = glm::normalize(box.orientation + 0.5f * dt * glm::quat(0, box.angularVelocity) * box.orientation);
+    }
+}
+
+uint32_t RigidBodyWorld::find(uint32_t body)
+{
+    while (parent[body] != body)
+    {
+        parent[body] = parent[parent[body]];
+        body = parent[body];
+    }
+    return body;
+}
+
+void RigidBodyWorld::updateIslands(float dt)
+{
+    PROFILE_ZONE("RigidBodyWorld::updateIslands");
+    auto startTime = clock::now();
+    parent.resize(boxes.size());
+    islandIndex.resize(boxes.size());
+    for (uint32_t i : awake)
+    {
+        parent[i] = i;
+        const RigidBox &box = boxes[i];
+        bool resting = glm::dot(box.linearVelocity, box.linearVelocity) < settings.sleepLinearVelocity * settings.sleepLinearVelocity &&
+                       glm::dot(box.angularVelocity, box.angularVelocity) < settings.sleepAngularVelocity * settings.sleepAngularVelocity;
+        restTime[i] = resting ? restTime[i] + dt : 0.0f;
+    }
+    // static bodies and the ground do not connect islands
+    for (const Contact &contact : contacts)
+    {
+        if (contact.b == ContactSolver::staticBody || state[contact.b] != Awake)
+            continue;
+        uint32_t a = find(contact.a), b = find(contact.b);
+        if (a != b)
+            parent[std::max(a, b)] = std::min(a, b);
+    }
+
+    // number the islands, their size and the shortest rest time of their bodies
+    std::vector<float> islandRestTime;
+    std::vector<uint32_t> islandSize;
+    for (uint32_t i : awake)
+    {
+        uint32_t root = find(i);
+        if (root == i)
+        {
+            islandIndex[i] = (uint32_t)islandSize.size();
+            islandSize.push_back(0);
+            islandRestTime.push_back(restTime[i]);
+        }
+    }
+    for (uint32_t i : awake)
+    {
+        uint32_t island = islandIndex[find(i)];
+        ++islandSize[island];
+        islandRestTime[island] = std::min(islandRestTime[island], restTime[i]);
+    }
+    lastStats.islands = islandSize.size();
+    for (uint32_t size : islandSize)
+        lastStats.largestIsland = std::max<size_t>(lastStats.largestIsland, size);
+
+    if (settings.sleeping)
+    {
+        // move every resting island to a sleeping island slot, keeping the order of the awake bodies
+        std::vector<uint32_t> slot(islandSize.size(), UINT32_MAX);
+        size_t kept = 0;
+        for (uint32_t i : awake)
+        {
+            uint32_t island = islandIndex[find(i)];
+            if (islandRestTime[island] < settings.timeToSleep)
+            {
+                awake[kept++] = i;
+                continue;
+            }
+            if (slot[island] == UINT32_MAX)
+            {
+                if (freeIslands.empty())
+                {
+                    slot[island] = (uint32_t)sleepingIslands.size();
+                    sleepingIslands.emplace_back();
+                }
+                else
+                {
+                    slot[island] = freeIslands.back();
+                    freeIslands.pop_back();
+                }
+                ++lastStats.islandsFellAsleep;
+            }
+            RigidBox &box = boxes[i];
+            box.linearVelocity = vec3(0);
+            box.angularVelocity = vec3(0);
+            state[i] = Sleeping;
+            islandOfBody[i] = slot[island];
+            sleepingIslands[slot[island]].push_back(i);
+            inactiveDirty = true;
+        }
+        awake.resize(kept);
+    }
+    lastStats.islandTime = secondsSince(startTime);
+}
+
+void RigidBodyWorld::wakeIsland(uint32_t island)
+{
+    for (uint32_t i : sleepingIslands[island])
+    {
+        state[i] = Awake;
+        restTime[i] = 0;
+        awake.push_back(i);
+    }
+    sleepingIslands[island].clear();
+    freeIslands.push_back(island);
+    inactiveDirty = true;
+    ++lastStats.islandsWoken;
+}
+
+void RigidBodyWorld::wake(uint32_t body)
+{
+    if (state[body] == Sleeping)
+        wakeIsland(islandOfBody[body]);
+}
+
+void RigidBodyWorld::wakeAll()
+{
+    for (uint32_t island = 0; island < sleepingIslands.size(); ++island)
+    {
+        if (!sleepingIslands[island].empty())
+            wakeIsland(island);
+    }
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <util/ContactSolver.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <vector>
+
+/// @brief Box shaped rigid body of a RigidBodyWorld
+struct RigidBox
+{
+    glm::vec3 position = glm::vec3(0);
+    glm::quat orientation = glm::quat(1, 0, 0, 0);
+    glm::vec3 size = glm::vec3(1);
+    glm::vec3 linearVelocity = glm::vec3(0);
+    glm::vec3 angularVelocity = glm::vec3(0);
+    /// 0 for static boxes
+    float inverseMass = 0;
+    /// inverse of the diagonal inertia tensor in body space
+    glm::vec3 inverseInertiaBody = glm::vec3(0);
+};
+
+/// @brief Boxes on a ground plane, collided with collisionTools::checkCollisionSAT and solved with the ContactSolver
+///
+/// Every step the contacts between awake bodies are joined into islands with union-find. An island whose
+/// bodies all stayed below the sleep velocities for Settings::timeToSleep seconds falls asleep: its bodies
+/// leave the awake set and are no longer integrated, tested against each other in the broadphase or handed
+/// to the solver. A contact between an awake and a sleeping body wakes the whole island of the sleeping one.
+/// Static boxes (mass 0) live in the same inactive set as the sleeping ones but never wake up.
+class RigidBodyWorld
+{
+public:
+    struct Settings
+    {
+        glm::vec3 gravity = glm::vec3(0, -9.81f, 0);
+        bool ground = true;
+        float groundHeight = 0;
+        /// Bodies closer than this get speculative contacts, keeps resting contacts from flickering
+        float contactMargin = 0.02f;
+        /// Velocity damping per second
+        float linearDamping = 0.05f;
+        float angularDamping = 0.2f;
+        bool sleeping = true;
+        /// An island may sleep once all its bodies were slower than these for timeToSleep seconds
+        float sleepLinearVelocity = 0.05f;
+        float sleepAngularVelocity = 0.1f;
+        float timeToSleep = 0.5f;
+    };
+
+    /// @brief Measurements of the last step
+    struct Stats
+    {
+        size_t bodies = 0;
+        size_t awakeBodies = 0;
+        size_t sleepingBodies = 0;
+        /// islands of awake bodies found in this step
+        size_t islands = 0;
+        size_t largestIsland = 0;
+        size_t sleepingIslands = 0;
+        size_t islandsFellAsleep = 0;
+        size_t islandsWoken = 0;
+        size_t broadphasePairs = 0;
+        size_t contacts = 0;
+        double broadphaseTime = 0;
+        double narrowphaseTime = 0;
+        double solveTime = 0;
+        double islandTime = 0;
+        double stepTime = 0;
+    };
+
+    Settings settings;
+    ContactSolver solver;
+
+    /// @brief Add a box, a mass <= 0 makes it static. Returns the body index.
+    uint32_t addBox(const glm::vec3 &position, const glm::vec3 &size, float mass, const glm::quat &orientation = glm::quat(1, 0, 0, 0));
+    /// @brief Remove all bodies
+    void clear();
+
+    /// @brief Append the bodies, their sleep state and the warm starting cache of the solver, not the settings
+    void saveState(StateWriter &writer) const;
+    /// @brief Replace the world with one written by saveState, the next step continues exactly where it left off.
+    /// Throws std::runtime_error and keeps the world as it was if the state does not fit
+    void loadState(StateReader &reader);
+
+    /// @brief Advance the world by dt seconds
+    void step(float dt);
+
+    /// @brief Wake the island of a sleeping body, call this after changing a sleeping body from the outside
+    void wake(uint32_t body);
+    void wakeAll();
+    bool isSleeping(uint32_t body) const { return state[body] == Sleeping; }
+    bool isStatic(uint32_t body) const { return state[body] == Static; }
+
+    size_t bodyCount() const { return boxes.size(); }
+    const RigidBox &body(uint32_t index) const { return boxes[index]; }
+    RigidBox &body(uint32_t index) { return boxes[index]; }
+    const Stats &stats() const { return lastStats; }
+
+    /// @brief Transformation from the unit cube to the box in world space, as expected by checkCollisionSAT
+    glm::mat4 worldFromObj(uint32_t body) const;
+
+protected:
+    enum State : uint8_t
+    {
+        Awake,
+        Sleeping,
+        Static
+    };
+
+    struct Bounds
+    {
+        glm::vec3 min, max;
+    };
+
+    struct Contact
+    {
+        uint32_t a, b;
+        CollisionInfo info;
+    };
+
+    std::vector<RigidBox> boxes;
+    std::vector<State> state;
+    /// seconds every body has been slower than the sleep velocities
+    std::vector<float> restTime;
+    std::vector<uint32_t> awake;
+
+    // sleeping and static bodies sorted by bounds.min.x, rebuilt when bodies fall asleep or wake up
+    std::vector<uint32_t> inactive;
+    std::vector<Bounds> inactiveBounds;
+    float inactiveMaxWidth = 0;
+    bool inactiveDirty = true;
+
+    // sleeping islands, islandOfBody is only valid for sleeping bodies
+    std::vector<std::vector<uint32_t>> sleepingIslands;
+    std::vector<uint32_t> freeIslands;
+    std::vector<uint32_t> islandOfBody;
+
+    // per step scratch, indexed by body
+    std::vector<ContactBody> solverBodies;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> islandIndex;
+    std::vector<Bounds> bounds;
+    std::vector<Contact> contacts;
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+
+    Stats lastStats;
+
+    Bounds computeBounds(const RigidBox &box) const;
+    void rebuildInactive();
+    void broadphase();
+    void narrowphase();
+    /// adds the clipped face contact of a box pair, false for edge contacts
+    bool addFaceContact(uint32_t a, uint32_t b, const glm::vec3 &normal);
+    void solve(float dt);
+    void integrate(float dt);
+    void updateIslands(float dt);
+    void wakeIsland(uint32_t island);
+    uint32_t find(uint32_t body);
+};
@@ -0,0 +1,91 @@
+#include <util/ShelfPacker.h>
+#include <algorithm>
+
+void ShelfPacker::reset(uint32_t width, uint32_t height)
+{
+    this->width = width;
+    this->height = height;
+    shelves.clear();
+}
+
+bool ShelfPacker::take(Shelf &shelf, uint32_t w, uint32_t &x)
+{
+    for (size_t i = 0; i < shelf.free.size(); ++i)
+    {
+        Span &span = shelf.free[i];
+        if (span.width < w)
+            continue;
+        x = span.x;
+        span.x += w;
+        span.width -= w;
+        if (span.width == 0)
+            shelf.free.erase(shelf.free.begin() + i);
+        return true;
+    }
+    return false;
+}
+
+bool ShelfPacker::allocate(uint32_t w, uint32_t h, uint32_t &x, uint32_t &y)
+{
+    if (w == 0 || h == 0 || w > width || h > height)
+        return false;
+
+    // lowest shelf that does not waste more than half of its height
+    for (Shelf &shelf : shelves)
+    {
+        if (shelf.height >= h && shelf.height <= 2 * h && take(shelf, w, x))
+        {
+            y = shelf.y;
+            return true;
+        }
+    }
+
+    uint32_t top = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+    uint32_t shelfHeight = std::min((h + 7) / 8 * 8, height - std::min(top, height));
+    if (shelfHeight >= h)
+    {
+        shelves.push_back({top, shelfHeight, {{0, width}}});
+        take(shelves.back(), w, x);
+        y = top;
+        return true;
+    }
+
+    // the area is full, any shelf that is high enough will do
+    for (Shelf &shelf : shelves)
+    {
+        if (shelf.height >= h && take(shelf, w, x))
+        {
+            y = shelf.y;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ShelfPacker::release(uint32_t x, uint32_t y, uint32_t w)
+{
+    auto shelf = std::find_if(shelves.begin(), shelves.end(), [&](const Shelf &s)
+                              { return s.y == y; });
+    if (shelf == shelves.end() || w == 0)
+        return;
+
+    std::vector<Span> &free = shelf->free;
+    auto next = std::lower_bound(free.begin(), free.end(), x, [](const Span &span, uint32_t x)
+                                 { return span.x < x; });
+    next = free.insert(next, {x, w});
+    // merge with the following and the preceding span
+    if (next + 1 != free.end() && next->x + next->width == (next + 1)->x)
+    {
+        next->width += (next + 1)->width;
+        free.erase(next + 1);
+    }
+    if (next != free.begin() && (next - 1)->x + (next - 1)->width == next->x)
+    {
+        (next - 1)->width += next->width;
+        free.erase(next);
+    }
+
+    // empty shelves at the top give their height back to the area
+    while (!shelves.empty() && shelves.back().free.size() == 1 && shelves.back().free[0].width == width)
+        shelves.pop_back();
+}
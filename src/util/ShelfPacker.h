@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/// @brief Packs rectangles into a fixed size area, e.g. images into a texture atlas
+///
+/// Rectangles go onto horizontal shelves. A rectangle takes the lowest shelf that is at most twice
+/// as high and has a wide enough free span, otherwise a new shelf of its height (rounded up to a
+/// multiple of 8) is opened above the others. Released spans merge with their free neighbors and can
+/// be taken by any rectangle that fits, emptied shelves at the top are removed. Rectangles that stay
+/// keep their place, so a changing set of rectangles can be repacked incrementally.
+class ShelfPacker
+{
+public:
+    explicit ShelfPacker(uint32_t width = 0, uint32_t height = 0) : width(width), height(height) {}
+
+    /// @brief Forget all rectangles and start over with an area of the given size
+    void reset(uint32_t width, uint32_t height);
+
+    /// @brief Find a place for a w x h rectangle
+    /// @return
+    ///     False if the area has no room for it, x and y are not changed then
+    bool allocate(uint32_t w, uint32_t h, uint32_t &x, uint32_t &y);
+
+    /// @brief Give back a rectangle returned by allocate
+    void release(uint32_t x, uint32_t y, uint32_t w);
+
+    uint32_t areaWidth() const { return width; }
+    uint32_t areaHeight() const { return height; }
+
+private:
+    struct Span
+    {
+        uint32_t x;
+        uint32_t width;
+    };
+    struct Shelf
+    {
+        uint32_t y;
+        uint32_t height;
+        /// free spans in ascending x order
+        std::vector<Span> free;
+    };
+
+    uint32_t width;
+    uint32_t height;
+    /// in ascending y order, without gaps
+    std::vector<Shelf> shelves;
+
+    bool take(Shelf &shelf, uint32_t w, uint32_t &x);
+};
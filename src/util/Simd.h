@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define SIMD_SSE 1
+#endif
+
+#if defined(__AVX__) && defined(SIMD_SSE)
+#define SIMD_AVX 1
+#endif
+
+/// @brief Minimal SIMD float wrappers
+///
+/// Kernels are written once as templates over the lane type and instantiated for Float1 (scalar),
+/// Float4 (SSE) or Float8 (AVX). All lane types perform the same IEEE operations in the same order,
+/// so results agree independent of the width unless the compiler contracts a * b + c into fused
+/// multiply-adds (-mfma) for some of them. Use Widest for the best type the build supports.
+namespace simd
+{
+    struct Float1
+    {
+        static constexpr int width = 1;
+        float v;
+
+        Float1() = default;
+        Float1(float x) : v(x) {}
+        static Float1 load(const float *p) { return p[0]; }
+        void store(float *p) const { p[0] = v; }
+        /// base[index[lane] * stride] for every lane
+        static Float1 gather(const float *base, const uint32_t *index, int stride) { return base[index[0] * stride]; }
+        float lane(int) const { return v; }
+    };
+    inline Float1 operator+(Float1 a, Float1 b) { return a.v + b.v; }
+    inline Float1 operator-(Float1 a, Float1 b) { return a.v - b.v; }
+    inline Float1 operator*(Float1 a, Float1 b) { return a.v * b.v; }
+    inline Float1 operator-(Float1 a) { return -a.v; }
+    // same semantics as the SSE instructions, relevant for signed zeros
+    inline Float1 max(Float1 a, Float1 b) { return a.v > b.v ? a.v : b.v; }
+    inline Float1 min(Float1 a, Float1 b) { return a.v < b.v ? a.v : b.v; }
+    inline Float1 abs(Float1 a) { return std::fabs(a.v); }
+    inline Float1 sqrt(Float1 a) { return std::sqrt(a.v); }
+    inline float horizontalMax(Float1 a) { return a.v; }
+
+#ifdef SIMD_SSE
+    struct Float4
+    {
+        static constexpr int width = 4;
+        __m128 v;
+
+        Float4() = default;
+        Float4(__m128 x) : v(x) {}
+        Float4(float x) : v(_mm_set1_ps(x)) {}
+        static Float4 load(const float *p) { return _mm_loadu_ps(p); }
+        void store(float *p) const { _mm_storeu_ps(p, v); }
+        static Float4 gather(const float *base, const uint32_t *index, int stride)
+        {
+            return _mm_setr_ps(base[index[0] * stride], base[index[1] * stride], base[index[2] * stride], base[index[3] * stride]);
+        }
+        float lane(int i) const
+        {
+            alignas(16) float values[4];
+            _mm_store_ps(values, v);
+            return values[i];
+        }
+    };
+    inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+    inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+    inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+    inline Float4 operator-(Float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+    inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+    inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+    inline Float4 abs(Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+    inline Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+    inline float horizontalMax(Float4 a)
+    {
+        __m128 m = _mm_max_ps(a.v, _mm_movehl_ps(a.v, a.v));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+#endif
+
+#ifdef SIMD_AVX
+    struct Float8
+    {
+        static constexpr int width = 8;
+        __m256 v;
+
+        Float8() = default;
+        Float8(__m256 x) : v(x) {}
+        Float8(float x) : v(_mm256_set1_ps(x)) {}
+        static Float8 load(const float *p) { return _mm256_loadu_ps(p); }
+        void store(float *p) const { _mm256_storeu_ps(p, v); }
+        static Float8 gather(const float *base, const uint32_t *index, int stride)
+        {
+            return _mm256_setr_ps(base[index[0] * stride], base[index[1] * stride], base[index[2] * stride], base[index[3] * stride],
+                                  base[index[4] * stride], base[index[5] * stride], base[index[6] * stride], base[index[7] * stride]);
+        }
+        float lane(int i) const
+        {
+            alignas(32) float values[8];
+            _mm256_store_ps(values, v);
+            return values[i];
+        }
+    };
+    inline Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+    inline Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+    inline Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+    inline Float8 operator-(Float8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+    inline Float8 max(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+    inline Float8 min(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+    inline Float8 abs(Float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    inline Float8 sqrt(Float8 a) { return _mm256_sqrt_ps(a.v); }
+    inline float horizontalMax(Float8 a)
+    {
+        return horizontalMax(Float4(_mm_max_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1))));
+    }
+    using Widest = Float8;
+#elif defined(SIMD_SSE)
+    using Widest = Float4;
+#else
+    using Widest = Float1;
+#endif
+}
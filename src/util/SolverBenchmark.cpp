@@ -0,0 +1,607 @@
+#include <util/SolverBenchmark.h>
+#include <util/pcgsolver.h>
+#include <util/MappedSystem.h>
+#include <util/ContactSolver.h>
+#include <util/CollisionDetection.h>
+#include <util/ThreadPool.h>
+#include <util/RigidBodyWorld.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace solverBenchmark
+{
+    using clock = std::chrono::high_resolution_clock;
+
+    // diagonally dominant matrix with the given off-diagonal structure, like the systems of an implicit mass-spring step
+    template <class T>
+    SparseMatrix<T> makeSystem(int n, const std::vector<std::pair<int, int>> &edges, int dofs)
+    {
+        SparseMatrix<T> matrix(n * dofs);
+        for (int i = 0; i < n * dofs; ++i)
+            matrix.set_element(i, i, 1);
+        for (auto &edge : edges)
+        {
+            for (int d = 0; d < dofs; ++d)
+            {
+                for (int e = 0; e < dofs; ++e)
+                {
+                    T k = d == e ? T(1) : T(0.1);
+                    matrix.add_to_element(edge.first * dofs + d, edge.second * dofs + e, -k);
+                    matrix.add_to_element(edge.second * dofs + e, edge.first * dofs + d, -k);
+                    matrix.add_to_element(edge.first * dofs + d, edge.first * dofs + e, k);
+                    matrix.add_to_element(edge.second * dofs + d, edge.second * dofs + e, k);
+                }
+            }
+        }
+        return matrix;
+    }
+
+    // small shrinks every case to a few thousand rows, for the checks of --selftest
+    template <class T>
+    SparseMatrix<T> makeMatrix(int caseid, bool small, std::string &name)
+    {
+        std::vector<std::pair<int, int>> edges;
+        std::mt19937 rng(42);
+        if (caseid == 1)
+        {
+            const int s = small ? 64 : 512;
+            name = "2D poisson " + std::to_string(s) + "x" + std::to_string(s);
+            for (int y = 0; y < s; ++y)
+                for (int x = 0; x < s; ++x)
+                {
+                    if (x + 1 < s)
+                        edges.push_back({y * s + x, y * s + x + 1});
+                    if (y + 1 < s)
+                        edges.push_back({y * s + x, (y + 1) * s + x});
+                }
+            return makeSystem<T>(s * s, edges, 1);
+        }
+        else if (caseid == 2)
+        {
+            const int s = small ? 16 : 64;
+            name = "3D poisson " + std::to_string(s) + "^3";
+            auto id = [s](int x, int y, int z)
+            { return (z * s + y) * s + x; };
+            for (int z = 0; z < s; ++z)
+                for (int y = 0; y < s; ++y)
+                    for (int x = 0; x < s; ++x)
+                    {
+                        if (x + 1 < s)
+                            edges.push_back({id(x, y, z), id(x + 1, y, z)});
+                        if (y + 1 < s)
+                            edges.push_back({id(x, y, z), id(x, y + 1, z)});
+                        if (z + 1 < s)
+                            edges.push_back({id(x, y, z), id(x, y, z + 1)});
+                    }
+            return makeSystem<T>(s * s * s, edges, 1);
+        }
+        else if (caseid == 3)
+        {
+            // grid cloth with structural springs plus a few heavily connected anchor points
+            const int s = small ? 40 : 200;
+            const int n = s * s;
+            name = "mass-spring " + std::to_string(n) + " points, 3 dofs";
+            for (int y = 0; y < s; ++y)
+                for (int x = 0; x < s; ++x)
+                {
+                    if (x + 1 < s)
+                        edges.push_back({y * s + x, y * s + x + 1});
+                    if (y + 1 < s)
+                        edges.push_back({y * s + x, (y + 1) * s + x});
+                }
+            std::uniform_int_distribution<int> point(0, n - 1);
+            for (int anchor = 0; anchor < 64; ++anchor)
+            {
+                int a = point(rng);
+                for (int k = 0; k < 8 + anchor; ++k)
+                {
+                    int b = point(rng);
+                    if (a != b)
+                        edges.push_back({a, b});
+                }
+            }
+            return makeSystem<T>(n, edges, 3);
+        }
+        else
+        {
+            const int n = small ? 5000 : 200000;
+            name = "power-law graph " + std::to_string(n) + " nodes";
+            std::uniform_int_distribution<int> point(0, n - 1);
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            for (int i = 0; i < n; ++i)
+            {
+                // pareto distributed valence between 1 and a few hundred
+                int valence = std::min(400, (int)(1.0 / std::pow(1.0 - uniform(rng), 1.0 / 1.5)));
+                for (int k = 0; k < valence; ++k)
+                {
+                    int j = point(rng);
+                    if (i != j)
+                        edges.push_back({i, j});
+                }
+            }
+            return makeSystem<T>(n, edges, 1);
+        }
+    }
+
+    template <class T>
+    bool benchmark(int caseid, bool small, const char *type)
+    {
+        std::string name;
+        SparseMatrix<T> matrix = makeMatrix<T>(caseid, small, name);
+        FixedSparseMatrix<T> csr;
+        auto start = clock::now();
+        csr.construct_from_matrix(matrix);
+        double csrConversion = std::chrono::duration<double>(clock::now() - start).count();
+
+        SellCSigmaMatrix<T> sell;
+        start = clock::now();
+        sell.construct_from_matrix(csr);
+        double sellConversion = std::chrono::duration<double>(clock::now() - start).count();
+
+        std::vector<T> x(csr.n), y_csr, y_sell;
+        for (int i = 0; i < csr.n; ++i)
+            x[i] = T(1) + T(i % 17) / T(17);
+
+        size_t nonzeros = csr.value.size();
+        int repetitions = std::max(10, (int)(2e8 / (double)nonzeros));
+        start = clock::now();
+        for (int k = 0; k < repetitions; ++k)
+            multiply(csr, x, y_csr);
+        double csrTime = std::chrono::duration<double>(clock::now() - start).count() / repetitions;
+        start = clock::now();
+        for (int k = 0; k < repetitions; ++k)
+            multiply(sell, x, y_sell);
+        double sellTime = std::chrono::duration<double>(clock::now() - start).count() / repetitions;
+
+        // relative to the rounding error bound of a row, sum |a_ij x_j| times the row length times epsilon
+        double maxError = 0;
+        for (int i = 0; i < csr.n; ++i)
+        {
+            double magnitude = 0;
+            for (int j = csr.rowstart[i]; j < csr.rowstart[i + 1]; ++j)
+                magnitude += std::abs((double)csr.value[j] * (double)x[csr.colindex[j]]);
+            double bound = magnitude * std::max(csr.rowstart[i + 1] - csr.rowstart[i], 1) * std::numeric_limits<T>::epsilon();
+            double error = std::abs((double)y_csr[i] - (double)y_sell[i]);
+            if (error > 0)
+                maxError = std::max(maxError, bound > 0 ? error / bound : std::numeric_limits<double>::infinity());
+        }
+
+        // the rows that do not read a non-finite x stay finite, also with padding
+        std::vector<T> xNaN = x;
+        xNaN[0] = std::numeric_limits<T>::quiet_NaN();
+        multiply(csr, xNaN, y_csr);
+        multiply(sell, xNaN, y_sell);
+        size_t spreadNaN = 0;
+        for (int i = 0; i < csr.n; ++i)
+        {
+            if (std::isfinite(y_csr[i]) && !std::isfinite(y_sell[i]))
+                ++spreadNaN;
+        }
+
+        std::cout << name << " (" << type << "): n = " << csr.n << ", nnz = " << nonzeros
+                  << ", fill = " << (double)nonzeros / (double)sell.stored_entries() << std::endl;
+        std::cout << "  CSR  : construct " << csrConversion * 1000 << " ms, spmv " << csrTime * 1000 << " ms, "
+                  << 2.0 * nonzeros / csrTime * 1e-9 << " GFLOP/s" << std::endl;
+        std::cout << "  SELL-" << sell.chunk_height << "-" << sell.sigma << ": convert " << sellConversion * 1000 << " ms, spmv "
+                  << sellTime * 1000 << " ms, " << 2.0 * nonzeros / sellTime * 1e-9 << " GFLOP/s"
+                  << ", max difference to CSR " << maxError << " of the rounding bound" << std::endl;
+        bool passed = maxError <= 1 && spreadNaN == 0;
+        if (maxError > 1)
+            std::cout << "  ERROR: SELL differs from CSR by more than rounding" << std::endl;
+        if (spreadNaN > 0)
+            std::cout << "  ERROR: a NaN in x[0] reaches " << spreadNaN << " rows of SELL that do not read it" << std::endl;
+        return passed;
+    }
+
+    bool benchmarkSpMV(int caseid, bool small)
+    {
+        bool passed = benchmark<float>(caseid, small, "float");
+        return benchmark<double>(caseid, small, "double") && passed;
+    }
+
+    template <class T>
+    void resolve(const MappedSystem &system, int repetitions)
+    {
+        pcg_binary::SolveInfo info = system.solveInfo();
+        auto start = clock::now();
+        SparseMatrix<T> matrix;
+        MappedSystem::copy(system.matrix<T>("matrix"), matrix);
+        size_t n;
+        const T *rhsData = system.vector<T>("rhs", n);
+        if (n != (size_t)matrix.n)
+            throw std::runtime_error("the rhs of the captured system has " + std::to_string(n) + " values for " + std::to_string(matrix.n) + " rows");
+        std::vector<T> rhs(rhsData, rhsData + n);
+        double loadTime = std::chrono::duration<double>(clock::now() - start).count();
+
+        SparsePCGSolver<T> solver;
+        solver.set_solver_parameters((T)info.tolerance_factor, info.max_iterations,
+                                     (T)info.modified_incomplete_cholesky_parameter, (T)info.min_diagonal_ratio);
+        std::vector<T> result(n);
+        T residual = 0;
+        int iterations = 0;
+        bool converged = false;
+        start = clock::now();
+        for (int k = 0; k < repetitions; ++k)
+            converged = solver.solve(matrix, rhs, result, residual, iterations, info.precondition);
+        double solveTime = std::chrono::duration<double>(clock::now() - start).count() / repetitions;
+
+        size_t capturedN;
+        const T *captured = system.vector<T>("result", capturedN);
+        double maxDifference = 0;
+        for (size_t i = 0; i < n && i < capturedN; ++i)
+            maxDifference = std::max(maxDifference, (double)std::abs(result[i] - captured[i]));
+
+        std::cout << "captured system: n = " << n << ", nnz = " << system.matrix<T>("matrix").nonzeros << std::endl;
+        std::cout << "  load " << loadTime * 1000 << " ms, solve " << solveTime * 1000 << " ms, "
+                  << iterations << " iterations (captured " << info.iterations << "), residual " << residual
+                  << " (captured " << info.relative_residual << "), " << (converged ? "converged" : "not converged")
+                  << ", max difference to captured result " << maxDifference << std::endl;
+    }
+
+    void benchmarkCapturedSolve(const std::string &path, int repetitions)
+    {
+        auto start = clock::now();
+        MappedSystem system(path);
+        double mapTime = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout << path << ": mapped and verified in " << mapTime * 1000 << " ms" << std::endl;
+        const MappedSystem::Section *matrix = system.find("matrix");
+        if (matrix != nullptr && matrix->header.scalar_size == sizeof(double))
+            resolve<double>(system, repetitions);
+        else
+            resolve<float>(system, repetitions);
+    }
+
+    template <class T>
+    bool sameMatrix(const MappedSystem::CsrView<T> &view, const FixedSparseMatrix<T> &csr)
+    {
+        return view.n == csr.n && view.nonzeros == csr.value.size() && std::equal(csr.rowstart.begin(), csr.rowstart.end(), view.rowstart) &&
+               std::equal(csr.colindex.begin(), csr.colindex.end(), view.colindex) && std::equal(csr.value.begin(), csr.value.end(), view.value);
+    }
+
+    template <class T>
+    bool sameVector(const MappedSystem &system, const char *name, const std::vector<T> &values)
+    {
+        size_t n;
+        const T *mapped = system.vector<T>(name, n);
+        return n == values.size() && std::equal(values.begin(), values.end(), mapped);
+    }
+
+    template <class T>
+    bool roundTrip(const std::string &path, const char *type)
+    {
+        std::string name;
+        SparseMatrix<T> matrix = makeMatrix<T>(4, true, name);
+        FixedSparseMatrix<T> csr;
+        csr.construct_from_matrix(matrix);
+        std::vector<T> rhs(matrix.n), result(matrix.n);
+        for (int i = 0; i < matrix.n; ++i)
+            rhs[i] = T(1) + T(i % 7) / T(7);
+
+        SparsePCGSolver<T> solver;
+        solver.capture_next_solve(path);
+        T residual = 0;
+        int iterations = 0;
+        bool converged = solver.solve(matrix, rhs, result, residual, iterations);
+        MappedSystem captured(path);
+        pcg_binary::SolveInfo info = captured.solveInfo();
+        bool capturedMatches = sameMatrix(captured.matrix<T>("matrix"), csr) && sameVector(captured, "rhs", rhs) &&
+                               sameVector(captured, "result", result) && info.iterations == iterations &&
+                               info.converged == (int32_t)converged && info.relative_residual == (double)residual;
+
+        // the FixedSparseMatrix writer lays out the arrays on its own
+        {
+            std::ofstream output(path, std::ios::binary);
+            pcg_binary::write_file_header(output, 1);
+            csr.write_binary(output, "matrix");
+        }
+        bool writtenMatches = sameMatrix(MappedSystem(path).matrix<T>("matrix"), csr);
+
+        std::cout << name << " (" << type << "): n = " << csr.n << ", nnz = " << csr.value.size() << ", capture_next_solve "
+                  << (capturedMatches ? "maps back exactly" : "DIFFERS") << ", FixedSparseMatrix::write_binary "
+                  << (writtenMatches ? "maps back exactly" : "DIFFERS") << std::endl;
+        return capturedMatches && writtenMatches;
+    }
+
+    bool checkCaptureRoundTrip(const std::string &path)
+    {
+        bool passed = roundTrip<float>(path, "float");
+        return roundTrip<double>(path, "double") && passed;
+    }
+
+    struct ContactScene
+    {
+        std::string name;
+        std::vector<ContactBody> bodies;
+        std::vector<uint32_t> bodyA, bodyB;
+        std::vector<CollisionInfo> contacts;
+    };
+
+    ContactBody makeBox(glm::vec3 position, glm::vec3 size, float mass)
+    {
+        ContactBody body;
+        body.position = position;
+        body.linearVelocity = glm::vec3(0, -0.1f, 0);
+        body.angularVelocity = glm::vec3(0);
+        body.inverseMass = 1.0f / mass;
+        glm::vec3 inertia = mass / 12.0f * glm::vec3(size.y * size.y + size.z * size.z, size.x * size.x + size.z * size.z, size.x * size.x + size.y * size.y);
+        body.inverseInertiaWorld = glm::mat3(glm::vec3(1.0f / inertia.x, 0, 0), glm::vec3(0, 1.0f / inertia.y, 0), glm::vec3(0, 0, 1.0f / inertia.z));
+        return body;
+    }
+
+    // small shrinks the scenes to a few hundred boxes, for the checks of --selftest
+    ContactScene makeContactScene(int caseid, bool small)
+    {
+        ContactScene scene;
+        std::mt19937 rng(42);
+        const glm::vec3 size(1.0f);
+        auto contact = [&scene](uint32_t a, uint32_t b, const CollisionInfo &info)
+        {
+            scene.bodyA.push_back(a);
+            scene.bodyB.push_back(b);
+            scene.contacts.push_back(info);
+        };
+        if (caseid == 1)
+        {
+            const int s = small ? 10 : 50;
+            scene.name = std::to_string(s) + "x" + std::to_string(s) + " stacks of 4 boxes";
+            for (int z = 0; z < s; ++z)
+                for (int x = 0; x < s; ++x)
+                    for (int y = 0; y < 4; ++y)
+                    {
+                        glm::vec3 center(x * 1.5f, y * 0.99f + 0.49f, z * 1.5f);
+                        uint32_t body = (uint32_t)scene.bodies.size();
+                        uint32_t below = y == 0 ? ContactSolver::staticBody : body - 1;
+                        scene.bodies.push_back(makeBox(center, size, 1.0f));
+                        for (int corner = 0; corner < 4; ++corner)
+                        {
+                            glm::vec3 offset((corner & 1) ? 0.5f : -0.5f, -0.5f, (corner & 2) ? 0.5f : -0.5f);
+                            contact(body, below, {true, center + offset, glm::vec3(0, 1, 0), 0.01f});
+                        }
+                    }
+        }
+        else
+        {
+            const int s = small ? 10 : 32, layers = small ? 4 : 10;
+            scene.name = "pile of " + std::to_string(s * s * layers) + " boxes";
+            std::uniform_real_distribution<float> jitter(-0.15f, 0.15f);
+            std::vector<glm::mat4> worldFromObj;
+            for (int y = 0; y < layers; ++y)
+                for (int z = 0; z < s; ++z)
+                    for (int x = 0; x < s; ++x)
+                    {
+                        // every layer is shifted by half a box so boxes rest on up to four boxes below
+                        float shift = (y % 2) * 0.5f;
+                        glm::vec3 center(x + shift + jitter(rng), y * 0.97f + 0.49f, z + shift + jitter(rng));
+                        float angle = jitter(rng);
+                        scene.bodies.push_back(makeBox(center, size, 1.0f));
+                        worldFromObj.push_back(glm::rotate(glm::translate(glm::mat4(1), center), angle, glm::vec3(0, 1, 0)) *
+                                               glm::scale(glm::mat4(1), size * 0.98f));
+                    }
+            auto id = [s](int x, int y, int z)
+            { return (uint32_t)((y * s + z) * s + x); };
+            for (int y = 0; y < layers; ++y)
+                for (int z = 0; z < s; ++z)
+                    for (int x = 0; x < s; ++x)
+                    {
+                        uint32_t a = id(x, y, z);
+                        if (y == 0)
+                        {
+                            glm::vec3 center = scene.bodies[a].position;
+                            contact(a, ContactSolver::staticBody, {true, center - glm::vec3(0, 0.49f, 0), glm::vec3(0, 1, 0), 0.01f});
+                        }
+                        // neighbours in the same layer and the layer below
+                        for (int dy = -1; dy <= 0; ++dy)
+                            for (int dz = -1; dz <= 1; ++dz)
+                                for (int dx = -1; dx <= 1; ++dx)
+                                {
+                                    int nx = x + dx, ny = y + dy, nz = z + dz;
+                                    if (nx < 0 || nz < 0 || ny < 0 || nx >= s || nz >= s || (dy == 0 && id(nx, ny, nz) >= a))
+                                        continue;
+                                    uint32_t b = id(nx, ny, nz);
+                                    CollisionInfo info = collisionTools::checkCollisionSAT(worldFromObj[a], worldFromObj[b]);
+                                    if (info.isColliding)
+                                        contact(a, b, info);
+                                }
+                    }
+        }
+        return scene;
+    }
+
+    struct ContactRun
+    {
+        double timePerIteration = 0;
+        ContactSolver::Stats stats;
+        std::vector<ContactBody> bodies;
+    };
+
+    // a few solves with the same contacts, so warm starting kicks in like in a resting configuration
+    ContactRun runContactSolver(const ContactScene &scene, const ContactSolver::Settings &settings)
+    {
+        const int steps = 10;
+        ContactSolver solver;
+        solver.settings = settings;
+        ContactRun run;
+        run.bodies = scene.bodies;
+        for (int step = 0; step < steps; ++step)
+        {
+            for (auto &body : run.bodies)
+                body.linearVelocity.y -= 9.81f * 0.01f;
+            for (size_t i = 0; i < scene.contacts.size(); ++i)
+                solver.addContact(scene.bodyA[i], scene.bodyB[i], scene.contacts[i]);
+            solver.solve(run.bodies, 0.01f);
+            run.timePerIteration += solver.stats().timePerIteration / steps;
+        }
+        run.stats = solver.stats();
+        return run;
+    }
+
+    bool benchmarkContactSolver(int caseid, bool small)
+    {
+        ContactScene scene = makeContactScene(caseid, small);
+        std::cout << scene.name << ": " << scene.bodies.size() << " bodies" << std::endl;
+
+        ContactSolver::Settings settings;
+        settings.iterations = 20;
+        settings.recordConvergence = true;
+
+        // returns the largest velocity difference to reference
+        auto report = [](const std::string &name, const ContactRun &run, const ContactRun *reference, const char *referenceName)
+        {
+            float maxDifference = 0;
+            std::cout << "  " << name << ": " << run.stats.contacts << " contacts, " << run.timePerIteration * 1e6 << " us/iteration";
+            if (run.stats.colors > 0)
+                std::cout << ", " << run.stats.colors << " colors, " << run.stats.overflowContacts << " overflow, coloring "
+                          << run.stats.coloringTime * 1000 << " ms";
+            std::cout << ", simd " << run.stats.simdWidth << ", threads " << run.stats.threads;
+            if (reference != nullptr)
+            {
+                for (size_t i = 0; i < run.bodies.size(); ++i)
+                    maxDifference = std::max({maxDifference, glm::length(run.bodies[i].linearVelocity - reference->bodies[i].linearVelocity),
+                                              glm::length(run.bodies[i].angularVelocity - reference->bodies[i].angularVelocity)});
+                std::cout << ", max velocity difference to " << referenceName << " " << maxDifference;
+            }
+            std::cout << std::endl
+                      << "    convergence:";
+            for (float delta : run.stats.convergence)
+                std::cout << " " << delta;
+            std::cout << std::endl;
+            return maxDifference;
+        };
+
+        settings.coloring = false;
+        settings.simd = false;
+        ContactRun serial = runContactSolver(scene, settings);
+        report("serial", serial, nullptr, nullptr);
+
+        // the colors change the order, so the impulses converge along another path, after the same iterations the
+        // largest impulse change has to be at most twice the one of the serial order
+        const float residualTolerance = 2.0f;
+        bool passed = true;
+        auto checkConvergence = [&](const std::string &name, const ContactRun &run)
+        {
+            float residual = run.stats.lastImpulseDelta, serialResidual = serial.stats.lastImpulseDelta;
+            if (residual > serialResidual * residualTolerance + 1e-6f)
+            {
+                std::cout << "  ERROR: " << name << " ends at an impulse change of " << residual << ", the serial order at " << serialResidual
+                          << std::endl;
+                passed = false;
+            }
+        };
+
+        settings.coloring = true;
+        ContactRun colored = runContactSolver(scene, settings);
+        report("colored", colored, nullptr, nullptr);
+        checkConvergence("colored", colored);
+
+        // scalar and simd only differ by rounding (fused multiply-adds), any thread count must match one thread exactly
+        settings.simd = true;
+        ContactRun simd = runContactSolver(scene, settings);
+        report("colored simd, 1 thread", simd, &colored, "colored");
+        checkConvergence("colored simd", simd);
+        for (unsigned threads = 2; threads <= ThreadPool::global().size(); threads *= 2)
+        {
+            settings.threads = threads;
+            std::string name = "colored simd, " + std::to_string(threads) + " threads";
+            ContactRun threaded = runContactSolver(scene, settings);
+            if (report(name, threaded, &simd, "1 thread") != 0)
+            {
+                std::cout << "  ERROR: " << name << " differs from 1 thread" << std::endl;
+                passed = false;
+            }
+            checkConvergence(name, threaded);
+        }
+        return passed;
+    }
+
+    bool checkRestingContacts()
+    {
+        // boxes that start 0.015 apart, inside the contact margin of 0.02
+        const float gap = 0.015f;
+        RigidBodyWorld world;
+        uint32_t onGround = world.addBox(glm::vec3(0, 0.5f + gap, 0), glm::vec3(1), 1.0f);
+        uint32_t below = world.addBox(glm::vec3(3, 0.5f, 0), glm::vec3(1), 1.0f);
+        uint32_t onBox = world.addBox(glm::vec3(3, 1.5f + gap, 0), glm::vec3(1), 1.0f);
+        for (int step = 0; step < 300; ++step)
+            world.step(0.01f);
+
+        // resting means touching, at most the slop deep and not moving
+        float tolerance = world.solver.settings.slop + 1e-3f;
+        auto rests = [&](const char *name, uint32_t body, float supportHeight)
+        {
+            float distance = world.body(body).position.y - 0.5f - supportHeight;
+            float speed = glm::length(world.body(body).linearVelocity);
+            bool resting = std::abs(distance) <= tolerance && speed < 1e-3f;
+            std::cout << "  " << name << ": " << distance << " above its support, speed " << speed << (resting ? "" : ", ERROR: not resting on it")
+                      << std::endl;
+            return resting;
+        };
+        std::cout << "boxes dropped from " << gap << " above their support, after 3 s:" << std::endl;
+        bool passed = rests("box on the ground", onGround, world.settings.groundHeight);
+        passed = rests("box on a box", onBox, world.body(below).position.y + 0.5f) && passed;
+        return passed;
+    }
+
+    void benchmarkSleepingPile(int layers)
+    {
+        RigidBodyWorld world;
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+        for (int y = 0; y < layers; ++y)
+            for (int z = 0; z < 10; ++z)
+                for (int x = 0; x < 10; ++x)
+                    world.addBox(glm::vec3(x * 1.2f + jitter(rng), 0.6f + y * 1.2f, z * 1.2f + jitter(rng)), glm::vec3(1), 1.0f,
+                                 glm::quat(glm::vec3(jitter(rng), jitter(rng), jitter(rng))));
+        std::cout << "pile of " << world.bodyCount() << " boxes" << std::endl;
+
+        const float dt = 0.01f;
+        const int maxSteps = 5000;
+        int steps = 0;
+        size_t islandSum = 0, maxIslands = 0, woken = 0;
+        double settleTime = 0;
+        for (; steps < maxSteps; ++steps)
+        {
+            world.step(dt);
+            const RigidBodyWorld::Stats &stats = world.stats();
+            islandSum += stats.islands;
+            maxIslands = std::max(maxIslands, stats.islands);
+            woken += stats.islandsWoken;
+            settleTime += stats.stepTime;
+            if (steps % 250 == 0)
+                std::cout << "  step " << steps << ": " << stats.awakeBodies << " awake, " << stats.islands << " islands (largest "
+                          << stats.largestIsland << "), " << stats.sleepingIslands << " sleeping islands, " << stats.contacts
+                          << " contacts, " << stats.stepTime * 1000 << " ms" << std::endl;
+            if (stats.awakeBodies == 0)
+                break;
+        }
+        std::cout << "  settled after " << steps << " steps, " << settleTime / (steps + 1) * 1000 << " ms/step on average, "
+                  << (double)islandSum / (steps + 1) << " islands/step on average, at most " << maxIslands << ", "
+                  << woken << " islands woken up" << std::endl;
+
+        auto measure = [&world, dt]()
+        {
+            const int steps = 100;
+            double time = 0;
+            for (int k = 0; k < steps; ++k)
+            {
+                world.step(dt);
+                time += world.stats().stepTime;
+            }
+            return time / steps;
+        };
+        double sleepingTime = measure();
+        std::cout << "  settled pile, sleeping: " << sleepingTime * 1000 << " ms/step, " << world.stats().sleepingIslands
+                  << " sleeping islands" << std::endl;
+        world.settings.sleeping = false;
+        double awakeTime = measure();
+        std::cout << "  settled pile, no sleeping: " << awakeTime * 1000 << " ms/step, " << world.stats().islands << " islands, "
+                  << world.stats().contacts << " contacts" << std::endl;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+
+// micro benchmarks for the sparse solver building blocks, results are printed to std::cout,
+// the ones with checks return false if one of them failed
+namespace solverBenchmark
+{
+    /* compare CSR (FixedSparseMatrix) and SELL-C-sigma matrix-vector products, checks that SELL matches CSR up to
+    rounding and that a NaN in x only reaches the rows that read it. small shrinks the matrices to a few thousand rows
+    caseid 1: 2D poisson matrix (5-point stencil)
+    caseid 2: 3D poisson matrix (7-point stencil)
+    caseid 3: 3D mass-spring system with strongly varying valence
+    caseid 4: random graph laplacian with power-law row lengths
+    */
+    bool benchmarkSpMV(int caseid, bool small = false);
+
+    /* map a file written by SparsePCGSolver::capture_next_solve and solve the captured system
+    again with the captured parameters, repeated the given number of times
+    */
+    void benchmarkCapturedSolve(const std::string &path, int repetitions = 10);
+
+    /* capture a solve of a small system with SparsePCGSolver::capture_next_solve and write its matrix with
+    FixedSparseMatrix::write_binary to path, map both back with MappedSystem and check that n, the indices,
+    the values, the vectors and the solve info are exactly the written ones
+    */
+    bool checkCaptureRoundTrip(const std::string &path);
+
+    /* compare the contact solver in the order contacts were added with the graph colored variants
+    (scalar, SIMD and SIMD with 1..hardware threads), prints time per iteration and the convergence curve.
+    Checks that the colored variants end at most at twice the impulse change of the serial one after the same
+    iterations and that every thread count gives the velocities of one thread. small shrinks the scenes
+    caseid 1: 50x50 stacks of 4 boxes each on the ground, 4 corner contacts of every box with the one below or the ground
+    caseid 2: pile of 10k jittered boxes in 10 layers, contacts from collisionTools::checkCollisionSAT
+    */
+    bool benchmarkContactSolver(int caseid, bool small = false);
+
+    /* drop a box onto the ground and one onto another box from inside the contact margin of a RigidBodyWorld,
+    checks that both come to rest on their support instead of hovering at the height they started from
+    */
+    bool checkRestingContacts();
+
+    /* drop a pile of boxes in a RigidBodyWorld until it settles, prints the islands per step while settling
+    and compares the step time of the settled pile with and without sleeping
+    */
+    void benchmarkSleepingPile(int layers = 8);
+}
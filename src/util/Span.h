@@ -0,0 +1,46 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+/// @brief Non-owning view of contiguous elements, a minimal std::span for C++17
+///
+/// Converts implicitly from std::vector, std::array, C arrays and single values, so bulk functions
+/// can be called with whatever container a scene keeps its data in.
+template <class T>
+class Span
+{
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+
+    Span() = default;
+    Span(T *data, size_t size) : pointer(data), count(size) {}
+    /// a single element, e.g. one color for all instances
+    Span(T &value) : pointer(&value), count(1) {}
+    template <class Allocator>
+    Span(std::vector<value_type, Allocator> &vector) : pointer(vector.data()), count(vector.size()) {}
+    template <class Allocator, class U = T, class = std::enable_if_t<std::is_const<U>::value>>
+    Span(const std::vector<value_type, Allocator> &vector) : pointer(vector.data()), count(vector.size()) {}
+    template <size_t N>
+    Span(std::array<value_type, N> &array) : pointer(array.data()), count(N) {}
+    template <size_t N, class U = T, class = std::enable_if_t<std::is_const<U>::value>>
+    Span(const std::array<value_type, N> &array) : pointer(array.data()), count(N) {}
+    template <size_t N>
+    Span(T (&array)[N]) : pointer(array), count(N) {}
+    template <class U, class = std::enable_if_t<std::is_const<T>::value && std::is_same<std::remove_cv_t<U>, value_type>::value>>
+    Span(const Span<U> &other) : pointer(other.data()), count(other.size()) {}
+
+    T *data() const { return pointer; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T &operator[](size_t index) const { return pointer[index]; }
+    T *begin() const { return pointer; }
+    T *end() const { return pointer + count; }
+    Span subspan(size_t offset, size_t length) const { return Span(pointer + offset, length); }
+
+private:
+    T *pointer = nullptr;
+    size_t count = 0;
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/// @brief Bounded first in, first out queue from one producer thread to one consumer thread without locks
+///
+/// The elements live in a ring of capacity slots that is allocated once. The producer only writes the tail and the
+/// consumer only writes the head, each one reads the other's index to see how many slots are taken.
+template <class T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity = 256) : slots(capacity + 1) {}
+
+    /// @brief Append a value, from the producer thread
+    /// @return
+    ///     False if the queue is full, value is left as it was then
+    bool push(T &&value)
+    {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        size_t next = tail + 1 == slots.size() ? 0 : tail + 1;
+        if (next == headIndex.load(std::memory_order_acquire))
+            return false;
+        slots[tail] = std::move(value);
+        tailIndex.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Take the oldest value, from the consumer thread
+    /// @return
+    ///     False if the queue is empty
+    bool pop(T &value)
+    {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire))
+            return false;
+        value = std::move(slots[head]);
+        // leave nothing behind that keeps resources alive, e.g. the captures of a std::function
+        slots[head] = T();
+        headIndex.store(head + 1 == slots.size() ? 0 : head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief True if there was nothing to pop at the time of the call
+    bool empty() const { return headIndex.load(std::memory_order_acquire) == tailIndex.load(std::memory_order_acquire); }
+
+private:
+    // one slot stays free, so a full queue can be told apart from an empty one
+    std::vector<T> slots;
+    // on separate cache lines, the two threads write one each
+    alignas(64) std::atomic<size_t> headIndex{0};
+    alignas(64) std::atomic<size_t> tailIndex{0};
+};
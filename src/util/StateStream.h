@@ -0,0 +1,91 @@
+#pragma once
+#include <util/DefaultInitAllocator.h>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// @brief Bytes of a saved state, growing it does not zero the bytes that are written right after
+using StateBuffer = std::vector<uint8_t, DefaultInitAllocator<uint8_t>>;
+
+/// @brief Appends the state of a scene to a byte buffer, see Scene::saveState
+///
+/// The format is the raw bytes of trivially copyable values in the order they are written, vectors are their size
+/// followed by their elements. Reading a state back needs the same order, there are no names or types in between.
+/// The bytes are those of the machine that wrote them, states are meant to be read by the same build.
+class StateWriter
+{
+public:
+    explicit StateWriter(StateBuffer &buffer) : buffer(buffer) {}
+
+    template <class T>
+    void write(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be written as bytes");
+        append(&value, sizeof(T));
+    }
+
+    template <class T, class Allocator>
+    void write(const std::vector<T, Allocator> &values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only vectors of trivially copyable values can be written as bytes");
+        write<uint64_t>(values.size());
+        append(values.data(), values.size() * sizeof(T));
+    }
+
+    void append(const void *data, size_t size)
+    {
+        if (size == 0)
+            return;
+        size_t offset = buffer.size();
+        buffer.resize(offset + size);
+        std::memcpy(buffer.data() + offset, data, size);
+    }
+
+private:
+    StateBuffer &buffer;
+};
+
+/// @brief Reads a state written by StateWriter, throws std::runtime_error when it runs past the end
+class StateReader
+{
+public:
+    StateReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+    template <class T>
+    void read(T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be read as bytes");
+        take(&value, sizeof(T));
+    }
+
+    template <class T, class Allocator>
+    void read(std::vector<T, Allocator> &values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only vectors of trivially copyable values can be read as bytes");
+        uint64_t count;
+        read(count);
+        if (count > remaining() / sizeof(T))
+            throw std::runtime_error("State ends inside a vector of " + std::to_string(count) + " elements");
+        values.resize(static_cast<size_t>(count));
+        take(values.data(), values.size() * sizeof(T));
+    }
+
+    void take(void *out, size_t bytes)
+    {
+        if (bytes > remaining())
+            throw std::runtime_error("State ends after " + std::to_string(size) + " bytes");
+        if (bytes > 0)
+            std::memcpy(out, data + position, bytes);
+        position += bytes;
+    }
+
+    size_t remaining() const { return size - position; }
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t position = 0;
+};
@@ -0,0 +1,53 @@
+#include <util/StepScheduler.h>
+#include <algorithm>
+#include <cmath>
+
+int StepScheduler::advance(double elapsed)
+{
+    elapsed = std::max(elapsed, 0.0);
+    int steps;
+    if (settings.maxThroughput)
+    {
+        steps = std::max(settings.renderInterval, 1);
+        accumulator = 0;
+        lastBacklog = steps;
+        lastAlpha = 1;
+    }
+    else
+    {
+        double stepTime = std::max(settings.stepTime, 1e-6);
+        int budget = std::max(settings.maxStepsPerFrame, 1);
+        accumulator += elapsed;
+        lastBacklog = accumulator / stepTime;
+        if (lastBacklog >= budget + 1)
+        {
+            // keep the fraction of a step, so the alpha stays continuous
+            double excess = std::floor(lastBacklog) - budget;
+            dropped += static_cast<size_t>(excess);
+            accumulator -= excess * stepTime;
+        }
+        steps = std::min(static_cast<int>(accumulator / stepTime), budget);
+        accumulator = std::max(accumulator - steps * stepTime, 0.0);
+        lastAlpha = std::min(static_cast<float>(accumulator / stepTime), 1.0f);
+    }
+
+    window += elapsed;
+    windowSteps += steps;
+    if (window >= 1.0)
+    {
+        rate = windowSteps / window;
+        window = 0;
+        windowSteps = 0;
+    }
+    return steps;
+}
+
+void StepScheduler::reset()
+{
+    accumulator = 0;
+    lastAlpha = 1;
+    lastBacklog = 0;
+    dropped = 0;
+    window = 0;
+    windowSteps = 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+
+/// @brief Fixed-timestep scheduler that decides how many simulation steps run before each drawn frame
+///
+/// Wall-clock time accumulates and every full stepTime of it is one step, so the simulation advances at the same rate
+/// no matter how fast frames are drawn. The time left over is the interpolation alpha for drawing between the last two
+/// steps. When steps take longer than the time they stand for, at most maxStepsPerFrame run per frame and the rest of
+/// the backlog is dropped, the simulation then runs slower than real time instead of falling further behind.
+class StepScheduler
+{
+public:
+    struct Settings
+    {
+        /// wall-clock seconds per step
+        double stepTime = 0.01;
+        /// catch-up budget, the most steps that run before a frame is drawn
+        int maxStepsPerFrame = 8;
+        /// ignore the clock and run renderInterval steps per frame, to see how fast the simulation can go
+        bool maxThroughput = false;
+        int renderInterval = 10;
+    };
+    Settings settings;
+
+    /// @brief Add the wall-clock time since the last frame and return the number of steps to run before drawing it
+    int advance(double elapsed);
+
+    /// @brief Forget the accumulated time, e.g. after loading a scene
+    void reset();
+
+    /// @brief How far the clock is from the last step towards the next one, in [0, 1), 1 in max throughput mode
+    float alpha() const { return lastAlpha; }
+    /// @brief Steps that were due in the last frame before the budget was applied, above 1 the simulation catches up
+    double backlog() const { return lastBacklog; }
+    /// @brief Steps dropped because they exceeded the catch-up budget, since the last reset
+    size_t droppedSteps() const { return dropped; }
+    /// @brief Steps per second of wall-clock time, measured over windows of about a second
+    double stepsPerSecond() const { return rate; }
+
+private:
+    double accumulator = 0;
+    float lastAlpha = 1;
+    double lastBacklog = 0;
+    size_t dropped = 0;
+    double window = 0;
+    size_t windowSteps = 0;
+    double rate = 0;
+};
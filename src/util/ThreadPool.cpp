@@ -0,0 +1,148 @@
+#include <util/ThreadPool.h>
+#include <util/Profiler.h>
+#include <algorithm>
+
+namespace
+{
+    // the pool whose task the current thread is running, workers keep their pool for their whole life
+    thread_local const ThreadPool *currentPool = nullptr;
+}
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+ThreadPool &ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+unsigned ThreadPool::threadCount(unsigned maxThreads) const
+{
+    if (currentPool == this)
+        return 1;
+    return maxThreads == 0 ? size() : std::min(maxThreads, size());
+}
+
+void ThreadPool::run(const std::function<void(unsigned, unsigned)> &task, unsigned maxThreads)
+{
+    unsigned threads = threadCount(maxThreads);
+    if (threads <= 1)
+    {
+        task(0, 1);
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]
+                  { return !running; });
+        running = true;
+        currentTask = &task;
+        participants = threads;
+        pending = threads - 1;
+        ++generation;
+    }
+    wake.notify_all();
+
+    // the pool has to be given back even if the task throws on this thread
+    struct Finish
+    {
+        ThreadPool &pool;
+        const ThreadPool *outerPool = currentPool;
+        ~Finish()
+        {
+            currentPool = outerPool;
+            {
+                std::unique_lock<std::mutex> lock(pool.mutex);
+                pool.finished.wait(lock, [this]
+                                   { return pool.pending == 0; });
+                pool.currentTask = nullptr;
+                pool.running = false;
+            }
+            pool.idle.notify_one();
+        }
+    } finish{*this};
+    currentPool = this;
+    task(0, threads);
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &body, unsigned maxThreads)
+{
+    if (count == 0)
+        return;
+    size_t ranges = std::max<size_t>(1, count / std::max<size_t>(1, grain));
+    unsigned threads = (unsigned)std::min<size_t>(ranges, maxThreads == 0 ? size() : std::min(maxThreads, size()));
+    run([&](unsigned thread, unsigned threadCount)
+        {
+        size_t begin = count * thread / threadCount;
+        size_t end = count * (thread + 1) / threadCount;
+        if (begin < end)
+            body(begin, end); },
+        threads);
+}
+
+void ThreadPool::workerLoop(unsigned index)
+{
+    Profiler::setThreadName("worker " + std::to_string(index));
+    currentPool = this;
+    uint64_t seen = 0;
+    while (true)
+    {
+        const std::function<void(unsigned, unsigned)> *task;
+        unsigned threads;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]
+                      { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            if (index >= participants)
+                continue;
+            task = currentTask;
+            threads = participants;
+        }
+        {
+            PROFILE_ZONE("ThreadPool task");
+            (*task)(index, threads);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                finished.notify_one();
+        }
+    }
+}
+
+void SpinBarrier::wait()
+{
+    unsigned currentPhase = phase.load(std::memory_order_acquire);
+    if (waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == count)
+    {
+        waiting.store(0, std::memory_order_relaxed);
+        phase.fetch_add(1, std::memory_order_acq_rel);
+        return;
+    }
+    int spins = 0;
+    while (phase.load(std::memory_order_acquire) == currentPhase)
+    {
+        if (++spins > 64)
+            std::this_thread::yield();
+    }
+}
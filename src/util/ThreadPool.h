@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief Fixed set of worker threads that run one task at a time on all of them
+///
+/// The calling thread takes part as thread 0, so a pool of size 1 has no workers and runs tasks inline.
+/// A run from inside a task of the same pool, e.g. a threaded solver called by a threaded batch, also runs
+/// inline on the calling thread instead of waiting for the pool it is part of.
+class ThreadPool
+{
+public:
+    /// @param threads
+    ///     Total number of threads including the caller, 0 for std::thread::hardware_concurrency()
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// @brief Number of threads including the caller
+    unsigned size() const { return (unsigned)workers.size() + 1; }
+
+    /// @brief Run task(threadIndex, threadCount) on threadCount threads and wait for all of them
+    ///
+    /// Tasks from different calling threads, e.g. the renderer and the simulation thread, run one after another.
+    /// No lock is held while a task runs, the next caller waits until the pool is idle.
+    /// @param maxThreads
+    ///     Upper limit for threadCount, 0 for all threads of the pool
+    void run(const std::function<void(unsigned, unsigned)> &task, unsigned maxThreads = 0);
+
+    /// @brief The threadCount a run with maxThreads started from this thread gets, 1 inside a task of the pool
+    ///
+    /// For state that has to be sized before the run, like a SpinBarrier.
+    unsigned threadCount(unsigned maxThreads = 0) const;
+
+    /// @brief Split [0, count) into contiguous ranges and call body(begin, end) for each, in parallel
+    /// @param grain
+    ///     Minimum number of elements per range
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &body, unsigned maxThreads = 0);
+
+    /// @brief Shared pool with one thread per hardware thread
+    static ThreadPool &global();
+
+private:
+    void workerLoop(unsigned index);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    /// signaled when a run gives the pool back, for callers from other threads waiting for it
+    std::condition_variable idle;
+    bool running = false;
+    const std::function<void(unsigned, unsigned)> *currentTask = nullptr;
+    unsigned participants = 0;
+    unsigned pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+/// @brief Reusable spinning barrier for a fixed number of threads, for short phases inside ThreadPool::run
+class SpinBarrier
+{
+public:
+    explicit SpinBarrier(unsigned count) : count(count) {}
+    void wait();
+
+private:
+    const unsigned count;
+    std::atomic<unsigned> waiting{0};
+    std::atomic<unsigned> phase{0};
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+/// @brief Hands the latest of a stream of values from one producer thread to one consumer thread without locks
+///
+/// The producer fills back() and publishes it, the consumer calls update() and reads front(). The third slot sits
+/// between them, so neither side ever waits: the producer can publish as often as it likes and the consumer keeps
+/// reading its front slot until it picks up the newest one. Values the consumer did not pick up in time are
+/// overwritten. The slots are reused, so values with vectors keep their capacity.
+template <class T>
+class TripleBuffer
+{
+public:
+    /// @brief The slot the producer fills, it keeps whatever it held three publishes ago
+    T &back() { return slots[backIndex]; }
+
+    /// @brief Make back() the newest value and continue with another slot
+    void publish()
+    {
+        uint8_t previous = middle.exchange(static_cast<uint8_t>(backIndex | fresh), std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+    }
+
+    /// @brief Switch front() to the newest published value
+    /// @return
+    ///     False if nothing was published since the last update, front() stays the same then
+    bool update()
+    {
+        if ((middle.load(std::memory_order_relaxed) & fresh) == 0)
+            return false;
+        uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & indexMask;
+        return true;
+    }
+
+    /// @brief The slot the consumer reads, a default constructed T before the first update
+    T &front() { return slots[frontIndex]; }
+    const T &front() const { return slots[frontIndex]; }
+
+private:
+    static constexpr uint8_t indexMask = 3;
+    static constexpr uint8_t fresh = 4;
+
+    T slots[3];
+    uint8_t backIndex = 0;
+    /// index of the slot in the middle, fresh while it holds a value the consumer has not seen
+    std::atomic<uint8_t> middle{1};
+    uint8_t frontIndex = 2;
+};
@@ -13,6 +13,13 @@
 #include <fstream>
 #include <cmath>
 #include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 // index type
 #define int_index long long
@@ -146,6 +153,185 @@ void erase(std::vector<T> &a, unsigned int index)
    a.pop_back();
 }
 
+//============================================================================
+// Compact binary format for matrices, vectors and solver inputs. It is meant
+// to be memory-mapped for reading (see util/MappedSystem.h). A file is a
+// FileHeader followed by named sections. Each section is a SectionHeader and a
+// payload of arrays in native byte order, each padded to 64 bytes, so every
+// array can be used in place. The checksum of a section covers its payload.
+
+namespace pcg_binary
+{
+   const char file_magic[8] = {'P', 'C', 'G', 'B', 'I', 'N', '\r', '\n'};
+   const uint32_t file_version = 1;
+   const size_t alignment = 64;
+
+   enum SectionKind : uint32_t
+   {
+      csr_matrix = 1, // payload: rowstart (int32, n+1), colindex (int32, nonzeros), value (scalar, nonzeros)
+      dense_vector = 2, // payload: value (scalar, n)
+      solve_info = 3, // payload: one SolveInfo
+   };
+
+   struct FileHeader
+   {
+      char magic[8];
+      uint32_t version;
+      uint32_t section_count;
+      uint64_t reserved[6];
+   };
+   static_assert(sizeof(FileHeader) == alignment, "file header has to keep the payloads aligned");
+
+   struct SectionHeader
+   {
+      uint32_t kind;        // SectionKind
+      uint32_t scalar_size; // sizeof(float) or sizeof(double)
+      uint64_t n;           // dimension
+      uint64_t nonzeros;    // number of stored entries of a matrix, 0 otherwise
+      uint64_t payload_size;
+      uint64_t checksum;
+      char name[24];
+   };
+   static_assert(sizeof(SectionHeader) == alignment, "section header has to keep the payloads aligned");
+
+   // parameters and outcome of a captured solve
+   struct SolveInfo
+   {
+      double tolerance_factor;
+      double modified_incomplete_cholesky_parameter;
+      double min_diagonal_ratio;
+      double relative_residual;
+      int32_t max_iterations;
+      int32_t precondition;
+      int32_t iterations;
+      int32_t converged;
+   };
+
+   inline size_t padded_size(size_t bytes) { return (bytes + alignment - 1) / alignment * alignment; }
+
+   // 64 bit hash over the payload, processed in 8 byte words
+   struct Checksum
+   {
+      uint64_t hash = 0x9E3779B97F4A7C15ull;
+      uint64_t bytes = 0;
+      uint64_t pending = 0;
+
+      void add_word(uint64_t word)
+      {
+         hash ^= word * 0xBF58476D1CE4E5B9ull;
+         hash = ((hash << 29) | (hash >> 35)) * 0x94D049BB133111EBull;
+      }
+
+      void data(const void *ptr, size_t size)
+      {
+         const unsigned char *p = (const unsigned char *)ptr;
+         while (size > 0 && bytes % 8 != 0)
+         {
+            pending |= (uint64_t)*p++ << (8 * (bytes % 8));
+            --size;
+            if (++bytes % 8 == 0)
+            {
+               add_word(pending);
+               pending = 0;
+            }
+         }
+         for (; size >= 8; size -= 8, p += 8, bytes += 8)
+         {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            add_word(word);
+         }
+         for (; size > 0; --size, ++bytes)
+            pending |= (uint64_t)*p++ << (8 * (bytes % 8));
+      }
+
+      void pad()
+      {
+         static const unsigned char zeros[alignment] = {};
+         data(zeros, padded_size(bytes) - bytes);
+      }
+
+      void array(const void *ptr, size_t size)
+      {
+         data(ptr, size);
+         pad();
+      }
+   };
+
+   inline uint64_t checksum(const void *payload, size_t size)
+   {
+      Checksum sum;
+      sum.data(payload, size);
+      return sum.hash;
+   }
+
+   struct StreamSink
+   {
+      std::ostream &output;
+      uint64_t bytes = 0;
+
+      void data(const void *ptr, size_t size)
+      {
+         output.write((const char *)ptr, size);
+         bytes += size;
+      }
+
+      void pad()
+      {
+         static const char zeros[alignment] = {};
+         output.write(zeros, padded_size(bytes) - bytes);
+         bytes = padded_size(bytes);
+      }
+
+      void array(const void *ptr, size_t size)
+      {
+         data(ptr, size);
+         pad();
+      }
+   };
+
+   inline void write_file_header(std::ostream &output, uint32_t section_count)
+   {
+      FileHeader header = {};
+      std::memcpy(header.magic, file_magic, sizeof(file_magic));
+      header.version = file_version;
+      header.section_count = section_count;
+      output.write((const char *)&header, sizeof(header));
+   }
+
+   // payload is called twice with a sink (data, pad and array calls): once for the checksum, once for writing
+   template <class Payload>
+   void write_section(std::ostream &output, SectionKind kind, const char *name, uint32_t scalar_size, uint64_t n, uint64_t nonzeros, Payload payload)
+   {
+      Checksum sum;
+      payload(sum);
+      SectionHeader header = {};
+      header.kind = kind;
+      header.scalar_size = scalar_size;
+      header.n = n;
+      header.nonzeros = nonzeros;
+      header.payload_size = sum.bytes;
+      header.checksum = sum.hash;
+      std::strncpy(header.name, name, sizeof(header.name) - 1);
+      output.write((const char *)&header, sizeof(header));
+      StreamSink sink{output};
+      payload(sink);
+   }
+
+   template <class T>
+   void write_vector(std::ostream &output, const char *name, const std::vector<T> &v)
+   {
+      write_section(output, dense_vector, name, sizeof(T), v.size(), 0, [&v](auto &sink)
+                    { sink.array(v.data(), v.size() * sizeof(T)); });
+   }
+
+   inline void write_solve_info(std::ostream &output, const char *name, uint32_t scalar_size, const SolveInfo &info)
+   {
+      write_section(output, solve_info, name, scalar_size, 0, 0, [&info](auto &sink)
+                    { sink.array(&info, sizeof(info)); });
+   }
+}
+
 //============================================================================
 // Dynamic compressed sparse row matrix.
 
@@ -293,6 +479,23 @@ struct SparseMatrix
       value[i].resize(0);
    }
 
+   // write as a csr_matrix section of the binary format, readable as SparseMatrix or FixedSparseMatrix
+   void write_binary(std::ostream &output, const char *section_name) const
+   {
+      std::vector<int> rowstart(n + 1, 0);
+      for (int i = 0; i < n; ++i)
+         rowstart[i + 1] = rowstart[i] + (int)index[i].size();
+      pcg_binary::write_section(output, pcg_binary::csr_matrix, section_name, sizeof(T), n, rowstart[n], [&](auto &sink)
+                                {
+         sink.array(rowstart.data(), rowstart.size() * sizeof(int));
+         for (int i = 0; i < n; ++i)
+            sink.data(index[i].data(), index[i].size() * sizeof(int));
+         sink.pad();
+         for (int i = 0; i < n; ++i)
+            sink.data(value[i].data(), value[i].size() * sizeof(T));
+         sink.pad(); });
+   }
+
    void write_matlab(std::ostream &output, const char *variable_name)
    {
       output << variable_name << "=sparse([";
@@ -415,6 +618,16 @@ struct FixedSparseMatrix
       }
    }
 
+   // write as a csr_matrix section of the binary format, readable as SparseMatrix or FixedSparseMatrix
+   void write_binary(std::ostream &output, const char *section_name) const
+   {
+      pcg_binary::write_section(output, pcg_binary::csr_matrix, section_name, sizeof(T), n, rowstart[n], [this](auto &sink)
+                                {
+         sink.array(rowstart.data(), rowstart.size() * sizeof(int));
+         sink.array(colindex.data(), colindex.size() * sizeof(int));
+         sink.array(value.data(), value.size() * sizeof(T)); });
+   }
+
    void write_matlab(std::ostream &output, const char *variable_name)
    {
       output << variable_name << "=sparse([";
@@ -480,6 +693,212 @@ void multiply_and_subtract(const FixedSparseMatrix<T> &matrix, const std::vector
    }
 }
 
+//============================================================================
+// Sliced ELLPACK (SELL-C-sigma) version of FixedSparseMatrix. Rows are sorted
+// by length inside windows of sigma rows and then packed into chunks of C rows.
+// Each chunk is padded to its longest row and stored column by column, so a
+// matrix-vector multiply works on C rows at once with contiguous loads. With C
+// equal to the SIMD width (8 floats or 4 doubles for AVX2) every chunk column
+// maps to one gather and one multiply-add. Build it from a FixedSparseMatrix.
+
+template <class T>
+struct SellCSigmaMatrix
+{
+   static constexpr int max_chunk_height = 32;
+   static constexpr int default_chunk_height() { return sizeof(T) >= 8 ? 4 : 8; }
+
+   int n;                        // dimension
+   int chunk_height;             // C: number of rows per chunk
+   int sigma;                    // sorting window in rows (rounded up to a multiple of C)
+   std::vector<T> value;         // nonzero values chunk by chunk, column-major inside a chunk, zero padded
+   std::vector<int> colindex;    // corresponding column indices (padding entries repeat a column of their row)
+   std::vector<int> chunkstart;  // where each chunk starts in value and colindex (and last entry is one past the end)
+   std::vector<int> chunklength; // number of columns of each chunk, i.e. the length of its longest row
+   std::vector<int> row;         // original row of each chunk slot, -1 for the padding slots of the last chunk
+
+   explicit SellCSigmaMatrix(int chunk_height_ = default_chunk_height(), int sigma_ = 256)
+       : n(0)
+   {
+      set_shape(chunk_height_, sigma_);
+   }
+
+   void set_shape(int chunk_height_, int sigma_)
+   {
+      assert(chunk_height_ > 0 && chunk_height_ <= max_chunk_height);
+      chunk_height = chunk_height_;
+      sigma = std::max(sigma_, chunk_height);
+      sigma = (sigma + chunk_height - 1) / chunk_height * chunk_height;
+   }
+
+   void clear(void)
+   {
+      n = 0;
+      value.clear();
+      colindex.clear();
+      chunkstart.clear();
+      chunklength.clear();
+      row.clear();
+   }
+
+   int chunk_count(void) const { return (int)chunklength.size(); }
+
+   // number of stored entries including padding, compare with the nonzeros of the source matrix for the fill ratio
+   size_t stored_entries(void) const { return value.size(); }
+
+   void construct_from_matrix(const FixedSparseMatrix<T> &matrix)
+   {
+      n = matrix.n;
+      const int C = chunk_height;
+      const int nchunks = (n + C - 1) / C;
+      row.resize((size_t)nchunks * C);
+      for (int i = 0; i < (int)row.size(); ++i)
+         row[i] = i < n ? i : -1;
+
+      // sort rows by decreasing length inside each sigma window
+      auto longer = [&matrix](int a, int b)
+      {
+         return matrix.rowstart[a + 1] - matrix.rowstart[a] > matrix.rowstart[b + 1] - matrix.rowstart[b];
+      };
+      for (int w = 0; w < n; w += sigma)
+         std::stable_sort(row.begin() + w, row.begin() + std::min(w + sigma, n), longer);
+
+      chunklength.resize(nchunks);
+      chunkstart.resize(nchunks + 1);
+      chunkstart[0] = 0;
+      for (int c = 0; c < nchunks; ++c)
+      {
+         int width = 0;
+         for (int r = 0; r < C; ++r)
+         {
+            int i = row[c * C + r];
+            if (i >= 0)
+               width = std::max(width, matrix.rowstart[i + 1] - matrix.rowstart[i]);
+         }
+         chunklength[c] = width;
+         chunkstart[c + 1] = chunkstart[c] + width * C;
+      }
+
+      value.assign(chunkstart[nchunks], 0);
+      colindex.assign(chunkstart[nchunks], 0);
+      for (int c = 0; c < nchunks; ++c)
+      {
+         for (int r = 0; r < C; ++r)
+         {
+            int i = row[c * C + r];
+            if (i < 0)
+               continue;
+            int k = chunkstart[c] + r;
+            for (int j = matrix.rowstart[i]; j < matrix.rowstart[i + 1]; ++j, k += C)
+            {
+               value[k] = matrix.value[j];
+               colindex[k] = matrix.colindex[j];
+            }
+            // zeros times an x the row reads anyway, so a non-finite x elsewhere does not turn the row into NaN
+            // (an empty row has no column of its own and uses its diagonal)
+            int padding = matrix.rowstart[i + 1] > matrix.rowstart[i] ? matrix.colindex[matrix.rowstart[i + 1] - 1] : i;
+            for (; k < chunkstart[c + 1]; k += C)
+               colindex[k] = padding;
+         }
+      }
+   }
+};
+
+// AVX2 kernels for the native chunk heights, return false if the matrix shape does not fit
+template <class T>
+inline bool multiply_sell_avx2(const SellCSigmaMatrix<T> &, const std::vector<T> &, std::vector<T> &)
+{
+   return false;
+}
+
+#ifdef __AVX2__
+inline bool multiply_sell_avx2(const SellCSigmaMatrix<float> &matrix, const std::vector<float> &x, std::vector<float> &result)
+{
+   if (matrix.chunk_height != 8)
+      return false;
+   const int nchunks = matrix.chunk_count();
+   for (int c = 0; c < nchunks; ++c)
+   {
+      const float *value = matrix.value.data() + matrix.chunkstart[c];
+      const int *colindex = matrix.colindex.data() + matrix.chunkstart[c];
+      __m256 sum = _mm256_setzero_ps();
+      for (int j = 0; j < matrix.chunklength[c]; ++j, value += 8, colindex += 8)
+      {
+         __m256i index = _mm256_loadu_si256((const __m256i *)colindex);
+         __m256 xj = _mm256_i32gather_ps(x.data(), index, sizeof(float));
+         sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(value), xj));
+      }
+      alignas(32) float out[8];
+      _mm256_store_ps(out, sum);
+      const int *row = matrix.row.data() + c * 8;
+      for (int r = 0; r < 8; ++r)
+      {
+         if (row[r] >= 0)
+            result[row[r]] = out[r];
+      }
+   }
+   return true;
+}
+
+inline bool multiply_sell_avx2(const SellCSigmaMatrix<double> &matrix, const std::vector<double> &x, std::vector<double> &result)
+{
+   if (matrix.chunk_height != 4)
+      return false;
+   const int nchunks = matrix.chunk_count();
+   for (int c = 0; c < nchunks; ++c)
+   {
+      const double *value = matrix.value.data() + matrix.chunkstart[c];
+      const int *colindex = matrix.colindex.data() + matrix.chunkstart[c];
+      __m256d sum = _mm256_setzero_pd();
+      for (int j = 0; j < matrix.chunklength[c]; ++j, value += 4, colindex += 4)
+      {
+         __m128i index = _mm_loadu_si128((const __m128i *)colindex);
+         __m256d xj = _mm256_i32gather_pd(x.data(), index, sizeof(double));
+         sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(value), xj));
+      }
+      alignas(32) double out[4];
+      _mm256_store_pd(out, sum);
+      const int *row = matrix.row.data() + c * 4;
+      for (int r = 0; r < 4; ++r)
+      {
+         if (row[r] >= 0)
+            result[row[r]] = out[r];
+      }
+   }
+   return true;
+}
+#endif
+
+// perform result=matrix*x
+template <class T>
+void multiply(const SellCSigmaMatrix<T> &matrix, const std::vector<T> &x, std::vector<T> &result)
+{
+   assert((size_t)matrix.n == x.size());
+   result.resize(matrix.n);
+   if (multiply_sell_avx2(matrix, x, result))
+      return;
+   const int C = matrix.chunk_height;
+   parallel_for(matrix.chunk_count())
+   {
+      int c = (int)parallel_index;
+      T sum[SellCSigmaMatrix<T>::max_chunk_height] = {};
+      int k = matrix.chunkstart[c];
+      for (int j = 0; j < matrix.chunklength[c]; ++j)
+      {
+         for (int r = 0; r < C; ++r, ++k)
+         {
+            sum[r] += matrix.value[k] * x[matrix.colindex[k]];
+         }
+      }
+      for (int r = 0; r < C; ++r)
+      {
+         int i = matrix.row[c * C + r];
+         if (i >= 0)
+            result[i] = sum[r];
+      }
+   }
+   parallel_end
+}
+
 //============================================================================
 // A simple compressed sparse column data structure (with separate diagonal)
 // for lower triangular matrices
@@ -739,7 +1158,48 @@ struct SparsePCGSolver
       min_diagonal_ratio = min_diagonal_ratio_;
    }
 
+   // use the SELL-C-sigma format instead of CSR for the matrix-vector products of the PCG loop,
+   // worth it for larger systems with varying row lengths (the conversion is done once per solve)
+   void set_sell_c_sigma(bool enabled, int chunk_height = SellCSigmaMatrix<T>::default_chunk_height(), int sigma = 256)
+   {
+      use_sell_c_sigma = enabled;
+      sell_matrix.set_shape(chunk_height, sigma);
+   }
+
+   // write matrix, rhs, result and solver parameters of the next solve to a binary file,
+   // read it back with MappedSystem (util/MappedSystem.h) to replay the solve offline
+   void capture_next_solve(const std::string &path)
+   {
+      capture_path = path;
+   }
+
    bool solve(const SparseMatrix<T> &matrix, const std::vector<T> &rhs, std::vector<T> &result, T &relative_residual_out, int &iterations_out, int precondition = 2)
+   {
+      if (capture_path.empty())
+         return solve_system(matrix, rhs, result, relative_residual_out, iterations_out, precondition);
+
+      bool converged = solve_system(matrix, rhs, result, relative_residual_out, iterations_out, precondition);
+      pcg_binary::SolveInfo info = {};
+      info.tolerance_factor = tolerance_factor;
+      info.modified_incomplete_cholesky_parameter = modified_incomplete_cholesky_parameter;
+      info.min_diagonal_ratio = min_diagonal_ratio;
+      info.relative_residual = relative_residual_out;
+      info.max_iterations = max_iterations;
+      info.precondition = precondition;
+      info.iterations = iterations_out;
+      info.converged = converged;
+      std::ofstream output(capture_path, std::ios::binary);
+      pcg_binary::write_file_header(output, 4);
+      matrix.write_binary(output, "matrix");
+      pcg_binary::write_vector(output, "rhs", rhs);
+      pcg_binary::write_vector(output, "result", result);
+      pcg_binary::write_solve_info(output, "info", sizeof(T), info);
+      capture_path.clear();
+      return converged;
+   }
+
+protected:
+   bool solve_system(const SparseMatrix<T> &matrix, const std::vector<T> &rhs, std::vector<T> &result, T &relative_residual_out, int &iterations_out, int precondition)
    {
       int n = matrix.n;
       if ((int)m.size() != n)
@@ -772,10 +1232,15 @@ struct SparsePCGSolver
 
       s = z;
       fixed_matrix.construct_from_matrix(matrix);
+      if (use_sell_c_sigma)
+         sell_matrix.construct_from_matrix(fixed_matrix);
       int iteration;
       for (iteration = 0; iteration < max_iterations; ++iteration)
       {
-         multiply(fixed_matrix, s, z);
+         if (use_sell_c_sigma)
+            multiply(sell_matrix, s, z);
+         else
+            multiply(fixed_matrix, s, z);
          double alpha = rho / InstantBLAS<int, T>::dot(s, z);
          InstantBLAS<int, T>::add_scaled(alpha, s, result);
          InstantBLAS<int, T>::add_scaled(-alpha, z, r);
@@ -798,11 +1263,13 @@ struct SparsePCGSolver
       return false;
    }
 
-protected:
    // internal structures
    SparseColumnLowerFactor<T> ic_factor; // modified incomplete cholesky factor
    std::vector<T> m, z, s, r;            // temporary vectors for PCG
    FixedSparseMatrix<T> fixed_matrix;    // used within loop
+   SellCSigmaMatrix<T> sell_matrix;      // used within loop instead of fixed_matrix if use_sell_c_sigma is set
+   bool use_sell_c_sigma = false;
+   std::string capture_path;             // non-empty if the next solve should be written to this file
 
    // parameters
    T tolerance_factor;